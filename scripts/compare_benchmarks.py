@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+
+# Compare the output of the `benchmarks` target or of `HaxEdit --bench-render` to a baseline.
+# Exits with 1 if a benchmark got slower than the threshold.
+#
+# Usage: compare_benchmarks.py BASELINE.json CURRENT.json [--threshold PERCENT]
+
+import sys
+import json
+import argparse
+
+def loadResults(path: str):
+    with open(path, "r") as file:
+        data = json.load(file)
+    return data, {bench["name"]: bench for bench in data["benchmarks"]}
+
+def formatValue(value: float, unit: str):
+    if unit == "count":
+        return f"{value:.0f}"
+    if unit == "bytes":
+        return f"{value/1024:.1f} KiB"
+    return formatNs(value)
+
+def formatNs(ns: float):
+    if ns >= 1e9:
+        return f"{ns/1e9:.2f} s"
+    if ns >= 1e6:
+        return f"{ns/1e6:.2f} ms"
+    if ns >= 1e3:
+        return f"{ns/1e3:.2f} us"
+    return f"{ns:.0f} ns"
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare benchmark results to a baseline")
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="Slowdown of the median in percent that counts as a regression (default: 10)")
+    args = parser.parse_args()
+
+    baselineData, baseline = loadResults(args.baseline)
+    currentData, current = loadResults(args.current)
+    if baselineData.get("buildType") != currentData.get("buildType"):
+        print(f"Warning: comparing a {baselineData.get('buildType')} build to a {currentData.get('buildType')} build")
+
+    regressions = []
+    nameWidth = max(len(name) for name in ["Benchmark", *current, *baseline])
+    print(f"{'Benchmark':<{nameWidth}}  {'Baseline':>10}  {'Current':>10}  {'Change':>8}")
+    for name, bench in current.items():
+        if name not in baseline:
+            print(f"{name:<{nameWidth}}  {'-':>10}  {formatValue(bench['median'], bench.get('unit', 'ns')):>10}  {'new':>8}")
+            continue
+
+        old = baseline[name]["median"]
+        new = bench["median"]
+        change = (new-old)/old*100 if old > 0 else 0
+        # Changes within the noise of the slower run are not regressions
+        noise = max(baseline[name].get("stddev", 0), bench.get("stddev", 0))
+        isRegression = change > args.threshold and new-old > noise
+        if isRegression:
+            regressions.append(name)
+        print(f"{name:<{nameWidth}}  {formatValue(old, bench.get('unit', 'ns')):>10}  {formatValue(new, bench.get('unit', 'ns')):>10}  {change:>+7.1f}%{'  <-- REGRESSION' if isRegression else ''}")
+
+    for name in baseline:
+        if name not in current:
+            print(f"{name:<{nameWidth}}  {formatValue(baseline[name]['median'], baseline[name].get('unit', 'ns')):>10}  {'-':>10}  {'removed':>8}")
+
+    if regressions:
+        print(f"\n{len(regressions)} regression(s) over {args.threshold}%")
+        return 1
+    print("\nNo regressions")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
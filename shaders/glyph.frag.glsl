@@ -1,14 +1,15 @@
 #version 330 core
 
 in vec2 texCoords;
+in vec3 textColor;
 
 out vec4 fragColor;
 
 uniform sampler2D tex;
-uniform vec3 textColor;
 
 void main()
 {
-    fragColor = vec4(textColor, 1.0f) * vec4(1.0f, 1.0f, 1.0f, texture(tex, texCoords).r);
+    // The atlas can grow, so normalize the coordinates here
+    vec2 uv = texCoords / vec2(textureSize(tex, 0));
+    fragColor = vec4(textColor, 1.0f) * vec4(1.0f, 1.0f, 1.0f, texture(tex, uv).r);
 }
-
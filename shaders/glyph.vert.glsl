@@ -1,14 +1,17 @@
 #version 330 core
 
 layout (location=0) in vec4 inData;
+layout (location=1) in vec3 inColor;
 
 out vec2 texCoords;
+out vec3 textColor;
 
 uniform mat4 projectionMat;
 
 void main()
 {
     gl_Position = projectionMat * vec4(inData.xy, 0.0f, 1.0f);
-    texCoords = vec2(inData.z, 1.0f-inData.w);
+    // Texture coordinates are in atlas pixels
+    texCoords = inData.zw;
+    textColor = inColor;
 }
-
@@ -1,11 +1,10 @@
 #version 330 core
 
-out vec4 fragColor;
+in vec4 fillColor;
 
-uniform vec4 fillColor;
+out vec4 fragColor;
 
 void main()
 {
     fragColor = fillColor;
 }
-
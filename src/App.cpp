@@ -10,7 +10,11 @@
 #include "common/file.h"
 #include "os.h"
 #include "Git.h"
+#include "EventLoop.h"
+#include "Profiler.h"
 #include <filesystem>
+#include <algorithm>
+#include <cstdio>
 #ifdef OS_LINUX
 #   include <unistd.h>
 #elif defined(OS_WIN)
@@ -49,6 +53,30 @@ std::string App::getResPath(const std::string& suffix)
     return (std::filesystem::path{g_exeDirPath} / suffix);
 }
 
+std::string App::getStatePath(const std::string& suffix)
+{
+    if (std::filesystem::path{suffix}.is_absolute())
+        return suffix;
+
+    fs::path dir;
+    if (const char* stateHome = std::getenv("XDG_STATE_HOME"); stateHome && *stateHome)
+        dir = stateHome;
+    else if (const char* home = std::getenv("HOME"); home && *home)
+        dir = fs::path{home} / ".local" / "state";
+    else
+        return getResPath(suffix);
+    dir /= "HaxEdit";
+
+    std::error_code err;
+    fs::create_directories(dir, err);
+    if (err)
+    {
+        std::fprintf(stderr, "Failed to create state directory: %s: %s\n", dir.c_str(), err.message().c_str());
+        return getResPath(suffix);
+    }
+    return dir / suffix;
+}
+
 #define BUFFER_RESIZE_MAX_CURS_DIST 10
 #define START_SCRN_INDENT_PX 100
 
@@ -81,6 +109,15 @@ void App::initGlew()
 {
     glewExperimental = GL_TRUE;
     uint initStatus = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // An EGL context without X (e.g. the headless render benchmark),
+    // only the GLX extensions are missing
+    if (initStatus == GLEW_ERROR_NO_GLX_DISPLAY)
+    {
+        Logger::warn << "GLEW: No GLX display, continuing without GLX" << Logger::End;
+        return;
+    }
+#endif
     if (initStatus != GLEW_OK)
     {
         Logger::fatal << "Failed to initialize GLEW: " << glewGetErrorString(initStatus) << Logger::End;
@@ -96,31 +133,37 @@ void App::setupGlFeatures()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
-TextRenderer* App::createTextRenderer()
+App::FontPaths App::resolveFontPaths()
+{
+    FontPaths paths;
+    paths.regular    = OS::getFontFilePath(FONT_FAMILY_REGULAR, FONT_STYLE_REGULAR);
+    paths.bold       = OS::getFontFilePath(FONT_FAMILY_BOLD, FONT_STYLE_BOLD);
+    paths.italic     = OS::getFontFilePath(FONT_FAMILY_ITALIC, FONT_STYLE_ITALIC);
+    paths.boldItalic = OS::getFontFilePath(FONT_FAMILY_BOLDITALIC, FONT_STYLE_BOLD|FONT_STYLE_ITALIC);
+    paths.fallback   = OS::getFontFilePath(FALLBACK_FONT_FAMILY, 0);
+    return paths;
+}
+
+TextRenderer* App::createTextRenderer(const FontPaths& paths)
 {
-    auto regularFontPath    = OS::getFontFilePath(FONT_FAMILY_REGULAR, FONT_STYLE_REGULAR);
-    auto boldFontPath       = OS::getFontFilePath(FONT_FAMILY_BOLD, FONT_STYLE_BOLD);
-    auto italicFontPath     = OS::getFontFilePath(FONT_FAMILY_ITALIC, FONT_STYLE_ITALIC);
-    auto boldItalicFontPath = OS::getFontFilePath(FONT_FAMILY_BOLDITALIC, FONT_STYLE_BOLD|FONT_STYLE_ITALIC);
-    auto fallbackFontPath   = OS::getFontFilePath(FALLBACK_FONT_FAMILY, 0);
     Logger::dbg
-        << "Regular font: " << regularFontPath
-        << "\n       Bold font: " << boldFontPath
-        << "\n       Italic font: " << italicFontPath
-        << "\n       Bold italic font: " << boldItalicFontPath
-        << "\n       Fallback font: " << fallbackFontPath
+        << "Regular font: " << paths.regular
+        << "\n       Bold font: " << paths.bold
+        << "\n       Italic font: " << paths.italic
+        << "\n       Bold italic font: " << paths.boldItalic
+        << "\n       Fallback font: " << paths.fallback
         << Logger::End;
-    assert(regularFontPath.length()
-        && boldFontPath.length()
-        && italicFontPath.length()
-        && boldItalicFontPath.length()
-        && fallbackFontPath.length());
+    assert(paths.regular.length()
+        && paths.bold.length()
+        && paths.italic.length()
+        && paths.boldItalic.length()
+        && paths.fallback.length());
     return new TextRenderer{
-        regularFontPath,
-        boldFontPath,
-        italicFontPath,
-        boldItalicFontPath,
-        fallbackFontPath};
+        paths.regular,
+        paths.bold,
+        paths.italic,
+        paths.boldItalic,
+        paths.fallback};
 }
 
 UiRenderer* App::createUiRenderer()
@@ -158,20 +201,39 @@ FileTypeHandler* App::createFileTypeHandler()
     return new FileTypeHandler{getResPath("../icons/file_icon_index.txt"), getResPath("../icons/folder_icon_index.txt")};
 }
 
-void App::createAutocompleteProviders()
+void App::createAutocompleteProviders(std::unique_ptr<Autocomp::LspClient> lspClient)
 {
-    Autocomp::dictProvider      = std::make_unique<Autocomp::DictionaryProvider>();
     Autocomp::buffWordProvid    = std::make_unique<Autocomp::BufferWordProvider>();
     Autocomp::pathProvid        = std::make_unique<Autocomp::PathProvider>();
-    Autocomp::lspProvider       = std::make_unique<Autocomp::LspProvider>();
+    Autocomp::lspProvider       = std::make_unique<Autocomp::LspProvider>(std::move(lspClient));
 
     Logger::log << "Autocompletion set up" << Logger::End;
 }
 
-void App::loadTheme()
+void App::loadDictionary()
+{
+    // `std::function` needs a copyable callable
+    auto provider = std::make_shared<std::unique_ptr<Autocomp::DictionaryProvider>>();
+    try
+    {
+        *provider = std::make_unique<Autocomp::DictionaryProvider>();
+    }
+    catch (std::exception&)
+    {
+        // Already logged, the editor works without it
+        return;
+    }
+
+    // The providers are only used on the main thread
+    EventLoop::runOnMainThread([provider](){
+        Autocomp::dictProvider = std::move(*provider);
+    });
+}
+
+Theme* App::loadTheme()
 {
     ThemeLoader tl;
-    g_theme = std::unique_ptr<Theme>(tl.load(getResPath(THEME_PATH)));
+    return tl.load(getResPath(THEME_PATH));
 }
 
 void App::setupKeyBindings()
@@ -448,7 +510,7 @@ void App::renderPopups()
     g_lspInfoPopup->render();
 }
 
-static const std::string genWelcomeMsg(std::string templ)
+static const std::string genWelcomeMsg(std::string templ, const std::string& fortune)
 {
     static std::map<std::string, std::string> map;
     map["BUILD_DATE"] = __DATE__ " at " __TIME__;
@@ -481,7 +543,7 @@ static const std::string genWelcomeMsg(std::string templ)
     map["FONT_FAMILY_BOLD"]         = FONT_FAMILY_BOLD;
     map["FONT_FAMILY_ITALIC"]       = FONT_FAMILY_ITALIC;
     map["FONT_FAMILY_BOLDITALIC"]   = FONT_FAMILY_BOLDITALIC;
-    map["FORTUNE"]                  = OS::runExternalCommand(FORTUNE_CMD);
+    map["FORTUNE"]                  = fortune;
 
     for (const auto& pair : map)
     {
@@ -494,10 +556,24 @@ static const std::string genWelcomeMsg(std::string templ)
     return templ;
 }
 
+// Set at startup, taken when it's ready
+static std::future<std::string> fortuneFuture;
+
+void App::setFortune(std::future<std::string>&& fortune)
+{
+    fortuneFuture = std::move(fortune);
+}
+
 void App::renderStartupScreen()
 {
     static const auto icon = loadProgramIcon();
-    static const auto welcomeMsg = genWelcomeMsg(WELCOME_MSG);
+    static std::string welcomeMsg;
+    // Generated when the fortune is ready, the rest of the screen is shown in the meantime
+    if (welcomeMsg.empty() && fortuneFuture.valid()
+     && fortuneFuture.wait_for(std::chrono::seconds{0}) == std::future_status::ready)
+    {
+        welcomeMsg = genWelcomeMsg(WELCOME_MSG, fortuneFuture.get());
+    }
     g_textRenderer->renderString(utf8To32(welcomeMsg), {START_SCRN_INDENT_PX, 30},
             FONT_STYLE_REGULAR, g_theme->values[Syntax::MARK_NONE].color, true);
 
@@ -534,6 +610,93 @@ void App::renderPrompt()
     Prompt::get()->render();
 }
 
+// Strip the return type and the parameters of `__PRETTY_FUNCTION__`
+static std::string shortenZoneName(const std::string& name)
+{
+    const size_t paramStart = name.find('(');
+    if (paramStart == std::string::npos)
+        return name;
+    const size_t nameStart = name.rfind(' ', paramStart);
+    return name.substr(nameStart == std::string::npos ? 0 : nameStart+1,
+            paramStart-(nameStart == std::string::npos ? 0 : nameStart+1));
+}
+
+// Queue a bar for every value, scaled so that `maxValue` fills the height
+static void queueHistoryGraph(const std::vector<float>& values, double maxValue,
+        const glm::ivec2& pos, const glm::ivec2& size, const RGBColor& color)
+{
+    g_uiRenderer->queueFilledRectangle(pos, pos+size, RGBAColor{0.1f, 0.1f, 0.1f, 1.0f});
+    if (values.empty() || maxValue <= 0)
+        return;
+
+    const float barWidth = std::max((float)size.x/PROFILER_HISTORY_LEN, 1.0f);
+    // Align the newest value to the right
+    const float startX = pos.x+size.x-barWidth*values.size();
+    for (size_t i{}; i < values.size(); ++i)
+    {
+        const int height = std::min<double>(values[i]/maxValue, 1.0)*size.y;
+        if (height == 0)
+            continue;
+        g_uiRenderer->queueFilledRectangle(
+                {int(startX+barWidth*i), pos.y+size.y-height},
+                {int(startX+barWidth*(i+1)), pos.y+size.y},
+                RGB_COLOR_TO_RGBA(color));
+    }
+}
+
+void App::renderProfilerOverlay()
+{
+    const Profiler::FrameStats& stats = Profiler::getFrameStats();
+    const size_t zoneCount = std::min<size_t>(stats.zones.size(), PROFILER_OVERLAY_MAX_ZONES);
+
+    // Keep the overlay readable in wireframe mode
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glEnable(GL_BLEND);
+
+    const int lineHeight = g_fontSizePx+2;
+    const int textWidth = g_fontWidthPx*48;
+    const int graphWidth = PROFILER_HISTORY_LEN*2;
+    const int padding = 8;
+    const glm::ivec2 panelSize = {textWidth+graphWidth+padding*3, lineHeight*(4+zoneCount)+padding*2};
+    const glm::ivec2 panelPos = {std::max(g_windowWidth-panelSize.x-10, 0), TABLINE_HEIGHT_PX+10};
+    g_uiRenderer->queueFilledRectangle(panelPos, panelPos+panelSize, RGBAColor{0.0f, 0.0f, 0.0f, 0.8f});
+
+    char line[128];
+    glm::ivec2 textPos = panelPos+padding;
+    std::snprintf(line, sizeof(line), "Frame: %6.2f ms  (avg %.2f, max %.2f)",
+            stats.lastMs, stats.avgMs, stats.maxMs);
+    g_textRenderer->renderString(utf8To32(line), textPos, FONT_STYLE_BOLD);
+    // Scale to at least one 60 FPS frame, so the short frames look short
+    queueHistoryGraph(stats.historyMs, std::max(stats.maxMs, 1000.0/60),
+            {textPos.x, textPos.y+lineHeight}, {panelSize.x-padding*2, lineHeight*2-4},
+            stats.lastMs > 1000.0/60 ? RGBColor{0.9f, 0.3f, 0.3f} : RGBColor{0.3f, 0.9f, 0.4f});
+    textPos.y += lineHeight*3;
+
+    std::snprintf(line, sizeof(line), "Other threads: %6.2f ms", stats.workerMs);
+    g_textRenderer->renderString(utf8To32(line), textPos, FONT_STYLE_ITALIC);
+    textPos.y += lineHeight;
+
+    for (size_t i{}; i < zoneCount; ++i)
+    {
+        const Profiler::ZoneStats& zone = stats.zones[i];
+        std::string name = shortenZoneName(zone.name);
+        if (name.size() > 28)
+            name = "..."+name.substr(name.size()-25);
+        std::snprintf(line, sizeof(line), "%-28s %6.2f ms x%-3u avg %.2f",
+                name.c_str(), zone.lastMs, zone.lastCallCount, zone.avgMs);
+        g_textRenderer->renderString(utf8To32(line), textPos);
+        queueHistoryGraph(zone.historyMs, zone.maxMs,
+                {textPos.x+textWidth+padding, textPos.y+2}, {graphWidth, lineHeight-4},
+                RGBColor{0.3f, 0.6f, 0.9f});
+        textPos.y += lineHeight;
+    }
+    g_textRenderer->flush();
+
+    glPolygonMode(GL_FRONT_AND_BACK, g_isDebugDrawMode ? GL_LINE : GL_FILL);
+    if (g_isDebugDrawMode)
+        glDisable(GL_BLEND);
+}
+
 Buffer* App::openFileInNewBuffer(
         const std::string& path, bool addToRecFileList/*=true*/)
 {
@@ -558,6 +721,21 @@ Buffer* App::openFileInNewBuffer(
     return buffer;
 }
 
+Buffer* App::openFileDeferred(
+        const std::string& path, bool addToRecFileList/*=true*/, int cursorLine/*=0*/, int cursorCol/*=0*/)
+{
+    // Images don't have a cursor to restore
+    if (isImageExtension(getFileExt(path)))
+        return openFileInNewBuffer(path, addToRecFileList);
+
+    if (addToRecFileList)
+        g_recentFilePaths->addItem(path);
+
+    Buffer* buffer = new Buffer;
+    buffer->openDeferred(path, cursorLine, cursorCol);
+    return buffer;
+}
+
 void App::flashDialog()
 {
     g_dialogFlashTime = DIALOG_FLASH_TIME_MS;
@@ -966,6 +1144,8 @@ void App::tickMouseHold(uint frameTime)
     }
 
     g_mouseHoldTime += frameTime;
+    if (g_mouseHoldTime < MOUSE_HOLD_TIME_HOVERINFO)
+        EventLoop::wakeUpIn(MOUSE_HOLD_TIME_HOVERINFO-g_mouseHoldTime);
 }
 
 
@@ -974,6 +1154,59 @@ void App::tickPopups()
     g_progressPopup->tick();
 }
 
+void App::tickLazyBuffers(float frameTimeMs)
+{
+    static float msUntilPreload = LAZY_BUFFER_PRELOAD_INTERVAL_MS;
+    msUntilPreload -= frameTimeMs;
+
+    // The buffers of the current tab are shown, so they are always loaded
+    std::vector<Buffer*> hiddenBuffers;
+    size_t loadedCount{};
+    for (size_t i{}; i < g_tabs.size(); ++i)
+    {
+        g_tabs[i]->forEachBufferRecursively([&](Buffer* buff){
+            if (buff->isMaterialized())
+                ++loadedCount;
+            if (i != g_currTabI)
+                hiddenBuffers.push_back(buff);
+        });
+    }
+
+    if (loadedCount > LAZY_BUFFER_MAX_LOADED)
+    {
+        const double now = glfwGetTime();
+        Buffer* leastRecentlyShown{};
+        for (Buffer* buff : hiddenBuffers)
+        {
+            if (buff->isMaterialized() && !buff->isModified()
+             && now-buff->getLastShownTime() >= LAZY_BUFFER_UNLOAD_AFTER_S
+             && (!leastRecentlyShown || buff->getLastShownTime() < leastRecentlyShown->getLastShownTime()))
+                leastRecentlyShown = buff;
+        }
+        if (leastRecentlyShown)
+            leastRecentlyShown->dematerialize();
+        return;
+    }
+
+    if (!LAZY_BUFFER_PRELOAD || loadedCount == LAZY_BUFFER_MAX_LOADED)
+        return;
+
+    auto placeholder = std::find_if(hiddenBuffers.begin(), hiddenBuffers.end(),
+            [](Buffer* buff){ return !buff->isMaterialized(); });
+    if (placeholder == hiddenBuffers.end())
+        return;
+
+    // Load one buffer at a time and only when nothing else is happening, so the input is not delayed
+    if (msUntilPreload <= 0 && !g_isRedrawNeeded)
+    {
+        (*placeholder)->materialize();
+        // The status line shows the opened file
+        g_isRedrawNeeded = true;
+        msUntilPreload = LAZY_BUFFER_PRELOAD_INTERVAL_MS;
+    }
+    EventLoop::wakeUpIn(std::max(msUntilPreload, 0.0f));
+}
+
 static std::string symbolKindToShortName(lsSymbolKind kind)
 {
     const size_t kind_ = size_t(kind)-1;
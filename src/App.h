@@ -4,6 +4,7 @@
 #include <cassert>
 #include <vector>
 #include <memory>
+#include <future>
 #include "glstuff.h"
 #include "Logger.h"
 #include "config.h"
@@ -17,7 +18,7 @@
 #include "dialogs/FileDialog.h"
 #include "dialogs/AskerDialog.h"
 #include "types.h"
-#include "Timer.h"
+#include "Profiler.h"
 #include "ImageBuffer.h"
 #include "Split.h"
 #include "globals.h"
@@ -103,17 +104,46 @@ public:
     // ----- Setup functions -----
     static std::string getExePath();
     static std::string getResPath(const std::string& suffix);
+    /*
+     * Returns `suffix` in the state directory ($XDG_STATE_HOME/HaxEdit or ~/.local/state/HaxEdit),
+     * which is created if needed. Falls back to the exe directory if it can't be created.
+     */
+    static std::string getStatePath(const std::string& suffix);
     static GLFWwindow* createWindow();
     static void initGlew();
     static void setupGlFeatures();
-    static TextRenderer* createTextRenderer();
+    struct FontPaths
+    {
+        std::string regular;
+        std::string bold;
+        std::string italic;
+        std::string boldItalic;
+        std::string fallback;
+    };
+    // Can be called from any thread
+    static FontPaths resolveFontPaths();
+    static TextRenderer* createTextRenderer(const FontPaths& paths);
     static UiRenderer* createUiRenderer();
     static std::unique_ptr<Image> loadProgramIcon();
     static void loadCursors();
     static void loadSignImages();
+    // Can be called from any thread
     static FileTypeHandler* createFileTypeHandler();
-    static void createAutocompleteProviders();
-    static void loadTheme();
+    /*
+     * @param lspClient The server started by `Autocomp::LspProvider::startServer()`.
+     */
+    static void createAutocompleteProviders(std::unique_ptr<Autocomp::LspClient> lspClient);
+    /*
+     * Load the dictionary and install it on the main thread when it's ready.
+     * Meant to be called from a worker thread.
+     */
+    static void loadDictionary();
+    // Can be called from any thread
+    static Theme* loadTheme();
+    /*
+     * The output of `FORTUNE_CMD`, the startup screen shows the welcome message when it's ready.
+     */
+    static void setFortune(std::future<std::string>&& fortune);
     static void setupKeyBindings();
     static void initGit();
 
@@ -125,10 +155,21 @@ public:
     static void renderPopups();
     static void renderStartupScreen();
     static void renderPrompt();
+    /*
+     * Draw the frame time and the profiler zones of the recent frames.
+     * Shown in debug draw mode.
+     */
+    static void renderProfilerOverlay();
 
     // ----- Helper functions -----
     [[nodiscard]] static Buffer* openFileInNewBuffer(
             const std::string& path, bool addToRecFileList=true);
+    /*
+     * Like `openFileInNewBuffer()`, but the file is only opened when the buffer is first shown
+     * or preloaded by `tickLazyBuffers()`. Images are opened right away.
+     */
+    [[nodiscard]] static Buffer* openFileDeferred(
+            const std::string& path, bool addToRecFileList=true, int cursorLine=0, int cursorCol=0);
     static void flashDialog();
 
 private:
@@ -138,7 +179,10 @@ private:
 
     // ----- Callbacks -----
     static void windowRefreshCB(GLFWwindow*);
+public:
+    // Also called by the render benchmark, it doesn't process the window events
     static void windowResizeCB(GLFWwindow*, int width, int height);
+private:
     static void windowKeyCB(GLFWwindow*, int key, int scancode, int action, int mods);
 public:
     static void windowCharCB(GLFWwindow*, uint codePoint);
@@ -153,6 +197,11 @@ public:
     static void toggleDebugDraw();
     static void tickMouseHold(uint frameTime);
     static void tickPopups();
+    /*
+     * Preload the placeholder buffers when idle
+     * and unload the least recently shown ones if too many are loaded.
+     */
+    static void tickLazyBuffers(float frameTimeMs);
 
     enum class FindType
     {
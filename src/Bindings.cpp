@@ -260,6 +260,10 @@ void runBindingForFrame()
         return;
     }
 
+    // The active buffer may not have been shown since it became active (tab switch in the same frame)
+    if (g_activeBuff)
+        g_activeBuff->materialize();
+
     const auto bindingIt = std::find_if(
             activeBindingMap->begin(), activeBindingMap->end(),
             [&](const auto& a){ return a.first == key; });
@@ -1,23 +1,25 @@
 #include "Buffer.h"
 #include "Document.h"
 #include "config.h"
-#include "Timer.h"
+#include "Profiler.h"
 #include "types.h"
 #include "modes.h"
 #include "Syntax.h"
 #include "dialogs/MessageDialog.h"
-#include "unicode/ustdio.h"
 #include "common/file.h"
 #include "common/string.h"
 #include "Clipboard.h"
 #include "ThemeLoader.h"
 #include "App.h"
+#include "EventLoop.h"
+#include "ThreadPool.h"
 #include <fstream>
 #include <sstream>
 #include <chrono>
 #include <filesystem>
 #include <cctype>
 #include <regex>
+#include <limits>
 using namespace std::chrono_literals;
 
 bufid_t Buffer::s_lastUsedId = 0;
@@ -27,46 +29,24 @@ Buffer::Buffer()
     m_id = s_lastUsedId++;
     m_document = std::make_unique<Document>();
 
-    /*
-     * This thread runs in the background while the buffer is alive.
-     * It constantly checks if an update is needed and if it does,
-     * it sets `m_isHighlightUpdateNeeded` to false and runs the updater function.
-     * The updater function constantly checks if the `m_isHighlightUpdateNeeded` has been
-     * set to true because it means that a new update has been requested and the current
-     * update is outdated, so the function exits and the loop executes it again.
-     */
-    m_highlighterThread = std::thread([&](){
-#ifndef TESTING
-            Logger::dbg << "Syntax highlighter thread started (buffer: " << this << ')' << Logger::End;
-            while (m_shouldHighlighterLoopRun)
-            {
-                if (m_isHighlightUpdateNeeded)
-                {
-                    m_isHighlightUpdateNeeded = false;
-                    Logger::dbg << "[Highl. Thread]: Updating highlighting (buffer: "
-                        << this << ')' << Logger::End;
-                    _updateHighlighting();
-                }
-                std::this_thread::sleep_for(10ms);
-            }
-            Logger::dbg << "Syntax highlighter thread exited (buffer: " << this << ')' << Logger::End;
-#endif
-    });
-
     Logger::dbg << "Setting up autocomplete for buffer: " << this << Logger::End;
     m_autocompPopup = std::make_unique<Autocomp::Popup>();
+    m_saveChannel->buffer = this;
 
     Logger::log << "Created a buffer: " << this << Logger::End;
 }
 
+// Returns 0 if the file doesn't exist or can't be accessed
 static inline Buffer::fileModTime_t getFileModTime(const std::string& path)
 {
-    return std::filesystem::last_write_time(std::filesystem::path{path}).time_since_epoch().count();
+    std::error_code error;
+    const auto time = std::filesystem::last_write_time(std::filesystem::path{path}, error);
+    return error ? 0 : time.time_since_epoch().count();
 }
 
 void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
 #ifndef TESTING
     glfwSetCursor(g_window, Cursors::busy);
@@ -78,7 +58,11 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
     m_document->clearHistory();
     m_gitRepo.reset();
     m_signs.clear();
+    // Drop the results of the running diff jobs
+    ++m_gitDiffChannel->generation;
+    m_isGitDiffOutdated = false;
     m_lineInfoList.clear();
+    m_searcher.resetLines(0);
     m_lastFileUpdateTime = 0;
     m_version = 0;
     if (isReload)
@@ -89,13 +73,15 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
     try
     {
         m_filePath = std::filesystem::canonical(filePath);
-        m_document->setContent(loadUnicodeFile(filePath));
+        m_document->loadFile(filePath);
         m_lineInfoList.resize(m_document->getLineCount());
-        m_highlightBuffer = std::u8string(m_document->calcCharCount(), Syntax::MARK_NONE);
-        m_isHighlightUpdateNeeded = true;
-        m_gitRepo = std::make_unique<Git::Repo>(filePath);
+        _invalidateHighlighting(0, m_lineInfoList.size()-1);
+        m_searcher.resetLines(m_document->getLineCount());
+        m_gitRepo = std::make_shared<Git::Repo>(filePath);
         m_lastFileUpdateTime = getFileModTime(m_filePath);
         updateGitDiff();
+        _updateGitBranch();
+        _updateFileWatches();
         m_language = Langs::lookupExtension(std_fs::path(m_filePath).extension().string().substr(1));
         Logger::dbg << "Buffer language: " << Langs::langIdToName(m_language)
             << " (LSP id: " << Langs::langIdToLspId(m_language) << ')' << Logger::End;
@@ -118,11 +104,13 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
     catch (std::exception& e)
     {
         m_document->clearContent();
-        m_highlightBuffer.clear();
-        m_isHighlightUpdateNeeded = true;
+        m_isHighlightDirty = false;
         m_gitRepo.reset();
         m_signs.clear();
+        ++m_gitDiffChannel->generation;
         m_lineInfoList.clear();
+        m_searcher.resetLines(0);
+        _updateFileWatches();
 
         if (isReload)
         {
@@ -144,7 +132,6 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
 #ifndef TESTING
         glfwSetCursor(g_window, nullptr);
 #endif
-        TIMER_END_FUNC();
         return;
     }
 
@@ -154,35 +141,6 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
         m_isReadOnly = true;
     }
 
-    /*
-    { // Regenerate the initial autocomplete list for `buffWordProvid`
-        Autocomp::buffWordProvid->clear();
-
-        for (const auto& line : m_document->getAll())
-        {
-            String word;
-            for (Char c : line)
-            {
-                // TODO: Filter out operators and such
-                if (u_isspace(c))
-                {
-                    // End of word
-                    if (!word.empty())
-                    {
-                        //Logger::dbg << "Feeding word: " << quoteStr(strToAscii(word)) << Logger::End;
-                        Autocomp::buffWordProvid->add(m_id, word);
-                        word.clear();
-                    }
-                }
-                else
-                {
-                    word += c;
-                }
-            }
-        }
-    }
-    regenAutocompList();
-    */
 
     if (isReload)
     {
@@ -196,73 +154,268 @@ void Buffer::open(const std::string& filePath, bool isReload/*=false*/)
     }
 
     // TODO: This is bad
-    const std::string content = utf32To8(m_document->getConcated());
+    const std::string content = m_document->getConcatedUtf8();
     // TODO: Properly tell reloading to LSP server (close first)
     Autocomp::lspProvider->onFileOpen(m_filePath, m_language, content);
+    _reindexWords();
 
 #ifndef TESTING
     glfwSetCursor(g_window, nullptr);
 #endif
-    TIMER_END_FUNC();
+}
+
+void Buffer::openDeferred(const std::string& filePath, int cursorLine, int cursorCol)
+{
+    Logger::dbg << "Deferring opening of file: " << filePath << Logger::End;
+
+    std::error_code err;
+    m_filePath = std::filesystem::canonical(filePath, err);
+    // Doesn't exist, the error is reported when we try to open it
+    if (err)
+        m_filePath = filePath;
+    m_isMaterialized = false;
+    m_deferredCursorLine = cursorLine;
+    m_deferredCursorCol = cursorCol;
+}
+
+void Buffer::materialize()
+{
+    if (m_isMaterialized)
+        return;
+
+    PROFILE_FUNC();
+
+    Logger::log << "Materializing buffer: " << this << " (" << m_filePath << ')' << Logger::End;
+    m_isMaterialized = true;
+    open(m_filePath);
+    if (!m_document->isEmpty())
+    {
+        moveCursorToLineCol(m_deferredCursorLine, m_deferredCursorCol);
+        if (m_size.y > 0)
+            scrollViewportToCursor();
+        else // Preloaded before it was laid out, keep some lines above the cursor
+            m_scrollY = -std::max(m_cursorLine-5, 0)*g_fontSizePx;
+    }
+}
+
+bool Buffer::dematerialize()
+{
+    if (!m_isMaterialized || m_isModified || m_isSaving)
+        return false;
+
+    PROFILE_FUNC();
+
+    Logger::log << "Dematerializing buffer: " << this << " (" << m_filePath << ')' << Logger::End;
+    m_deferredCursorLine = m_cursorLine;
+    m_deferredCursorCol = m_cursorCol;
+    m_isMaterialized = false;
+
+#ifndef TESTING
+    Autocomp::lspProvider->cancelRequestsOf(this);
+    Autocomp::lspProvider->onFileClose(m_filePath);
+    g_fileWatcher->unwatch(m_fileWatchId);
+    g_fileWatcher->unwatch(m_gitHeadWatchId);
+    g_fileWatcher->unwatch(m_gitIndexWatchId);
+    m_fileWatchId = 0;
+    m_gitHeadWatchId = 0;
+    m_gitIndexWatchId = 0;
+#endif
+    if (Autocomp::buffWordProvid)
+        Autocomp::buffWordProvid->removeBuffer(m_id);
+
+    // Drop the results of the background jobs
+    ++m_hlJobChannel->generation;
+    m_isHlJobPending = false;
+    m_isHighlightDirty = false;
+    ++m_gitDiffChannel->generation;
+    m_isGitDiffOutdated = false;
+
+    m_document->clearContent();
+    m_document->clearHistory();
+    m_lineInfoList.clear();
+    m_searcher.resetLines(0);
+    m_gitRepo.reset();
+    m_signs.clear();
+    m_cursorLine = 0;
+    m_cursorCol = 0;
+    m_cursorCharPos = 0;
+    m_scrollY = 0;
+    m_selection = {};
+
+    return true;
 }
 
 int Buffer::saveToFile()
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
+
+    // A placeholder has no content, and nothing to save
+    if (!m_isMaterialized)
+    {
+        return 0;
+    }
+
+    if (m_isSaving)
+    {
+        // Save the newer content when the running save has finished
+        Logger::dbg << "Already saving, queuing save: " << m_filePath << Logger::End;
+        m_isSaveQueued = true;
+        return 0;
+    }
 
     Logger::dbg << "Writing buffer to file: " << m_filePath << Logger::End;
     Autocomp::lspProvider->beforeFileSave(m_filePath, Autocomp::LspProvider::saveReason_t::Manual);
 
-    size_t contentLen{};
+    // Create the temporary file here, so the usual errors (permissions, etc.) are reported right away
+    std::shared_ptr<AtomicFileWriter> writer;
     try
     {
-        // TODO: Is there a way to write the content line-by-line to the file?
-        //       That would be faster.
-        const String content = m_document->getConcated();
-        contentLen = content.length();
-        const icu::UnicodeString str = icu::UnicodeString::fromUTF32(
-                (const UChar32*)content.data(), content.length());
-        UFILE* outFile = u_fopen(m_filePath.c_str(), "w", NULL, NULL);
-        if (!outFile)
-        {
-            throw std::runtime_error{"Call to `u_fopen()` failed"};
-        }
-        if (u_file_write(str.getBuffer(), str.length(), outFile) != str.length())
-        {
-            u_fclose(outFile);
-            throw std::runtime_error{"Call to `u_file_write()` failed"};
-        }
-        u_fclose(outFile);
+        // The mapped lines would be overwritten while they are read
+        if (m_document->isLargeFile() && !AtomicFileWriter::canReplace(m_filePath))
+            throw std::runtime_error{"The directory is not writable, a mapped file can only be saved by replacing it"};
+        writer = std::make_shared<AtomicFileWriter>(m_filePath);
     }
     catch (std::exception& e)
     {
         Logger::err << "Failed to write to file: \"" << m_filePath << "\": " << e.what() << Logger::End;
         g_statMsg.set("Failed to write to file: \""+m_filePath+"\": "+e.what(), StatusMsg::Type::Error);
-        TIMER_END_FUNC();
         return 1;
     }
-    Logger::log << "Wrote " << contentLen << " characters ("
-        << m_document->getLineCount() << " lines)" << Logger::End;
-    g_statMsg.set("Wrote buffer to file: \""+m_filePath+"\"", StatusMsg::Type::Info);
+
+    // The edits made while saving make the buffer modified again
+    m_isModified = false;
+    m_isSaving = true;
+    m_saveChannel->isRunning = true;
+
+    // The file is replaced by renaming, so the mapped lines of the snapshot stay valid
+    auto job = [channel=m_saveChannel, writer, filePath=m_filePath, snapshot=m_document->makeSnapshot()](){
+        PROFILE_ZONE("Save file");
+
+        std::string error;
+        size_t byteCount{};
+        try
+        {
+            // Transcode and write the content in chunks, reusing the chunk buffer
+            std::string chunk;
+            chunk.reserve(SAVE_CHUNK_SIZE+4096);
+            for (size_t i{}; i < snapshot.size(); ++i)
+            {
+                snapshot.appendUtf8(i, &chunk);
+                if (chunk.size() >= SAVE_CHUNK_SIZE)
+                {
+                    writer->write(chunk);
+                    byteCount += chunk.size();
+                    chunk.clear();
+                }
+            }
+            writer->write(chunk);
+            byteCount += chunk.size();
+            writer->commit(SAVE_FSYNC);
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+        }
+
+        EventLoop::runOnMainThread([channel, filePath, error, byteCount](){
+            Buffer* buffer;
+            {
+                std::lock_guard<std::mutex> guard{channel->mutex};
+                buffer = channel->buffer;
+            }
+            if (buffer)
+            {
+                buffer->_onSaveDone(filePath, error, byteCount);
+            }
+            else if (!error.empty())
+            {
+                // The buffer was closed while saving, the user still has to know
+                Logger::err << "Failed to write to file: \"" << filePath << "\": " << error << Logger::End;
+                g_statMsg.set("Failed to write to file: \""+filePath+"\": "+error, StatusMsg::Type::Error);
+                MessageDialog::create(MessageDialog::EMPTY_CB, nullptr,
+                        "Failed to save file: \""+filePath+"\": "+error,
+                        MessageDialog::Type::Error);
+            }
+        });
+
+        {
+            std::lock_guard<std::mutex> guard{channel->mutex};
+            channel->isRunning = false;
+        }
+        channel->cond.notify_all();
+    };
+
+    if (g_threadPool)
+        g_threadPool->submit(std::move(job));
+    else
+        job();
+
+    return 0;
+}
+
+void Buffer::_onSaveDone(const std::string& filePath, const std::string& error, size_t byteCount)
+{
+    PROFILE_FUNC();
+
+    m_isSaving = false;
+    if (!error.empty())
+    {
+        Logger::err << "Failed to write to file: \"" << filePath << "\": " << error << Logger::End;
+        g_statMsg.set("Failed to write to file: \""+filePath+"\": "+error, StatusMsg::Type::Error);
+        MessageDialog::create(MessageDialog::EMPTY_CB, nullptr,
+                "Failed to save file: \""+filePath+'"',
+                MessageDialog::Type::Error);
+        m_isModified = true;
+        m_isSaveQueued = false;
+        g_isTitleUpdateNeeded = true;
+        g_isRedrawNeeded = true;
+        return;
+    }
+
+    Logger::log << "Wrote " << byteCount << " bytes ("
+        << m_document->getLineCount() << " lines) to " << filePath << Logger::End;
+    g_statMsg.set("Wrote buffer to file: \""+filePath+"\"", StatusMsg::Type::Info);
+
+    // Save as is rejected while saving, but don't touch a path we didn't write
+    if (filePath != m_filePath)
+    {
+        Logger::warn << "The buffer was renamed while saving, not updating the file state" << Logger::End;
+        m_isSaveQueued = false;
+        return;
+    }
 
     if (Autocomp::lspProvider->onFileSaveNeedsContent())
-        Autocomp::lspProvider->onFileSave(m_filePath, utf32To8(m_document->getConcated()));
+        Autocomp::lspProvider->onFileSave(m_filePath, m_document->getConcatedUtf8());
     else
         Autocomp::lspProvider->onFileSave(m_filePath, "");
 
-    m_isModified = false;
     m_isReadOnly = false;
-    m_gitRepo = std::make_unique<Git::Repo>(m_filePath);
+    m_gitRepo = std::make_shared<Git::Repo>(m_filePath);
     m_lastFileUpdateTime = getFileModTime(m_filePath);
     updateGitDiff();
+    _updateGitBranch();
+    _updateFileWatches();
+    g_isTitleUpdateNeeded = true;
+    g_isRedrawNeeded = true;
 
-    TIMER_END_FUNC();
-    return 0;
+    if (m_isSaveQueued)
+    {
+        m_isSaveQueued = false;
+        saveToFile();
+    }
 }
 
 int Buffer::saveAsToFile(const std::string& filePath)
 {
-    const std::string originalPath = filePath;
+    // The running job would report to the new path
+    if (m_isSaving)
+    {
+        Logger::err << "Save as rejected, a save is still running: " << m_filePath << Logger::End;
+        g_statMsg.set("Cannot save as while saving, try again", StatusMsg::Type::Error);
+        return 1;
+    }
+
+    const std::string originalPath = m_filePath;
     m_filePath = filePath;
     Logger::dbg << "Saving as: " << filePath << Logger::End;
 
@@ -304,307 +457,316 @@ void Buffer::centerCursor()
         m_scrollY = 0;
 }
 
-void Buffer::_updateHighlighting()
+void Buffer::_invalidateHighlighting(size_t firstLine, size_t lastLine)
 {
-    // TODO: This should really be optimized, don't generate a concatenated buffer
-
-    Logger::dbg("Highighter");
-    Logger::log << "Updating syntax highlighting" << Logger::End;
+    assert(firstLine <= lastLine);
 
-    m_findResultIs.clear();
-    g_isRedrawNeeded = true;
+    for (size_t i{firstLine}; i <= lastLine && i < m_lineInfoList.size(); ++i)
+        m_lineInfoList[i].isHlValid = false;
 
-    const auto buffer = m_document->getConcated();
+    if (m_isHighlightDirty)
+    {
+        m_hlDirtyFirstLine = std::min(m_hlDirtyFirstLine, firstLine);
+        m_hlDirtyLastLine = std::max(m_hlDirtyLastLine, lastLine);
+    }
+    else
+    {
+        m_hlDirtyFirstLine = firstLine;
+        m_hlDirtyLastLine = lastLine;
+    }
+    m_isHighlightDirty = true;
 
-    // This is the temporary buffer we are working with
-    // `m_highlightBuffer` is replaced with this at the end
-    auto highlightBuffer = std::u8string(buffer.length(), Syntax::MARK_NONE);
+    // Cancel the running job, it works on outdated lines
+    ++m_hlJobChannel->generation;
+    m_isHlJobPending = false;
+}
 
-    auto highlightWord{[&](const String& word, char colorMark, bool shouldBeWholeWord){
-        assert(!word.empty());
-        size_t start{};
-        while (true)
+// Doesn't capture the buffer, so it can be used by the background jobs
+static Syntax::isPathFn_t makeIsPathFn(const std::string& filePath)
+{
+    return [parentPath=getParentPath(filePath)](const String& word){ // -> bool
+        if (isFormallyValidUrl(word))
+            return true;
+        try
         {
-            if (m_isHighlightUpdateNeeded) break;
-            size_t found = buffer.find(word, start);
-            if (found == String::npos)
-                break;
-            if (!shouldBeWholeWord |
-                ((found == 0 || !isalnum((uchar)buffer[found-1]))
-                 && (found+word.size()-1 == buffer.length()-1 || !isalnum((uchar)buffer[found+word.size()]))))
-                highlightBuffer.replace(found, word.length(), word.length(), colorMark);
-            start = found+word.length();
+            if (word[0] == '/')
+                // Absolute path
+                return isValidFilePath(word);
+            else
+                // Relative path
+                return isValidFilePath((parentPath/std::filesystem::path{word}).string());
         }
-    }};
-
-    auto highlightStrings{[&](){
-        bool isInsideString = false;
-        for (size_t i{}; i < buffer.length(); ++i)
+        catch (std::exception&)
         {
-            if (m_isHighlightUpdateNeeded) break;
-            if (highlightBuffer[i] == Syntax::MARK_NONE && buffer[i] == '"'
-                    && (i == 0 || (buffer[i-1] != '\\' || (i >= 2 && buffer[i-2] == '\\'))))
-                isInsideString = !isInsideString;
-            if (isInsideString || (highlightBuffer[i] == Syntax::MARK_NONE && buffer[i] == '"'))
-                highlightBuffer[i] = Syntax::MARK_STRING;
+            return false;
         }
-    }};
+    };
+}
+
+void Buffer::_updateHighlighting(size_t untilLine)
+{
+    if (!m_isHighlightDirty)
+        return;
+
+    PROFILE_FUNC();
+
+    assert(m_lineInfoList.size() == m_document->getLineCount());
+    const size_t lineCount = m_lineInfoList.size();
+
+    // Take what the worker did first
+    _applyBgHighlighting();
+
+    const Syntax::isPathFn_t isPath = makeIsPathFn(m_filePath);
+
+    size_t lineI = m_hlDirtyFirstLine;
+    Syntax::LineState state = (lineI < lineCount ? m_lineInfoList[lineI].hlStartState : Syntax::LineState{});
+    size_t updatedLineCount{};
+    const bool wasDirty = m_isHighlightDirty;
+    m_isHighlightDirty = false;
+    for (; wasDirty && lineI < lineCount; ++lineI)
+    {
+        LineInfo& info = m_lineInfoList[lineI];
 
-    auto highlightNumbers{[&](){
-        size_t i{};
-        while (i < buffer.length())
+        // If the line hasn't been changed and it starts in the same state,
+        // the rest of the document is up to date
+        if (lineI > m_hlDirtyLastLine && info.isHlValid && info.hlStartState == state)
+            break;
+
+        // Leave the rest for later, continue from here
+        if (lineI > untilLine)
         {
-            if (m_isHighlightUpdateNeeded) break;
-            // Go till a number
-            while (i < buffer.length() && !isdigit((uchar)buffer[i]) && buffer[i] != '.')
-                ++i;
-            // Color the number
-            while (i < buffer.length() && (isxdigit((uchar)buffer[i]) || buffer[i] == '.' || buffer[i] == 'x'))
-                highlightBuffer[i++] = Syntax::MARK_NUMBER;
+            if (info.hlStartState != state)
+                info.isHlValid = false;
+            info.hlStartState = state;
+            m_hlDirtyFirstLine = lineI;
+            m_isHighlightDirty = true;
+            break;
         }
-    }};
 
-    auto highlightPrefixed{[&](const String& prefix, char colorMark){
-        size_t charI{};
-        LineIterator<String> it{buffer};
-        String line;
-        while (it.next(line))
+        info.hlStartState = state;
+        state = Syntax::highlightLine(m_document->getLine(lineI), state, &info.hlMarks, isPath);
+        info.isHlValid = true;
+        ++updatedLineCount;
+    }
+
+    if (updatedLineCount)
+    {
+        LOG_DBG("Highlighter") << "Highlighted " << updatedLineCount << " lines" << Logger::End;
+        // The running job started from a line that we've just done
+        ++m_hlJobChannel->generation;
+        m_isHlJobPending = false;
+    }
+
+    // Do the lines below the viewport in the background
+    if (m_isHighlightDirty && !m_isHlJobPending)
+        _startBgHighlighting();
+}
+
+void Buffer::_startBgHighlighting()
+{
+    assert(m_isHighlightDirty);
+    if (!g_threadPool)
+        return;
+
+    const size_t firstLine = m_hlDirtyFirstLine;
+    const size_t lineCount = std::min<size_t>(HL_BG_CHUNK_LINES, m_document->getLineCount()-firstLine);
+    if (lineCount == 0)
+        return;
+
+    // The document can't be accessed from the worker, give it a copy of the lines
+    std::vector<String> lines;
+    lines.reserve(lineCount);
+    if (m_document->isLargeFile())
+    {
+        // Don't keep every line of the file decoded
+        for (size_t i{}; i < lineCount; ++i)
+            lines.push_back(m_document->getLine(firstLine+i));
+    }
+    else
+    {
+        for (auto it = m_document->iterAt(firstLine); lines.size() < lineCount; ++it)
+            lines.push_back(*it);
+    }
+
+    const uint64_t generation = m_hlJobChannel->generation;
+    g_threadPool->submit([
+            channel=m_hlJobChannel,
+            generation,
+            firstLine,
+            state=m_lineInfoList[firstLine].hlStartState,
+            lines=std::move(lines),
+            isPath=makeIsPathFn(m_filePath)]() mutable {
+        PROFILE_ZONE("Highlight lines");
+
+        HlJobChannel::Result result;
+        result.generation = generation;
+        result.firstLine = firstLine;
+        result.startStates.reserve(lines.size());
+        result.marks.resize(lines.size());
+        for (size_t i{}; i < lines.size(); ++i)
         {
-            if (m_isHighlightUpdateNeeded) break;
-            const size_t found = line.find(prefix);
-            if (found != String::npos)
-            {
-                const size_t beginning = charI+found;
-                const size_t size = line.size()-found;
-                highlightBuffer.replace(beginning, size, size, colorMark);
-            }
-            charI += line.size()+1;
+            // Stop if the buffer has been modified in the meantime
+            if (channel->generation != generation)
+                return;
+
+            result.startStates.push_back(state);
+            state = Syntax::highlightLine(lines[i], state, &result.marks[i], isPath);
         }
-    }};
+        result.endState = state;
 
-    auto highlightPreprocessors{[&](){
-        size_t charI{};
-        LineIterator<String> it{buffer};
-        String line;
-        while (it.next(line))
         {
-            if (m_isHighlightUpdateNeeded) break;
-            const size_t prefixPos = line.find(Syntax::preprocessorPrefix);
-            if (prefixPos != String::npos)
-            {
-                const size_t beginning = charI+prefixPos;
-                if (highlightBuffer[beginning] == Syntax::MARK_NONE)
-                {
-                    const size_t preprocessorEnd = line.find_first_of(' ', prefixPos);
-                    const size_t size = (preprocessorEnd != String::npos ? preprocessorEnd : line.size())-prefixPos;
-                    highlightBuffer.replace(beginning, size, size, Syntax::MARK_PREPRO);
-                }
-            }
-            charI += line.size()+1;
+            std::lock_guard<std::mutex> guard{channel->resultMutex};
+            channel->result = std::move(result);
         }
-    }};
+        g_isRedrawNeeded = true;
+        EventLoop::wakeUpNow();
+    });
+    m_isHlJobPending = true;
+}
 
-    auto highlightBlockComments{[&](){
-        bool isInsideComment = false;
-        for (size_t i{}; i < buffer.length(); ++i)
-        {
-            if (m_isHighlightUpdateNeeded) break;
-            if (highlightBuffer[i] != Syntax::MARK_STRING
-                    && buffer.substr(i, Syntax::blockCommentBegin.size()) == Syntax::blockCommentBegin)
-                isInsideComment = true;
-            else if (highlightBuffer[i] != Syntax::MARK_STRING
-                    && buffer.substr(i, Syntax::blockCommentEnd.size()) == Syntax::blockCommentEnd)
-                isInsideComment = false;
-            if (isInsideComment
-                    || (highlightBuffer[i] != Syntax::MARK_STRING
-                    && (buffer.substr(i, Syntax::blockCommentEnd.size()) == Syntax::blockCommentEnd
-                    || (i > 0 && buffer.substr(i-1, Syntax::blockCommentEnd.size()) == Syntax::blockCommentEnd))))
-                highlightBuffer[i] = Syntax::MARK_COMMENT;
-        }
-    }};
+bool Buffer::_applyBgHighlighting()
+{
+    std::optional<HlJobChannel::Result> result;
+    {
+        std::lock_guard<std::mutex> guard{m_hlJobChannel->resultMutex};
+        result.swap(m_hlJobChannel->result);
+    }
+    // Nothing is ready or it's outdated
+    if (!result || result->generation != m_hlJobChannel->generation)
+        return false;
+
+    m_isHlJobPending = false;
+    // Nothing has changed since the job was started, so it continued where we stopped
+    assert(m_isHighlightDirty);
+    assert(result->firstLine == m_hlDirtyFirstLine);
+
+    const size_t lineCount = m_lineInfoList.size();
+    size_t lineI = result->firstLine;
+    for (size_t i{}; i < result->marks.size(); ++i, ++lineI)
+    {
+        LineInfo& info = m_lineInfoList[lineI];
+        const Syntax::LineState state = result->startStates[i];
 
-    auto highlightCharLiterals{[&](){
-        bool isInsideCharLit = false;
-        for (size_t i{}; i < buffer.length(); ++i)
+        // Same as in `_updateHighlighting()`
+        if (lineI > m_hlDirtyLastLine && info.isHlValid && info.hlStartState == state)
         {
-            if (m_isHighlightUpdateNeeded) break;
-            if (highlightBuffer[i] == Syntax::MARK_NONE && buffer[i] == '\''
-                    && (i == 0 || (buffer[i-1] != '\\' || (i < 2 || buffer[i-2] == '\\'))))
-                isInsideCharLit = !isInsideCharLit;
-            if (buffer[i] == '\n')
-                isInsideCharLit = false;
-            if (isInsideCharLit || (highlightBuffer[i] == Syntax::MARK_NONE && buffer[i] == '\''))
-                highlightBuffer[i] = Syntax::MARK_CHARLIT;
+            m_isHighlightDirty = false;
+            break;
         }
-    }};
 
-    auto highlightChar{[&](Char c, char colorMark){
-        for (size_t i{}; i < buffer.length(); ++i)
+        info.hlStartState = state;
+        info.hlMarks = std::move(result->marks[i]);
+        info.isHlValid = true;
+    }
+    LOG_DBG("Highlighter") << "Got " << lineI-result->firstLine << " highlighted lines from worker" << Logger::End;
+
+    if (m_isHighlightDirty)
+    {
+        if (lineI < lineCount)
         {
-            if (m_isHighlightUpdateNeeded) break;
-            if (highlightBuffer[i] != Syntax::MARK_STRING && highlightBuffer[i] != Syntax::MARK_COMMENT && buffer[i] == c)
-                highlightBuffer[i] = colorMark;
+            // Continue from the end of the chunk
+            LineInfo& info = m_lineInfoList[lineI];
+            if (info.hlStartState != result->endState)
+                info.isHlValid = false;
+            info.hlStartState = result->endState;
+            m_hlDirtyFirstLine = lineI;
         }
-    }};
+        else
+        {
+            m_isHighlightDirty = false;
+        }
+    }
+    return true;
+}
 
-    auto highlightFilePathsAndUrls{[&](){
-        auto _isValidFilePathOrUrl{[&](const String& path){ // -> bool
-            if (isFormallyValidUrl(path))
-                return true;
-            try
-            {
-                if (path[0] == '/')
-                    // Absolute path
-                    return isValidFilePath(path);
-                else
-                    // Relative path
-                    return isValidFilePath((getParentPath(m_filePath)/std::filesystem::path{path}).string());
-            }
-            catch (std::exception&)
-            {
-                return false;
-            }
-        }};
+void Buffer::updateGitDiff()
+{
+    m_isGitDiffOutdated = false;
+    const uint64_t generation = ++m_gitDiffChannel->generation;
+    if (!m_gitRepo || !m_gitRepo->isRepo())
+    {
+        m_signs.clear();
+        return;
+    }
 
-        for (size_t i{}; i < buffer.length();)
-        {
-            if (m_isHighlightUpdateNeeded) break;
-            while (i < buffer.length() && (isspace((uchar)buffer[i]) || buffer[i] == '"'))
-                ++i;
+    // Diffing would take too long, and copying the content for it too
+    if (m_document->isLargeFile())
+    {
+        Logger::dbg << "Not diffing a large file" << Logger::End;
+        m_signs.clear();
+        return;
+    }
 
-            String word;
-            while (i < buffer.length() && !isspace((uchar)buffer[i]) && buffer[i] != '"')
-                word += buffer[i++];
+    const std::string relPath = m_filePath.substr(m_gitRepo->getRepoRoot().size());
+    Logger::dbg << "Filepath: " << m_filePath
+        << ", git repo root: " << m_gitRepo->getRepoRoot()
+        << ", relative path: " << relPath << Logger::End;
+
+    // Diff the content in memory, so the signs are up to date while typing.
+    // Only the compact lines are copied here, they are encoded on the worker.
+    auto job = [
+            channel=m_gitDiffChannel,
+            repo=m_gitRepo,
+            generation,
+            relPath,
+            snapshot=m_document->makeSnapshot()](){
+        PROFILE_ZONE("Git diff");
+
+        // A newer job has been started in the meantime
+        if (channel->generation != generation)
+            return;
+
+        std::string content;
+        for (size_t i{}; i < snapshot.size(); ++i)
+            snapshot.appendUtf8(i, &content);
 
-            if (_isValidFilePathOrUrl(word))
+        GitDiffChannel::Result result;
+        result.generation = generation;
+        for (const auto& pair : repo->getFileDiff(relPath, content))
+        {
+            Sign sign;
+            switch (pair.second)
             {
-                highlightBuffer.replace(i-word.size(), word.size(), word.size(), Syntax::MARK_FILEPATH);
+            case Git::ChangeType::Add: sign = Sign::GitAdd; break;
+            case Git::ChangeType::Delete: sign = Sign::GitRemove; break;
+            case Git::ChangeType::Modify: sign = Sign::GitModify; break;
+            default: assert(false);
             }
+            result.signs.push_back({pair.first, sign});
+        }
 
-            ++i;
+        {
+            std::lock_guard<std::mutex> guard{channel->resultMutex};
+            channel->result = std::move(result);
         }
-    }};
+        g_isRedrawNeeded = true;
+        EventLoop::wakeUpNow();
+    };
 
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    for (const auto& word : Syntax::operatorList) highlightWord(word, Syntax::MARK_OPERATOR, false);
-    Logger::dbg << "Highlighting of operators took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    for (const auto& word : Syntax::keywordList) highlightWord(word, Syntax::MARK_KEYWORD, true);
-    Logger::dbg << "Highlighting of keywords took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    for (const auto& word : Syntax::typeList) highlightWord(word, Syntax::MARK_TYPE, true);
-    Logger::dbg << "Highlighting of types took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightNumbers();
-    Logger::dbg << "Highlighting of numbers took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightPrefixed(Syntax::lineCommentPrefix, Syntax::MARK_COMMENT);
-    Logger::dbg << "Highlighting of line comments took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightBlockComments();
-    Logger::dbg << "Highlighting of block comments took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightCharLiterals();
-    Logger::dbg << "Highlighting of character literals took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightStrings();
-    Logger::dbg << "Highlighting of strings took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightPreprocessors();
-    Logger::dbg << "Highlighting preprocessor directives took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightWord(U"TODO:", Syntax::MARK_TODO, true);
-    Logger::dbg << "Highlighting of TODOs took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightWord(U"FIXME:", Syntax::MARK_FIXME, true);
-    Logger::dbg << "Highlighting of FIXMEs took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightWord(U"XXX:", Syntax::MARK_XXX, true);
-    Logger::dbg << "Highlighting of XXXs took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightChar(U';', Syntax::MARK_SPECCHAR);
-    if (m_isHighlightUpdateNeeded) return;
-    highlightChar(U'{', Syntax::MARK_SPECCHAR);
-    if (m_isHighlightUpdateNeeded) return;
-    highlightChar(U'}', Syntax::MARK_SPECCHAR);
-    if (m_isHighlightUpdateNeeded) return;
-    highlightChar(U'(', Syntax::MARK_SPECCHAR);
-    if (m_isHighlightUpdateNeeded) return;
-    highlightChar(U')', Syntax::MARK_SPECCHAR);
-    Logger::dbg << "Highlighting special characters took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-    //--------------------------------------------------------------------------
-
-    if (m_isHighlightUpdateNeeded) return;
-    timer.reset();
-    highlightFilePathsAndUrls();
-    Logger::dbg << "Highlighting of paths and URLs took " << timer.getElapsedTimeMs() << "ms" << Logger::End;
-
-
-    m_highlightBuffer = highlightBuffer;
-
-    Logger::log << "Syntax highlighting updated" << Logger::End;
-    Logger::log(Logger::End);
-    g_isRedrawNeeded = true;
+    if (g_threadPool)
+        g_threadPool->submit(std::move(job));
+    else
+        job();
+}
 
-    findUpdate();
-    g_isRedrawNeeded = true;
+void Buffer::_scheduleGitDiffUpdate()
+{
+    m_isGitDiffOutdated = true;
+    m_msUntilGitDiffUpdate = GIT_DIFF_DEBOUNCE_MS;
 }
 
-void Buffer::updateGitDiff()
+void Buffer::_applyGitDiff()
 {
-    const std::string relPath = m_filePath.substr(m_gitRepo->getRepoRoot().size());
-    Logger::dbg << "Filepath: " << m_filePath
-        << ", git repo root: " << m_gitRepo->getRepoRoot()
-        << ", relative path: " << relPath << Logger::End;
-    auto diff = m_gitRepo->getDiff(relPath);
-    for (const auto& pair : diff)
+    std::optional<GitDiffChannel::Result> result;
     {
-        Sign sign;
-        switch (pair.second)
-        {
-        case Git::ChangeType::Add: sign = Sign::GitAdd; break;
-        case Git::ChangeType::Delete: sign = Sign::GitRemove; break;
-        case Git::ChangeType::Modify: sign = Sign::GitModify; break;
-        default: assert(false);
-        }
-        m_signs.push_back({pair.first, sign});
+        std::lock_guard<std::mutex> guard{m_gitDiffChannel->resultMutex};
+        result.swap(m_gitDiffChannel->result);
     }
+    // Nothing is ready or it's outdated
+    if (!result || result->generation != m_gitDiffChannel->generation)
+        return;
+
+    m_signs = std::move(result->signs);
 }
 
 std::string Buffer::getCheckedOutObjName(int hashLen/*=-1*/) const
@@ -623,7 +785,7 @@ std::string Buffer::getCheckedOutObjName(int hashLen/*=-1*/) const
 
 void Buffer::updateCursor()
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     m_document->assertPos(m_cursorLine, m_cursorCol, m_cursorCharPos);
 
@@ -946,8 +1108,6 @@ void Buffer::updateCursor()
         m_cursorHoldTime = 0;
         g_hoverPopup->hideAndClear();
     }
-
-    TIMER_END_FUNC();
 }
 
 int Buffer::getNumOfLines() const
@@ -1012,16 +1172,7 @@ void Buffer::moveCursorToLineCol(int line, int col)
 
 size_t Buffer::lineColToPos(const lsPosition& pos) const
 {
-    size_t out = 0;
-    {
-        // Add up the whole line lengths
-        for (size_t lineI{}; lineI < pos.line; ++lineI)
-            out += m_document->getLineLen(lineI);
-
-        // Add the remaining
-        out += pos.character;
-    }
-    return out;
+    return m_document->getLineStartPos(pos.line)+pos.character;
 }
 
 void Buffer::moveCursorToLineCol(const lsPosition& pos)
@@ -1031,21 +1182,12 @@ void Buffer::moveCursorToLineCol(const lsPosition& pos)
 
 void Buffer::moveCursorToChar(int pos)
 {
-    size_t i{};
-    for (size_t lineI{}; lineI < m_document->getLineCount(); ++lineI)
+    if (pos >= 0 && (size_t)pos < m_document->calcCharCount())
     {
-        const size_t lineLen = m_document->getLineLen(lineI);
-        if (int(i + lineLen - 1) < pos)
-        {
-            i += lineLen;
-        }
-        else
-        {
-            m_cursorCol = pos-i;
-            m_cursorLine = lineI;
-            m_cursorCharPos = pos;
-            break;
-        }
+        size_t lineStart{};
+        m_cursorLine = m_document->getLineOfPos(pos, &lineStart);
+        m_cursorCol = pos-lineStart;
+        m_cursorCharPos = pos;
     }
 
     m_isCursorShown = true;
@@ -1055,7 +1197,7 @@ void Buffer::moveCursorToChar(int pos)
 
 void Buffer::scrollBy(int val)
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     const int origScroll = m_scrollY;
 
@@ -1075,8 +1217,6 @@ void Buffer::scrollBy(int val)
 
     // Make the hover popup follow the original origin
     g_hoverPopup->moveYBy(m_scrollY-origScroll);
-
-    TIMER_END_FUNC();
 }
 
 #define STATUS_LINE_STR_LEN_MAX\
@@ -1099,23 +1239,10 @@ void Buffer::updateRStatusLineStr()
     {
         int errDiagCount{};
         int warnDiagCount{};
-        auto fileDiagsIt = Autocomp::LspProvider::s_diags.find(m_filePath);
-        if (fileDiagsIt != Autocomp::LspProvider::s_diags.end())
+        if (const auto fileDiags = Autocomp::LspProvider::getDiagsForFile(m_filePath))
         {
-            // Count the errors and warnings
-            for (const auto& diag : fileDiagsIt->second)
-            {
-                // Note: We default to Information, maybe this needs to be changed later
-                const auto sev = diag.severity.get_value_or(lsDiagnosticSeverity::Information);
-                if (sev == lsDiagnosticSeverity::Error)
-                {
-                    ++errDiagCount;
-                }
-                else if (sev == lsDiagnosticSeverity::Warning)
-                {
-                    ++warnDiagCount;
-                }
-            }
+            errDiagCount = fileDiags->getErrorCount();
+            warnDiagCount = fileDiags->getWarningCount();
         }
 
         m_statusLineStr.str
@@ -1370,67 +1497,65 @@ void Buffer::_renderDrawCursor(const glm::ivec2& textPos, int initTextY, int wid
 
         if (g_editorMode.get() == EditorMode::_EditorMode::Normal || m_isDimmed)
         {
-            g_uiRenderer->renderRectangleOutline(
+            g_uiRenderer->queueRectangleOutline(
                     {textPos.x-2, initTextY+textPos.y-m_scrollY-m_position.y-2},
                     {textPos.x+width+2, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx+2},
                     {UNPACK_RGB_COLOR(cursColor), 1.0f},
-                    2
+                    2,
+                    UiRenderer::Layer::AboveText
             );
-            g_uiRenderer->renderFilledRectangle(
+            g_uiRenderer->queueFilledRectangle(
                     {textPos.x-2, initTextY+textPos.y-m_scrollY-m_position.y-2},
                     {textPos.x+width+2, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx+2},
-                    {UNPACK_RGB_COLOR(cursColor), 0.4f}
+                    {UNPACK_RGB_COLOR(cursColor), 0.4f},
+                    UiRenderer::Layer::AboveText
             );
         }
         else if (g_editorMode.get() == EditorMode::_EditorMode::Replace)
         {
-            g_uiRenderer->renderFilledRectangle(
+            g_uiRenderer->queueFilledRectangle(
                     {textPos.x-2,       initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx-2},
                     {textPos.x+width+2, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx+2},
-                    {UNPACK_RGB_COLOR(cursColor), 1.0f}
+                    {UNPACK_RGB_COLOR(cursColor), 1.0f},
+                    UiRenderer::Layer::AboveText
             );
         }
         else
         {
-            g_uiRenderer->renderFilledRectangle(
+            g_uiRenderer->queueFilledRectangle(
                     {textPos.x-1, initTextY+textPos.y-m_scrollY-m_position.y-2},
                     {textPos.x+1, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx+2},
-                    {UNPACK_RGB_COLOR(cursColor), 0.4f}
+                    {UNPACK_RGB_COLOR(cursColor), 0.4f},
+                    UiRenderer::Layer::AboveText
             );
         }
-
-        // Bind the text renderer shader again
-        g_textRenderer->prepareForDrawing();
     }
 }
 
 void Buffer::_renderDrawSelBg(const glm::ivec2& textPos, int initTextY, int width) const
 {
     // Render selection background
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y},
             {textPos.x+width, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx},
             RGB_COLOR_TO_RGBA(g_theme->selBg)
     );
-
-    // Bind the text renderer shader again
-    g_textRenderer->prepareForDrawing();
 }
 
 void Buffer::_renderDrawIndGuid(const glm::ivec2& textPos, int initTextY) const
 {
     const RGBColor& defcol = g_theme->values[Syntax::MARK_NONE].color;
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y+2},
             {textPos.x+g_fontSizePx/10, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx/5},
             {defcol.r, defcol.g, defcol.b, 0.7f}
     );
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx/5*2},
             {textPos.x+g_fontSizePx/10, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx/5*3},
             {defcol.r, defcol.g, defcol.b, 0.7f}
     );
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx/5*4},
             {textPos.x+g_fontSizePx/10, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx/5*5},
             {defcol.r, defcol.g, defcol.b, 0.7f}
@@ -1450,12 +1575,11 @@ void Buffer::_renderDrawIndRainbow(const glm::ivec2& textPos, int initTextY, int
         {0.9f, 0.5f, 0.9f, 0.1f}
     };
 
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x,               initTextY+textPos.y-m_scrollY-m_position.y+2},
             {textPos.x+g_fontWidthPx, initTextY+textPos.y-m_scrollY-m_position.y+2+g_fontSizePx},
             indentColors[colI/TAB_SPACE_COUNT%indentColorCount]
     );
-    g_textRenderer->prepareForDrawing();
 #else
     (void)textPos;
     (void)initTextY;
@@ -1536,16 +1660,13 @@ static RGBColor calcFindResultFgColor(RGBColor col)
     return calcCompColor(col);
 }
 
-void Buffer::_renderDrawFoundMark(const glm::ivec2& textPos, int initTextY) const
+void Buffer::_renderDrawFoundMark(const glm::ivec2& textPos, int initTextY, int len) const
 {
-    g_uiRenderer->renderFilledRectangle(
+    g_uiRenderer->queueFilledRectangle(
             {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y},
-            {textPos.x+g_fontWidthPx*m_toFind.size(), initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx},
+            {textPos.x+g_fontWidthPx*len, initTextY+textPos.y-m_scrollY-m_position.y+g_fontSizePx},
             RGB_COLOR_TO_RGBA(g_theme->findResultBg)
     );
-
-    // Bind the text renderer shader again
-    g_textRenderer->prepareForDrawing();
 }
 
 namespace
@@ -1570,7 +1691,7 @@ static int getDiagnSevIndex(const lsDiagnostic& diagn)
 
 
 void Buffer::_renderDrawDiagnosticMsg(
-        const Autocomp::LspProvider::diagList_t& diags, int lineI, bool isCurrent,
+        const Autocomp::LspProvider::FileDiags& diags, int lineI, bool isCurrent,
         const glm::ivec2& textPos, int initTextY
         ) const
 {
@@ -1581,51 +1702,46 @@ void Buffer::_renderDrawDiagnosticMsg(
         'H', // Hint
     };
 
-    for (const auto& diagn : diags)
+    const lsDiagnostic* const diagnP = diags.findStartingIn(lineI);
+    if (diagnP)
     {
-        if ((int)diagn.range.start.line == lineI)
-        {
-            const int sevIndex = getDiagnSevIndex(diagn);
-            const RGBColor textColor = diagnSeverityColors[sevIndex];
+        const lsDiagnostic& diagn = *diagnP;
+        const int sevIndex = getDiagnSevIndex(diagn);
+        const RGBColor textColor = diagnSeverityColors[sevIndex];
 
-            // If the diagnostic is in the current line, show the whole message.
-            // Otherwise only show the first line.
-            std::string msgToDisplay;
-            if (isCurrent)
-            {
-                msgToDisplay = diagn.message;
-            }
-            else
-            {
-                LineIterator msgLineIt{diagn.message};
-                (void)msgLineIt.next(msgToDisplay);
-            }
+        // If the diagnostic is in the current line, show the whole message.
+        // Otherwise only show the first line.
+        std::string msgToDisplay;
+        if (isCurrent)
+        {
+            msgToDisplay = diagn.message;
+        }
+        else
+        {
+            LineIterator msgLineIt{diagn.message};
+            (void)msgLineIt.next(msgToDisplay);
+        }
 
-            auto rendOrMeasure{[&](bool render){
-                return g_textRenderer->renderString(
-                    charToStr(severityMarks[sevIndex])+U": "+utf8To32(msgToDisplay),
-                    {textPos.x+g_fontWidthPx*4, initTextY+textPos.y-m_scrollY-m_position.y},
-                    FONT_STYLE_ITALIC|(isCurrent ? FONT_STYLE_BOLD : 0),
-                    textColor,
-                    true,
-                    !render);
-            }};
+        auto rendOrMeasure{[&](bool render){
+            return g_textRenderer->renderString(
+                charToStr(severityMarks[sevIndex])+U": "+utf8To32(msgToDisplay),
+                {textPos.x+g_fontWidthPx*4, initTextY+textPos.y-m_scrollY-m_position.y},
+                FONT_STYLE_ITALIC|(isCurrent ? FONT_STYLE_BOLD : 0),
+                textColor,
+                true,
+                !render);
+        }};
 
-            // Calculate and fill the background of the diagnostic message
-            const auto diagnArea = rendOrMeasure(false);
-            g_uiRenderer->renderFilledRectangle(
-                    diagnArea.first,
-                    {diagnArea.second.x, diagnArea.second.y+g_fontSizePx*0.2f},
-                    {UNPACK_RGB_COLOR(textColor), 0.1f});
+        // Calculate and fill the background of the diagnostic message
+        const auto diagnArea = rendOrMeasure(false);
+        g_uiRenderer->queueFilledRectangle(
+                diagnArea.first,
+                {diagnArea.second.x, diagnArea.second.y+g_fontSizePx*0.2f},
+                {UNPACK_RGB_COLOR(textColor), 0.1f});
 
-            // Render the message
-            rendOrMeasure(true);
-            break;
-        }
+        // Render the message
+        rendOrMeasure(true);
     }
-
-    // Bind the text renderer shader again
-    g_textRenderer->prepareForDrawing();
 }
 
 static bool isPosInRange(const lsRange& range, const lsPosition& pos)
@@ -1634,25 +1750,10 @@ static bool isPosInRange(const lsRange& range, const lsPosition& pos)
 }
 
 void Buffer::_renderDrawDiagnosticDecorations(
-        const Autocomp::LspProvider::diagList_t& diags, int lineI, int colI,
+        const lsDiagnostic& foundDiagn,
         const glm::ivec2& textPos, int initTextY
         ) const
 {
-    static lsDiagnostic foundDiagn{};
-
-    // If `foundDiagn` is outdated
-    if (!isPosInRange(foundDiagn.range, {lineI, colI}))
-    {
-        // Find a new containing diagnostic
-        auto found = std::find_if(diags.begin(), diags.end(), [&](const lsDiagnostic& diagn){
-                return isPosInRange(diagn.range, {lineI, colI});
-        });
-        // If there is no containing diagnostic, exit
-        if (found == diags.end())
-            return;
-        foundDiagn = *found;
-    }
-
     const glm::ivec2 pos1 = {textPos.x, initTextY+textPos.y-m_scrollY-m_position.y};
     auto drawUnderlineSegment = [&](int index){
         static constexpr int segmentW = 1;
@@ -1661,7 +1762,7 @@ void Buffer::_renderDrawDiagnosticDecorations(
 
         // Draw a wavy line
         const int yoffs1 = g_fontSizePx+std::round(sin(index/g_fontWidthPx*M_PI*2)*maxOffs);
-        g_uiRenderer->renderFilledRectangle(
+        g_uiRenderer->queueFilledRectangle(
                 pos1+glm::ivec2{segmentW*index,     yoffs1},
                 pos1+glm::ivec2{segmentW*(index+1), yoffs1+segmentH},
                 RGB_COLOR_TO_RGBA(diagnSeverityColors[getDiagnSevIndex(foundDiagn)]));
@@ -1678,13 +1779,12 @@ void Buffer::_renderDrawDiagnosticDecorations(
         {
             const int yoffs = g_fontSizePx*0.65;
             static constexpr int segmentH = 1;
-            g_uiRenderer->renderFilledRectangle(
+            g_uiRenderer->queueFilledRectangle(
                     pos1+glm::ivec2{0,             yoffs},
                     pos1+glm::ivec2{g_fontWidthPx, yoffs+segmentH},
                     RGBAColor{1.f, 1.f, 1.f});
         }
     }
-    g_textRenderer->prepareForDrawing();
 }
 
 void Buffer::_renderDrawCursorLineCodeAct(int yPos, int initTextY)
@@ -1717,11 +1817,17 @@ void Buffer::_renderDrawBreadcrumbBar()
 
 void Buffer::render()
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     assert(m_size.x > 0);
     assert(m_size.y > 0);
 
+    // Opened lazily, when it's first shown
+    materialize();
+    m_lastShownTime = glfwGetTime();
+
+    _applyGitDiff();
+
     // Fill background
     g_uiRenderer->renderFilledRectangle(
             m_position,
@@ -1740,6 +1846,9 @@ void Buffer::render()
     float textX = initTextX;
     float textY = initTextY;
 
+    // Only highlight till the bottom of the viewport, the rest is done when it gets visible
+    _updateHighlighting((m_size.y-m_scrollY)/g_fontSizePx+1);
+
     g_textRenderer->prepareForDrawing();
     g_textRenderer->setDrawingColor({1.0f, 1.0f, 1.0f});
 
@@ -1752,22 +1861,33 @@ void Buffer::render()
     const int maxLineLenChar = m_size.x/g_fontWidthPx;
 #endif
 
-    auto fileDiagsIt = Autocomp::LspProvider::s_diags.find(m_filePath);
+    // Hold a reference, so the LSP thread can replace the diagnostics while we are drawing
+    const Autocomp::LspProvider::fileDiagsPtr_t fileDiags = Autocomp::LspProvider::getDiagsForFile(m_filePath);
 
     m_charUnderMouseCol = -1;
     m_charUnderMouseRow = -1;
     m_charUnderMouseI = -1;
     m_isMouseOverText = false;
 
+    // Seek to the first line that is not above the viewport
+    // (the lines with `textY <= -g_fontSizePx`)
+    int lineI{};
+    {
+        const float aboveViewportHeight = -g_fontSizePx-initTextY;
+        if (aboveViewportHeight >= 0)
+            lineI = std::min<size_t>(aboveViewportHeight/g_fontSizePx+1, m_document->getLineCount());
+    }
+    textY += lineI*g_fontSizePx;
+
     bool isLineBeginning = true;
     bool isLeadingSpace = true;
-    int lineI{};
-    size_t charI{};
-    // Chars since last search result character
-    int _charFoundOffs = INT_MIN;
+    size_t charI = m_document->getLineStartPos(lineI);
+    // Search the visible lines that changed, the rest is done in `tickSearch()`
+    m_searcher.updateLines(*m_document, lineI, lineI+m_size.y/g_fontSizePx+1);
 
-    for (const String& line : m_document->getAll())
+    for (auto lineIt = m_document->iterAt(lineI); lineIt != m_document->end(); ++lineIt)
     {
+        const String& line = *lineIt;
 #ifndef NDEBUG
         if (!line.ends_with('\n'))
         {
@@ -1796,25 +1916,15 @@ void Buffer::render()
             break;
         }
 
-        const bool isLineAboveViewport = textY <= -g_fontSizePx;
-        if (isLineAboveViewport)
-        {
-            ++lineI;
-            charI += line.size();
-            textX = initTextX;
-            textY += g_fontSizePx;
-            _charFoundOffs += line.size();
-
-            // TODO: Reimplement
-#if 0
-            if (BUFFER_WRAP_LINES && textX+g_fontWidthPx > m_position.x+m_size.x)
-            {
-                textX = initTextX;
-                textY += g_fontSizePx*line.size()/maxLineLenChar;
-            }
-#endif
-            continue;
-        }
+        static const std::u8string emptyMarks;
+        const std::u8string& lineMarks = (size_t)lineI < m_lineInfoList.size()
+            ? m_lineInfoList[lineI].hlMarks : emptyMarks;
+        // Null if there are no diagnostics in this line
+        const Autocomp::LspProvider::FileDiags::spanList_t* lineDiagSpans
+            = fileDiags ? fileDiags->getLineSpans(lineI) : nullptr;
+        // Null if there are no search results in this line
+        const Search::spanList_t* lineFindSpans = m_searcher.getLineSpans(lineI);
+        size_t findSpanI{};
 
         isLineBeginning = true;
         isLeadingSpace = true;
@@ -1834,11 +1944,14 @@ void Buffer::render()
                 isLeadingSpace = false;
             const bool isCharSel = isCharSelected(lineI, colI, charI);
 
-            // Handle if this is the beginning of a search result
-            if (std::binary_search(m_findResultIs.begin(), m_findResultIs.end(), charI))
-                _charFoundOffs = 0;
-            // If the current character is inside a search result
-            const bool isCharFound = (!m_toFind.empty() && (size_t)_charFoundOffs < m_toFind.size());
+            // Skip the search results that end before this character
+            while (lineFindSpans && findSpanI < lineFindSpans->size()
+                    && (*lineFindSpans)[findSpanI].col+(*lineFindSpans)[findSpanI].len <= (int)colI)
+                ++findSpanI;
+            // The search result the current character is inside of
+            const Search::Span* const foundSpan = (lineFindSpans && findSpanI < lineFindSpans->size()
+                    && (*lineFindSpans)[findSpanI].col <= (int)colI) ? &(*lineFindSpans)[findSpanI] : nullptr;
+            const bool isCharFound = (foundSpan != nullptr);
             const bool isClosingSpace = colI < line.size()-1 && ((int)colI > (int)line.size()-closingSpaceCount-2);
 
             //-------------------------------------- Drawing lambdas ---------------------------------------------
@@ -1887,27 +2000,26 @@ void Buffer::render()
             }};
 
             auto drawFoundMarkIfNeeded{[&](){
-                if (isCharFound && _charFoundOffs == 0)
-                    _renderDrawFoundMark({textX, textY}, initTextY);
+                if (isCharFound && foundSpan->col == (int)colI)
+                    _renderDrawFoundMark({textX, textY}, initTextY, foundSpan->len);
             }};
 
             auto drawClosingSpaceMarkIfNeeded{[&](){
                 // Render closing space chars if they are not in the cursor line
                 if (isClosingSpace && lineI != m_cursorLine)
                 {
-                    g_uiRenderer->renderFilledRectangle(
+                    g_uiRenderer->queueFilledRectangle(
                             {textX, initTextY+textY-m_scrollY-m_position.y},
                             {textX+g_fontWidthPx, initTextY+textY-m_scrollY-m_position.y+g_fontSizePx},
                             {1.0f, 0.4f, 0.4f, 0.2f}
                     );
-                    g_textRenderer->prepareForDrawing();
                 }
             }};
 
-            if (fileDiagsIt != Autocomp::LspProvider::s_diags.end())
-                _renderDrawDiagnosticDecorations(
-                        fileDiagsIt->second, lineI, colI,
-                        {textX, textY}, initTextY);
+            // The diagnostic under the current character
+            const lsDiagnostic* const charDiagn = (lineDiagSpans ? fileDiags->findAt(lineI, colI) : nullptr);
+            if (charDiagn)
+                _renderDrawDiagnosticDecorations(*charDiagn, {textX, textY}, initTextY);
 
             //----------------------------------------------------------------------------------------------------
 
@@ -1919,7 +2031,7 @@ void Buffer::render()
             // Render the cursor line highlight
             if (isLineBeginning && m_cursorLine == lineI)
             {
-                g_uiRenderer->renderFilledRectangle(
+                g_uiRenderer->queueFilledRectangle(
                         {textX, initTextY+textY-m_scrollY-m_position.y+2},
                         {textX+m_size.x,
                             initTextY+textY-m_scrollY-m_position.y+2+g_fontSizePx},
@@ -1934,16 +2046,13 @@ void Buffer::render()
             // Underline current word
             if (charI > wordBeg && charI < wordEnd)
             {
-                g_uiRenderer->renderFilledRectangle(
+                g_uiRenderer->queueFilledRectangle(
                         {textX, initTextY+textY-m_scrollY-m_position.y+g_fontSizePx+2-g_fontSizePx*0.1f},
                         {textX+g_fontWidthPx, initTextY+textY-m_scrollY-m_position.y+g_fontSizePx+2},
                         {0.4f, 0.4f, 0.4f, 1.0f}
                 );
             }
 
-            // Bind the text renderer shader again
-            g_textRenderer->prepareForDrawing();
-
             // If the mouse is in the current character, take a note
             //
             // If we haven't found a char under the mouse
@@ -1966,18 +2075,16 @@ void Buffer::render()
                 drawClosingSpaceMarkIfNeeded();
                 drawCursorIfNeeded(g_fontWidthPx*4);
                 // Draw a horizontal line to mark the tab character
-                g_uiRenderer->renderFilledRectangle(
+                g_uiRenderer->queueFilledRectangle(
                         {textX+g_fontSizePx*0.3f,
                          initTextY+textY-m_scrollY-m_position.y+g_fontSizePx/2.0f+2},
                         {textX+g_fontSizePx*0.3f+(g_fontSizePx*0.7f)*4-g_fontSizePx*0.6f,
                          initTextY+textY-m_scrollY-m_position.y+g_fontSizePx/2.0f+4},
                         {0.8f, 0.8f, 0.8f, 0.2f}
                 );
-                g_textRenderer->prepareForDrawing();
                 ++charI;
                 isLineBeginning = false;
                 textX += g_fontWidthPx*4;
-                ++_charFoundOffs;
                 continue;
             }
 
@@ -1997,14 +2104,9 @@ void Buffer::render()
             // Render non-whitespace character
             if (!u_isspace(c))
             {
-#if 0
-                const size_t contentLen = countLineListLen(m_content);
-                if (m_highlightBuffer.size() < contentLen)
-                {
-                    Logger::fatal << "BUG: Invalid highlight buffer length. Expected: " << contentLen
-                        << ", got: " << m_highlightBuffer.length() << Logger::End;
-                }
-#endif
+                // The marks can be shorter than the line until the line gets highlighted again
+                const uint8_t charMark = colI < lineMarks.size() ? lineMarks[colI] : Syntax::MARK_NONE;
+
                 RGBColor charColor = g_theme->values[0].color;
                 FontStyle charStyle = Syntax::defStyles[0];
                 // If the character is selected, draw with selection FG color
@@ -2019,34 +2121,23 @@ void Buffer::render()
                     charColor = calcFindResultFgColor(g_theme->findResultBg);
                     charStyle = FONT_STYLE_BOLD|FONT_STYLE_ITALIC;
                 }
-                else if (m_highlightBuffer[charI] < Syntax::_SYNTAX_MARK_COUNT)
+                else if (charMark < Syntax::_SYNTAX_MARK_COUNT)
                 {
-                    charColor = g_theme->values[m_highlightBuffer[charI]].color;
-                    charStyle = Syntax::defStyles[m_highlightBuffer[charI]];
+                    charColor = g_theme->values[charMark].color;
+                    charStyle = Syntax::defStyles[charMark];
                 }
                 else // Error: Something is wrong with the highlight buffer
                 {
                     assert(false && "Invalid highlight buffer value");
                 }
 
-                if (fileDiagsIt != Autocomp::LspProvider::s_diags.end())
+                if (charDiagn && !charDiagn->tags.get_value_or({}).empty())
                 {
-                    const auto& diags = fileDiagsIt->second;
-
-                    // TODO: Cache at least some of this
-
-                    // Find a containing diagnostic
-                    const auto found = std::find_if(diags.begin(), diags.end(), [&](const auto& diagn){
-                            return isPosInRange(diagn.range, {lineI, (int)colI});
-                    });
-                    if (found != diags.end() && !found->tags.get_value_or({}).empty())
+                    if (std::find(charDiagn->tags->begin(), charDiagn->tags->end(), DiagnosticTag::Unnecessary)
+                            != charDiagn->tags->end())
                     {
-                        if (std::find(found->tags->begin(), found->tags->end(), DiagnosticTag::Unnecessary)
-                                != found->tags->end())
-                        {
-                            // Render unused variables and functions faded out
-                            charColor = lerpColors(charColor, RGBA_COLOR_TO_RGB(g_theme->bgColor), 0.6);
-                        }
+                        // Render unused variables and functions faded out
+                        charColor = lerpColors(charColor, RGBA_COLOR_TO_RGB(g_theme->bgColor), 0.6);
                     }
                 }
                 g_textRenderer->setDrawingColor(charColor);
@@ -2071,20 +2162,21 @@ void Buffer::render()
 
             ++charI;
             textX += g_fontWidthPx;
-            ++_charFoundOffs;
             isLineBeginning = false;
         }
 
-        if (fileDiagsIt != Autocomp::LspProvider::s_diags.end())
-            _renderDrawDiagnosticMsg(fileDiagsIt->second, lineI, lineI == m_cursorLine, {textX, textY}, initTextY);
+        if (lineDiagSpans)
+            _renderDrawDiagnosticMsg(*fileDiags, lineI, lineI == m_cursorLine, {textX, textY}, initTextY);
         if (m_cursorLine == lineI)
             _renderDrawCursorLineCodeAct(textY, initTextY);
 
         ++lineI;
         textX = initTextX;
         textY += g_fontSizePx;
-        ++_charFoundOffs;
     }
+    // Draw the text that is still queued, then the cursor above it
+    g_textRenderer->flush();
+    g_uiRenderer->flush(UiRenderer::Layer::AboveText);
 
     if (m_isDimmed)
     {
@@ -2100,8 +2192,6 @@ void Buffer::render()
     }
 
     _renderDrawBreadcrumbBar();
-
-    TIMER_END_FUNC();
 }
 
 template <typename T1, typename T2>
@@ -2128,23 +2218,6 @@ void Buffer::insertCharAtCursor(Char character)
     }
     ++m_cursorCharPos;
 
-    // If this is the end of a word
-    if (u_isspace(character))
-    {
-        // Find the word
-        int wordStart;
-        for (wordStart=oldCol-1; wordStart >= 0 && !u_isspace(m_document->getChar({oldLine, wordStart})); wordStart--)
-            ;
-        const String word = m_document->getLine(oldLine).substr(wordStart+1, oldCol-wordStart-1);
-
-        // Feed the buffer word provider the word
-        if (!word.empty())
-        {
-            //Logger::dbg << "Feeding word to buffer word provider: " << quoteStr(strToAscii(word)) << Logger::End;
-            Autocomp::buffWordProvid->add(m_id, word);
-        }
-    }
-
 #if FORMAT_ON_TYPING
     const auto& formattingCaps = Autocomp::lspProvider->getCaps().documentOnTypeFormattingProvider;
     if (formattingCaps
@@ -2231,17 +2304,20 @@ void Buffer::undo()
 {
     if (m_document->getHistory().canGoBack())
     {
-        const auto undoInfo = m_document->undo();
+        Document::changeList_t appliedChanges;
+        const auto undoInfo = m_document->undo(&appliedChanges);
         // Restore cursor pos
         m_cursorLine    = undoInfo.oldCursPos.line;
         m_cursorCol     = undoInfo.oldCursPos.col;
         m_cursorCharPos = undoInfo.oldCursPos.index;
 
-        // TODO: Adjust `m_highlightBuffer`
-
-        m_isHighlightUpdateNeeded = true;
+        // TODO: Only invalidate the changed lines
+        m_lineInfoList.resize(m_document->getLineCount());
+        _invalidateHighlighting(0, m_lineInfoList.size()-1);
+        m_searcher.resetLines(m_document->getLineCount());
         m_version++;
-        Autocomp::lspProvider->onFileChange(m_filePath, m_version, utf32To8(m_document->getConcated()));
+        _onHistoryChangesApplied(appliedChanges);
+        _scheduleGitDiffUpdate();
         scrollViewportToCursor();
         g_statMsg.set("Undid change ("+std::to_string(getElapsedSince(undoInfo.timestamp))+" seconds old)",
                 StatusMsg::Type::Info);
@@ -2259,17 +2335,20 @@ void Buffer::redo()
 {
     if (m_document->getHistory().canGoForward())
     {
-        const auto redoInfo = m_document->redo();
+        Document::changeList_t appliedChanges;
+        const auto redoInfo = m_document->redo(&appliedChanges);
         // Restore cursor pos
         m_cursorLine    = redoInfo.newCursPos.line;
         m_cursorCol     = redoInfo.newCursPos.col;
         m_cursorCharPos = redoInfo.newCursPos.index;
 
-        // TODO: Adjust `m_highlightBuffer`
-
-        m_isHighlightUpdateNeeded = true;
+        // TODO: Only invalidate the changed lines
+        m_lineInfoList.resize(m_document->getLineCount());
+        _invalidateHighlighting(0, m_lineInfoList.size()-1);
+        m_searcher.resetLines(m_document->getLineCount());
         m_version++;
-        Autocomp::lspProvider->onFileChange(m_filePath, m_version, utf32To8(m_document->getConcated()));
+        _onHistoryChangesApplied(appliedChanges);
+        _scheduleGitDiffUpdate();
         g_statMsg.set("Redid change ("+std::to_string(getElapsedSince(redoInfo.timestamp))+" seconds old)",
                 StatusMsg::Type::Info);
         scrollViewportToCursor();
@@ -2334,12 +2413,6 @@ void Buffer::autocompPopupHide()
     g_isRedrawNeeded = true;
 }
 
-static Autocomp::Popup::Item updateCompItem(Autocomp::Popup::Item item)
-{
-    const auto resolved = Autocomp::lspProvider->compItemResolve(item);
-    return resolved.has_value() ? resolved.value() : item;
-}
-
 void Buffer::autocompPopupInsert()
 {
     // Hide the popup and insert the current item
@@ -2349,7 +2422,7 @@ void Buffer::autocompPopupInsert()
     beginHistoryEntry();
     if (m_autocompPopup->isRendered())
     {
-        const auto item = updateCompItem(*m_autocompPopup->getSelectedItem());
+        const auto item = *m_autocompPopup->getSelectedItem();
         const bool isSnippet = ((item.kind && item.kind.get() == lsCompletionItemKind::Snippet)
                              || (item.insertTextFormat.get_value_or(lsInsertTextFormat::PlainText) == lsInsertTextFormat::Snippet));
 
@@ -2381,6 +2454,16 @@ void Buffer::autocompPopupInsert()
             // TODO: Support snippets here
             applyEdits(item.additionalTextEdits.get());
         }
+        else if (!Langs::langIdToLspId(m_language).empty()) // Otherwise the item is not from the server
+        {
+            // The server may only send the additional edits (e.g. an #include) when the item is resolved.
+            // Insert right away and apply them when they arrive, if nothing was typed in the meantime.
+            Autocomp::lspProvider->compItemResolve(item, this, [this, version=m_version](const lsCompletionItem& resolved){
+                if (m_version != version || !resolved.additionalTextEdits || resolved.additionalTextEdits->empty())
+                    return;
+                applyEdits(resolved.additionalTextEdits.get());
+            });
+        }
     }
     endHistoryEntry();
     m_autocompPopup->hide();
@@ -2640,12 +2723,18 @@ jump_loop_end:
 void Buffer::regenAutocompList(lsCompletionTriggerKind trigger)
 {
     Logger::dbg << "Regenerating autocomplete list for buffer " << this << Logger::End;
-    m_autocompPopup->clear();
 #if 0
-    Autocomp::dictProvider->get(m_id, m_autocompPopup.get());
-    Autocomp::buffWordProvid->get(m_id, m_autocompPopup.get());
     Autocomp::pathProvid->get(m_id, m_autocompPopup.get());
 #endif
+    // Files without a language server get the words of the open buffers and the dictionary
+    if (Langs::langIdToLspId(m_language).empty())
+    {
+        if (Autocomp::buffWordProvid)
+            Autocomp::buffWordProvid->get(m_id, m_autocompPopup.get());
+        // Loaded in the background, null until it is ready
+        if (Autocomp::dictProvider)
+            Autocomp::dictProvider->get(m_id, m_autocompPopup.get());
+    }
     Autocomp::lspProvider->get(m_autocompPopup.get(), trigger);
 }
 
@@ -2768,14 +2857,15 @@ size_t Buffer::deleteSelectedChars()
     return delCount;
 }
 
-void Buffer::_goToCurrFindResult(bool showStatMsg)
+void Buffer::_goToFindResult(const Search::MatchPos& pos, bool showStatMsg)
 {
-    const size_t goTo = m_findResultIs[m_findCurrResultI];
-    moveCursorToChar(goTo);
-    if (showStatMsg)
+    moveCursorToLineCol(pos.line, pos.span.col);
+    // The index is only known when every line is searched
+    if (showStatMsg && m_searcher.isComplete())
     {
-        g_statMsg.set("Jumped to search result "+std::to_string(m_findCurrResultI+1)+
-                " out of "+std::to_string(m_findResultIs.size()),
+        g_statMsg.set("Jumped to search result "
+                +std::to_string(m_searcher.countMatchesBefore(pos.line, pos.span.col)+1)+
+                " out of "+std::to_string(m_searcher.getMatchCount()),
                 StatusMsg::Type::Info);
     }
     centerCursor();
@@ -2786,92 +2876,90 @@ void Buffer::_goToCurrFindResult(bool showStatMsg)
 
 void Buffer::findGoToNextResult()
 {
-    if (m_toFind.empty() || m_findResultIs.empty())
+    Search::MatchPos pos;
+    bool isWrapped{};
+    if (!m_searcher.findNext(*m_document, m_cursorLine, m_cursorCol, &pos, &isWrapped))
         return;
 
-    ++m_findCurrResultI;
-    if ((size_t)m_findCurrResultI >= m_findResultIs.size())
-    {
-        m_findCurrResultI = 0;
+    if (isWrapped)
         g_statMsg.set("Starting search from beginning", StatusMsg::Type::Info);
-        _goToCurrFindResult(false);
-    }
-    else
-    {
-        _goToCurrFindResult(true);
-    }
+    _goToFindResult(pos, !isWrapped);
 }
 
 void Buffer::findGoToPrevResult()
 {
-    if (m_toFind.empty() || m_findResultIs.empty())
+    Search::MatchPos pos;
+    bool isWrapped{};
+    if (!m_searcher.findPrev(*m_document, m_cursorLine, m_cursorCol, &pos, &isWrapped))
         return;
 
-    --m_findCurrResultI;
-    if (m_findCurrResultI < 0)
-    {
-        m_findCurrResultI = m_findResultIs.size()-1;
+    if (isWrapped)
         g_statMsg.set("Starting search from end", StatusMsg::Type::Info);
-        _goToCurrFindResult(false);
-    }
-    else
-    {
-        _goToCurrFindResult(true);
-    }
+    _goToFindResult(pos, !isWrapped);
 }
 
 void Buffer::find(const String& str)
 {
-    m_toFind = str;
-    m_findCurrResultI = 0;
-    findUpdate();
+    Search::Flags flags;
+    const String pattern = Search::parseFlags(str, &flags);
+    try
+    {
+        m_searcher.setPattern(pattern, flags);
+    }
+    catch (const std::runtime_error& e)
+    {
+        Logger::err << "Search: " << e.what() << Logger::End;
+        g_statMsg.set(e.what(), StatusMsg::Type::Error);
+        return;
+    }
+    m_searcher.resetLines(m_document->getLineCount());
+    m_isFindCountPending = false;
+    g_isRedrawNeeded = true;
 
-    if (m_toFind.empty())
+    if (!m_searcher.isActive())
         return;
 
-    if (m_findResultIs.empty())
+    // Jump to the first result in the document, the lines before it are searched on the way
+    Search::MatchPos pos;
+    bool isWrapped{};
+    if (!m_searcher.findNext(*m_document, 0, -1, &pos, &isWrapped))
     {
         g_statMsg.set("Not found: "+quoteStr(utf32To8(str)), StatusMsg::Type::Error);
         return;
     }
 
-    g_statMsg.set(
-            "Found "+std::to_string(m_findResultIs.size())+" occurences of "+quoteStr(utf32To8(m_toFind)),
-            StatusMsg::Type::Info);
+    // Count the results in one go if the budget allows, otherwise `tickSearch()` reports it
+    m_searcher.updateFor(*m_document, SEARCH_TICK_BUDGET_MS);
+    if (m_searcher.isComplete())
+    {
+        g_statMsg.set(
+                "Found "+std::to_string(m_searcher.getMatchCount())+" occurences of "+quoteStr(utf32To8(str)),
+                StatusMsg::Type::Info);
+    }
+    else
+    {
+        m_isFindCountPending = true;
+        g_statMsg.set("Searching for "+quoteStr(utf32To8(str))+"...", StatusMsg::Type::Info);
+    }
 
-    _goToCurrFindResult(false);
+    _goToFindResult(pos, false);
 }
 
 void Buffer::findUpdate()
 {
-    m_findResultIs.clear();
+    PROFILE_FUNC();
 
-    if (m_toFind.empty())
+    if (!m_searcher.isActive())
         return;
-    {
-        size_t index{};
-        for (const auto& line : *m_document)
-        {
-            int col = -1;
-            while (true)
-            {
-                col = line.find(m_toFind, col+1);
-                if ((size_t)col == line.npos)
-                    break;
-                m_findResultIs.push_back(index + col);
-            }
 
-            index += line.length();
-        }
-    }
-
-    Logger::log << "Found " << m_findResultIs.size() << " matches" << Logger::End;
+    m_searcher.updateFor(*m_document, std::numeric_limits<double>::infinity());
+    Logger::log << "Found " << m_searcher.getMatchCount() << " matches" << Logger::End;
 }
 
 void Buffer::findClear()
 {
-    m_toFind.clear();
-    m_findResultIs.clear();
+    m_searcher.clear();
+    m_isFindCountPending = false;
 }
 
 void Buffer::indentSelectedLines()
@@ -2982,11 +3070,13 @@ void Buffer::tickCursorHold(float frameTimeMs)
          * If the user applies one of them, we send a workspace/executeCommand request with the selected command.
          * The server replies with a workspace/applyEdit request. We apply the edits and send back a response.
          */
-        auto codeAct = Autocomp::lspProvider->getCodeActionForLine(m_filePath, m_cursorLine);
-        m_lineCodeAction.forLine = m_cursorLine;
-        m_lineCodeAction.actions = std::move(codeAct);
-        // Draw the code action mark
-        g_isRedrawNeeded = true;
+        Autocomp::lspProvider->getCodeActionForLine(m_filePath, m_cursorLine, this,
+                [this, line=m_cursorLine](Autocomp::LspProvider::codeActionResult_t&& codeAct){
+            m_lineCodeAction.forLine = line;
+            m_lineCodeAction.actions = std::move(codeAct);
+            // Draw the code action mark
+            g_isRedrawNeeded = true;
+        });
     }
     if (isTriggered(CURSOR_HOLD_TIME_LOCATION_UPD))
     {
@@ -3026,6 +3116,10 @@ void Buffer::tickCursorHold(float frameTimeMs)
     }
 
     m_cursorHoldTime += frameTimeMs;
+    if (m_cursorHoldTime < CURSOR_HOLD_TIME_LOCATION_UPD)
+        EventLoop::wakeUpIn(CURSOR_HOLD_TIME_LOCATION_UPD-m_cursorHoldTime);
+    else if (m_cursorHoldTime < CURSOR_HOLD_TIME_CODE_ACTION)
+        EventLoop::wakeUpIn(CURSOR_HOLD_TIME_CODE_ACTION-m_cursorHoldTime);
 }
 
 void _autoReloadDialogCb(int btn, Dialog*, void* userData)
@@ -3046,92 +3140,183 @@ void _autoReloadDialogCb(int btn, Dialog*, void* userData)
     buffer->m_isReloadAskerDialogOpen = false;
 }
 
-void Buffer::tickAutoReload(float frameTimeMs)
+void Buffer::_onFileChangedOnDisk()
 {
-    // Don't auto reload if it is disabled
-    if constexpr (AUTO_RELOAD_MODE == AUTO_RELOAD_MODE_DONT)
+    // We are replacing it
+    if (m_isSaving)
+        return;
+
+    Logger::dbg << "Checking file change: " << m_filePath << Logger::End;
+
+    const fileModTime_t modTime = getFileModTime(m_filePath);
+    if (modTime == 0)
+    {
+        // Removed, maybe it's being replaced
+        Logger::dbg << "Failed to get modification time" << Logger::End;
         return;
+    }
 
-    m_msUntilAutoReloadCheck -= frameTimeMs;
+    if (modTime == m_lastFileUpdateTime)
+    {
+        Logger::dbg << "No change" << Logger::End;
+        return;
+    }
 
-    if (m_msUntilAutoReloadCheck <= 0)
+    // The lines of a large file are read from its mapping when they are first shown. If the file
+    // was written to (and not replaced), they no longer match the index and reading past its new
+    // end crashes, so drop the mapping right away if nothing would be lost.
+    if (m_document->isLargeFile() && m_document->isMappedFileChangedInPlace())
     {
-        Logger::dbg << "Checking file change" << Logger::End;
+        if (!m_isModified)
+        {
+            Logger::warn << "Mapped file changed in place, reloading: " << m_filePath << Logger::End;
+            g_statMsg.set("File changed from outside, reloaded", StatusMsg::Type::Info);
+            open(m_filePath, true);
+            return;
+        }
+        Logger::warn << "Mapped file changed in place, the buffer has unsaved changes: " << m_filePath << Logger::End;
+        g_statMsg.set("File changed from outside, the lines not shown yet are invalid", StatusMsg::Type::Error);
+    }
 
-        if (getFileModTime(m_filePath) == m_lastFileUpdateTime)
+    if constexpr (AUTO_RELOAD_MODE == AUTO_RELOAD_MODE_ASK) // Ask to reload
+    {
+        if (m_isReloadAskerDialogOpen)
         {
-            Logger::dbg << "No change" << Logger::End;
+            Logger::log << "Change detected, already asked user" << Logger::End;
         }
         else
         {
-            if constexpr (AUTO_RELOAD_MODE == AUTO_RELOAD_MODE_ASK) // Ask to reload
-            {
-                if (m_isReloadAskerDialogOpen)
-                {
-                    Logger::log << "Change detected, already asked user" << Logger::End;
-                }
-                else
-                {
-                    Logger::log << "Change detected! Asking to reload." << Logger::End;
-                    m_isReloadAskerDialogOpen = true;
-                    MessageDialog::create(_autoReloadDialogCb, this,
-                            "The file "+quoteStr(m_filePath)+"\nhas been changed from outside."
-                                "\nDo you want to reload it?",
-                            MessageDialog::Type::Information,
-                            {{"Yes", {0, U"y"}}, {"No", {0, U"n"}}});
-                }
-            }
-            else // Reload without asking
-            {
-                (void)_autoReloadDialogCb; // Let's "use" this bad boy
-
-                Logger::log << "Change detected! Reloading." << Logger::End;
-                open(m_filePath, true);
-            }
+            Logger::log << "Change detected! Asking to reload." << Logger::End;
+            m_isReloadAskerDialogOpen = true;
+            MessageDialog::create(_autoReloadDialogCb, this,
+                    "The file "+quoteStr(m_filePath)+"\nhas been changed from outside."
+                        "\nDo you want to reload it?",
+                    MessageDialog::Type::Information,
+                    {{"Yes", {0, U"y"}}, {"No", {0, U"n"}}});
         }
+    }
+    else // Reload without asking
+    {
+        (void)_autoReloadDialogCb; // Let's "use" this bad boy
+
+        Logger::log << "Change detected! Reloading." << Logger::End;
+        open(m_filePath, true);
+    }
+}
+
+void Buffer::_updateGitBranch()
+{
+    if (!m_gitRepo)
+        return;
+
+    Logger::dbg << "Updating checked out Git object" << Logger::End;
+    m_gitBranchName = m_gitRepo->getCheckedOutObjName();
+    Logger::log << "Current checked out Git object: " << m_gitBranchName.name;
+    // If this is a branch, show only the branch name
+    if (m_gitBranchName.name.starts_with("refs/heads/"))
+    {
+        m_gitBranchName.name = m_gitBranchName.name.substr(11);
+        Logger::log << " aka '" << m_gitBranchName.name << '\'' << Logger::End;
+    }
+    Logger::log << Logger::End;
+    g_isRedrawNeeded = true;
+}
+
+void Buffer::_updateFileWatches()
+{
+    if (!g_fileWatcher)
+        return;
+
+    g_fileWatcher->unwatch(m_fileWatchId);
+    g_fileWatcher->unwatch(m_gitHeadWatchId);
+    g_fileWatcher->unwatch(m_gitIndexWatchId);
+    m_fileWatchId = 0;
+    m_gitHeadWatchId = 0;
+    m_gitIndexWatchId = 0;
 
-        m_msUntilAutoReloadCheck = AUTO_RELOAD_CHECK_FREQ_MS;
+    if (m_filePath == FILENAME_NEW)
+        return;
+
+    if constexpr (AUTO_RELOAD_MODE != AUTO_RELOAD_MODE_DONT)
+        m_fileWatchId = g_fileWatcher->watch(m_filePath, [this](){ _onFileChangedOnDisk(); });
+
+    if (m_gitRepo && m_gitRepo->isRepo())
+    {
+        // Changes when switching branches, the index and the files change too
+        m_gitHeadWatchId = g_fileWatcher->watch(m_gitRepo->getGitDir()+"HEAD", [this](){
+            _updateGitBranch();
+            updateGitDiff();
+        });
+        // The signs are relative to the index, it changes when staging
+        // Note: Git rewrites it for many commands, so wait until it settles
+        m_gitIndexWatchId = g_fileWatcher->watch(m_gitRepo->getGitDir()+"index", [this](){
+            _scheduleGitDiffUpdate();
+        });
     }
 }
 
-void Buffer::tickGitBranchUpdate(float frameTimeMs)
+void Buffer::tickGitDiffUpdate(float frameTimeMs)
+{
+    if (!m_isGitDiffOutdated)
+        return;
+
+    m_msUntilGitDiffUpdate -= frameTimeMs;
+    if (m_msUntilGitDiffUpdate <= 0)
+        updateGitDiff();
+    else
+        EventLoop::wakeUpIn(m_msUntilGitDiffUpdate);
+}
+
+void Buffer::tickSearch()
 {
-    m_msUntilGitBranchUpdate -= frameTimeMs;
-    if (m_msUntilGitBranchUpdate <= 0)
+    if (m_searcher.isComplete())
+        return;
+
+    PROFILE_FUNC();
+
+    if (m_searcher.updateFor(*m_document, SEARCH_TICK_BUDGET_MS))
     {
-        Logger::dbg << "Updating checked out Git object" << Logger::End;
-        m_gitBranchName = m_gitRepo->getCheckedOutObjName();
-        Logger::log << "Current checked out Git object: " << m_gitBranchName.name;
-        // If this is a branch, show only the branch name
-        if (m_gitBranchName.name.starts_with("refs/heads/"))
+        LOG_DBG("Search") << "Searched every line, " << m_searcher.getMatchCount() << " matches" << Logger::End;
+        if (m_isFindCountPending)
         {
-            m_gitBranchName.name = m_gitBranchName.name.substr(11);
-            Logger::log << " aka '" << m_gitBranchName.name << '\'' << Logger::End;
+            g_statMsg.set(
+                    "Found "+std::to_string(m_searcher.getMatchCount())+" occurences of "
+                    +quoteStr(utf32To8(m_searcher.getPattern())),
+                    StatusMsg::Type::Info);
+            m_isFindCountPending = false;
         }
-        Logger::log << Logger::End;
-
-        m_msUntilGitBranchUpdate = GIT_BRANCH_CHECK_FREQ_MS;
+        g_isRedrawNeeded = true;
+    }
+    else
+    {
+        // Continue in the next iteration
+        EventLoop::wakeUpNow();
     }
 }
 
 void Buffer::showSymbolHover(bool atMouse/*=false*/)
 {
-    Autocomp::LspProvider::HoverInfo hoverInfo;
+    const auto callback = [this, atMouse](const Autocomp::LspProvider::HoverInfo& hoverInfo){
+        _displaySymbolHover(hoverInfo, atMouse);
+    };
     if (atMouse)
     {
         // Return if there is nothing under the cursor
         if (!m_isMouseOverText)
             return;
 
-        hoverInfo = Autocomp::lspProvider->getHover(
-                m_filePath, m_charUnderMouseRow, m_charUnderMouseCol);
+        Autocomp::lspProvider->getHover(
+                m_filePath, m_charUnderMouseRow, m_charUnderMouseCol, this, callback);
     }
     else
     {
-        hoverInfo = Autocomp::lspProvider->getHover(
-                m_filePath, m_cursorLine, m_cursorCol);
+        Autocomp::lspProvider->getHover(
+                m_filePath, m_cursorLine, m_cursorCol, this, callback);
     }
+}
 
+void Buffer::_displaySymbolHover(const Autocomp::LspProvider::HoverInfo& hoverInfo, bool atMouse)
+{
     if (!hoverInfo.text.empty())
     {
         if (hoverInfo.gotRange)
@@ -3168,7 +3353,12 @@ void Buffer::showSymbolHover(bool atMouse/*=false*/)
 
 void Buffer::showSignatureHelp()
 {
-    auto signHelp = Autocomp::lspProvider->getSignatureHelp(m_filePath, m_cursorLine, m_cursorCol);
+    Autocomp::lspProvider->getSignatureHelp(m_filePath, m_cursorLine, m_cursorCol, this,
+            [this](const lsSignatureHelp& signHelp){ _displaySignatureHelp(signHelp); });
+}
+
+void Buffer::_displaySignatureHelp(const lsSignatureHelp& signHelp)
+{
     if (signHelp.signatures.empty())
         return;
 
@@ -3233,6 +3423,7 @@ void Buffer::showSignatureHelp()
     g_hoverPopup->setContent(utf8To32(content));
     g_hoverPopup->setPos({m_cursorXPx+g_fontWidthPx, m_cursorYPx-g_hoverPopup->calcHeight()});
     g_hoverPopup->show();
+    g_isRedrawNeeded = true;
 }
 
 void Buffer::_goToDeclOrDefOrImp(const Autocomp::LspProvider::Location& loc)
@@ -3267,26 +3458,20 @@ void Buffer::_goToDeclOrDefOrImp(const Autocomp::LspProvider::Location& loc)
 
 void Buffer::gotoDef()
 {
-    const auto loc = Autocomp::lspProvider->getDefinition(m_filePath, m_cursorLine, m_cursorCol);
-    if (loc.path.empty())
-        return;
-    _goToDeclOrDefOrImp(loc);
+    Autocomp::lspProvider->getDefinition(m_filePath, m_cursorLine, m_cursorCol, this,
+            [this](const Autocomp::LspProvider::Location& loc){ _goToDeclOrDefOrImp(loc); });
 }
 
 void Buffer::gotoDecl()
 {
-    const auto loc = Autocomp::lspProvider->getDeclaration(m_filePath, m_cursorLine, m_cursorCol);
-    if (loc.path.empty())
-        return;
-    _goToDeclOrDefOrImp(loc);
+    Autocomp::lspProvider->getDeclaration(m_filePath, m_cursorLine, m_cursorCol, this,
+            [this](const Autocomp::LspProvider::Location& loc){ _goToDeclOrDefOrImp(loc); });
 }
 
 void Buffer::gotoImp()
 {
-    const auto loc = Autocomp::lspProvider->getImplementation(m_filePath, m_cursorLine, m_cursorCol);
-    if (loc.path.empty())
-        return;
-    _goToDeclOrDefOrImp(loc);
+    Autocomp::lspProvider->getImplementation(m_filePath, m_cursorLine, m_cursorCol, this,
+            [this](const Autocomp::LspProvider::Location& loc){ _goToDeclOrDefOrImp(loc); });
 }
 
 static void applyLineCodeActDialogCb(int btn, Dialog* dlg, void* buff)
@@ -3336,24 +3521,30 @@ size_t Buffer::applyDeletion(const lsRange& range)
     if (range.start == range.end)
         return 0;
 
-    const size_t deleted = m_document->delete_(range);
+    const size_t oldLineCount = m_document->getLineCount();
+    const String oldLines = _getLineRange(range.start.line, range.end.line);
+    const String deleted = m_document->delete_(range);
 
     // Update `m_lineInfoList`
     // TODO: Update line info entry columns
-    for (int i{}; i < (int)range.end.line-(int)range.end.line; ++i)
-        m_lineInfoList.erase(m_lineInfoList.begin()+i);
+    const size_t removedLineCount = oldLineCount-m_document->getLineCount();
+    m_lineInfoList.erase(
+            m_lineInfoList.begin()+range.start.line+1,
+            m_lineInfoList.begin()+range.start.line+1+removedLineCount);
     assert(m_lineInfoList.size() == m_document->getLineCount());
+    _invalidateHighlighting(range.start.line, range.start.line);
+    m_searcher.onLinesRemoved(range.start.line, removedLineCount);
+    m_searcher.invalidateLines(range.start.line, range.start.line);
 
     m_isModified = true;
     m_isCursorShown = true;
     m_cursorHoldTime = 0;
-    m_isHighlightUpdateNeeded = true;
-    m_highlightBuffer.resize(m_document->calcCharCount()); // TODO: Just delete from `range`
     m_version++;
     g_isRedrawNeeded = true;
-    // TODO: Only send change
-    Autocomp::lspProvider->onFileChange(m_filePath, m_version, utf32To8(m_document->getConcated()));
-    return deleted;
+    _notifyLspOfChange(range.start, deleted, U"");
+    _scheduleGitDiffUpdate();
+    _updateWordIndex(oldLines, _getLineRange(range.start.line, range.start.line));
+    return deleted.size();
 }
 
 lsPosition Buffer::applyInsertion(const lsPosition& pos, const String& text)
@@ -3361,27 +3552,150 @@ lsPosition Buffer::applyInsertion(const lsPosition& pos, const String& text)
     if (m_isReadOnly)
         return pos;
 
+    const String oldLine = _getLineRange(pos.line, pos.line);
     const lsPosition endPos = m_document->insert(pos, text);
 
     // Update `m_lineInfoList`
     // TODO: Update line info entry columns
-    const int textLineCnt = strCountLines(text);
-    for (int i{}; i < textLineCnt; ++i)
-        m_lineInfoList.emplace(m_lineInfoList.begin()+pos.line);
+    const size_t newLineCount = endPos.line-pos.line;
+    m_lineInfoList.insert(m_lineInfoList.begin()+pos.line+1, newLineCount, LineInfo{});
     assert(m_lineInfoList.size() == m_document->getLineCount());
+    _invalidateHighlighting(pos.line, endPos.line);
+    m_searcher.onLinesInserted(pos.line, newLineCount);
+    m_searcher.invalidateLines(pos.line, endPos.line);
 
     m_isModified = true;
     m_isCursorShown = true;
     m_cursorHoldTime = 0;
-    m_isHighlightUpdateNeeded = true;
-    m_highlightBuffer.resize(m_document->calcCharCount()); // TODO: Just insert at `pos`
     m_version++;
     g_isRedrawNeeded = true;
-    // TODO: Only send change
-    Autocomp::lspProvider->onFileChange(m_filePath, m_version, utf32To8(m_document->getConcated()));
+    _notifyLspOfChange(pos, U"", text);
+    _scheduleGitDiffUpdate();
+    _updateWordIndex(oldLine, _getLineRange(pos.line, endPos.line));
     return endPos;
 }
 
+String Buffer::_getLineRange(int firstLineI, int lastLineI) const
+{
+    String output;
+    for (int i=firstLineI; i <= lastLineI; ++i)
+        output += m_document->getLine(i);
+    return output;
+}
+
+void Buffer::_updateWordIndex(const String& oldLines, const String& newLines)
+{
+    // Large files are not indexed
+    if (!Autocomp::buffWordProvid || m_document->isLargeFile())
+        return;
+    Autocomp::buffWordProvid->update(m_id, oldLines, newLines);
+}
+
+void Buffer::_reindexWords()
+{
+    if (!Autocomp::buffWordProvid || m_document->isLargeFile())
+        return;
+    String content;
+    for (const String& line : *m_document)
+        content += line;
+    Autocomp::buffWordProvid->indexBuffer(m_id, std::move(content));
+}
+
+// Returns the index of `pos` in `text`, which holds the lines from `firstLineI`
+static size_t posToIndexInLines(const String& text, int firstLineI, const lsPosition& pos)
+{
+    size_t index = 0;
+    for (int line=firstLineI; line < pos.line; ++line)
+    {
+        index = text.find(U'\n', index);
+        assert(index != String::npos);
+        ++index;
+    }
+    return index+pos.character;
+}
+
+void Buffer::_onHistoryChangesApplied(const Document::changeList_t& appliedChanges)
+{
+    using Type = DocumentHistory::Entry::Change::Type;
+
+    if (appliedChanges.empty())
+        return;
+
+    // Find the lines touched by the changes, in the current coordinates
+    int firstLine = std::numeric_limits<int>::max();
+    int lastLine = -1;
+    for (const auto& change : appliedChanges)
+    {
+        const int startLine = change.range.start.line;
+        const int endLine = change.range.end.line;
+        const int lineDelta = endLine-startLine;
+        if (change.type == Type::Insertion)
+        {
+            if (lastLine >= startLine)
+                lastLine += lineDelta;
+            lastLine = std::max(lastLine, endLine);
+        }
+        else
+        {
+            if (lastLine > endLine)
+                lastLine -= lineDelta;
+            else if (lastLine >= startLine)
+                lastLine = startLine;
+            lastLine = std::max(lastLine, startLine);
+        }
+        firstLine = std::min(firstLine, startLine);
+    }
+    lastLine = std::min(lastLine, int(m_document->getLineCount())-1);
+
+    // Undo the changes on a copy of the touched lines to get their previous content
+    const String newLines = _getLineRange(firstLine, lastLine);
+    String lines = newLines;
+    for (auto it=appliedChanges.rbegin(); it != appliedChanges.rend(); ++it)
+    {
+        const size_t start = posToIndexInLines(lines, firstLine, it->range.start);
+        if (it->type == Type::Insertion)
+            lines.erase(start, it->text.size());
+        else
+            lines.insert(start, it->text);
+    }
+    const String oldLines = lines;
+
+    // Replay them to notify the LSP server, it needs the line before each change
+    for (const auto& change : appliedChanges)
+    {
+        const size_t lineStart = posToIndexInLines(lines, firstLine, {change.range.start.line, 0});
+        const String linePrefix = lines.substr(lineStart, change.range.start.character);
+        const size_t start = lineStart+change.range.start.character;
+        if (change.type == Type::Insertion)
+        {
+            _notifyLspOfChange(linePrefix, change.range.start, U"", change.text);
+            lines.insert(start, change.text);
+        }
+        else
+        {
+            _notifyLspOfChange(linePrefix, change.range.start, change.text, U"");
+            lines.erase(start, change.text.size());
+        }
+    }
+    assert(lines == newLines);
+
+    _updateWordIndex(oldLines, newLines);
+}
+
+void Buffer::_notifyLspOfChange(const lsPosition& start, const String& removed, const String& inserted)
+{
+    // The part of the line before `start` is the same before and after the change
+    _notifyLspOfChange(m_document->getLine(start.line), start, removed, inserted);
+}
+
+void Buffer::_notifyLspOfChange(const String& line, const lsPosition& start, const String& removed, const String& inserted)
+{
+    // The server counts the columns in UTF-16 code units
+    const lsPosition start16{start.line, int(countUtf16Units(line.data(), start.character))};
+    Autocomp::lspProvider->onFileChange(m_filePath, m_version, start16, removed, inserted,
+            [this](){ return m_document->getConcatedUtf8(); });
+}
+
 void Buffer::beginHistoryEntry()
 {
     m_document->m_history.beginEntry(m_cursorLine, m_cursorCol, m_cursorCharPos);
@@ -3437,47 +3751,73 @@ void Buffer::applyEdits(const std::vector<lsTextEdit>& edits)
 
 void Buffer::renameSymbolAtCursor()
 {
-    const auto canRename = Autocomp::lspProvider->canRenameSymbolAt(m_filePath, {m_cursorLine, m_cursorCol});
-    if (canRename.isError)
-    {
-        Logger::err << "Can't rename symbol: " << canRename.errorOrSymName << Logger::End;
-        g_statMsg.set(canRename.errorOrSymName, StatusMsg::Type::Error);
-        return;
-    }
+    const lsPosition pos{m_cursorLine, m_cursorCol};
+    Autocomp::lspProvider->canRenameSymbolAt(m_filePath, pos, this,
+            [this, pos, version=m_version](const Autocomp::LspProvider::CanRenameSymbolResult& canRename){
+        if (canRename.isError)
+        {
+            Logger::err << "Can't rename symbol: " << canRename.errorOrSymName << Logger::End;
+            g_statMsg.set(canRename.errorOrSymName, StatusMsg::Type::Error);
+            return;
+        }
+        // The range is outdated
+        if (m_version != version)
+            return;
 
-    auto cb = [this](int, Dialog* dlg, void*){
-        const lsPosition pos{m_cursorLine, m_cursorCol};
-        auto dlg_ = dynamic_cast<AskerDialog*>(dlg);
-        assert(dlg_);
-        Autocomp::lspProvider->renameSymbol(m_filePath, pos, utf32To8(dlg_->getValue()));
-    };
+        auto cb = [this, pos](int, Dialog* dlg, void*){
+            auto dlg_ = dynamic_cast<AskerDialog*>(dlg);
+            assert(dlg_);
+            Autocomp::lspProvider->renameSymbol(m_filePath, pos, utf32To8(dlg_->getValue()));
+        };
 
-    const std::string symName = (!canRename.errorOrSymName.empty()
-            ? canRename.errorOrSymName
-            : utf32To8(m_document->get(canRename.rangeIfNoName)));
-    Logger::dbg << "Will rename symbol: " << symName << Logger::End;
-    AskerDialog::create(cb, nullptr, "New name for \033[3m"+symName+"\033[0m:");
+        const std::string symName = (!canRename.errorOrSymName.empty()
+                ? canRename.errorOrSymName
+                : utf32To8(m_document->get(canRename.rangeIfNoName)));
+        Logger::dbg << "Will rename symbol: " << symName << Logger::End;
+        AskerDialog::create(cb, nullptr, "New name for \033[3m"+symName+"\033[0m:");
+    });
 }
 
 void Buffer::formatDocument()
 {
-    beginHistoryEntry();
-
-    applyEdits(Autocomp::lspProvider->getFormattingEdits(m_filePath));
+    Autocomp::lspProvider->getFormattingEdits(m_filePath, this,
+            [this, version=m_version](const std::vector<lsTextEdit>& edits){
+        // The edits are for an older version
+        if (m_version != version)
+        {
+            g_statMsg.set("The document was changed while formatting", StatusMsg::Type::Error);
+            return;
+        }
 
-    endHistoryEntry();
+        beginHistoryEntry();
+        applyEdits(edits);
+        endHistoryEntry();
+    });
 }
 
 Buffer::~Buffer()
 {
+    // Stop the background highlighting
+    ++m_hlJobChannel->generation;
+    // Don't lose the content if we are closed while saving
+    {
+        std::unique_lock<std::mutex> lock{m_saveChannel->mutex};
+        if (m_saveChannel->isRunning)
+            Logger::log << "Waiting for the save to finish: " << m_filePath << Logger::End;
+        m_saveChannel->cond.wait(lock, [this](){ return !m_saveChannel->isRunning; });
+        m_saveChannel->buffer = nullptr;
+    }
 #ifndef TESTING
     glfwSetCursor(g_window, Cursors::busy);
-    m_shouldHighlighterLoopRun = false; // Signal the thread that we don't want more syntax updates
-    m_isHighlightUpdateNeeded = true; // Exit the current update
-#endif
-    m_highlighterThread.join(); // Wait for the thread
-#ifndef TESTING
-    Autocomp::lspProvider->onFileClose(m_filePath);
+    // The responses would call us
+    Autocomp::lspProvider->cancelRequestsOf(this);
+    // A placeholder was not opened
+    if (m_isMaterialized)
+        Autocomp::lspProvider->onFileClose(m_filePath);
+    Autocomp::buffWordProvid->removeBuffer(m_id);
+    g_fileWatcher->unwatch(m_fileWatchId);
+    g_fileWatcher->unwatch(m_gitHeadWatchId);
+    g_fileWatcher->unwatch(m_gitIndexWatchId);
     Logger::log << "Destroyed a buffer: " << this << " (" << m_filePath << ')' << Logger::End;
     glfwSetCursor(g_window, nullptr);
 #endif
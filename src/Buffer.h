@@ -2,9 +2,13 @@
 
 #include <filesystem>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
 #include <glm/glm.hpp>
 #include "unicode/uchar.h"
-#include "Timer.h"
+#include "Profiler.h"
 #include "TextRenderer.h"
 #include "UiRenderer.h"
 #include "config.h"
@@ -13,10 +17,12 @@
 #include "Syntax.h"
 #include "signs.h"
 #include "Git.h"
+#include "FileWatcher.h"
 #include "autocomp/Popup.h"
 #include "autocomp/LspProvider.h"
 #include "FloatingWin.h"
 #include "languages.h"
+#include "Search.h"
 class Document;
 
 namespace std_fs = std::filesystem;
@@ -75,10 +81,42 @@ protected:
     bool m_isModified{};
     bool m_isReadOnly{};
 
-    std::u8string m_highlightBuffer;
-    bool m_isHighlightUpdateNeeded{};
-    std::thread m_highlighterThread;
-    bool m_shouldHighlighterLoopRun = true;
+    // False while the buffer is a placeholder that only knows its path and cursor position
+    bool m_isMaterialized = true;
+    int m_deferredCursorLine{};
+    int m_deferredCursorCol{};
+    // When the buffer was last rendered (`glfwGetTime()`), the least recently shown ones are unloaded
+    double m_lastShownTime{};
+
+    // The lines from `m_hlDirtyFirstLine` need to be highlighted again
+    // until the highlighter state converges after `m_hlDirtyLastLine`
+    bool m_isHighlightDirty{};
+    size_t m_hlDirtyFirstLine{};
+    size_t m_hlDirtyLastLine{};
+
+    /*
+     * Shared between the buffer and its background highlighter job.
+     * Every edit starts a new generation, the job stops if its generation is outdated.
+     */
+    struct HlJobChannel
+    {
+        struct Result
+        {
+            uint64_t generation{};
+            size_t firstLine{};
+            std::vector<Syntax::LineState> startStates;
+            std::vector<std::u8string> marks;
+            Syntax::LineState endState{};
+        };
+
+        std::atomic<uint64_t> generation{};
+        std::mutex resultMutex;
+        // Set by the job when it's done, taken by the buffer
+        std::optional<Result> result;
+    };
+    std::shared_ptr<HlJobChannel> m_hlJobChannel = std::make_shared<HlJobChannel>();
+    // True if a job was started for the current generation and we didn't get its result yet
+    bool m_isHlJobPending{};
 
     glm::ivec2 m_position{0, TABLINE_HEIGHT_PX};
     glm::ivec2 m_size{};
@@ -119,18 +157,59 @@ protected:
     // Line number : Sign
     std::vector<std::pair<int, Sign>> m_signs;
 
-    std::unique_ptr<Git::Repo> m_gitRepo;
+    // Shared with the background diff jobs
+    std::shared_ptr<Git::Repo> m_gitRepo;
     Git::Repo::GitObjectName m_gitBranchName;
-    float m_msUntilGitBranchUpdate{};
 
-    String m_toFind;
-    std::vector<size_t> m_findResultIs{};
-    int m_findCurrResultI{};
+    /*
+     * Shared between the buffer and its background git diff jobs.
+     * Every job gets a new generation, only the result of the newest one is used.
+     */
+    struct GitDiffChannel
+    {
+        struct Result
+        {
+            uint64_t generation{};
+            std::vector<std::pair<int, Sign>> signs;
+        };
+
+        std::atomic<uint64_t> generation{};
+        std::mutex resultMutex;
+        std::optional<Result> result;
+    };
+    std::shared_ptr<GitDiffChannel> m_gitDiffChannel = std::make_shared<GitDiffChannel>();
+    // Set after an edit, the diff is updated when no edit was made for `GIT_DIFF_DEBOUNCE_MS`
+    bool m_isGitDiffOutdated{};
+    float m_msUntilGitDiffUpdate{};
+
+    Search::Searcher m_searcher;
+    // The match count is shown when the background search finishes
+    bool m_isFindCountPending{};
 
     friend void _autoReloadDialogCb(int, Dialog*, void*);
-    float m_msUntilAutoReloadCheck{};
     fileModTime_t m_lastFileUpdateTime{};
     bool m_isReloadAskerDialogOpen{};
+    FileWatcher::watchId_t m_fileWatchId{};
+    FileWatcher::watchId_t m_gitHeadWatchId{};
+    FileWatcher::watchId_t m_gitIndexWatchId{};
+
+    /*
+     * Shared between the buffer and its background save jobs.
+     * The buffer waits for the running job when it's destroyed,
+     * so the results of the jobs only have to check if the buffer is still alive.
+     */
+    struct SaveChannel
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool isRunning{};
+        // Null after the buffer has been destroyed
+        Buffer* buffer{};
+    };
+    std::shared_ptr<SaveChannel> m_saveChannel = std::make_shared<SaveChannel>();
+    bool m_isSaving{};
+    // Saving was requested while a save was running, save again when it's done
+    bool m_isSaveQueued{};
 
     // This is incremented after each change.
     // Sent to the LSP server.
@@ -149,6 +228,13 @@ protected:
     struct LineInfo
     {
         std::vector<TabStop> tabstops;
+
+        // Highlighter state at the beginning of the line
+        Syntax::LineState hlStartState{};
+        // False if the line has been changed since it was highlighted
+        bool isHlValid{};
+        // A `Syntax::SyntaxMarks` value for each character
+        std::u8string hlMarks;
     };
     std::vector<LineInfo> m_lineInfoList;
 
@@ -165,8 +251,58 @@ protected:
 
     virtual size_t deleteSelectedChars();
 
-    virtual void _updateHighlighting();
+    /*
+     * Mark lines to be highlighted again.
+     */
+    virtual void _invalidateHighlighting(size_t firstLine, size_t lastLine);
+    /*
+     * Highlight the invalidated lines, and the lines after them until the highlighter
+     * state converges. Lines after `untilLine` are left for later.
+     */
+    virtual void _updateHighlighting(size_t untilLine);
+    /*
+     * Highlight the next chunk of the invalidated lines on a worker thread.
+     */
+    virtual void _startBgHighlighting();
+    /*
+     * Use the result of the background highlighter job if it is ready.
+     */
+    virtual bool _applyBgHighlighting(); // Returns true if got a result
+    /*
+     * Queue an edit to be sent to the LSP server.
+     */
+    virtual void _notifyLspOfChange(const lsPosition& start, const String& removed, const String& inserted);
+    // Same, but the part of the line before `start` is taken from `line` instead of the document
+    void _notifyLspOfChange(const String& line, const lsPosition& start, const String& removed, const String& inserted);
+    // Returns the concatenated lines `firstLineI`..`lastLineI` (inclusive)
+    String _getLineRange(int firstLineI, int lastLineI) const;
+    /*
+     * Update the word index of the buffer word provider.
+     * `oldLines` and `newLines` are the whole lines touched by an edit, before and after it.
+     */
+    void _updateWordIndex(const String& oldLines, const String& newLines);
+    // Rebuild the word index of the buffer in the background
+    void _reindexWords();
+    // Notify the LSP server and update the word index after an undo or redo applied `appliedChanges`
+    void _onHistoryChangesApplied(const Document::changeList_t& appliedChanges);
+    /*
+     * Start diffing the current content against the git index in the background.
+     */
     virtual void updateGitDiff();
+    // Update the git diff after the edits have stopped
+    void _scheduleGitDiffUpdate();
+    void _updateGitBranch();
+    // Watch the file and the git HEAD (again), call after the path or the repo has changed
+    void _updateFileWatches();
+    // Called by the file watcher, reloads the file or asks to
+    void _onFileChangedOnDisk();
+    // Called on the main thread when the background save job has finished.
+    // `error` is empty if the file was written successfully.
+    void _onSaveDone(const std::string& filePath, const std::string& error, size_t byteCount);
+    /*
+     * Use the result of the background git diff job if it is ready.
+     */
+    void _applyGitDiff();
     virtual std::string getCheckedOutObjName(int hashLen=-1) const;
 
     // -------------------- Rendering functions -----------------------------
@@ -175,21 +311,25 @@ protected:
     void _renderDrawIndGuid(const glm::ivec2& textPos, int initTextY) const;
     void _renderDrawIndRainbow(const glm::ivec2& textPos, int initTextY, int colI) const;
     void _renderDrawLineNumBar(const glm::ivec2& textPos, int lineI) const;
-    void _renderDrawFoundMark(const glm::ivec2& textPos, int initTextY) const;
+    void _renderDrawFoundMark(const glm::ivec2& textPos, int initTextY, int len) const;
     void _renderDrawDiagnosticMsg(
-        const Autocomp::LspProvider::diagList_t& diags, int lineI, bool isCurrent,
+        const Autocomp::LspProvider::FileDiags& diags, int lineI, bool isCurrent,
         const glm::ivec2& textPos, int initTextY
     ) const;
     void _renderDrawDiagnosticDecorations(
-        const Autocomp::LspProvider::diagList_t& diags, int lineI, int colI,
+        const lsDiagnostic& foundDiagn,
         const glm::ivec2& textPos, int initTextY
     ) const;
     void _renderDrawCursorLineCodeAct(int yPos, int initTextY);
     void _renderDrawBreadcrumbBar();
 
-    void _goToCurrFindResult(bool showStatMsg);
+    void _goToFindResult(const Search::MatchPos& pos, bool showStatMsg);
 
     void _goToDeclOrDefOrImp(const Autocomp::LspProvider::Location& loc);
+    // Called when the response arrives
+    void _displaySymbolHover(const Autocomp::LspProvider::HoverInfo& hoverInfo, bool atMouse);
+    // Called when the response arrives
+    void _displaySignatureHelp(const lsSignatureHelp& signHelp);
 
     friend class App;
     friend class Document; // So we can make Buffer::open() friend of Document
@@ -197,6 +337,12 @@ protected:
      * Do not call this. Use `App::openFileInNewBuffer`.
      */
     virtual void open(const std::string& filePath, bool isReload=false);
+    /*
+     * Only remember the path and the cursor position, the file is opened
+     * when the buffer is first shown or preloaded (see `materialize()`).
+     * Do not call this. Use `App::openFileDeferred`.
+     */
+    virtual void openDeferred(const std::string& filePath, int cursorLine, int cursorCol);
 
     virtual size_t lineColToPos(const lsPosition& pos) const;
 
@@ -225,8 +371,23 @@ public:
     virtual inline bool isNewFile() const final { return m_filePath.compare(FILENAME_NEW) == 0; }
     virtual int getNumOfLines() const;
 
-    virtual inline int getCursorLine() const { return m_cursorLine; }
-    virtual inline int getCursorCol() const { return m_cursorCol; }
+    virtual inline int getCursorLine() const { return m_isMaterialized ? m_cursorLine : m_deferredCursorLine; }
+    virtual inline int getCursorCol() const { return m_isMaterialized ? m_cursorCol : m_deferredCursorCol; }
+
+    virtual inline bool isMaterialized() const final { return m_isMaterialized; }
+    virtual inline double getLastShownTime() const final { return m_lastShownTime; }
+    // False while some lines are waiting to be highlighted (in the background or when they get visible)
+    virtual inline bool isHighlightingDone() const final { return !m_isHighlightDirty; }
+    /*
+     * Open the file of a placeholder buffer and restore the cursor position.
+     */
+    virtual void materialize();
+    /*
+     * Close the file and turn the buffer into a placeholder, keeping the path and the cursor position.
+     * Does nothing and returns false if the buffer has unsaved changes or is being saved.
+     * The undo history is lost.
+     */
+    virtual bool dematerialize();
     virtual inline int getCursorCharPos() const { return m_cursorCharPos; }
 
     virtual inline void moveCursor(CursorMovCmd cmd) { m_cursorMovCmd = cmd; }
@@ -350,6 +511,7 @@ public:
     virtual void autocompPopupHide();
     virtual bool isAutocompPopupShown() const { return m_autocompPopup->isEnabled(); }
     virtual void autocompPopupInsert();
+    // Feed the completion providers into the (already cleared) autocomplete popup
     virtual void regenAutocompList(lsCompletionTriggerKind trigger);
     virtual void insertSnippet(const std::string& snippet);
 
@@ -374,8 +536,9 @@ public:
     virtual void goToMousePos();
 
     virtual void tickCursorHold(float frameTimeMs);
-    virtual void tickAutoReload(float frameTimeMs);
-    virtual void tickGitBranchUpdate(float frameTimeMs);
+    virtual void tickGitDiffUpdate(float frameTimeMs);
+    // Search the lines that are not visible in the background
+    virtual void tickSearch();
 
     virtual void showSymbolHover(bool atMouse=false);
     virtual void showSignatureHelp();
@@ -398,4 +561,5 @@ public:
     virtual ~Buffer();
 
     friend class TestRunner;
+    friend class BenchmarkRunner;
 };
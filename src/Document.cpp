@@ -1,9 +1,50 @@
 #include "Document.h"
+#include "config.h"
+#include "common/file.h"
+#include "common/string.h"
 #include <ctime>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
 
 void Document::setContent(const String& content)
 {
-    m_content = splitStrToLines(content, true);
+    m_content.assign(splitStrToLines(content, true));
+}
+
+void Document::loadFile(const std::string& filePath)
+{
+    const size_t fileSize = std::filesystem::file_size(filePath);
+    if (fileSize < LARGE_FILE_MODE_MIN_SIZE || fileSize > MAX_FILE_SIZE)
+    {
+        setContent(loadUnicodeFile(filePath));
+        return;
+    }
+
+    auto file = std::make_shared<const MappedFile>(filePath);
+    Logger::dbg << "Using large file mode for " << filePath << Logger::End;
+
+    // Only index the lines, they are decoded when accessed
+    // Note: Follows `splitStrToLines()`, there is no empty line after the last line break
+    std::vector<LineRope::MappedLine> lines;
+    const char* const data = file->data();
+    const size_t size = file->size();
+    size_t lineStart{};
+    while (lineStart < size)
+    {
+        const char* lineBreak = (const char*)std::memchr(data+lineStart, '\n', size-lineStart);
+        const size_t lineEnd = lineBreak ? lineBreak-data : size;
+        lines.push_back({lineStart, lineEnd-lineStart, countUtf8Chars(data+lineStart, lineEnd-lineStart)});
+        lineStart = lineEnd+1;
+    }
+    file->adviseRandomAccess();
+    m_content.assignMapped(std::move(file), lines);
+}
+
+bool Document::isMappedFileChangedInPlace() const
+{
+    const MappedFile* file = m_content.getMappedFile();
+    return file && file->isChangedInPlace();
 }
 
 lsRange Document::_makeRangeInclusive(lsRange range) const
@@ -12,7 +53,7 @@ lsRange Document::_makeRangeInclusive(lsRange range) const
     {
         --range.end.line;
         assert(range.end.line < m_content.size());
-        range.end.character = m_content[range.end.line].size()-1;
+        range.end.character = m_content.lineLenAt(range.end.line)-1;
     }
     else
     {
@@ -23,132 +64,98 @@ lsRange Document::_makeRangeInclusive(lsRange range) const
 
 String Document::get(lsRange range) const
 {
-    Logger::dbg << "Getting from range: " << range.ToString() << Logger::End;
-
-    String output;
+    LOG_DBG("Document") << "Getting from range: " << range.ToString() << Logger::End;
 
     range = _makeRangeInclusive(range);
-    int lineI = range.end.line;
-    int colI = range.end.character;
-    while (true)
+    const size_t startLine = range.start.line;
+    const size_t startCol = range.start.character;
+    const size_t endLine = range.end.line;
+    const size_t endCol = range.end.character;
+    assert(startLine <= endLine && endLine < m_content.size());
+    assert(endCol < m_content.lineLenAt(endLine));
+
+    if (startLine == endLine)
     {
-        //Logger::dbg << lineI << ':' << colI << Logger::End;
-
-        assert(lineI >= 0);
-        assert(lineI < (int)m_content.size());
-        assert(colI >= 0);
-        assert(colI < (int)m_content[lineI].size());
-
-        output += m_content[lineI][colI];
-
-        // Exit if this was the last char
-        if (lineI == (int)range.start.line && colI == (int)range.start.character)
-        {
-            break;
-        }
-
-        // Go to next char
-        --colI;
-        if (colI == -1)
-        {
-            --lineI;
-            assert(lineI >= 0);
-            assert(lineI < (int)m_content.size());
-            colI = m_content[lineI].size()-1;
-            assert(colI >= 0);
-        }
+        assert(startCol <= endCol);
+        return m_content[startLine].substr(startCol, endCol-startCol+1);
     }
 
-    String out = output;
-    // We delete backwards, so we must reverse the string
-    std::reverse(out.begin(), out.end());
-    return out;
+    String output = m_content[startLine].substr(startCol);
+    for (size_t i{startLine+1}; i < endLine; ++i)
+        output += m_content[i];
+    output += m_content[endLine].substr(0, endCol+1);
+    return output;
 }
 
 String Document::_delete_impl(range_t range)
 {
-    Logger::dbg << "Deleting range: " << range.ToString() << Logger::End;
-
-    String deletedStr;
+    LOG_DBG("Document") << "Deleting range: " << range.ToString() << Logger::End;
 
     range = _makeRangeInclusive(range);
-    int lineI = range.end.line;
-    int colI = range.end.character;
-
-    while (true)
+    size_t startLine = range.start.line;
+    size_t startCol = range.start.character;
+    size_t endLine = range.end.line;
+    size_t endCol = range.end.character;
+    assert(startLine <= endLine && endLine < m_content.size());
+    assert(endCol < m_content.lineLenAt(endLine));
+
+    // The last character of the document (a line break) can't be deleted
+    if (endLine == m_content.size()-1 && endCol == m_content.lineLenAt(endLine)-1)
     {
-        //Logger::dbg << lineI << ':' << colI << Logger::End;
+        // If this was the only character to be deleted, exit
+        if (startLine == endLine && startCol == endCol)
+            return U"";
 
-        assert(lineI >= 0);
-        assert(lineI < (int)m_content.size());
-        assert(colI >= 0);
-        assert(colI < (int)m_content[lineI].size());
-
-        // If this is the last character of the document
-        if (lineI == int(m_content.size())-1 && colI == int(m_content[lineI].size())-1)
+        if (endCol == 0)
         {
-            // If this was the only character to be deleted, exit
-            if (lineI == (int)range.start.line && colI == (int)range.start.character)
-                break;
-
-            // Skip the last character
-            goto skip_char;
+            --endLine;
+            endCol = m_content.lineLenAt(endLine)-1;
         }
-
-        deletedStr += m_content[lineI][colI];
-        // Do the deletion
-        m_content[lineI].erase(colI, 1);
-        if (m_content[lineI].empty())
+        else
         {
-            m_content.erase(m_content.begin()+lineI);
-            assert(colI == 0);
+            --endCol;
         }
+    }
 
-        // Exit if this was the last char
-        if (lineI == (int)range.start.line && colI == (int)range.start.character)
-        {
-            if (colI != 0)
-            {
-                // If we deleted the line break,
-                if (!m_content[lineI].ends_with('\n'))
-                {
-                    // Append the next line to the end of the current one
-                    assert(lineI+1 < (int)m_content.size());
-                    const String nextLine = m_content[lineI+1];
-                    m_content.erase(m_content.begin()+lineI+1);
-                    m_content[lineI].append(nextLine);
-                }
-            }
-            break;
-        }
+    const String firstLine = m_content[startLine];
+    const String lastLine = m_content[endLine];
 
-skip_char:
+    String deletedStr;
+    if (startLine == endLine)
+    {
+        deletedStr = firstLine.substr(startCol, endCol-startCol+1);
+    }
+    else
+    {
+        deletedStr = firstLine.substr(startCol);
+        for (size_t i{startLine+1}; i < endLine; ++i)
+            deletedStr += m_content[i];
+        deletedStr += lastLine.substr(0, endCol+1);
+    }
 
-        // Go to next char
-        --colI;
-        if (colI == -1)
-        {
-            --lineI;
-            assert(lineI >= 0);
-            assert(lineI < (int)m_content.size());
-            colI = m_content[lineI].size()-1;
-            //Logger::dbg << "Line " << lineI << " is " << m_content[lineI].size() << " chars long" << Logger::End;
-            //Logger::dbg << "Line: " << strToAscii(m_content[lineI]) << Logger::End;
-            assert(colI >= 0);
-        }
+    String newLine = firstLine.substr(0, startCol)+lastLine.substr(endCol+1);
+    size_t eraseCount = endLine-startLine+1;
+    // If we deleted the line break
+    if (!newLine.empty() && !newLine.ends_with('\n'))
+    {
+        // Append the next line to the end of the current one
+        assert(endLine+1 < m_content.size());
+        newLine += m_content[endLine+1];
+        ++eraseCount;
     }
 
-    String out = deletedStr;
-    // We delete backwards, so we must reverse the deleted string
-    std::reverse(out.begin(), out.end());
-    return out;
+    m_content.erase(startLine, eraseCount);
+    if (!newLine.empty())
+        m_content.insert(startLine, {std::move(newLine)});
+
+    return deletedStr;
 }
 
-size_t Document::delete_(const range_t& range)
+String Document::delete_(const range_t& range)
 {
     const String deletedStr = _delete_impl(range);
     if (deletedStr.empty()) // If there was nothing to delete
-        return 0;
+        return deletedStr;
 
     DocumentHistory::Entry::Change change;
     change.type = DocumentHistory::Entry::Change::Type::Deletion;
@@ -156,34 +163,43 @@ size_t Document::delete_(const range_t& range)
     change.text = deletedStr;
     m_history.add(std::move(change));
 
-    return deletedStr.length();
+    return deletedStr;
 }
 
 lsPosition Document::_insert_impl(const pos_t& pos, const String& text)
 {
-    // TODO: Check position
+    assert((size_t)pos.line < m_content.size());
+    const String line = m_content[pos.line];
+    assert((size_t)pos.character <= line.size());
 
-    int lineI = pos.line;
-    int colI = pos.character;
-    for (auto c : text)
+    const size_t breakCount = std::count(text.begin(), text.end(), '\n');
+    if (breakCount == 0)
     {
-        m_content[lineI].insert(colI, 1, c);
+        String newLine = line;
+        newLine.insert(pos.character, text);
+        m_content.set(pos.line, std::move(newLine));
+        return {pos.line, int(pos.character+text.size())};
+    }
 
-        ++colI;
-        // End
+    // Split the text to lines and insert them at once
+    std::vector<String> newLines;
+    newLines.reserve(breakCount+1);
+    const String lineEnd = line.substr(pos.character);
+    newLines.push_back(line.substr(0, pos.character));
+    for (Char c : text)
+    {
+        newLines.back() += c;
         if (c == '\n')
-        {
-            const String lineEnd = m_content[lineI].substr(colI);
-            m_content[lineI].erase(colI);
-            m_content.insert(m_content.begin()+lineI+1, lineEnd);
-            colI = 0;
-
-            ++lineI;
-        }
+            newLines.emplace_back();
     }
+    const int endCol = newLines.back().size();
+    newLines.back() += lineEnd;
+
+    m_content.erase(pos.line, 1);
+    m_content.insert(pos.line, std::move(newLines));
 
     // Return the end
-    return {lineI, colI};
+    return {int(pos.line+breakCount), endCol};
 }
 
 lsPosition Document::insert(const pos_t& pos, const String& text)
@@ -202,17 +218,19 @@ lsPosition Document::insert(const pos_t& pos, const String& text)
     return endPos;
 }
 
-const std::vector<String>& Document::getAll() const
+String Document::getConcated() const
 {
-    return m_content;
+    String output;
+    output.reserve(calcCharCount());
+    for (const String& line : m_content)
+        output += line;
+    return output;
 }
 
 Char Document::getChar(const pos_t& pos) const
 {
     assert(pos.line < m_content.size());
-    const String& line = m_content[pos.line];
-    assert(pos.character < line.length());
-    return line[pos.character];
+    return m_content.charAt(pos.line, pos.character);
 }
 
 Char Document::getChar(size_t pos) const
@@ -220,33 +238,28 @@ Char Document::getChar(size_t pos) const
     if (isEmpty())
         return '\0';
 
-    size_t i{};
-    for (const String& line : m_content)
+    if (pos >= calcCharCount())
     {
-        if (i + line.size() - 1 < pos)
-        {
-            i += line.size();
-        }
-        else
-        {
-            return line[pos-i];
-        }
+        Logger::fatal << "Tried to get character at invalid position: "
+            << pos << " / " << std::to_string((int)pos) << Logger::End;
+        return '\0';
     }
-    Logger::fatal << "Tried to get character at invalid position: "
-        << pos << " / " << std::to_string((int)pos) << Logger::End;
-    return '\0';
+
+    size_t lineStart{};
+    const size_t lineI = m_content.getLineOfPos(pos, &lineStart);
+    return m_content.charAt(lineI, pos-lineStart);
 }
 
 String Document::getLine(size_t i) const
 {
     assert(i < m_content.size());
-    return m_content[i];
+    return m_content.copyAt(i);
 }
 
 size_t Document::getLineLen(size_t i) const
 {
     assert(i < m_content.size());
-    return m_content[i].size();
+    return m_content.lineLenAt(i);
 }
 
 void Document::assertPos(int line, int col, size_t pos) const
@@ -254,32 +267,66 @@ void Document::assertPos(int line, int col, size_t pos) const
     assert(line >= 0);
     assert(m_content.empty() || (size_t)line < m_content.size());
     assert(col >= 0);
-    assert(m_content.empty() || pos < countLineListLen(m_content));
+    assert(m_content.empty() || pos < m_content.getCharCount());
 }
 
-DocumentHistory::Entry::ExtraInfo Document::undo()
+static DocumentHistory::Entry::Change makeAppliedChange(
+        DocumentHistory::Entry::Change::Type type, const lsPosition& start, const lsPosition& end, String text)
 {
+    DocumentHistory::Entry::Change applied;
+    applied.type = type;
+    applied.range = {start, end};
+    applied.text = std::move(text);
+    return applied;
+}
+
+DocumentHistory::Entry::ExtraInfo Document::undo(changeList_t* outAppliedChanges/*=nullptr*/)
+{
+    using Type = DocumentHistory::Entry::Change::Type;
+
     const DocumentHistory::Entry entry = m_history.goBack();
     for (auto it{entry.changes.rbegin()}; it != entry.changes.rend(); ++it)
     {
         const auto& change = *it;
-        if (change.type == DocumentHistory::Entry::Change::Type::Insertion)
-            _delete_impl(change.range);
+        if (change.type == Type::Insertion)
+        {
+            String deleted = _delete_impl(change.range);
+            if (outAppliedChanges)
+                outAppliedChanges->push_back(makeAppliedChange(
+                            Type::Deletion, change.range.start, change.range.end, std::move(deleted)));
+        }
         else
-            _insert_impl(change.range.start, change.text);
+        {
+            const lsPosition end = _insert_impl(change.range.start, change.text);
+            if (outAppliedChanges)
+                outAppliedChanges->push_back(makeAppliedChange(
+                            Type::Insertion, change.range.start, end, change.text));
+        }
     }
     return entry.extraInfo;
 }
 
-DocumentHistory::Entry::ExtraInfo Document::redo()
+DocumentHistory::Entry::ExtraInfo Document::redo(changeList_t* outAppliedChanges/*=nullptr*/)
 {
+    using Type = DocumentHistory::Entry::Change::Type;
+
     const DocumentHistory::Entry entry = m_history.goForward();
     for (const auto& change : entry.changes)
     {
-        if (change.type == DocumentHistory::Entry::Change::Type::Insertion)
-            _insert_impl(change.range.start, change.text);
+        if (change.type == Type::Insertion)
+        {
+            const lsPosition end = _insert_impl(change.range.start, change.text);
+            if (outAppliedChanges)
+                outAppliedChanges->push_back(makeAppliedChange(
+                            Type::Insertion, change.range.start, end, change.text));
+        }
         else
-            _delete_impl(change.range);
+        {
+            String deleted = _delete_impl(change.range);
+            if (outAppliedChanges)
+                outAppliedChanges->push_back(makeAppliedChange(
+                            Type::Deletion, change.range.start, change.range.end, std::move(deleted)));
+        }
     }
     return entry.extraInfo;
 }
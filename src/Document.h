@@ -4,6 +4,7 @@
 #include "types.h"
 #include "string.h"
 #include "Buffer.h"
+#include "LineRope.h"
 #include "LibLsp/lsp/lsRange.h"
 #include <vector>
 #include <stack>
@@ -67,7 +68,7 @@ public:
 
     inline void add(const DocumentHistory::Entry::Change& change)
     {
-        Logger::dbg << "New change added ("
+        LOG_DBG("Document") << "New change added ("
             << "type=" << (change.type == Entry::Change::Type::Insertion ? "INS": "DEL")
             << ", range=" << change.range.ToString()
             << ", lineCount=" << strCountLines(change.text) << ')' << Logger::End;
@@ -135,7 +136,7 @@ public:
 class Document final
 {
 private:
-    std::vector<String> m_content;
+    LineRope m_content;
     DocumentHistory m_history;
 
 public:
@@ -159,6 +160,10 @@ private:
     friend void Buffer::beginHistoryEntry();
     // To allow calling `m_history->endEntry()`
     friend void Buffer::endHistoryEntry();
+    // To allow setting the content in tests
+    friend class TestRunner;
+    // To allow editing the content in benchmarks
+    friend class BenchmarkRunner;
 
     lsRange _makeRangeInclusive(lsRange range) const;
 
@@ -175,9 +180,10 @@ private:
     /*
      * Delete text from the specified range and create a history entry for the edit.
      *
-     * @returns The number of characters deleted.
+     * @returns The deleted string. It can be shorter than the range,
+     *          as the last line break of the document is never deleted.
      */
-    size_t delete_(const range_t& range);
+    String delete_(const range_t& range);
 
     /*
      * The actual insert implementation.
@@ -197,30 +203,60 @@ private:
     lsPosition insert(const pos_t& pos, const String& text);
 
     void setContent(const String& content);
+    /*
+     * Load the content from a file.
+     * Files of at least `LARGE_FILE_MODE_MIN_SIZE` bytes are memory mapped
+     * and their lines are only decoded when they are accessed.
+     *
+     * Throws `std::runtime_error` when the file can't be read.
+     */
+    void loadFile(const std::string& filePath);
     inline void clearContent() { m_content.clear(); }
 
-    DocumentHistory::Entry::ExtraInfo undo();
-    DocumentHistory::Entry::ExtraInfo redo();
+    using changeList_t = std::vector<DocumentHistory::Entry::Change>;
+    /*
+     * Undo/redo the last history entry.
+     *
+     * @param outAppliedChanges If not null, the edits that were actually made are appended to it.
+     */
+    DocumentHistory::Entry::ExtraInfo undo(changeList_t* outAppliedChanges=nullptr);
+    DocumentHistory::Entry::ExtraInfo redo(changeList_t* outAppliedChanges=nullptr);
     void clearHistory();
 
 public:
     String get(lsRange range) const;
-    const std::vector<String>& getAll() const;
     Char getChar(const pos_t& pos) const;
     Char getChar(size_t pos) const;
     String getLine(size_t i) const;
-    inline String getConcated() const { return lineVecConcat(m_content); }
+    String getConcated() const;
+    // Faster than `utf32To8(getConcated())` when the file is mapped
+    inline std::string getConcatedUtf8() const { return m_content.getConcatedUtf8(); }
+    inline bool isLargeFile() const { return m_content.isMapped(); }
+    // True if the mapped file of a large file was overwritten, the lines not decoded yet are invalid then
+    bool isMappedFileChangedInPlace() const;
+    // A copy of the content that the background jobs can read
+    inline LineRope::Snapshot makeSnapshot() const { return m_content.makeSnapshot(); }
 
     inline bool isEmpty() const { return m_content.empty(); }
     inline size_t getLineCount() const { return m_content.size(); }
     size_t getLineLen(size_t i) const;
-    inline size_t calcCharCount() const { return countLineListLen(m_content); }
+    inline size_t calcCharCount() const { return m_content.getCharCount(); }
+    // Returns the index of the first character of a line
+    inline size_t getLineStartPos(size_t lineI) const { return m_content.getLineStartPos(lineI); }
+    // Returns the index of the line that contains the character at `pos`
+    // and optionally the index of the first character of that line
+    inline size_t getLineOfPos(size_t pos, size_t* outLineStart=nullptr) const
+    {
+        return m_content.getLineOfPos(pos, outLineStart);
+    }
 
     void assertPos(int line, int col, size_t pos) const;
 
     inline const DocumentHistory& getHistory() const { return m_history; }
 
     // Note: We only allow reading
-    inline decltype(m_content)::const_iterator begin() const { return m_content.cbegin(); }
-    inline decltype(m_content)::const_iterator end() const { return m_content.cend(); }
+    inline LineRope::const_iterator begin() const { return m_content.begin(); }
+    inline LineRope::const_iterator end() const { return m_content.end(); }
+    // Returns an iterator to line `lineI`
+    inline LineRope::const_iterator iterAt(size_t lineI) const { return m_content.iterAt(lineI); }
 };
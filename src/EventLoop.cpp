@@ -0,0 +1,70 @@
+#include "EventLoop.h"
+#include "glstuff.h"
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+extern std::atomic<bool> g_isRedrawNeeded;
+
+namespace EventLoop
+{
+
+static constexpr double NO_WAKE_UP = std::numeric_limits<double>::infinity();
+
+// The earliest requested wake up
+static double msUntilWakeUp = NO_WAKE_UP;
+
+static std::mutex queueMutex;
+static std::vector<std::function<void()>> queue;
+
+void wakeUpIn(double ms)
+{
+    msUntilWakeUp = std::min(msUntilWakeUp, std::max(ms, 0.0));
+}
+
+void wakeUpNow()
+{
+#ifndef TESTING
+    glfwPostEmptyEvent();
+#endif
+}
+
+void runOnMainThread(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> guard{queueMutex};
+        queue.push_back(std::move(fn));
+    }
+    wakeUpNow();
+}
+
+void runQueued()
+{
+    std::vector<std::function<void()>> fns;
+    {
+        std::lock_guard<std::mutex> guard{queueMutex};
+        fns.swap(queue);
+    }
+    // The functions may queue others, those run in the next iteration
+    for (auto& fn : fns)
+        fn();
+}
+
+void waitEvents()
+{
+    // Requests made by the event callbacks are for the next wait
+    const double timeoutMs = msUntilWakeUp;
+    msUntilWakeUp = NO_WAKE_UP;
+
+    if (g_isRedrawNeeded || timeoutMs <= 0)
+        glfwPollEvents();
+    else if (std::isinf(timeoutMs))
+        glfwWaitEvents();
+    else
+        glfwWaitEventsTimeout(timeoutMs/1000.0);
+}
+
+} // namespace EventLoop
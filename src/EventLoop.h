@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+
+/*
+ * Lets the main loop sleep until something has to be done.
+ *
+ * Components that have to do something in the future (blinking the cursor,
+ * checking for file changes, etc.) request a wake up every frame while they
+ * are waiting, and the main loop blocks until the earliest one or an input event.
+ */
+namespace EventLoop
+{
+
+/*
+ * Request the main loop to run again in `ms` milliseconds at the latest.
+ * Only call from the main thread. The request is valid for the next wait only.
+ */
+void wakeUpIn(double ms);
+
+/*
+ * Wake up the main loop immediately. Can be called from any thread.
+ */
+void wakeUpNow();
+
+/*
+ * Run `fn` on the main thread in the next iteration of the main loop
+ * and wake the main loop up. Can be called from any thread.
+ */
+void runOnMainThread(std::function<void()> fn);
+
+/*
+ * Run the functions queued by `runOnMainThread()`. Only call from the main thread.
+ */
+void runQueued();
+
+/*
+ * Process the pending events, or wait for events until the earliest
+ * requested wake up if there is nothing to redraw.
+ */
+void waitEvents();
+
+} // namespace EventLoop
@@ -168,13 +168,9 @@ void FileTypeHandler::loadFolderTypes(const std::string& databasePath)
     Logger::log << "Loaded " << m_folderTypes.size() << " folder types" << Logger::End;
 }
 
-#define SEQ_CLEAR_LINE "\33[2K"
-#define SEQ_UP_LINE "\033[A"
-
 static Image* loadIcon(const std::string& name)
 {
-    Logger::dbg << SEQ_UP_LINE SEQ_CLEAR_LINE "\rLoading icon: " << name << '\n';
-    std::cout << std::flush;
+    Logger::dbg << "Loading icon: " << name << Logger::End;
     return new Image{App::getResPath(PATH_DIR_FT_ICON"/"+name+".png"), Image::UPSCALE_FILT_DEF, Image::DOWNSCALE_FILT_DEF, true};
 }
 
@@ -202,7 +198,7 @@ FileTypeHandler::FileTypeHandler(
     // Load default folder icon
     m_defFolderIcon = std::unique_ptr<Image>(loadIcon("folder-other"));
 
-    Logger::dbg << SEQ_UP_LINE SEQ_CLEAR_LINE "\rLoaded icons" << Logger::End;
+    Logger::dbg << "Loaded icons" << Logger::End;
 }
 
 const Image* FileTypeHandler::getIconFromFilename(std::string fname, bool isDir)
@@ -0,0 +1,251 @@
+#include "FileWatcher.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include "os.h"
+#include <filesystem>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#ifdef OS_LINUX
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef OS_LINUX
+// Not IN_MODIFY, we don't want to see half written files
+static constexpr uint32_t WATCH_MASK
+    = IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_CREATE|IN_DELETE|IN_ATTRIB;
+#endif
+
+FileWatcher::FileWatcher()
+{
+#ifdef OS_LINUX
+    m_inotifyFd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (m_inotifyFd == -1)
+    {
+        Logger::err << "Failed to initialize inotify: " << strerror(errno) << Logger::End;
+        return;
+    }
+    m_stopFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (m_stopFd == -1)
+    {
+        Logger::err << "Failed to create eventfd: " << strerror(errno) << Logger::End;
+        close(m_inotifyFd);
+        m_inotifyFd = -1;
+        return;
+    }
+    m_thread = std::thread{&FileWatcher::_threadLoop, this};
+    Logger::dbg << "Started file watcher" << Logger::End;
+#else
+    Logger::warn << "File watching is not supported on this platform" << Logger::End;
+#endif
+}
+
+void FileWatcher::_threadLoop()
+{
+#ifdef OS_LINUX
+    Profiler::setThreadName("File watcher");
+    while (true)
+    {
+        pollfd fds[2]{
+            {.fd=m_inotifyFd, .events=POLLIN, .revents=0},
+            {.fd=m_stopFd, .events=POLLIN, .revents=0},
+        };
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            Logger::err << "FileWatcher: poll() failed: " << strerror(errno) << Logger::End;
+            return;
+        }
+        if (fds[1].revents)
+            return;
+        if (fds[0].revents & POLLIN)
+            _readEvents();
+    }
+#endif
+}
+
+void FileWatcher::_markChanged(const std::string& path)
+{
+    if (m_watchedPaths.find(path) == m_watchedPaths.end())
+        return;
+
+    if (m_changedPaths.empty())
+        EventLoop::wakeUpNow();
+    m_changedPaths.insert(path);
+}
+
+void FileWatcher::_readEvents()
+{
+#ifdef OS_LINUX
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        const ssize_t len = read(m_inotifyFd, buffer, sizeof(buffer));
+        if (len <= 0)
+            break;
+
+        std::lock_guard<std::mutex> guard{m_mutex};
+        for (ssize_t offs{}; offs < len;)
+        {
+            const auto* event = (const inotify_event*)(buffer+offs);
+            offs += sizeof(inotify_event)+event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                Logger::warn << "FileWatcher: Event queue overflowed" << Logger::End;
+                for (const auto& pair : m_watchedPaths)
+                    _markChanged(pair.first);
+                continue;
+            }
+
+            auto dirIt = m_wdToDir.find(event->wd);
+            if (dirIt == m_wdToDir.end())
+                continue;
+            const std::string& dir = dirIt->second;
+            if (event->mask & IN_IGNORED)
+            {
+                // The directory has been removed, the kernel dropped the watch
+                _markChanged(dir);
+                auto watchedDirIt = m_dirs.find(dir);
+                if (watchedDirIt != m_dirs.end())
+                    watchedDirIt->second.wd = -1;
+                m_wdToDir.erase(dirIt);
+                continue;
+            }
+
+            // Something in the directory has changed
+            _markChanged(dir);
+            if (event->len)
+                _markChanged((dir == "/" ? dir : dir+'/')+event->name);
+        }
+    }
+#endif
+}
+
+FileWatcher::watchId_t FileWatcher::watch(const std::string& path, callback_t callback)
+{
+    if (!isAvailable())
+        return 0;
+
+#ifdef OS_LINUX
+    std::error_code err;
+    const std::string dir = std::filesystem::is_directory(path, err)
+        ? path : std::filesystem::path{path}.parent_path().string();
+
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        auto dirIt = m_dirs.find(dir);
+        // Not watched yet, or it was removed and may have been created again
+        if (dirIt == m_dirs.end() || dirIt->second.wd == -1)
+        {
+            const int wd = inotify_add_watch(m_inotifyFd, dir.c_str(), WATCH_MASK);
+            if (wd == -1)
+            {
+                Logger::err << "Failed to watch directory " << dir << ": " << strerror(errno) << Logger::End;
+                return 0;
+            }
+            if (dirIt == m_dirs.end())
+                dirIt = m_dirs.emplace(dir, WatchedDir{wd, 0}).first;
+            else
+                dirIt->second.wd = wd;
+            m_wdToDir[wd] = dir;
+            Logger::dbg << "Watching directory: " << dir << Logger::End;
+        }
+        ++dirIt->second.refCount;
+        ++m_watchedPaths[path];
+    }
+
+    const watchId_t id = ++m_lastWatchId;
+    m_watches.emplace(id, Watch{path, dir, std::move(callback)});
+    return id;
+#else
+    (void)path;
+    (void)callback;
+    return 0;
+#endif
+}
+
+void FileWatcher::unwatch(watchId_t id)
+{
+    auto watchIt = m_watches.find(id);
+    if (watchIt == m_watches.end())
+        return;
+
+#ifdef OS_LINUX
+    const std::string& path = watchIt->second.path;
+    const std::string& dir = watchIt->second.dir;
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        auto pathIt = m_watchedPaths.find(path);
+        if (pathIt != m_watchedPaths.end() && --pathIt->second == 0)
+            m_watchedPaths.erase(pathIt);
+
+        auto dirIt = m_dirs.find(dir);
+        if (dirIt != m_dirs.end() && --dirIt->second.refCount == 0)
+        {
+            // The kernel has already dropped the watch if the directory was removed
+            if (dirIt->second.wd != -1)
+            {
+                inotify_rm_watch(m_inotifyFd, dirIt->second.wd);
+                m_wdToDir.erase(dirIt->second.wd);
+            }
+            Logger::dbg << "Stopped watching directory: " << dirIt->first << Logger::End;
+            m_dirs.erase(dirIt);
+        }
+    }
+#endif
+
+    m_watches.erase(watchIt);
+}
+
+void FileWatcher::processEvents()
+{
+    PROFILE_FUNC();
+
+    std::set<std::string> changedPaths;
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        changedPaths.swap(m_changedPaths);
+    }
+    if (changedPaths.empty())
+        return;
+
+    // The callbacks can add and remove watches
+    std::vector<watchId_t> toCall;
+    for (const auto& [id, watch] : m_watches)
+    {
+        if (changedPaths.count(watch.path))
+            toCall.push_back(id);
+    }
+
+    for (watchId_t id : toCall)
+    {
+        auto it = m_watches.find(id);
+        if (it == m_watches.end())
+            continue;
+        Logger::dbg << "FileWatcher: Changed: " << it->second.path << Logger::End;
+        // Copy, the callback may remove the watch
+        const callback_t callback = it->second.callback;
+        callback();
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef OS_LINUX
+    if (!isAvailable())
+        return;
+
+    const uint64_t value = 1;
+    (void)!write(m_stopFd, &value, sizeof(value));
+    m_thread.join();
+    close(m_stopFd);
+    close(m_inotifyFd);
+    Logger::dbg << "Stopped file watcher" << Logger::End;
+#endif
+}
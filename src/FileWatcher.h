@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <cstdint>
+
+/*
+ * Watches files and directories for changes using one inotify instance.
+ *
+ * The directories are watched instead of the files themselves, so files replaced
+ * by renaming (like most editors and git save them) are also noticed.
+ * A background thread collects the changed paths and wakes up the main loop,
+ * which calls the callbacks from `processEvents()`. The changes of a path
+ * are coalesced until they are processed.
+ */
+class FileWatcher final
+{
+public:
+    using watchId_t = uint64_t;
+    using callback_t = std::function<void()>;
+
+private:
+    int m_inotifyFd{-1};
+    // Written to stop the thread
+    int m_stopFd{-1};
+    std::thread m_thread;
+
+    // Only used by the main thread
+    struct Watch
+    {
+        std::string path;
+        // The watched directory, the parent of `path` if it's a file
+        std::string dir;
+        callback_t callback;
+    };
+    std::map<watchId_t, Watch> m_watches;
+    watchId_t m_lastWatchId{};
+
+    // The members below are shared with the thread
+    std::mutex m_mutex;
+    struct WatchedDir
+    {
+        // -1 if the directory was removed, the next `watch()` of it tries to watch it again
+        int wd{};
+        size_t refCount{};
+    };
+    std::map<std::string, WatchedDir> m_dirs;
+    std::map<int, std::string> m_wdToDir;
+    // The watched files and directories, with the number of watches of them
+    std::map<std::string, size_t> m_watchedPaths;
+    // Changed since the last `processEvents()`
+    std::set<std::string> m_changedPaths;
+
+    void _threadLoop();
+    void _readEvents();
+    // Call with `m_mutex` locked
+    void _markChanged(const std::string& path);
+
+public:
+    FileWatcher();
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    inline bool isAvailable() const { return m_inotifyFd != -1; }
+
+    /*
+     * Call `callback` when a file or anything in a directory changes.
+     * `path` should be canonical. Returns 0 on error.
+     * Only call from the main thread.
+     */
+    watchId_t watch(const std::string& path, callback_t callback);
+    void unwatch(watchId_t id);
+
+    /*
+     * Call the callbacks of the changed paths. Only call from the main thread.
+     */
+    void processEvents();
+
+    ~FileWatcher();
+};
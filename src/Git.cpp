@@ -44,89 +44,101 @@ Repo::Repo(const std::string& path)
     m_isRepo = true;
     m_repoRootPath = git_repository_workdir(repo);
     assert(!m_repoRootPath.empty());
-    Logger::dbg << "Repo root: " << m_repoRootPath << Logger::End;
+    m_gitDirPath = git_repository_path(repo);
+    Logger::dbg << "Repo root: " << m_repoRootPath << ", git dir: " << m_gitDirPath << Logger::End;
 }
 
-static int lineDiffCallback(const git_diff_delta*, const git_diff_hunk*, const git_diff_line* line, void* payload)
+bool Repo::_getBaseContent(const std::string& relPath, std::string* output)
 {
-    if (line->origin != 'F' && line->origin != '+' && line->origin != '-')
-        return 0;
-
-    auto _payload = (std::pair<const std::string&, Repo::diffList_t*>*)payload;
-    Repo::diffList_t* output = _payload->second;
-    const std::string& fileToDiff = _payload->first;
-
-    static bool isFileToDiff = false;
-    static std::string currentFile;
-    static std::vector<int> changedLines{};
+    git_index* index;
+    if (git_repository_index(&index, m_repo) < 0)
+    {
+        const git_error* err = git_error_last();
+        Logger::err << "Failed to get git index: " << err->klass << ": " << err->message << Logger::End;
+        return false;
+    }
+    // Only reads the file if it has changed since the last time
+    git_index_read(index, false);
 
-    if (line->origin == 'F')
+    git_blob* blob{};
+    const git_index_entry* entry = git_index_get_bypath(index, relPath.c_str(), 0);
+    if (entry)
     {
-        currentFile = std::string(line->content, line->content_len);
-        currentFile = currentFile.substr(currentFile.find('\n')+1);
-        currentFile = currentFile.substr(currentFile.find('\n')+1);
-        currentFile = currentFile.substr(currentFile.find('/')+1);
-        currentFile = currentFile.substr(0, currentFile.find('\n'));
-        Logger::dbg << "Current file is now " << currentFile << Logger::End;
-        if (currentFile == fileToDiff)
-        {
-            isFileToDiff = true;
-            Logger::dbg << "Found the file to diff" << Logger::End;
-        }
-        else if (isFileToDiff)
-        {
-            Logger::dbg << "End of file to diff, exiting" << Logger::End;
-            isFileToDiff = false;
-            changedLines.clear();
-            return 1;
-        }
+        if (git_blob_lookup(&blob, m_repo, &entry->id) < 0)
+            blob = nullptr;
     }
-    else if (isFileToDiff)
+    else
     {
-        const int changedLine = (line->origin == '+' ? line->new_lineno : line->old_lineno);
-        assert(changedLine != -1);
-        if (std::find(changedLines.begin(), changedLines.end(), changedLine) != changedLines.end())
-        {
-            Logger::dbg << "Modified line: " << changedLine << Logger::End;
-            auto found = std::find_if(output->begin(), output->end(),
-                    [&](std::pair<int, ChangeType> x){ return x.first == changedLine; }
-            );
-            *found = std::pair<int, ChangeType>{found->first, ChangeType::Modify};
-        }
-        else
+        // Removed from the index, but maybe still in HEAD
+        git_object* object;
+        if (git_revparse_single(&object, m_repo, ("HEAD:"+relPath).c_str()) == 0)
         {
-            ChangeType changeType;
-            Logger::dbg << (line->origin == '+' ? "New" : "Deleted")
-                << " line: " << changedLine << Logger::End;
-            changeType = (line->origin == '+' ? ChangeType::Add : ChangeType::Delete);
-            output->push_back({changedLine, changeType});
-            changedLines.push_back(changedLine);
+            if (git_object_type(object) == GIT_OBJECT_BLOB)
+                blob = (git_blob*)object;
+            else
+                git_object_free(object);
         }
     }
+    git_index_free(index);
+
+    if (!blob)
+        return false;
+
+    output->assign((const char*)git_blob_rawcontent(blob), git_blob_rawsize(blob));
+    git_blob_free(blob);
+    return true;
+}
+
+static int hunkDiffCallback(const git_diff_delta*, const git_diff_hunk* hunk, void* payload)
+{
+    auto* output = (Repo::diffList_t*)payload;
+
+    // There are no context lines, so the hunk only contains the changed lines
+    const int newStart = hunk->new_start-1;
+    if (hunk->new_lines == 0)
+    {
+        // The lines were deleted after line `new_start`, mark the line that follows them
+        output->push_back({hunk->new_start, ChangeType::Delete});
+        return 0;
+    }
+
+    const int modifiedCount = std::min(hunk->old_lines, hunk->new_lines);
+    for (int i{}; i < modifiedCount; ++i)
+        output->push_back({newStart+i, ChangeType::Modify});
+    for (int i=modifiedCount; i < hunk->new_lines; ++i)
+        output->push_back({newStart+i, ChangeType::Add});
     return 0;
 }
 
-Repo::diffList_t Repo::getDiff(const std::string& filename)
+Repo::diffList_t Repo::getFileDiff(const std::string& relPath, const std::string& content)
 {
-    Logger::log << "Getting git diff of file " << filename << " in repo " << m_repoRootPath << Logger::End;
     if (!m_isRepo)
         return {};
 
-    git_diff* diff;
-    if (git_diff_index_to_workdir(&diff, m_repo, NULL, NULL) < 0)
+    std::lock_guard<std::mutex> guard{m_mutex};
+
+    std::string baseContent;
+    if (!_getBaseContent(relPath, &baseContent))
     {
-        const git_error* err = git_error_last();
-        Logger::err << "Failed to get diff: " << err->klass << ": " << err->message << Logger::End;
+        Logger::dbg << "File is not tracked by git: " << relPath << Logger::End;
         return {};
     }
 
-    diffList_t diffList;
-    std::pair<const std::string&, diffList_t*> pair{filename, &diffList};
-    git_diff_print(diff, GIT_DIFF_FORMAT_PATCH, lineDiffCallback, &pair);
+    git_diff_options options = GIT_DIFF_OPTIONS_INIT;
+    options.context_lines = 0;
 
-    git_diff_free(diff);
+    diffList_t diffList;
+    if (git_diff_buffers(
+            baseContent.data(), baseContent.size(), relPath.c_str(),
+            content.data(), content.size(), relPath.c_str(),
+            &options, nullptr, nullptr, hunkDiffCallback, nullptr, &diffList) < 0)
+    {
+        const git_error* err = git_error_last();
+        Logger::err << "Failed to get diff: " << err->klass << ": " << err->message << Logger::End;
+        return {};
+    }
 
-    Logger::dbg << "Found " << diffList.size() << " differences in the file " << filename << Logger::End;
+    Logger::dbg << "Found " << diffList.size() << " differences in the file " << relPath << Logger::End;
     return diffList;
 }
 
@@ -134,6 +146,8 @@ Repo::GitObjectName Repo::getCheckedOutObjName() const
 {
     if (!m_isRepo) return {};
 
+    std::lock_guard<std::mutex> guard{m_mutex};
+
     git_reference* headRef;
     git_repository_head(&headRef, m_repo);
     git_reference_t refType = git_reference_type(headRef);
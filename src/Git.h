@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <mutex>
 #include <git2.h>
 
 namespace Git
@@ -25,14 +26,28 @@ private:
     bool m_isRepo{};
     git_repository* m_repo{};
     std::string m_repoRootPath;
+    std::string m_gitDirPath;
+    // The diffs are made by background jobs
+    mutable std::mutex m_mutex;
+
+    // Returns false if the file is not tracked
+    bool _getBaseContent(const std::string& relPath, std::string* output);
 
 public:
     Repo(const std::string& path);
 
     inline const std::string& getRepoRoot() const { return m_repoRootPath; }
+    // The `.git` directory, ends with a slash
+    inline const std::string& getGitDir() const { return m_gitDirPath; }
     inline bool isRepo() const { return m_isRepo; }
 
-    diffList_t getDiff(const std::string& filename);
+    /*
+     * Diff `content` against the file in the index (or in HEAD if it's not in the index).
+     * Only this one file is diffed, so this is cheap even in huge repositories.
+     * The line numbers are 0-based and refer to the lines of `content`.
+     * Thread safe.
+     */
+    diffList_t getFileDiff(const std::string& relPath, const std::string& content);
     struct GitObjectName
     {
         std::string name;
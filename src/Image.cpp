@@ -4,6 +4,7 @@
 #define STBI_FAILURE_USERMSG // Get better error messages
 #include "../external/stb/stb_image.h"
 #include "glstuff.h"
+#include <vector>
 
 Image::Image(
         const std::string& filePath,
@@ -12,8 +13,9 @@ Image::Image(
 {
     m_filePath = filePath;
     m_preventLogging = preventLogging;
+    m_upscaleFilt = upscaleFilt;
+    m_downscaleFilt = downscaleFilt;
 
-    stbi_set_flip_vertically_on_load(1);
     int channelCount;
     m_data = stbi_load(filePath.c_str(), &m_physicalSize.x, &m_physicalSize.y, &channelCount, 4);
     if (!m_data)
@@ -36,11 +38,26 @@ Image::Image(
         if (!m_preventLogging)
             Logger::dbg << "Loaded image file: " << filePath << Logger::End;
         m_isOpenFailed = false;
+
+        // Flip it here instead of `stbi_set_flip_vertically_on_load()`, that is global state
+        const size_t rowSize = m_physicalSize.x*4;
+        std::vector<uint8_t> tmpRow(rowSize);
+        for (int y{}; y < m_physicalSize.y/2; ++y)
+        {
+            uint8_t* const row1 = m_data+y*rowSize;
+            uint8_t* const row2 = m_data+(m_physicalSize.y-1-y)*rowSize;
+            memcpy(tmpRow.data(), row1, rowSize);
+            memcpy(row1, row2, rowSize);
+            memcpy(row2, tmpRow.data(), rowSize);
+        }
     }
+}
 
+void Image::_upload() const
+{
     glGenTextures(1, &m_sampler);
-    glBindTexture(GL_TEXTURE_2D, m_sampler);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_physicalSize.x, m_physicalSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_data);
+    GlStats::bindTexture(GL_TEXTURE_2D, m_sampler);
+    GlStats::texImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_physicalSize.x, m_physicalSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_data);
     if (m_isOpenFailed) // If failed to open, force "nearest" filter
     {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Downscale filter
@@ -48,8 +65,8 @@ Image::Image(
     }
     else
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, downscaleFilt); // Downscale filter
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, upscaleFilt); // Upscale filter
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, m_downscaleFilt); // Downscale filter
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, m_upscaleFilt); // Upscale filter
     }
 }
 
@@ -81,7 +98,8 @@ RGBAColor Image::getColorAt(glm::ivec2 pos)
 Image::~Image()
 {
     stbi_image_free(m_data);
-    glDeleteTextures(1, &m_sampler);
+    if (m_sampler)
+        glDeleteTextures(1, &m_sampler);
     if (!m_preventLogging)
         Logger::dbg << "Cleaned up texture data for image " << this << " (" << m_filePath << ')' << Logger::End;
 }
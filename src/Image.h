@@ -5,16 +5,24 @@
 #include "UiRenderer.h"
 #include "types.h"
 
+/*
+ * The image is decoded when it's constructed, so it can be loaded on any thread.
+ * The texture is only uploaded when the image is first used for rendering (on the main thread).
+ */
 class Image final
 {
 private:
-    uint m_sampler{};
+    mutable uint m_sampler{};
+    uint m_upscaleFilt{};
+    uint m_downscaleFilt{};
     glm::ivec2 m_physicalSize{};
     std::string m_filePath;
     bool m_isOpenFailed{};
     uint8_t* m_data{};
     bool m_preventLogging{};
 
+    void _upload() const;
+
 public:
     static constexpr int UPSCALE_FILT_DEF = GL_LINEAR;
     static constexpr int DOWNSCALE_FILT_DEF = GL_LINEAR;
@@ -40,7 +48,8 @@ public:
      */
     void render(const glm::ivec2& pos, const glm::ivec2& size={0, 0}) const;
 
-    inline uint getSamplerId() const { return m_sampler; }
+    // Uploads the texture if it's not uploaded yet. Only call from the main thread.
+    inline uint getSamplerId() const { if (!m_sampler) _upload(); return m_sampler; }
     inline glm::ivec2 getPhysicalSize() const { return m_physicalSize; }
     RGBAColor getColorAt(glm::ivec2 pos);
 
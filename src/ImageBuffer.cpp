@@ -2,7 +2,7 @@
 #include "dialogs/MessageDialog.h"
 #include <cassert>
 #include "config.h"
-#include "Timer.h"
+#include "Profiler.h"
 #include "types.h"
 #include "ThemeLoader.h"
 #include "globals.h"
@@ -11,7 +11,7 @@
 
 void ImageBuffer::open(const std::string& filePath, bool isReload/*=false*/)
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
     glfwSetCursor(g_window, Cursors::busy);
 
     assert(isImageExtension(::getFileExt(filePath)));
@@ -51,7 +51,6 @@ void ImageBuffer::open(const std::string& filePath, bool isReload/*=false*/)
         g_statMsg.set("Opened image file: "+quoteStr(filePath), StatusMsg::Type::Info);
 
     glfwSetCursor(g_window, nullptr);
-    TIMER_END_FUNC();
 }
 
 void ImageBuffer::updateRStatusLineStr()
@@ -85,7 +84,7 @@ void ImageBuffer::updateRStatusLineStr()
 
 void ImageBuffer::render()
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     // Fill background
     g_uiRenderer->renderFilledRectangle(
@@ -145,6 +144,4 @@ void ImageBuffer::render()
                 {0, 0, 0, 1},
                 1);
     }
-
-    TIMER_END_FUNC();
 }
@@ -52,6 +52,9 @@ public:
     ImageBuffer(ImageBuffer&& other) = default;
     ImageBuffer& operator=(ImageBuffer&& other) = default;
 
+    // The image is always loaded
+    virtual bool dematerialize() override { return false; }
+
     virtual int saveToFile() override { return 1; }
     virtual int saveAsToFile(const std::string&) override { return 1; }
 
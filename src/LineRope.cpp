@@ -0,0 +1,479 @@
+#include "LineRope.h"
+#include "common/string.h"
+#include <cstring>
+#include <algorithm>
+
+uint32_t LineRope::_genPriority()
+{
+    // Xorshift32, good enough for balancing
+    m_rngState ^= m_rngState << 13;
+    m_rngState ^= m_rngState >> 17;
+    m_rngState ^= m_rngState << 5;
+    return m_rngState;
+}
+
+void LineRope::_update(Node* node)
+{
+    node->lineCount = 1+_lineCountOf(node->left)+_lineCountOf(node->right);
+    node->charCount = node->lineLen+_charCountOf(node->left)+_charCountOf(node->right);
+}
+
+void LineRope::_destroy(Node* node)
+{
+    if (!node)
+        return;
+    _destroy(node->left);
+    _destroy(node->right);
+    delete node;
+}
+
+void LineRope::_split(Node* node, size_t count, Node** outLeft, Node** outRight)
+{
+    if (!node)
+    {
+        *outLeft = nullptr;
+        *outRight = nullptr;
+        return;
+    }
+
+    const size_t leftCount = _lineCountOf(node->left);
+    if (count <= leftCount)
+    {
+        _split(node->left, count, outLeft, &node->left);
+        *outRight = node;
+    }
+    else
+    {
+        _split(node->right, count-leftCount-1, &node->right, outRight);
+        *outLeft = node;
+    }
+    _update(node);
+}
+
+LineRope::Node* LineRope::_merge(Node* left, Node* right)
+{
+    if (!left) return right;
+    if (!right) return left;
+
+    if (left->priority > right->priority)
+    {
+        left->right = _merge(left->right, right);
+        _update(left);
+        return left;
+    }
+    else
+    {
+        right->left = _merge(left, right->left);
+        _update(right);
+        return right;
+    }
+}
+
+static void updateSubtree(auto* node, auto updateFn)
+{
+    if (!node)
+        return;
+    updateSubtree(node->left, updateFn);
+    updateSubtree(node->right, updateFn);
+    updateFn(node);
+}
+
+LineRope::Node* LineRope::_build(const std::vector<Node*>& nodes)
+{
+    // Build a Cartesian tree using a stack that holds the right spine
+    std::vector<Node*> spine;
+    for (Node* node : nodes)
+    {
+        node->priority = _genPriority();
+
+        Node* lastPopped{};
+        while (!spine.empty() && spine.back()->priority < node->priority)
+        {
+            lastPopped = spine.back();
+            spine.pop_back();
+        }
+        node->left = lastPopped;
+        if (!spine.empty())
+            spine.back()->right = node;
+        spine.push_back(node);
+    }
+
+    if (spine.empty())
+        return nullptr;
+
+    Node* root = spine.front();
+    updateSubtree(root, _update);
+    return root;
+}
+
+LineRope::Node* LineRope::_build(std::vector<String>&& lines)
+{
+    std::vector<Node*> nodes;
+    nodes.reserve(lines.size());
+    for (auto& line : lines)
+    {
+        Node* node = new Node{};
+        node->lineLen = line.size();
+        _store(node, line);
+        nodes.push_back(node);
+    }
+    return _build(nodes);
+}
+
+void LineRope::_store(const Node* node, const String& line)
+{
+    node->encoded = nullptr;
+    node->isWide = std::any_of(line.begin(), line.end(), [](Char c){ return c > 0xff; });
+    if (node->isWide)
+    {
+        node->chars.assign((const char*)line.data(), line.size()*sizeof(Char));
+    }
+    else
+    {
+        node->chars.resize(line.size());
+        for (size_t i{}; i < line.size(); ++i)
+            node->chars[i] = (char)line[i];
+    }
+}
+
+String LineRope::_loadNoCache(const Node* node)
+{
+    String line;
+    if (node->encoded)
+    {
+        decodeUtf8Line(node->encoded, node->encodedSize, &line);
+    }
+    else if (node->isWide)
+    {
+        line.resize(node->chars.size()/sizeof(Char));
+        std::memcpy(line.data(), node->chars.data(), node->chars.size());
+    }
+    else
+    {
+        line.resize(node->chars.size());
+        for (size_t i{}; i < node->chars.size(); ++i)
+            line[i] = (uint8_t)node->chars[i];
+    }
+    assert(line.size() == node->lineLen);
+    return line;
+}
+
+String LineRope::_load(const Node* node)
+{
+    String line = _loadNoCache(node);
+    if (node->encoded)
+        _store(node, line);
+    return line;
+}
+
+const LineRope::Node* LineRope::_getNode(size_t lineI) const
+{
+    assert(lineI < size());
+
+    const Node* node = m_root;
+    while (true)
+    {
+        const size_t leftCount = _lineCountOf(node->left);
+        if (lineI < leftCount)
+        {
+            node = node->left;
+        }
+        else if (lineI == leftCount)
+        {
+            return node;
+        }
+        else
+        {
+            lineI -= leftCount+1;
+            node = node->right;
+        }
+    }
+}
+
+String LineRope::at(size_t lineI) const
+{
+    return _load(_getNode(lineI));
+}
+
+String LineRope::copyAt(size_t lineI) const
+{
+    return _loadNoCache(_getNode(lineI));
+}
+
+size_t LineRope::lineLenAt(size_t lineI) const
+{
+    return _getNode(lineI)->lineLen;
+}
+
+Char LineRope::charAt(size_t lineI, size_t colI) const
+{
+    const Node* node = _getNode(lineI);
+    assert(colI < node->lineLen);
+    if (node->encoded)
+        return _load(node)[colI];
+
+    if (node->isWide)
+    {
+        Char c;
+        std::memcpy(&c, node->chars.data()+colI*sizeof(Char), sizeof(Char));
+        return c;
+    }
+    return (uint8_t)node->chars[colI];
+}
+
+void LineRope::set(size_t lineI, String line)
+{
+    assert(lineI < size());
+
+    // Walk down, then fix the character counts on the path
+    std::vector<Node*> path;
+    Node* node = m_root;
+    while (true)
+    {
+        path.push_back(node);
+        const size_t leftCount = _lineCountOf(node->left);
+        if (lineI < leftCount)
+        {
+            node = node->left;
+        }
+        else if (lineI == leftCount)
+        {
+            break;
+        }
+        else
+        {
+            lineI -= leftCount+1;
+            node = node->right;
+        }
+    }
+
+    node->lineLen = line.size();
+    _store(node, line);
+    for (auto it{path.rbegin()}; it != path.rend(); ++it)
+        _update(*it);
+}
+
+void LineRope::insert(size_t lineI, std::vector<String>&& lines)
+{
+    assert(lineI <= size());
+
+    Node* left;
+    Node* right;
+    _split(m_root, lineI, &left, &right);
+    m_root = _merge(_merge(left, _build(std::move(lines))), right);
+}
+
+void LineRope::erase(size_t firstLineI, size_t count)
+{
+    assert(firstLineI+count <= size());
+
+    Node* left;
+    Node* mid;
+    Node* right;
+    _split(m_root, firstLineI, &left, &mid);
+    _split(mid, count, &mid, &right);
+    _destroy(mid);
+    m_root = _merge(left, right);
+}
+
+void LineRope::assign(std::vector<String>&& lines)
+{
+    clear();
+    m_root = _build(std::move(lines));
+}
+
+void LineRope::assignMapped(std::shared_ptr<const MappedFile> file, const std::vector<MappedLine>& lines)
+{
+    clear();
+
+    std::vector<Node*> nodes;
+    nodes.reserve(lines.size());
+    for (const auto& line : lines)
+    {
+        assert(line.offset+line.size <= file->size());
+        Node* node = new Node{};
+        node->encoded = file->data()+line.offset;
+        node->encodedSize = line.size;
+        node->lineLen = line.charCount+1;
+        nodes.push_back(node);
+    }
+    m_root = _build(nodes);
+    m_mappedFile = std::move(file);
+}
+
+void LineRope::unmap()
+{
+    if (!m_mappedFile)
+        return;
+
+    for (auto it=begin(); it != end(); ++it)
+        _load(it.m_stack.back());
+    m_mappedFile.reset();
+}
+
+void LineRope::clear()
+{
+    _destroy(m_root);
+    m_root = nullptr;
+    m_mappedFile.reset();
+}
+
+void LineRope::_appendUtf8(const char* encoded, size_t encodedSize,
+        const std::string& chars, bool isWide, std::string* output)
+{
+    if (encoded)
+    {
+        output->append(encoded, encodedSize);
+        *output += '\n';
+    }
+    else if (isWide)
+    {
+        String line(chars.size()/sizeof(Char), 0);
+        std::memcpy(line.data(), chars.data(), chars.size());
+        *output += utf32To8(line);
+    }
+    else
+    {
+        // Latin-1 maps directly to one or two byte UTF-8 sequences
+        for (char c : chars)
+        {
+            const uint8_t byte = c;
+            if (byte < 0x80)
+            {
+                *output += c;
+            }
+            else
+            {
+                *output += char(0xc0 | (byte >> 6));
+                *output += char(0x80 | (byte & 0x3f));
+            }
+        }
+    }
+}
+
+std::string LineRope::getConcatedUtf8() const
+{
+    std::string output;
+    for (auto it=begin(); it != end(); ++it)
+    {
+        const Node* node = it.m_stack.back();
+        _appendUtf8(node->encoded, node->encodedSize, node->chars, node->isWide, &output);
+    }
+    return output;
+}
+
+LineRope::Snapshot LineRope::makeSnapshot() const
+{
+    Snapshot snapshot;
+    snapshot.m_lines.reserve(size());
+    for (auto it=begin(); it != end(); ++it)
+    {
+        const Node* node = it.m_stack.back();
+        if (node->encoded)
+            snapshot.m_lines.push_back({node->encoded, node->encodedSize, {}, false});
+        else
+            snapshot.m_lines.push_back({nullptr, 0, node->chars, node->isWide});
+    }
+    snapshot.m_mappedFile = m_mappedFile;
+    return snapshot;
+}
+
+size_t LineRope::getLineStartPos(size_t lineI) const
+{
+    assert(lineI <= size());
+
+    size_t pos{};
+    const Node* node = m_root;
+    while (node)
+    {
+        const size_t leftCount = _lineCountOf(node->left);
+        if (lineI <= leftCount)
+        {
+            node = node->left;
+        }
+        else
+        {
+            pos += _charCountOf(node->left)+node->lineLen;
+            lineI -= leftCount+1;
+            node = node->right;
+        }
+    }
+    return pos;
+}
+
+size_t LineRope::getLineOfPos(size_t pos, size_t* outLineStart/*=nullptr*/) const
+{
+    assert(pos < getCharCount());
+
+    size_t lineI{};
+    size_t lineStart{};
+    const Node* node = m_root;
+    while (true)
+    {
+        const size_t leftChars = _charCountOf(node->left);
+        if (pos < leftChars)
+        {
+            node = node->left;
+        }
+        else if (pos < leftChars+node->lineLen)
+        {
+            lineI += _lineCountOf(node->left);
+            lineStart += leftChars;
+            break;
+        }
+        else
+        {
+            pos -= leftChars+node->lineLen;
+            lineI += _lineCountOf(node->left)+1;
+            lineStart += leftChars+node->lineLen;
+            node = node->right;
+        }
+    }
+
+    if (outLineStart)
+        *outLineStart = lineStart;
+    return lineI;
+}
+
+void LineRope::const_iterator::_pushLeftPath(const Node* node)
+{
+    while (node)
+    {
+        m_stack.push_back(node);
+        node = node->left;
+    }
+}
+
+LineRope::const_iterator::const_iterator(const Node* root, size_t lineI)
+{
+    // Only the nodes where we go left are still to be visited
+    const Node* node = root;
+    while (node)
+    {
+        const size_t leftCount = _lineCountOf(node->left);
+        if (lineI < leftCount)
+        {
+            m_stack.push_back(node);
+            node = node->left;
+        }
+        else if (lineI == leftCount)
+        {
+            m_stack.push_back(node);
+            break;
+        }
+        else
+        {
+            lineI -= leftCount+1;
+            node = node->right;
+        }
+    }
+}
+
+LineRope::const_iterator& LineRope::const_iterator::operator++()
+{
+    assert(!m_stack.empty());
+    const Node* node = m_stack.back();
+    m_stack.pop_back();
+    _pushLeftPath(node->right);
+    return *this;
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "types.h"
+#include "common/file.h"
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <iterator>
+#include <cstddef>
+
+/*
+ * A balanced tree of lines (implicit treap).
+ *
+ * Every node stores one line and the line and character count of its subtree,
+ * so indexing by line, inserting/erasing a run of lines and converting between
+ * character positions and line indices are O(log n).
+ *
+ * Lines that only contain Latin-1 characters are stored with one byte per character,
+ * the others as UTF-32. The lines are widened to `String` when they are accessed.
+ *
+ * The lines can also point into a memory mapped file. Those are only decoded
+ * when they are accessed, the edited lines replace them.
+ */
+class LineRope final
+{
+private:
+    struct Node
+    {
+        // The characters of the line, one byte per character if `isWide` is false,
+        // otherwise the bytes of the UTF-32 encoded line. Empty while the line is not decoded.
+        mutable std::string chars;
+        mutable bool isWide{};
+        // If not null, the line is not decoded yet, this is its UTF-8 data in the mapped file
+        // (without the line break)
+        mutable const char* encoded{};
+        size_t encodedSize{};
+        // Number of characters in the line, including the line break
+        size_t lineLen{};
+        uint32_t priority{};
+        // Number of lines in this subtree
+        size_t lineCount = 1;
+        // Number of characters in this subtree
+        size_t charCount{};
+        Node* left{};
+        Node* right{};
+    };
+
+    Node* m_root{};
+    uint32_t m_rngState = 0x9e3779b9;
+    // The file the not yet decoded lines point into
+    std::shared_ptr<const MappedFile> m_mappedFile;
+
+    uint32_t _genPriority();
+    static inline size_t _lineCountOf(const Node* node) { return node ? node->lineCount : 0; }
+    static inline size_t _charCountOf(const Node* node) { return node ? node->charCount : 0; }
+    static void _update(Node* node);
+    static void _destroy(Node* node);
+    // Split to the first `count` lines and the rest
+    static void _split(Node* node, size_t count, Node** outLeft, Node** outRight);
+    static Node* _merge(Node* left, Node* right);
+    // Build a tree from the nodes in O(n)
+    Node* _build(const std::vector<Node*>& nodes);
+    Node* _build(std::vector<String>&& lines);
+    const Node* _getNode(size_t lineI) const;
+    static void _store(const Node* node, const String& line);
+    static String _load(const Node* node);
+    // Like `_load()`, but doesn't store the line if it needs to be decoded from the file
+    static String _loadNoCache(const Node* node);
+    // Append the line to `output` as UTF-8, with the line break
+    static void _appendUtf8(const char* encoded, size_t encodedSize,
+            const std::string& chars, bool isWide, std::string* output);
+
+public:
+    class const_iterator
+    {
+    private:
+        // The path to the current node, only contains the nodes that still need to be visited
+        std::vector<const Node*> m_stack;
+
+        void _pushLeftPath(const Node* node);
+
+        friend LineRope;
+        const_iterator(const Node* root) { _pushLeftPath(root); }
+        // Start at line `lineI`
+        const_iterator(const Node* root, size_t lineI);
+
+    public:
+        // The lines are returned by value, as they are not stored as `String`
+        using iterator_category = std::input_iterator_tag;
+        using value_type = String;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = String;
+
+        const_iterator() {}
+
+        inline reference operator*() const { return _load(m_stack.back()); }
+        const_iterator& operator++();
+        inline const_iterator operator++(int) { auto old = *this; ++*this; return old; }
+        inline bool operator==(const const_iterator& other) const
+        {
+            if (m_stack.empty() || other.m_stack.empty())
+                return m_stack.empty() == other.m_stack.empty();
+            return m_stack.back() == other.m_stack.back();
+        }
+    };
+
+    LineRope() {}
+    LineRope(const LineRope&) = delete;
+    LineRope& operator=(const LineRope&) = delete;
+
+    inline size_t size() const { return _lineCountOf(m_root); }
+    inline bool empty() const { return !m_root; }
+    inline size_t getCharCount() const { return _charCountOf(m_root); }
+
+    String at(size_t lineI) const;
+    inline String operator[](size_t lineI) const { return at(lineI); }
+    // Like `at()`, but doesn't keep the decoded line in memory
+    String copyAt(size_t lineI) const;
+    // Returns the length of the line without decoding it
+    size_t lineLenAt(size_t lineI) const;
+    Char charAt(size_t lineI, size_t colI) const;
+    void set(size_t lineI, String line);
+
+    // Insert the lines before line `lineI`
+    void insert(size_t lineI, std::vector<String>&& lines);
+    void erase(size_t firstLineI, size_t count);
+    void assign(std::vector<String>&& lines);
+
+    struct MappedLine
+    {
+        size_t offset{};
+        size_t size{}; // Without the line break
+        size_t charCount{}; // Without the line break
+    };
+    // Assign the lines of a mapped file, they are decoded when accessed
+    void assignMapped(std::shared_ptr<const MappedFile> file, const std::vector<MappedLine>& lines);
+    inline bool isMapped() const { return (bool)m_mappedFile; }
+    inline const MappedFile* getMappedFile() const { return m_mappedFile.get(); }
+    // Decode the remaining lines and unmap the file
+    void unmap();
+
+    void clear();
+
+    // Concatenate the lines as UTF-8, the lines that are not decoded yet are copied as they are
+    std::string getConcatedUtf8() const;
+
+    /*
+     * An immutable copy of the content that can be read from other threads.
+     * The lines that are not decoded yet keep pointing into the mapped file,
+     * the others are copied in their compact form.
+     */
+    class Snapshot
+    {
+    private:
+        struct Line
+        {
+            const char* encoded{};
+            size_t encodedSize{};
+            std::string chars;
+            bool isWide{};
+        };
+        std::vector<Line> m_lines;
+        std::shared_ptr<const MappedFile> m_mappedFile;
+
+        friend LineRope;
+
+    public:
+        inline size_t size() const { return m_lines.size(); }
+        // Append line `lineI` to `output` as UTF-8, with the line break
+        inline void appendUtf8(size_t lineI, std::string* output) const
+        {
+            const Line& line = m_lines[lineI];
+            _appendUtf8(line.encoded, line.encodedSize, line.chars, line.isWide, output);
+        }
+    };
+    Snapshot makeSnapshot() const;
+
+    // Returns the index of the first character of a line
+    size_t getLineStartPos(size_t lineI) const;
+    // Returns the index of the line that contains the character at `pos`
+    // and optionally the index of the first character of that line
+    size_t getLineOfPos(size_t pos, size_t* outLineStart=nullptr) const;
+
+    inline const_iterator begin() const { return const_iterator{m_root}; }
+    inline const_iterator end() const { return const_iterator{}; }
+    // Returns an iterator to line `lineI` in O(log n)
+    inline const_iterator iterAt(size_t lineI) const { return const_iterator{m_root, lineI}; }
+
+    ~LineRope() { clear(); }
+};
@@ -1,45 +1,430 @@
 #include "Logger.h"
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 
 namespace Logger
 {
 
-std::string _loggerPrefix;
+thread_local std::string _loggerPrefix;
 
-Logger dbg{Logger::Type::Debug};
-Logger log{Logger::Type::Log};
-Logger warn{Logger::Type::Warning};
-Logger err{Logger::Type::Error};
-Logger fatal{Logger::Type::Fatal};
+Logger<Type::Debug> dbg;
+Logger<Type::Log> log;
+Logger<Type::Warning> warn;
+Logger<Type::Error> err;
+Logger<Type::Fatal> fatal;
 
-void setLoggerVerbosity(LoggerVerbosity verbosity)
+static std::atomic<int> minType{(int)Type::Debug};
+
+static std::atomic<bool> hasSubsystemLevels{};
+static std::shared_mutex subsystemLevelsMutex;
+static std::unordered_map<std::string, int> subsystemLevels;
+
+static int verbosityToMinType(LoggerVerbosity verbosity)
 {
     switch (verbosity)
     {
-    case LoggerVerbosity::Quiet:
-        dbg.m_isEnabled   = false;
-        log.m_isEnabled   = false;
-        warn.m_isEnabled  = true;
-        err.m_isEnabled   = true;
-        fatal.m_isEnabled = true;
-        break;
+    case LoggerVerbosity::Quiet:   return (int)Type::Warning;
+    case LoggerVerbosity::Verbose: return (int)Type::Log;
+    case LoggerVerbosity::Debug:   return (int)Type::Debug;
+    }
+    return (int)Type::Debug;
+}
+
+void setLoggerVerbosity(LoggerVerbosity verbosity)
+{
+    minType = verbosityToMinType(verbosity);
+}
+
+void setSubsystemVerbosity(const std::string& subsystem, LoggerVerbosity verbosity)
+{
+    std::unique_lock<std::shared_mutex> lock{subsystemLevelsMutex};
+    subsystemLevels[subsystem] = verbosityToMinType(verbosity);
+    hasSubsystemLevels = true;
+}
+
+_PendingLine& _getPendingLine(Type type)
+{
+    thread_local _PendingLine lines[(int)Type::Fatal+1];
+    return lines[(int)type];
+}
 
-    case LoggerVerbosity::Verbose:
-        dbg.m_isEnabled   = false;
-        log.m_isEnabled   = true;
-        warn.m_isEnabled  = true;
-        err.m_isEnabled   = true;
-        fatal.m_isEnabled = true;
-        break;
+bool _isEnabled(Type type, const char* subsystem)
+{
+    if (type == Type::Fatal)
+        return true;
 
-    case LoggerVerbosity::Debug:
-        dbg.m_isEnabled   = true;
-        log.m_isEnabled   = true;
-        warn.m_isEnabled  = true;
-        err.m_isEnabled   = true;
-        fatal.m_isEnabled = true;
-        break;
+    // Only look up the subsystem if there are overrides
+    if (hasSubsystemLevels.load(std::memory_order_relaxed))
+    {
+        const std::string name = subsystem ? subsystem : _loggerPrefix;
+        if (!name.empty())
+        {
+            std::shared_lock<std::shared_mutex> lock{subsystemLevelsMutex};
+            auto it = subsystemLevels.find(name);
+            if (it != subsystemLevels.end())
+                return (int)type >= it->second;
+        }
     }
+    return (int)type >= minType.load(std::memory_order_relaxed);
 }
 
-} // End of namespace Logger
+namespace
+{
+
+struct Record
+{
+    Type type{};
+    std::string subsystem;
+    std::string text;
+    std::chrono::system_clock::time_point time;
+};
+
+/*
+ * Writes the records on a background thread.
+ *
+ * The records are passed in a bounded lock-free multi-producer single-consumer ring.
+ * When it's full, the debug and info records are dropped, the others wait for space.
+ */
+class Writer final
+{
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence{};
+        Record record;
+    };
+
+    std::unique_ptr<Slot[]> m_slots = std::make_unique<Slot[]>(LOGGER_QUEUE_SIZE);
+    std::atomic<size_t> m_enqueuePos{};
+    // Only touched by the writer thread
+    size_t m_dequeuePos{};
+    // Number of records written, for `flush()`
+    std::atomic<size_t> m_writtenCount{};
+    std::atomic<size_t> m_droppedCount{};
+
+    std::atomic<bool> m_isSleeping{};
+    std::atomic<bool> m_shouldStop{};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_sleepCond;
+    std::thread m_thread;
+
+    std::mutex m_fileMutex;
+    std::string m_filePath;
+    FILE* m_file{};
+    size_t m_fileSize{};
+
+    void _threadLoop();
+    bool _tryDequeue(Record* output);
+    void _rotateFile();
+    void _wakeUp();
+
+public:
+    Writer();
+
+    // Returns false if the ring is full
+    bool tryEnqueue(Record&& record);
+    inline void countDropped() { m_droppedCount.fetch_add(1, std::memory_order_relaxed); }
+    // Wait until the records enqueued so far are written
+    void flush();
+    void stop();
+    void write(const Record& record);
+    void setFile(const std::string& path);
+};
 
+Writer::Writer()
+{
+    for (size_t i{}; i < LOGGER_QUEUE_SIZE; ++i)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    m_thread = std::thread{&Writer::_threadLoop, this};
+}
+
+bool Writer::tryEnqueue(Record&& record)
+{
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true)
+    {
+        slot = &m_slots[pos%LOGGER_QUEUE_SIZE];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const intptr_t diff = (intptr_t)sequence-(intptr_t)pos;
+        if (diff == 0)
+        {
+            // The slot is free, claim it
+            // Sequentially consistent, so the writer going to sleep can't miss it
+            if (m_enqueuePos.compare_exchange_weak(pos, pos+1))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The writer hasn't consumed this slot yet
+            return false;
+        }
+        else
+        {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record = std::move(record);
+    slot->sequence.store(pos+1, std::memory_order_release);
+    _wakeUp();
+    return true;
+}
+
+bool Writer::_tryDequeue(Record* output)
+{
+    Slot& slot = m_slots[m_dequeuePos%LOGGER_QUEUE_SIZE];
+    if (slot.sequence.load(std::memory_order_acquire) != m_dequeuePos+1)
+        return false;
+
+    *output = std::move(slot.record);
+    slot.sequence.store(m_dequeuePos+LOGGER_QUEUE_SIZE, std::memory_order_release);
+    ++m_dequeuePos;
+    return true;
+}
+
+void Writer::_wakeUp()
+{
+    if (m_isSleeping.exchange(false))
+    {
+        std::lock_guard<std::mutex> guard{m_sleepMutex};
+        m_sleepCond.notify_one();
+    }
+}
+
+void Writer::_threadLoop()
+{
+    Record record;
+    while (true)
+    {
+        size_t count{};
+        while (_tryDequeue(&record))
+        {
+            write(record);
+            ++count;
+        }
+        if (count)
+        {
+            std::fflush(stdout);
+            std::fflush(stderr);
+            m_writtenCount.fetch_add(count, std::memory_order_release);
+        }
+
+        if (const size_t dropped = m_droppedCount.exchange(0))
+        {
+            write({Type::Warning, "Logger", std::to_string(dropped)+" records were dropped, the queue was full",
+                   std::chrono::system_clock::now()});
+        }
+
+        std::unique_lock<std::mutex> lock{m_sleepMutex};
+        if (m_shouldStop && m_dequeuePos == m_enqueuePos.load())
+            return;
+        // Check the ring again after announcing that we sleep, a producer may have missed it
+        m_isSleeping = true;
+        if (m_dequeuePos != m_enqueuePos.load() || m_shouldStop)
+        {
+            m_isSleeping = false;
+            continue;
+        }
+        // The timeout is only a safety net
+        m_sleepCond.wait_for(lock, std::chrono::milliseconds{100});
+        m_isSleeping = false;
+    }
+}
+
+void Writer::flush()
+{
+    const size_t target = m_enqueuePos.load();
+    while (m_writtenCount.load(std::memory_order_acquire) < target && m_thread.joinable())
+    {
+        _wakeUp();
+        std::this_thread::yield();
+    }
+}
+
+void Writer::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard{m_sleepMutex};
+        m_shouldStop = true;
+        m_sleepCond.notify_one();
+    }
+    if (m_thread.joinable())
+        m_thread.join();
+
+    std::lock_guard<std::mutex> guard{m_fileMutex};
+    if (m_file)
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void Writer::write(const Record& record)
+{
+    const char* color = LOGGER_COLOR_DEF;
+    const char* name = "";
+    switch (record.type)
+    {
+    case Type::Debug:   color = LOGGER_COLOR_DBG;   name = "[DBG]";   break;
+    case Type::Log:     color = LOGGER_COLOR_LOG;   name = "[INFO]";  break;
+    case Type::Warning: color = LOGGER_COLOR_WARN;  name = "[WARN]";  break;
+    case Type::Error:   color = LOGGER_COLOR_ERR;   name = "[ERR]";   break;
+    case Type::Fatal:   color = LOGGER_COLOR_FATAL; name = "[FATAL]"; break;
+    }
+    const std::string prefix = record.subsystem.empty() ? "" : '<'+record.subsystem+'>';
+
+    FILE* console = record.type <= Type::Log ? stdout : stderr;
+    std::fprintf(console, "%s%s%s" LOGGER_COLOR_DEF ": %s\n", color, name, prefix.c_str(), record.text.c_str());
+
+    std::lock_guard<std::mutex> guard{m_fileMutex};
+    if (!m_file)
+        return;
+
+    const std::time_t time = std::chrono::system_clock::to_time_t(record.time);
+    const int millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+            record.time.time_since_epoch()).count()%1000;
+    std::tm localTime{};
+    localtime_r(&time, &localTime);
+    char timeStr[32];
+    std::strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &localTime);
+
+    const int written = std::fprintf(m_file, "%s.%03d %s%s: %s\n",
+            timeStr, millis, name, prefix.c_str(), record.text.c_str());
+    if (written > 0)
+        m_fileSize += written;
+    if (m_fileSize >= LOGGER_FILE_MAX_SIZE)
+        _rotateFile();
+    else if (record.type >= Type::Warning)
+        std::fflush(m_file);
+}
+
+void Writer::_rotateFile()
+{
+    // Called with `m_fileMutex` locked
+    std::fclose(m_file);
+    m_file = nullptr;
+
+    // "log" -> "log.1" -> "log.2" ..., the oldest is overwritten
+    std::error_code ec;
+    for (int i=LOGGER_FILE_KEEP_COUNT-1; i >= 0; --i)
+    {
+        const std::string from = i == 0 ? m_filePath : m_filePath+'.'+std::to_string(i);
+        std::filesystem::rename(from, m_filePath+'.'+std::to_string(i+1), ec);
+    }
+
+    m_file = std::fopen(m_filePath.c_str(), "w");
+    m_fileSize = 0;
+}
+
+void Writer::setFile(const std::string& path)
+{
+    std::lock_guard<std::mutex> guard{m_fileMutex};
+    if (m_file)
+    {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+    m_filePath = path;
+    m_fileSize = 0;
+    if (path.empty())
+        return;
+
+    m_file = std::fopen(path.c_str(), "a");
+    if (m_file)
+    {
+        std::fseek(m_file, 0, SEEK_END);
+        m_fileSize = std::ftell(m_file);
+    }
+    else
+    {
+        std::fprintf(stderr, "Failed to open log file: %s\n", path.c_str());
+    }
+}
+
+// Set when the writer thread has been stopped at exit, the records are written synchronously after that
+std::atomic<bool> isWriterStopped{};
+std::mutex syncWriteMutex;
+
+/*
+ * The writer is never destroyed, so the static objects can log in their destructors.
+ * Its thread is stopped at exit.
+ */
+Writer* getWriter()
+{
+    static Writer* writer = [](){
+        Writer* writer = new Writer;
+        std::atexit([](){
+            getWriter()->stop();
+            isWriterStopped = true;
+        });
+        return writer;
+    }();
+    return writer;
+}
+
+} // namespace
+
+void _submit(Type type, _PendingLine& line)
+{
+    Record record{
+        type,
+        line.subsystem ? line.subsystem : _loggerPrefix,
+        line.stream.str(),
+        std::chrono::system_clock::now()};
+    line.stream.str({});
+    line.stream.clear();
+    line.subsystem = nullptr;
+    line.isStarted = false;
+
+    Writer* writer = getWriter();
+    if (isWriterStopped)
+    {
+        std::lock_guard<std::mutex> guard{syncWriteMutex};
+        writer->write(record);
+    }
+    else
+    {
+        while (!writer->tryEnqueue(std::move(record)))
+        {
+            // Don't block the typing for the chatty records
+            if (type <= Type::Log)
+            {
+                writer->countDropped();
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    if (type == Type::Fatal)
+    {
+        flush();
+        std::fputs("\n==================== Fatal error. Exiting. ====================\n", stderr);
+        abort();
+    }
+}
+
+void setLogFile(const std::string& path)
+{
+    getWriter()->setFile(path);
+}
+
+void flush()
+{
+    if (!isWriterStopped)
+        getWriter()->flush();
+}
+
+} // End of namespace Logger
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <iostream>
+#include <sstream>
+#include <string>
 #include "types.h"
+#include "config.h"
 
 std::string utf32To8(const String& input);
 String charToStr(Char c);
@@ -13,6 +16,25 @@ String charToStr(Char c);
 #define LOGGER_COLOR_ERR   "\033[91m"
 #define LOGGER_COLOR_FATAL "\033[101;97m"
 
+/*
+ * Log a record only if the level is enabled for `subsystem`.
+ * Unlike `Logger::dbg << ...`, the arguments are not evaluated otherwise,
+ * use this in the hot paths:
+ *
+ *     LOG_DBG("LSP") << "Sending: " << msg.ToJson() << Logger::End;
+ */
+#define LOGGER_LAZY(logger, subsystem) \
+    !Logger::logger.isEnabled(subsystem) ? (void)0 : Logger::_Voidify{} & Logger::logger.in(subsystem)
+#define LOG_DBG(subsystem)  LOGGER_LAZY(dbg, subsystem)
+#define LOG_INFO(subsystem) LOGGER_LAZY(log, subsystem)
+#define LOG_WARN(subsystem) LOGGER_LAZY(warn, subsystem)
+#define LOG_ERR(subsystem)  LOGGER_LAZY(err, subsystem)
+
+/*
+ * The records are formatted on the calling thread and queued,
+ * a background thread writes them to the console and the log file.
+ * Every thread builds its own line, so the threads don't mix their records.
+ */
 namespace Logger
 {
 
@@ -31,67 +53,96 @@ enum Control
     End, // Can be used to mark the end of the line
 };
 
-extern std::string _loggerPrefix;
-
-class Logger final
+/*
+ * The type of the logger, from the least to the most severe
+ */
+enum class Type
 {
-public:
-    /*
-     * The type of the logger
-     */
-    enum class Type
-    {
-        Debug,
-        Log,
-        Warning,
-        Error,
-        Fatal,
-    };
+    Debug,
+    Log,
+    Warning,
+    Error,
+    Fatal,
+};
 
-private:
-    // Whether this is the beginning of the line
-    bool m_isBeginning{true};
-    // The logger type: info, error, etc.
-    Type m_type{};
-    // If this logger object is enabled
-    bool m_isEnabled{true};
+// The prefix of the records of the current thread
+extern thread_local std::string _loggerPrefix;
 
-    friend void setLoggerVerbosity(LoggerVerbosity verbosity);
+// The record a logger is building on the current thread
+struct _PendingLine
+{
+    std::ostringstream stream;
+    // Set by `Logger::in()`, the prefix is used if null
+    const char* subsystem{};
+    bool isStarted{};
+    bool isEnabled{};
+};
 
+_PendingLine& _getPendingLine(Type type);
+bool _isEnabled(Type type, const char* subsystem);
+// Queue the line and reset it. Aborts if `type` is `Fatal`.
+void _submit(Type type, _PendingLine& line);
+
+template <Type type>
+class Logger final
+{
 public:
-    Logger(Type type)
-        : m_type{type}
-    {
-    }
+    // The levels below `LOGGER_MIN_LEVEL` are compiled out
+    static constexpr bool isCompiledIn = (int)type >= LOGGER_MIN_LEVEL || type == Type::Fatal;
 
-    template <typename T>
-    Logger& operator<<(const T &value)
+private:
+    // Returns null if the current line is not logged
+    _PendingLine* _getLine()
     {
-        if (!m_isEnabled)
-            return *this;
-
-        if (m_isBeginning)
+        if constexpr (!isCompiledIn)
+        {
+            return nullptr;
+        }
+        else
         {
-            switch (m_type)
+            _PendingLine& line = _getPendingLine(type);
+            if (!line.isStarted)
             {
-            case Type::Debug:   std::cout << LOGGER_COLOR_DBG   "[DBG]"   << (_loggerPrefix.empty() ? "" : '<'+_loggerPrefix+'>') << LOGGER_COLOR_DEF ": "; break;
-            case Type::Log:     std::cout << LOGGER_COLOR_LOG   "[INFO]"  << (_loggerPrefix.empty() ? "" : '<'+_loggerPrefix+'>') << LOGGER_COLOR_DEF ": "; break;
-            case Type::Warning: std::cerr << LOGGER_COLOR_WARN  "[WARN]"  << (_loggerPrefix.empty() ? "" : '<'+_loggerPrefix+'>') << LOGGER_COLOR_DEF ": "; break;
-            case Type::Error:   std::cerr << LOGGER_COLOR_ERR   "[ERR]"   << (_loggerPrefix.empty() ? "" : '<'+_loggerPrefix+'>') << LOGGER_COLOR_DEF ": "; break;
-            case Type::Fatal:   std::cerr << LOGGER_COLOR_FATAL "[FATAL]" << (_loggerPrefix.empty() ? "" : '<'+_loggerPrefix+'>') << LOGGER_COLOR_DEF ": "; break;
+                line.isStarted = true;
+                line.isEnabled = _isEnabled(type, nullptr);
             }
+            return line.isEnabled ? &line : nullptr;
         }
+    }
+
+public:
+    /*
+     * Whether a record would be written.
+     * `subsystem` overrides the prefix when looking up the runtime level.
+     */
+    bool isEnabled(const char* subsystem=nullptr) const
+    {
+        if constexpr (!isCompiledIn)
+            return false;
+        else
+            return _isEnabled(type, subsystem);
+    }
 
-        switch (m_type)
+    /*
+     * Start a record of a subsystem, it is shown as the prefix.
+     */
+    Logger& in(const char* subsystem)
+    {
+        if constexpr (isCompiledIn)
         {
-        case Type::Debug:   std::cout << value; break;
-        case Type::Log:     std::cout << value; break;
-        case Type::Warning: std::cerr << value; break;
-        case Type::Error:   std::cerr << value; break;
-        case Type::Fatal:   std::cerr << value; break;
+            _PendingLine& line = _getPendingLine(type);
+            line.subsystem = subsystem;
+            line.isStarted = true;
+            line.isEnabled = _isEnabled(type, subsystem);
         }
+        return *this;
+    }
 
-        m_isBeginning = false;
+    template <typename T>
+    Logger& operator<<(const T &value)
+    {
+        if (_PendingLine* line = _getLine())
+            line->stream << value;
 
         // Make the operator chainable
         return *this;
@@ -99,49 +150,43 @@ public:
 
     Logger& operator<<(const String& value)
     {
-        return this->operator<<(utf32To8(value));
+        if (_PendingLine* line = _getLine())
+            line->stream << utf32To8(value);
+        return *this;
     }
 
     Logger& operator<<(Char value)
     {
-        return this->operator<<(utf32To8(charToStr(value)));
+        if (_PendingLine* line = _getLine())
+            line->stream << utf32To8(charToStr(value));
+        return *this;
     }
 
     inline Logger& operator<<(Control ctrl)
     {
-        if (!m_isEnabled)
-            return *this;
         if (ctrl != End)
             return *this;
 
-        switch (m_type)
+        if constexpr (isCompiledIn)
         {
-        case Type::Debug:
-        case Type::Log:
-            std::cout << '\n';
-            break;
-
-        case Type::Warning:
-        case Type::Error:
-            std::cerr << '\n';
-            break;
-
-        case Type::Fatal:
-            std::cerr << '\n';
-            std::cerr << "\n==================== Fatal error. Exiting. ====================\n";
-            abort();
-            break;
+            _PendingLine& line = _getPendingLine(type);
+            if (line.isStarted && line.isEnabled)
+            {
+                _submit(type, line);
+            }
+            else
+            {
+                line.isStarted = false;
+                line.subsystem = nullptr;
+            }
         }
 
-        // We printed the \n, to this is the beginning of the new line
-        m_isBeginning = true;
-
         // Make the operator chainable
         return *this;
     }
 
     /*
-     * Sets the prefix to `prefix`.
+     * Sets the prefix of the current thread to `prefix`.
      */
     inline Logger& operator()(const std::string& prefix)
     {
@@ -160,16 +205,38 @@ public:
     }
 };
 
+// Turns the `LOGGER_LAZY()` expression into void
+struct _Voidify
+{
+    template <typename T>
+    void operator&(const T&) {}
+};
+
 /*
  * Logger object instances with different types
  */
-extern Logger dbg;
-extern Logger log;
-extern Logger warn;
-extern Logger err;
-extern Logger fatal;
+extern Logger<Type::Debug> dbg;
+extern Logger<Type::Log> log;
+extern Logger<Type::Warning> warn;
+extern Logger<Type::Error> err;
+extern Logger<Type::Fatal> fatal;
 
 void setLoggerVerbosity(LoggerVerbosity verbosity);
 
-} // End of namespace Logger
+/*
+ * Override the verbosity of the records with this prefix or subsystem.
+ */
+void setSubsystemVerbosity(const std::string& subsystem, LoggerVerbosity verbosity);
+
+/*
+ * Also write the records to this file. It is rotated when it grows larger than
+ * `LOGGER_FILE_MAX_SIZE`, keeping `LOGGER_FILE_KEEP_COUNT` old files.
+ */
+void setLogFile(const std::string& path);
 
+/*
+ * Wait until the queued records are written.
+ */
+void flush();
+
+} // End of namespace Logger
@@ -0,0 +1,360 @@
+#include "Profiler.h"
+#include "Logger.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+namespace Profiler
+{
+
+/*
+ * A finished zone. The fields are atomic because the slot may be overwritten
+ * by its thread while another thread is reading it, the readers check the
+ * write count afterwards to drop the torn entries.
+ */
+struct Event
+{
+    std::atomic<const char*> name{};
+    std::atomic<uint64_t> startNs{};
+    std::atomic<uint64_t> endNs{};
+    std::atomic<uint32_t> depth{};
+};
+
+struct ThreadBuffer
+{
+    uint32_t id{};
+    std::string name; // Guarded by `registryMutex`
+    std::unique_ptr<Event[]> events = std::make_unique<Event[]>(PROFILER_RING_SIZE);
+    // Number of events ever written, only written by the owner thread
+    std::atomic<uint64_t> writeCount{};
+};
+
+struct EventCopy
+{
+    const char* name;
+    uint64_t startNs;
+    uint64_t endNs;
+    uint32_t depth;
+};
+
+// The buffers are kept after their threads exit, so the trace contains them
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> threadBuffers;
+
+static thread_local ThreadBuffer* threadBuffer{};
+static thread_local uint32_t threadDepth{};
+
+static ThreadBuffer* getThreadBuffer()
+{
+    if (!threadBuffer)
+    {
+        auto buffer = std::make_unique<ThreadBuffer>();
+        threadBuffer = buffer.get();
+
+        std::lock_guard<std::mutex> guard{registryMutex};
+        buffer->id = threadBuffers.size()+1;
+        buffer->name = "Thread "+std::to_string(buffer->id);
+        threadBuffers.push_back(std::move(buffer));
+    }
+    return threadBuffer;
+}
+
+static void pushEvent(const char* name, uint64_t startNs, uint64_t endNs, uint32_t depth)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    const uint64_t index = buffer->writeCount.load(std::memory_order_relaxed);
+    Event& event = buffer->events[index%PROFILER_RING_SIZE];
+    event.name.store(name, std::memory_order_relaxed);
+    event.startNs.store(startNs, std::memory_order_relaxed);
+    event.endNs.store(endNs, std::memory_order_relaxed);
+    event.depth.store(depth, std::memory_order_relaxed);
+    buffer->writeCount.store(index+1, std::memory_order_release);
+}
+
+/*
+ * Copy the events of a buffer written after `sinceCount` that are still in the ring.
+ * Returns the write count at the time of the copy.
+ */
+static uint64_t copyEvents(const ThreadBuffer* buffer, uint64_t sinceCount, std::vector<EventCopy>* output)
+{
+    const uint64_t endCount = buffer->writeCount.load(std::memory_order_acquire);
+    uint64_t beginCount = std::max(sinceCount,
+            endCount > PROFILER_RING_SIZE ? endCount-PROFILER_RING_SIZE : 0);
+
+    const size_t oldSize = output->size();
+    for (uint64_t i=beginCount; i < endCount; ++i)
+    {
+        const Event& event = buffer->events[i%PROFILER_RING_SIZE];
+        output->push_back({
+                event.name.load(std::memory_order_relaxed),
+                event.startNs.load(std::memory_order_relaxed),
+                event.endNs.load(std::memory_order_relaxed),
+                event.depth.load(std::memory_order_relaxed)});
+    }
+
+    // Drop the events that the owner thread may have overwritten while we copied them
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t newCount = buffer->writeCount.load(std::memory_order_relaxed);
+    if (newCount > PROFILER_RING_SIZE && newCount-PROFILER_RING_SIZE > beginCount)
+    {
+        const size_t overwritten = std::min<uint64_t>(newCount-PROFILER_RING_SIZE-beginCount, endCount-beginCount);
+        output->erase(output->begin()+oldSize, output->begin()+oldSize+overwritten);
+    }
+    return endCount;
+}
+
+// ---------- Main thread only ----------
+
+struct ZoneHistory
+{
+    std::deque<float> historyMs;
+    uint32_t lastCallCount{};
+};
+
+static uint64_t frameStartNs{};
+static uint64_t frameStartCount{};
+static std::deque<float> frameHistoryMs;
+static std::unordered_map<const char*, ZoneHistory> zoneHistories;
+// How far the events of the other threads have been aggregated
+static std::unordered_map<const ThreadBuffer*, uint64_t> workerReadCounts;
+static FrameStats frameStats;
+
+static void pushHistory(std::deque<float>* history, float value)
+{
+    history->push_back(value);
+    if (history->size() > PROFILER_HISTORY_LEN)
+        history->pop_front();
+}
+
+static void calcStats(const std::deque<float>& history, double* outAvg, double* outMax)
+{
+    double sum{};
+    double max{};
+    for (float value : history)
+    {
+        sum += value;
+        max = std::max<double>(max, value);
+    }
+    *outAvg = history.empty() ? 0 : sum/history.size();
+    *outMax = max;
+}
+
+static double calcWorkerMs()
+{
+    std::vector<const ThreadBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> guard{registryMutex};
+        for (const auto& buffer : threadBuffers)
+        {
+            if (buffer.get() != threadBuffer)
+                buffers.push_back(buffer.get());
+        }
+    }
+
+    double workerMs{};
+    std::vector<EventCopy> events;
+    for (const ThreadBuffer* buffer : buffers)
+    {
+        events.clear();
+        uint64_t& readCount = workerReadCounts[buffer];
+        readCount = copyEvents(buffer, readCount, &events);
+        for (const auto& event : events)
+        {
+            // The nested zones are already included in their parents
+            if (event.depth == 0)
+                workerMs += (event.endNs-event.startNs)/1e6;
+        }
+    }
+    return workerMs;
+}
+
+static void writeJsonString(std::ostream& stream, const char* str)
+{
+    stream << '"';
+    for (; *str; ++str)
+    {
+        const char c = *str;
+        if (c == '"' || c == '\\')
+        {
+            stream << '\\' << c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            stream << escaped;
+        }
+        else
+        {
+            stream << c;
+        }
+    }
+    stream << '"';
+}
+
+uint64_t getTimeNs()
+{
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point startTime = clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-startTime).count();
+}
+
+void setThreadName(const std::string& name)
+{
+    ThreadBuffer* buffer = getThreadBuffer();
+    std::lock_guard<std::mutex> guard{registryMutex};
+    buffer->name = name;
+}
+
+Zone::Zone(const char* name)
+    : m_name{name}, m_startNs{getTimeNs()}
+{
+    ++threadDepth;
+}
+
+Zone::~Zone()
+{
+    --threadDepth;
+    pushEvent(m_name, m_startNs, getTimeNs(), threadDepth);
+}
+
+void beginFrame()
+{
+    frameStartNs = getTimeNs();
+    frameStartCount = getThreadBuffer()->writeCount.load(std::memory_order_relaxed);
+    ++threadDepth;
+}
+
+void endFrame()
+{
+    --threadDepth;
+    const uint64_t endNs = getTimeNs();
+    pushEvent("Frame", frameStartNs, endNs, threadDepth);
+
+    const double frameMs = (endNs-frameStartNs)/1e6;
+    pushHistory(&frameHistoryMs, frameMs);
+
+    // Sum up the zones of this frame by name
+    std::vector<EventCopy> events;
+    copyEvents(threadBuffer, frameStartCount, &events);
+    std::unordered_map<const char*, std::pair<double, uint32_t>> frameZones;
+    for (const auto& event : events)
+    {
+        if (event.depth == 0) // The frame itself
+            continue;
+        auto& [ms, count] = frameZones[event.name];
+        ms += (event.endNs-event.startNs)/1e6;
+        ++count;
+    }
+    for (const auto& [name, zone] : frameZones)
+        zoneHistories.emplace(name, ZoneHistory{});
+    for (auto& [name, history] : zoneHistories)
+    {
+        auto it = frameZones.find(name);
+        pushHistory(&history.historyMs, it == frameZones.end() ? 0 : it->second.first);
+        history.lastCallCount = it == frameZones.end() ? 0 : it->second.second;
+    }
+
+    frameStats.lastMs = frameMs;
+    calcStats(frameHistoryMs, &frameStats.avgMs, &frameStats.maxMs);
+    frameStats.historyMs.assign(frameHistoryMs.begin(), frameHistoryMs.end());
+    frameStats.workerMs = calcWorkerMs();
+    frameStats.zones.clear();
+    for (const auto& [name, history] : zoneHistories)
+    {
+        ZoneStats stats;
+        stats.name = name;
+        stats.lastMs = history.historyMs.back();
+        calcStats(history.historyMs, &stats.avgMs, &stats.maxMs);
+        // Forget the zones that haven't run for a while
+        if (stats.maxMs == 0)
+            continue;
+        stats.lastCallCount = history.lastCallCount;
+        stats.historyMs.assign(history.historyMs.begin(), history.historyMs.end());
+        frameStats.zones.push_back(std::move(stats));
+    }
+    std::sort(frameStats.zones.begin(), frameStats.zones.end(),
+            [](const ZoneStats& a, const ZoneStats& b){
+                return a.lastMs != b.lastMs ? a.lastMs > b.lastMs : a.avgMs > b.avgMs; });
+}
+
+const FrameStats& getFrameStats()
+{
+    return frameStats;
+}
+
+long writeChromeTrace(const std::string& path)
+{
+    struct ThreadEvents
+    {
+        uint32_t id;
+        std::string name;
+        std::vector<EventCopy> events;
+    };
+    std::vector<const ThreadBuffer*> buffers;
+    std::vector<ThreadEvents> threads;
+    {
+        std::lock_guard<std::mutex> guard{registryMutex};
+        for (const auto& buffer : threadBuffers)
+        {
+            buffers.push_back(buffer.get());
+            threads.push_back({buffer->id, buffer->name, {}});
+        }
+    }
+    for (size_t i{}; i < buffers.size(); ++i)
+        copyEvents(buffers[i], 0, &threads[i].events);
+
+    std::ofstream file{path};
+    if (!file.is_open())
+    {
+        Logger::err << "Failed to open trace file: " << path << ": " << std::strerror(errno) << Logger::End;
+        return -1;
+    }
+
+    const pid_t pid = getpid();
+    long eventCount{};
+    char numBuffer[64];
+    file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    bool isFirst = true;
+    for (const auto& thread : threads)
+    {
+        file << (isFirst ? "" : ",\n")
+             << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << thread.id
+             << ",\"args\":{\"name\":";
+        writeJsonString(file, thread.name.c_str());
+        file << "}}";
+        isFirst = false;
+
+        for (const auto& event : thread.events)
+        {
+            // Timestamps are in microseconds
+            std::snprintf(numBuffer, sizeof(numBuffer), "%.3f,\"dur\":%.3f",
+                    event.startNs/1e3, (event.endNs-event.startNs)/1e3);
+            file << ",\n{\"name\":";
+            writeJsonString(file, event.name);
+            file << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << thread.id << ",\"ts\":" << numBuffer << '}';
+            ++eventCount;
+        }
+    }
+    file << "\n]}\n";
+
+    file.close();
+    if (file.fail())
+    {
+        Logger::err << "Failed to write trace file: " << path << Logger::End;
+        return -1;
+    }
+    Logger::log << "Wrote " << eventCount << " profiler zones to " << path << Logger::End;
+    return eventCount;
+}
+
+} // namespace Profiler
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "config.h"
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+#if PROFILER_ENABLE
+/*
+ * Measure the time until the end of the enclosing scope.
+ * `name` has to be a string literal (or live until the end of the program).
+ */
+#   define PROFILE_ZONE(name) \
+        Profiler::Zone PROFILER_CONCAT(_profilerZone, __LINE__){name}
+#   define PROFILE_FUNC() PROFILE_ZONE(__PRETTY_FUNCTION__)
+#else
+#   define PROFILE_ZONE(name) do {\
+        } while (0)
+#   define PROFILE_FUNC() do {\
+        } while (0)
+#endif
+
+/*
+ * A profiler that records scoped zones with nanosecond timestamps.
+ *
+ * Every thread writes the finished zones into its own ring buffer without locking,
+ * the oldest zones are overwritten when it's full. The main thread aggregates
+ * the zones of every frame for the overlay shown in debug draw mode,
+ * and all of the buffers can be exported as a Chrome trace.
+ */
+namespace Profiler
+{
+
+// Nanoseconds since the start of the program (monotonic)
+uint64_t getTimeNs();
+
+/*
+ * Name the calling thread in the exported trace.
+ */
+void setThreadName(const std::string& name);
+
+class Zone final
+{
+private:
+    const char* m_name;
+    uint64_t m_startNs;
+
+public:
+    explicit Zone(const char* name);
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
+    ~Zone();
+};
+
+/*
+ * Mark the start and the end of the work the main loop does for a frame.
+ * Only call from the main thread.
+ */
+void beginFrame();
+void endFrame();
+
+struct ZoneStats
+{
+    const char* name{};
+    // Total time of the zones with this name in the last frame
+    double lastMs{};
+    double avgMs{};
+    double maxMs{};
+    uint32_t lastCallCount{};
+    // Total time in the recent frames, oldest first
+    std::vector<float> historyMs;
+};
+
+struct FrameStats
+{
+    double lastMs{};
+    double avgMs{};
+    double maxMs{};
+    // Oldest first
+    std::vector<float> historyMs;
+    // Time spent in the zones of the other threads that ended during the last frame
+    double workerMs{};
+    // Sorted by the time of the last frame, descending
+    std::vector<ZoneStats> zones;
+};
+
+/*
+ * The statistics of the recent frames. Only call from the main thread.
+ */
+const FrameStats& getFrameStats();
+
+/*
+ * Write the recorded zones of all threads to `path` as a Chrome trace
+ * (viewable in chrome://tracing or Perfetto).
+ *
+ * Returns:
+ *  + the number of written zones, or -1 on error.
+ */
+long writeChromeTrace(const std::string& path);
+
+} // namespace Profiler
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "FloatingWin.h"
+#include "EventLoop.h"
 
 class ProgressFloatingWin final : public FloatingWindow
 {
@@ -36,6 +37,7 @@ public:
         {
             ++m_tick;
             g_isRedrawNeeded = true;
+            EventLoop::wakeUpIn(0); // Animate
         }
     }
 };
@@ -6,6 +6,10 @@
 #include "App.h"
 #include "Bindings.h"
 #include "globals.h"
+#include "EventLoop.h"
+#include "Profiler.h"
+#include <filesystem>
+#include <ctime>
 
 #define PROMPT_ANIM_LEN_MS (100)
 
@@ -87,6 +91,19 @@ void Prompt::runCommand()
 
         Bindings::Callbacks::createTempBufferInNewTab();
     }
+    else if (cmd == U"profile")
+    {
+        // Write the profiler zones as a Chrome trace, to the temp dir by default
+        const std::string path = args.empty()
+            ? (std::filesystem::temp_directory_path()
+                    /("haxedit-trace-"+std::to_string(std::time(nullptr))+".json")).string()
+            : utf32To8(args);
+        const long zoneCount = Profiler::writeChromeTrace(path);
+        if (zoneCount < 0)
+            g_statMsg.set("Failed to write profile: "+path, StatusMsg::Type::Error);
+        else
+            g_statMsg.set("Wrote profile ("+std::to_string(zoneCount)+" zones): "+path, StatusMsg::Type::Info);
+    }
     else
     {
         g_statMsg.set("Unknown command", StatusMsg::Type::Error);
@@ -136,6 +153,7 @@ void Prompt::update(float frameTimeMs)
 
         m_slideVal += valChange;
         g_isRedrawNeeded = true;
+        EventLoop::wakeUpIn(0); // Animate
     }
     else
     {
@@ -144,6 +162,7 @@ void Prompt::update(float frameTimeMs)
 
         m_slideVal -= valChange;
         g_isRedrawNeeded = true;
+        EventLoop::wakeUpIn(0); // Animate
     }
 }
 
@@ -0,0 +1,495 @@
+#include "RenderBenchmark.h"
+#include "App.h"
+#include "Bindings.h"
+#include "Profiler.h"
+#include "FileWatcher.h"
+#include "ThreadPool.h"
+#include "Git.h"
+#include "glstuff.h"
+#include "globals.h"
+#include "../external/cJSON/cJSON.h"
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace RenderBenchmark
+{
+
+struct Options
+{
+    int frameCount = 300;
+    int winWidth = DEF_WIN_W;
+    int winHeight = DEF_WIN_H;
+    std::string outPath = "render_benchmark.json";
+    std::string tracePath;
+    std::vector<std::string> filePaths;
+};
+
+struct Scenario
+{
+    const char* name;
+    // Called once before the first frame
+    std::function<void(Buffer*)> setup;
+    // Called before rendering each frame
+    std::function<void(Buffer*, int frameI)> step;
+};
+
+struct Series
+{
+    std::string name;
+    const char* unit;
+    std::vector<double> samples;
+};
+
+// The frames rendered before each scenario to fill the glyph atlas, etc.
+static constexpr int warmupFrameCount = 10;
+
+static void printUsage(const char* exeName)
+{
+    std::cerr << "Usage: " << exeName
+        << " --bench-render [--frames N] [--size WxH] [--out FILE] [--trace FILE] [FILES...]\n";
+}
+
+static bool parseArgs(int argc, char** argv, Options* output)
+{
+    for (int i{}; i < argc; ++i)
+    {
+        const bool hasValue = i+1 < argc;
+        if (std::strcmp(argv[i], "--frames") == 0 && hasValue)
+        {
+            output->frameCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (std::strcmp(argv[i], "--size") == 0 && hasValue)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &output->winWidth, &output->winHeight) != 2
+             || output->winWidth < 200 || output->winHeight < 100)
+                return false;
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && hasValue)
+        {
+            output->outPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && hasValue)
+        {
+            output->tracePath = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            output->filePaths.push_back(argv[i]);
+        }
+    }
+    return true;
+}
+
+// Write C++-like code with some long lines, the same for every run
+static std::string genSourceFile(int lineCount)
+{
+    std::mt19937 rng{1234};
+    static const char* const words[] = {
+        "int", "return", "value", "buffer", "size_t", "const", "auto", "for", "if", "while",
+        "std::string", "count", "index", "result", "nullptr", "true", "false", "0x7f", "42",
+    };
+
+    const std::string path = (fs::temp_directory_path()/"HaxEdit_render_benchmark.cpp").string();
+    std::ofstream file{path};
+    for (int i{}; i < lineCount; ++i)
+    {
+        if (i%40 == 0)
+        {
+            file << "// Function number " << i/40 << ", with a \"string\" in the comment\n";
+            continue;
+        }
+        file << std::string((1+rng()%3)*4, ' ');
+        const size_t wordCount = (i%97 == 0 ? 60 : 2+rng()%10);
+        for (size_t j{}; j < wordCount; ++j)
+            file << words[rng()%std::size(words)] << (j+1 == wordCount ? ";" : " ");
+        file << '\n';
+    }
+    return path;
+}
+
+static bool initWindow()
+{
+    // Use EGL without a display server if GLFW supports it
+    const bool isHeadless = !std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY");
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4)
+    if (isHeadless)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+#else
+    if (isHeadless)
+        Logger::warn << "No display and GLFW is older than 3.4, creating the window may fail" << Logger::End;
+#endif
+
+    if (!glfwInit())
+    {
+        Logger::err << "Failed to initialize GLFW" << Logger::End;
+        return false;
+    }
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#if GLFW_VERSION_MAJOR > 3 || (GLFW_VERSION_MAJOR == 3 && GLFW_VERSION_MINOR >= 4)
+    if (isHeadless)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+#endif
+    g_window = App::createWindow();
+    // We never swap, but don't wait for the vsync if something does
+    glfwSwapInterval(0);
+    App::initGlew();
+    App::setupGlFeatures();
+
+    Logger::log << "Renderer: " << (const char*)glGetString(GL_RENDERER)
+        << ", version: " << (const char*)glGetString(GL_VERSION) << Logger::End;
+    return true;
+}
+
+/*
+ * Render into a framebuffer of our own, an invisible or surfaceless window
+ * may not have a usable default framebuffer.
+ */
+static bool createFramebuffer(int width, int height, uint* outFbo, uint* outRbo)
+{
+    glGenFramebuffers(1, outFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, *outFbo);
+    glGenRenderbuffers(1, outRbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, *outRbo);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, *outRbo);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        Logger::err << "The offscreen framebuffer is incomplete" << Logger::End;
+        return false;
+    }
+    return true;
+}
+
+static void initEditor()
+{
+    const App::FontPaths fontPaths = App::resolveFontPaths();
+    g_textRenderer.reset(App::createTextRenderer(fontPaths));
+    g_uiRenderer.reset(App::createUiRenderer());
+    g_hoverPopup.reset(new FloatingWindow);
+    g_progressPopup.reset(new ProgressFloatingWin);
+    g_lspInfoPopup.reset(new FloatingWindow);
+    g_recentFilePaths = std::make_unique<RecentFileList>();
+    g_fileWatcher = std::make_unique<FileWatcher>();
+    g_theme.reset(App::loadTheme());
+    g_fileTypeHandler.reset(App::createFileTypeHandler());
+    App::setupKeyBindings();
+    App::initGit();
+    App::loadSignImages();
+    // The highlighting is done by the workers, we wait for it before measuring
+    g_threadPool = std::make_unique<ThreadPool>();
+    // No LSP server, so the frames only depend on the scenario
+    App::createAutocompleteProviders(nullptr);
+    g_editorMode.set(EditorMode::_EditorMode::Normal);
+}
+
+static void resetView(Buffer* buffer)
+{
+    g_editorMode.set(EditorMode::_EditorMode::Normal);
+    buffer->closeSelection();
+    buffer->moveCursorToLineCol(0, 0);
+    // Scroll to the top
+    buffer->scrollBy(INT_MAX/2);
+}
+
+static std::vector<Scenario> makeScenarios()
+{
+    static const String typedText = U"    if (result != nullptr && count > 0) { return value; }\n";
+
+    return {
+        {"idle", [](Buffer*){}, [](Buffer*, int){}},
+        {"scroll",
+            [](Buffer*){},
+            [](Buffer* buffer, int){ buffer->scrollBy(-g_fontSizePx); }},
+        {"select",
+            [](Buffer* buffer){ buffer->startSelection(Buffer::Selection::Mode::Normal); },
+            [](Buffer* buffer, int frameI){
+                buffer->moveCursor(frameI%4 == 3 ? Buffer::CursorMovCmd::LineEnd : Buffer::CursorMovCmd::Down); }},
+        // Typing shows the autocompletion popup too
+        {"type",
+            [](Buffer* buffer){
+                buffer->moveCursorToLineCol(20, 0);
+                g_editorMode.set(EditorMode::_EditorMode::Insert);
+            },
+            [](Buffer* buffer, int frameI){ buffer->insertCharAtCursor(typedText[frameI%typedText.size()]); }},
+    };
+}
+
+struct FrameResult
+{
+    double cpuNs{};
+    double finishNs{};
+    GlStats::Counters counters;
+};
+
+static FrameResult renderFrame()
+{
+    Profiler::beginFrame();
+    GlStats::reset();
+    const uint64_t startNs = Profiler::getTimeNs();
+
+    glClearColor(UNPACK_RGB_COLOR(g_theme->bgColor), 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    App::renderBuffers();
+    App::renderTabLine();
+    App::renderStatusLine();
+    App::renderPopups();
+
+    const uint64_t cpuEndNs = Profiler::getTimeNs();
+    const GlStats::Counters counters = GlStats::counters;
+    // Wait for the rasterization, so the next frame doesn't pay for it
+    glFinish();
+    const uint64_t finishEndNs = Profiler::getTimeNs();
+    Profiler::endFrame();
+
+    return {double(cpuEndNs-startNs), double(finishEndNs-cpuEndNs), counters};
+}
+
+/*
+ * Render until the workers have highlighted the whole buffer,
+ * otherwise the first scenarios would measure plain text.
+ */
+static void waitForHighlighting(Buffer* buffer)
+{
+    // The results of the workers are taken when rendering
+    while (!buffer->isHighlightingDone())
+    {
+        renderFrame();
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+}
+
+static void runScenario(const Scenario& scenario, Buffer* buffer, int frameCount,
+        const std::string& prefix, std::vector<Series>* output)
+{
+    resetView(buffer);
+    for (int i{}; i < warmupFrameCount; ++i)
+        renderFrame();
+    scenario.setup(buffer);
+
+    std::vector<Series> series = {
+        {prefix+"/cpu", "ns", {}},
+        {prefix+"/gl_finish", "ns", {}},
+        {prefix+"/wrapped_gl_calls", "count", {}},
+        {prefix+"/draw_calls", "count", {}},
+        {prefix+"/texture_binds", "count", {}},
+        {prefix+"/texture_uploads", "count", {}},
+        {prefix+"/buffer_uploads", "count", {}},
+        {prefix+"/uploaded_bytes", "bytes", {}},
+    };
+    std::map<std::string, std::vector<double>> zoneSamples;
+    for (int frameI{}; frameI < frameCount; ++frameI)
+    {
+        scenario.step(buffer, frameI);
+        const FrameResult result = renderFrame();
+        series[0].samples.push_back(result.cpuNs);
+        series[1].samples.push_back(result.finishNs);
+        series[2].samples.push_back(result.counters.wrappedCalls);
+        series[3].samples.push_back(result.counters.drawCalls);
+        series[4].samples.push_back(result.counters.textureBinds);
+        series[5].samples.push_back(result.counters.textureUploads);
+        series[6].samples.push_back(result.counters.bufferUploads);
+        series[7].samples.push_back(result.counters.uploadedBytes);
+
+        for (const auto& zone : Profiler::getFrameStats().zones)
+        {
+            std::vector<double>& samples = zoneSamples[zone.name];
+            // Zero for the frames where it didn't run
+            samples.resize(frameI+1, 0);
+            samples[frameI] += zone.lastMs*1e6;
+        }
+    }
+    for (auto& [name, samples] : zoneSamples)
+    {
+        samples.resize(frameCount, 0);
+        series.push_back({prefix+"/zone/"+name, "ns", std::move(samples)});
+    }
+
+    output->insert(output->end(), std::make_move_iterator(series.begin()), std::make_move_iterator(series.end()));
+}
+
+struct Stats
+{
+    double min{};
+    double median{};
+    double mean{};
+    double stddev{};
+    double max{};
+};
+
+static Stats calcStats(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    Stats stats;
+    stats.min = samples.front();
+    stats.median = samples[samples.size()/2];
+    stats.max = samples.back();
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0)/samples.size();
+    double variance{};
+    for (double sample : samples)
+        variance += (sample-stats.mean)*(sample-stats.mean);
+    stats.stddev = std::sqrt(variance/std::max<size_t>(samples.size()-1, 1));
+    return stats;
+}
+
+static void printReport(const std::vector<Series>& series)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& entry : series)
+    {
+        // The zone list is long, only show the interesting ones
+        if (entry.name.find("/zone/") != std::string::npos
+         && entry.name.find("Buffer::render") == std::string::npos
+         && entry.name.find("renderString") == std::string::npos)
+            continue;
+
+        const Stats stats = calcStats(entry.samples);
+        if (std::strcmp(entry.unit, "ns") == 0)
+            std::cout << entry.name << ": median " << stats.median/1e6 << " ms, max " << stats.max/1e6 << " ms\n";
+        else
+            std::cout << entry.name << ": median " << stats.median << ", mean " << stats.mean << '\n';
+    }
+    std::cout << std::defaultfloat;
+}
+
+static bool writeJson(const std::string& path, const std::vector<Series>& series, const Options& options)
+{
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "schemaVersion", 1);
+    cJSON_AddNumberToObject(json, "timestamp", std::time(nullptr));
+#ifdef NDEBUG
+    cJSON_AddStringToObject(json, "buildType", "release");
+#else
+    cJSON_AddStringToObject(json, "buildType", "debug");
+#endif
+    cJSON_AddStringToObject(json, "renderer", (const char*)glGetString(GL_RENDERER));
+    cJSON_AddStringToObject(json, "windowSize",
+            (std::to_string(options.winWidth)+'x'+std::to_string(options.winHeight)).c_str());
+    cJSON* benchmarks = cJSON_AddArrayToObject(json, "benchmarks");
+    for (const auto& entry : series)
+    {
+        const Stats stats = calcStats(entry.samples);
+        cJSON* bench = cJSON_CreateObject();
+        cJSON_AddStringToObject(bench, "name", entry.name.c_str());
+        cJSON_AddStringToObject(bench, "unit", entry.unit);
+        cJSON_AddNumberToObject(bench, "repetitions", entry.samples.size());
+        cJSON_AddNumberToObject(bench, "min", stats.min);
+        cJSON_AddNumberToObject(bench, "median", stats.median);
+        cJSON_AddNumberToObject(bench, "mean", stats.mean);
+        cJSON_AddNumberToObject(bench, "stddev", stats.stddev);
+        cJSON_AddNumberToObject(bench, "max", stats.max);
+        cJSON_AddItemToArray(benchmarks, bench);
+    }
+
+    char* printed = cJSON_Print(json);
+    std::ofstream file{path};
+    file << printed << '\n';
+    cJSON_free(printed);
+    cJSON_Delete(json);
+    return file.good();
+}
+
+int run(int argc, char** argv)
+{
+    Options options;
+    if (!parseArgs(argc, argv, &options))
+    {
+        printUsage(g_exePath.c_str());
+        return 1;
+    }
+    Logger::setLoggerVerbosity(Logger::LoggerVerbosity::Quiet);
+
+    std::string generatedPath;
+    if (options.filePaths.empty())
+    {
+        generatedPath = genSourceFile(20000);
+        options.filePaths.push_back(generatedPath);
+    }
+
+    if (!initWindow())
+        return 1;
+    uint fbo{};
+    uint rbo{};
+    if (!createFramebuffer(options.winWidth, options.winHeight, &fbo, &rbo))
+        return 1;
+    initEditor();
+
+    for (const auto& path : options.filePaths)
+    {
+        Buffer* buffer = new Buffer;
+        buffer->open(path);
+        g_tabs.push_back(std::make_unique<Split>(buffer));
+    }
+    // Lay out the buffers, the window events are not processed
+    glfwSetWindowSize(g_window, options.winWidth, options.winHeight);
+    App::windowResizeCB(g_window, options.winWidth, options.winHeight);
+
+    std::vector<Series> series;
+    const std::vector<Scenario> scenarios = makeScenarios();
+    for (size_t tabI{}; tabI < g_tabs.size(); ++tabI)
+    {
+        g_currTabI = tabI;
+        g_activeBuff = g_tabs[tabI]->getActiveBufferRecursively();
+        const std::string fileName = fs::path{options.filePaths[tabI]}.filename().string();
+        waitForHighlighting(g_activeBuff);
+        for (const auto& scenario : scenarios)
+        {
+            Logger::log << "Running scenario: " << fileName << '/' << scenario.name << Logger::End;
+            runScenario(scenario, g_activeBuff, options.frameCount, "render/"+fileName+'/'+scenario.name, &series);
+        }
+    }
+
+    printReport(series);
+    int exitCode = 0;
+    if (writeJson(options.outPath, series, options))
+    {
+        std::cout << "Wrote results to " << options.outPath << '\n';
+    }
+    else
+    {
+        std::cerr << "Failed to write results: " << options.outPath << '\n';
+        exitCode = 1;
+    }
+    if (!options.tracePath.empty() && Profiler::writeChromeTrace(options.tracePath) < 0)
+        exitCode = 1;
+
+    // The typing modified the buffers, they are not saved
+    g_activeBuff = nullptr;
+    g_tabs.clear();
+    // Stop the workers before the window is gone
+    g_threadPool.reset();
+    g_fileWatcher.reset();
+    glDeleteRenderbuffers(1, &rbo);
+    glDeleteFramebuffers(1, &fbo);
+    glfwDestroyWindow(g_window);
+    glfwTerminate();
+    Git::shutdown();
+    if (!generatedPath.empty())
+    {
+        std::error_code ec;
+        fs::remove(generatedPath, ec);
+    }
+    return exitCode;
+}
+
+} // namespace RenderBenchmark
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Measures the rendering without a desktop session.
+ *
+ * Renders into an offscreen framebuffer of an invisible window. Without a display
+ * (and with GLFW 3.4+), the null platform with an EGL context is used, which works
+ * on Mesa's software rasterizer (llvmpipe).
+ * The files (or a generated one) are loaded into buffers, then scripted scenarios
+ * (idle, scroll, select, type) are rendered. The CPU time of the render calls,
+ * the time until the GL work finishes, the GL call counts and the profiler zones
+ * are reported per scenario and written as JSON, which `scripts/compare_benchmarks.py`
+ * can compare to a baseline.
+ *
+ * Usage: HaxEdit --bench-render [--frames N] [--size WxH] [--out FILE] [--trace FILE] [FILES...]
+ */
+namespace RenderBenchmark
+{
+
+/*
+ * Run the benchmark with the arguments after `--bench-render`.
+ * Returns the exit code.
+ */
+int run(int argc, char** argv);
+
+} // namespace RenderBenchmark
@@ -0,0 +1,1017 @@
+#include "Search.h"
+#include "Document.h"
+#include "config.h"
+#include "Logger.h"
+#include "common/string.h"
+#include <unicode/uchar.h>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <cassert>
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
+namespace Search
+{
+
+String parseFlags(const String& input, Flags* outFlags)
+{
+    *outFlags = {};
+    size_t i{};
+    while (i+1 < input.size() && input[i] == '\\')
+    {
+        if (input[i+1] == 'c')
+            outFlags->isIgnoreCase = true;
+        else if (input[i+1] == 'v')
+            outFlags->isRegex = true;
+        else
+            break;
+        i += 2;
+    }
+    return input.substr(i);
+}
+
+//------------------------------------------------ Regex ------------------------------------------------
+
+struct Regex::Node
+{
+    enum class Type
+    {
+        Class,
+        Begin,
+        End,
+        Concat,
+        Alt,
+        Star,
+        Plus,
+        Quest,
+    } type;
+    int classI{};
+    std::vector<std::unique_ptr<Node>> children;
+};
+
+class Regex::Parser final
+{
+private:
+    using nodePtr_t = std::unique_ptr<Node>;
+    using Type = Node::Type;
+
+    static constexpr int MAX_DEPTH = 64;
+
+    const String& m_pattern;
+    size_t m_pos{};
+    Regex* m_regex;
+
+    [[noreturn]] void _error(const std::string& msg) const
+    {
+        throw std::runtime_error{"Invalid regex: "+msg+" (at column "+std::to_string(m_pos+1)+")"};
+    }
+
+    inline bool _isAtEnd() const { return m_pos >= m_pattern.size(); }
+
+    static nodePtr_t _makeNode(Type type)
+    {
+        auto node = std::make_unique<Node>();
+        node->type = type;
+        return node;
+    }
+
+    nodePtr_t _makeClassNode(CharClass&& cls)
+    {
+        m_regex->m_classes.push_back(std::move(cls));
+        auto node = _makeNode(Type::Class);
+        node->classI = m_regex->m_classes.size()-1;
+        return node;
+    }
+
+    static Char _unescape(Char c)
+    {
+        switch (c)
+        {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        default:  return c;
+        }
+    }
+
+    // Add the characters of `\d`, `\w` or `\s`
+    static bool _addEscapeClass(Char c, CharClass* cls)
+    {
+        switch (c)
+        {
+        case 'd':
+            cls->ranges.push_back({'0', '9'});
+            return true;
+        case 'w':
+            cls->ranges.push_back({'a', 'z'});
+            cls->ranges.push_back({'A', 'Z'});
+            cls->ranges.push_back({'0', '9'});
+            cls->ranges.push_back({'_', '_'});
+            return true;
+        case 's':
+            for (Char space : std::u32string_view{U" \t\r\n\f\v"})
+                cls->ranges.push_back({space, space});
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // After the `[`
+    CharClass _parseClass()
+    {
+        CharClass cls;
+        if (!_isAtEnd() && m_pattern[m_pos] == '^')
+        {
+            cls.isNegated = true;
+            ++m_pos;
+        }
+
+        bool isFirst = true;
+        while (true)
+        {
+            if (_isAtEnd())
+                _error("Missing ]");
+            Char low = m_pattern[m_pos++];
+            // A `]` at the beginning is a literal
+            if (low == ']' && !isFirst)
+                break;
+            isFirst = false;
+
+            if (low == '\\')
+            {
+                if (_isAtEnd())
+                    _error("Trailing backslash");
+                const Char escaped = m_pattern[m_pos++];
+                if (_addEscapeClass(escaped, &cls))
+                    continue;
+                if (escaped == 'D' || escaped == 'W' || escaped == 'S')
+                    _error("Negated class escapes are not supported inside []");
+                low = _unescape(escaped);
+            }
+
+            Char high = low;
+            if (m_pos+1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos+1] != ']')
+            {
+                high = m_pattern[m_pos+1];
+                m_pos += 2;
+                if (high == '\\')
+                {
+                    if (_isAtEnd())
+                        _error("Trailing backslash");
+                    high = _unescape(m_pattern[m_pos++]);
+                }
+                if (high < low)
+                    _error("Invalid range");
+            }
+            cls.ranges.push_back({low, high});
+        }
+        return cls;
+    }
+
+    nodePtr_t _parseAtom(int depth)
+    {
+        const Char c = m_pattern[m_pos++];
+        switch (c)
+        {
+        case '(':
+        {
+            if (depth >= MAX_DEPTH)
+                _error("Too deeply nested");
+            nodePtr_t node = _parseAlt(depth+1);
+            if (_isAtEnd() || m_pattern[m_pos] != ')')
+                _error("Missing )");
+            ++m_pos;
+            return node;
+        }
+
+        case '*':
+        case '+':
+        case '?':
+            --m_pos;
+            _error("Nothing to repeat");
+
+        case '.':
+            // A negated empty class matches everything
+            return _makeClassNode({{}, true});
+
+        case '^':
+            return _makeNode(Type::Begin);
+
+        case '$':
+            return _makeNode(Type::End);
+
+        case '[':
+            return _makeClassNode(_parseClass());
+
+        case '\\':
+        {
+            if (_isAtEnd())
+                _error("Trailing backslash");
+            const Char escaped = m_pattern[m_pos++];
+            CharClass cls;
+            if (_addEscapeClass(u_tolower(escaped), &cls))
+            {
+                cls.isNegated = u_isupper(escaped);
+                return _makeClassNode(std::move(cls));
+            }
+            const Char literal = _unescape(escaped);
+            return _makeClassNode({{{literal, literal}}, false});
+        }
+
+        default:
+            return _makeClassNode({{{c, c}}, false});
+        }
+    }
+
+    nodePtr_t _parseRepeat(int depth)
+    {
+        nodePtr_t atom = _parseAtom(depth);
+        while (!_isAtEnd())
+        {
+            Type type;
+            switch (m_pattern[m_pos])
+            {
+            case '*': type = Type::Star; break;
+            case '+': type = Type::Plus; break;
+            case '?': type = Type::Quest; break;
+            default: return atom;
+            }
+            if (atom->type == Type::Begin || atom->type == Type::End)
+                _error("Nothing to repeat");
+            ++m_pos;
+
+            nodePtr_t node = _makeNode(type);
+            node->children.push_back(std::move(atom));
+            atom = std::move(node);
+        }
+        return atom;
+    }
+
+    nodePtr_t _parseConcat(int depth)
+    {
+        nodePtr_t node = _makeNode(Type::Concat);
+        while (!_isAtEnd() && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')')
+            node->children.push_back(_parseRepeat(depth));
+        return node;
+    }
+
+    nodePtr_t _parseAlt(int depth)
+    {
+        nodePtr_t first = _parseConcat(depth);
+        if (_isAtEnd() || m_pattern[m_pos] != '|')
+            return first;
+
+        nodePtr_t node = _makeNode(Type::Alt);
+        node->children.push_back(std::move(first));
+        while (!_isAtEnd() && m_pattern[m_pos] == '|')
+        {
+            ++m_pos;
+            node->children.push_back(_parseConcat(depth));
+        }
+        return node;
+    }
+
+public:
+    Parser(const String& pattern, Regex* regex)
+        : m_pattern{pattern}, m_regex{regex}
+    {
+    }
+
+    nodePtr_t parse()
+    {
+        nodePtr_t root = _parseAlt(0);
+        if (!_isAtEnd())
+            _error("Unmatched )");
+        return root;
+    }
+};
+
+Regex::Regex(const String& pattern, bool isIgnoreCase)
+    : m_isIgnoreCase{isIgnoreCase}
+{
+    using InstType = Inst::Type;
+
+    const std::unique_ptr<Node> root = Parser{pattern, this}.parse();
+
+    std::vector<Inst> program;
+    _emit(*root, false, &program);
+    program.push_back({InstType::Match});
+    m_forwardDfa.init(this, std::move(program));
+
+    // L0: split L1, L3; L1: any; L2: jump L0; L3: reversed pattern
+    // The `.*` prefix makes it match anywhere
+    m_classes.push_back({{}, true});
+    program.clear();
+    program.push_back({InstType::Split, 1, 3});
+    program.push_back({InstType::Class, int(m_classes.size()-1)});
+    program.push_back({InstType::Jump, 0});
+    _emit(*root, true, &program);
+    program.push_back({InstType::Match});
+    m_reverseDfa.init(this, std::move(program));
+}
+
+void Regex::_emit(const Node& node, bool isReversed, std::vector<Inst>* program) const
+{
+    using Type = Node::Type;
+    using InstType = Inst::Type;
+
+    switch (node.type)
+    {
+    case Type::Class:
+        program->push_back({InstType::Class, node.classI});
+        break;
+
+    // The beginning of the reversed input is the end of the line
+    case Type::Begin:
+        program->push_back({isReversed ? InstType::End : InstType::Begin});
+        break;
+
+    case Type::End:
+        program->push_back({isReversed ? InstType::Begin : InstType::End});
+        break;
+
+    case Type::Concat:
+        if (isReversed)
+        {
+            for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+                _emit(**it, isReversed, program);
+        }
+        else
+        {
+            for (const auto& child : node.children)
+                _emit(*child, isReversed, program);
+        }
+        break;
+
+    case Type::Alt:
+    {
+        // split L1, L2; L1: a; jump END; L2: split ...; last; END:
+        std::vector<int> jumps;
+        for (size_t i{}; i < node.children.size(); ++i)
+        {
+            const bool isLast = i+1 == node.children.size();
+            const int split = program->size();
+            if (!isLast)
+                program->push_back({InstType::Split, split+1});
+            _emit(*node.children[i], isReversed, program);
+            if (!isLast)
+            {
+                jumps.push_back(program->size());
+                program->push_back({InstType::Jump});
+                (*program)[split].arg2 = program->size();
+            }
+        }
+        for (int jump : jumps)
+            (*program)[jump].arg1 = program->size();
+        break;
+    }
+
+    case Type::Star:
+    {
+        // L1: split L2, END; L2: a; jump L1; END:
+        const int split = program->size();
+        program->push_back({InstType::Split, split+1});
+        _emit(*node.children[0], isReversed, program);
+        program->push_back({InstType::Jump, split});
+        (*program)[split].arg2 = program->size();
+        break;
+    }
+
+    case Type::Plus:
+    {
+        // L1: a; split L1, END; END:
+        const int start = program->size();
+        _emit(*node.children[0], isReversed, program);
+        const int split = program->size();
+        program->push_back({InstType::Split, start, split+1});
+        break;
+    }
+
+    case Type::Quest:
+    {
+        // split L1, END; L1: a; END:
+        const int split = program->size();
+        program->push_back({InstType::Split, split+1});
+        _emit(*node.children[0], isReversed, program);
+        (*program)[split].arg2 = program->size();
+        break;
+    }
+    }
+}
+
+bool Regex::_classContains(const CharClass& cls, Char c) const
+{
+    auto contains{[&](Char ch){
+        for (const auto& [low, high] : cls.ranges)
+        {
+            if (ch >= low && ch <= high)
+                return true;
+        }
+        return false;
+    }};
+
+    bool result = contains(c);
+    if (!result && m_isIgnoreCase)
+        result = contains(u_tolower(c)) || contains(u_toupper(c));
+    return result != cls.isNegated;
+}
+
+void Regex::Dfa::_addClosure(int pc, bool isAtBegin, std::vector<int>* output, std::vector<bool>* visited) const
+{
+    std::vector<int> stack{pc};
+    while (!stack.empty())
+    {
+        pc = stack.back();
+        stack.pop_back();
+        if ((*visited)[pc])
+            continue;
+        (*visited)[pc] = true;
+
+        const Inst& inst = m_program[pc];
+        switch (inst.type)
+        {
+        case Inst::Type::Split:
+            stack.push_back(inst.arg2);
+            stack.push_back(inst.arg1);
+            break;
+
+        case Inst::Type::Jump:
+            stack.push_back(inst.arg1);
+            break;
+
+        case Inst::Type::Begin:
+            if (isAtBegin)
+                stack.push_back(pc+1);
+            break;
+
+        case Inst::Type::Class:
+        case Inst::Type::End:
+        case Inst::Type::Match:
+            output->push_back(pc);
+            break;
+        }
+    }
+}
+
+int Regex::Dfa::_getState(std::vector<int>&& insts)
+{
+    if (insts.empty())
+        return DEAD_STATE;
+
+    std::sort(insts.begin(), insts.end());
+    auto it = m_stateIndices.find(insts);
+    if (it != m_stateIndices.end())
+        return it->second;
+
+    auto state = std::make_unique<State>();
+    state->asciiNext.fill(UNKNOWN_STATE);
+
+    // Follow the `End`s to see if the input can end here
+    std::vector<bool> visited(m_program.size());
+    std::vector<int> atEnd;
+    for (int pc : insts)
+    {
+        if (m_program[pc].type == Inst::Type::Match)
+            state->isMatch = true;
+        else if (m_program[pc].type == Inst::Type::End)
+            _addClosure(pc+1, false, &atEnd, &visited);
+    }
+    for (size_t i{}; i < atEnd.size(); ++i)
+    {
+        if (m_program[atEnd[i]].type == Inst::Type::Match)
+            state->isMatchAtEnd = true;
+        else if (m_program[atEnd[i]].type == Inst::Type::End)
+            _addClosure(atEnd[i]+1, false, &atEnd, &visited);
+    }
+    state->isMatchAtEnd |= state->isMatch;
+
+    const int index = m_states.size();
+    state->insts = insts;
+    m_states.push_back(std::move(state));
+    m_stateIndices.emplace(std::move(insts), index);
+    return index;
+}
+
+int Regex::Dfa::step(int state, Char c)
+{
+    {
+        State& current = *m_states[state];
+        if (c < 128 && current.asciiNext[c] != UNKNOWN_STATE)
+            return current.asciiNext[c];
+        if (c >= 128)
+        {
+            auto it = current.otherNext.find(c);
+            if (it != current.otherNext.end())
+                return it->second;
+        }
+    }
+
+    std::vector<bool> visited(m_program.size());
+    std::vector<int> next;
+    for (int pc : m_states[state]->insts)
+    {
+        const Inst& inst = m_program[pc];
+        if (inst.type == Inst::Type::Class && m_regex->_classContains(m_regex->m_classes[inst.arg1], c))
+            _addClosure(pc+1, false, &next, &visited);
+    }
+    const int nextState = _getState(std::move(next));
+
+    // The states are not moved when a new one is added
+    State& current = *m_states[state];
+    if (c < 128)
+        current.asciiNext[c] = nextState;
+    else
+        current.otherNext.emplace(c, nextState);
+    return nextState;
+}
+
+void Regex::Dfa::_reset()
+{
+    m_states.clear();
+    m_stateIndices.clear();
+
+    std::vector<bool> visited(m_program.size());
+    std::vector<int> insts;
+    _addClosure(0, false, &insts, &visited);
+    m_startState = _getState(std::move(insts));
+
+    visited.assign(m_program.size(), false);
+    insts.clear();
+    _addClosure(0, true, &insts, &visited);
+    m_startStateAtBegin = _getState(std::move(insts));
+}
+
+void Regex::Dfa::init(const Regex* regex, std::vector<Inst>&& program)
+{
+    m_regex = regex;
+    m_program = std::move(program);
+    _reset();
+}
+
+void Regex::Dfa::shrinkIfNeeded()
+{
+    // Don't let the cache grow forever
+    if (m_states.size() > SEARCH_REGEX_MAX_DFA_STATES)
+        _reset();
+}
+
+void Regex::findAll(const Char* str, size_t len, spanList_t* output)
+{
+    m_forwardDfa.shrinkIfNeeded();
+    m_reverseDfa.shrinkIfNeeded();
+
+    // Mark the starts of the matches, going backwards from the end of the line
+    // NOTE: The `.*` prefix of the reversed pattern never dies
+    m_canStart.assign(len, false);
+    bool hasMatch = false;
+    int state = m_reverseDfa.getStartState(true);
+    for (size_t i{len}; i-- > 0;)
+    {
+        state = m_reverseDfa.step(state, str[i]);
+        if (m_reverseDfa.isMatch(state, i == 0))
+        {
+            m_canStart[i] = true;
+            hasMatch = true;
+        }
+    }
+    if (!hasMatch)
+        return;
+
+    m_memoStates.assign(len+1, DEAD_STATE);
+    m_memoEnds.resize(len+1);
+
+    // Take the longest match from each start
+    size_t start{};
+    while (start < len)
+    {
+        while (start < len && !m_canStart[start])
+            ++start;
+        if (start == len)
+            break;
+
+        // Scan until the DFA dies, or reaches a state an earlier scan was in at the same column
+        size_t matchEnd = SIZE_MAX;
+        m_scanStates.clear();
+        state = m_forwardDfa.getStartState(start == 0);
+        size_t i = start;
+        while (state != DEAD_STATE)
+        {
+            if (m_memoStates[i] == state)
+            {
+                matchEnd = m_memoEnds[i];
+                break;
+            }
+            m_scanStates.push_back(state);
+            if (i == len)
+                break;
+            state = m_forwardDfa.step(state, str[i]);
+            ++i;
+        }
+
+        // Remember the longest match from each column of the scan, the first one from the back
+        for (size_t k{m_scanStates.size()}; k-- > 0;)
+        {
+            const size_t col = start+k;
+            if (matchEnd == SIZE_MAX && m_forwardDfa.isMatch(m_scanStates[k], col == len))
+                matchEnd = col;
+            m_memoStates[col] = m_scanStates[k];
+            m_memoEnds[col] = matchEnd;
+        }
+
+        // Empty matches are not shown
+        if (matchEnd != SIZE_MAX && matchEnd > start)
+        {
+            output->push_back({(int)start, int(matchEnd-start)});
+            start = matchEnd;
+        }
+        else
+        {
+            ++start;
+        }
+    }
+}
+
+//----------------------------------------------- Matcher -----------------------------------------------
+
+Matcher::Matcher(const String& pattern, const Flags& flags)
+    : m_isIgnoreCase{flags.isIgnoreCase}
+{
+    if (flags.isRegex)
+    {
+        m_regex = std::make_unique<Regex>(pattern, flags.isIgnoreCase);
+        return;
+    }
+
+    m_needle = (flags.isIgnoreCase ? strToLower(pattern) : pattern);
+    // The shift is the distance of the last occurrence from the end,
+    // the characters with the same low byte share the smallest one
+    m_bmhShifts.fill(m_needle.size());
+    for (size_t i{}; i+1 < m_needle.size(); ++i)
+        m_bmhShifts[m_needle[i]&0xff] = m_needle.size()-1-i;
+}
+
+size_t Matcher::_findNeedle(const Char* str, size_t len) const
+{
+    const size_t needleLen = m_needle.size();
+    const Char* const needle = m_needle.data();
+    if (needleLen > len)
+        return String::npos;
+
+    // Boyer-Moore-Horspool skips more with the long needles
+    if (needleLen >= SEARCH_BMH_MIN_LEN)
+    {
+        size_t i{};
+        while (i <= len-needleLen)
+        {
+            const Char last = str[i+needleLen-1];
+            if (last == needle[needleLen-1] && std::memcmp(str+i, needle, (needleLen-1)*sizeof(Char)) == 0)
+                return i;
+            i += m_bmhShifts[last&0xff];
+        }
+        return String::npos;
+    }
+
+    // Compare the first and the last character of the needle at 4 positions at once,
+    // only the candidates that match both are compared fully
+    size_t i{};
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi32((int)needle[0]);
+    const __m128i last = _mm_set1_epi32((int)needle[needleLen-1]);
+    for (; i+4+needleLen-1 <= len; i += 4)
+    {
+        const __m128i blockFirst = _mm_loadu_si128((const __m128i*)(str+i));
+        const __m128i blockLast = _mm_loadu_si128((const __m128i*)(str+i+needleLen-1));
+        const __m128i eq = _mm_and_si128(_mm_cmpeq_epi32(blockFirst, first), _mm_cmpeq_epi32(blockLast, last));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (mask)
+        {
+            const int lane = __builtin_ctz(mask);
+            if (needleLen <= 2 || std::memcmp(str+i+lane+1, needle+1, (needleLen-2)*sizeof(Char)) == 0)
+                return i+lane;
+            mask &= mask-1;
+        }
+    }
+#endif
+    for (; i+needleLen <= len; ++i)
+    {
+        if (str[i] == needle[0] && str[i+needleLen-1] == needle[needleLen-1]
+         && std::memcmp(str+i, needle, needleLen*sizeof(Char)) == 0)
+            return i;
+    }
+    return String::npos;
+}
+
+void Matcher::findAll(const Char* line, size_t len, spanList_t* output)
+{
+    if (m_regex)
+    {
+        m_regex->findAll(line, len, output);
+        return;
+    }
+
+    if (m_needle.empty())
+        return;
+
+    // The simple case mapping keeps the columns
+    if (m_isIgnoreCase)
+    {
+        m_foldedLine.resize(len);
+        for (size_t i{}; i < len; ++i)
+            m_foldedLine[i] = u_tolower(line[i]);
+        line = m_foldedLine.data();
+    }
+
+    size_t pos{};
+    while (pos < len)
+    {
+        const size_t found = _findNeedle(line+pos, len-pos);
+        if (found == String::npos)
+            break;
+        output->push_back({int(pos+found), (int)m_needle.size()});
+        pos += found+m_needle.size();
+    }
+}
+
+//----------------------------------------------- Searcher ----------------------------------------------
+
+void Searcher::setPattern(const String& pattern, const Flags& flags)
+{
+    if (pattern.empty())
+    {
+        clear();
+        return;
+    }
+
+    // Throws on error, keeping the old one
+    auto matcher = std::make_unique<Matcher>(pattern, flags);
+    m_matcher = std::move(matcher);
+    m_pattern = pattern;
+}
+
+void Searcher::clear()
+{
+    m_pattern.clear();
+    m_matcher.reset();
+    // Free the memory
+    m_lineSpans = std::vector<spanList_t>{};
+    m_isLineSearched = std::vector<bool>{};
+    m_dirtyCount = 0;
+    m_firstDirtyLine = 0;
+    m_matchCount = 0;
+}
+
+void Searcher::resetLines(size_t lineCount)
+{
+    if (!isActive())
+        return;
+
+    m_lineSpans = std::vector<spanList_t>(lineCount);
+    m_isLineSearched = std::vector<bool>(lineCount, false);
+    m_dirtyCount = lineCount;
+    m_firstDirtyLine = 0;
+    m_matchCount = 0;
+}
+
+void Searcher::_markDirty(size_t lineI)
+{
+    if (m_isLineSearched[lineI])
+    {
+        m_isLineSearched[lineI] = false;
+        ++m_dirtyCount;
+    }
+    m_firstDirtyLine = std::min(m_firstDirtyLine, lineI);
+}
+
+void Searcher::invalidateLines(size_t firstLine, size_t lastLine)
+{
+    if (!isActive())
+        return;
+
+    assert(firstLine <= lastLine);
+    for (size_t i{firstLine}; i <= lastLine && i < m_lineSpans.size(); ++i)
+        _markDirty(i);
+}
+
+void Searcher::onLinesInserted(size_t line, size_t count)
+{
+    if (!isActive() || count == 0)
+        return;
+
+    const size_t at = std::min(line+1, m_lineSpans.size());
+    m_lineSpans.insert(m_lineSpans.begin()+at, count, spanList_t{});
+    m_isLineSearched.insert(m_isLineSearched.begin()+at, count, false);
+    m_dirtyCount += count;
+    m_firstDirtyLine = std::min(m_firstDirtyLine, at);
+}
+
+void Searcher::onLinesRemoved(size_t line, size_t count)
+{
+    if (!isActive() || count == 0)
+        return;
+
+    const size_t first = std::min(line+1, m_lineSpans.size());
+    const size_t end = std::min(first+count, m_lineSpans.size());
+    for (size_t i{first}; i < end; ++i)
+    {
+        if (!m_isLineSearched[i])
+            --m_dirtyCount;
+        m_matchCount -= m_lineSpans[i].size();
+    }
+    m_lineSpans.erase(m_lineSpans.begin()+first, m_lineSpans.begin()+end);
+    m_isLineSearched.erase(m_isLineSearched.begin()+first, m_isLineSearched.begin()+end);
+    m_firstDirtyLine = std::min(m_firstDirtyLine, first);
+}
+
+void Searcher::_syncLineCount(const Document& doc)
+{
+    // Start over if an edit was missed
+    if (m_lineSpans.size() != doc.getLineCount())
+    {
+        Logger::warn << "Search: line count out of sync, searching again" << Logger::End;
+        resetLines(doc.getLineCount());
+    }
+}
+
+void Searcher::_searchLine(size_t lineI, const String& line)
+{
+    spanList_t& spans = m_lineSpans[lineI];
+    m_matchCount -= spans.size();
+    spans.clear();
+
+    // Without the line break
+    size_t len = line.size();
+    if (len && line[len-1] == '\n')
+        --len;
+    m_matcher->findAll(line.data(), len, &spans);
+    m_matchCount += spans.size();
+
+    if (!m_isLineSearched[lineI])
+    {
+        m_isLineSearched[lineI] = true;
+        --m_dirtyCount;
+    }
+}
+
+void Searcher::updateLines(const Document& doc, size_t firstLine, size_t lastLine)
+{
+    if (!isActive())
+        return;
+
+    _syncLineCount(doc);
+    if (m_dirtyCount == 0 || m_lineSpans.empty())
+        return;
+    firstLine = std::max(firstLine, m_firstDirtyLine);
+    lastLine = std::min(lastLine, m_lineSpans.size()-1);
+    if (firstLine > lastLine)
+        return;
+
+    auto it = doc.iterAt(firstLine);
+    for (size_t i{firstLine}; i <= lastLine; ++i, ++it)
+    {
+        if (!m_isLineSearched[i])
+            _searchLine(i, *it);
+    }
+}
+
+bool Searcher::updateFor(const Document& doc, double budgetMs)
+{
+    if (!isActive())
+        return true;
+
+    _syncLineCount(doc);
+    if (m_dirtyCount == 0)
+        return true;
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now()+std::chrono::duration<double, std::milli>{budgetMs};
+
+    const size_t lineCount = m_lineSpans.size();
+    size_t lineI = m_firstDirtyLine;
+    // The line `it` is at
+    size_t iterLineI = SIZE_MAX;
+    decltype(doc.iterAt(0)) it;
+    // Checking the clock after every line would be slow with the short lines
+    size_t linesSinceCheck{};
+    size_t charsSinceCheck{};
+    while (m_dirtyCount > 0)
+    {
+        while (lineI < lineCount && m_isLineSearched[lineI])
+            ++lineI;
+        if (lineI >= lineCount)
+        {
+            assert(false && "The dirty line count is out of sync");
+            m_dirtyCount = 0;
+            break;
+        }
+
+        // Only seek if we skipped lines
+        if (iterLineI != lineI)
+            it = doc.iterAt(lineI);
+        const String& line = *it;
+        _searchLine(lineI, line);
+        ++it;
+        ++lineI;
+        iterLineI = lineI;
+
+        ++linesSinceCheck;
+        charsSinceCheck += line.size();
+        if (linesSinceCheck >= 256 || charsSinceCheck >= 64*1024)
+        {
+            if (clock::now() >= deadline)
+                break;
+            linesSinceCheck = 0;
+            charsSinceCheck = 0;
+        }
+    }
+    m_firstDirtyLine = lineI;
+    return m_dirtyCount == 0;
+}
+
+const spanList_t* Searcher::getLineSpans(size_t line) const
+{
+    if (line >= m_lineSpans.size() || m_lineSpans[line].empty())
+        return nullptr;
+    return &m_lineSpans[line];
+}
+
+size_t Searcher::countMatchesBefore(size_t line, int col) const
+{
+    size_t count{};
+    for (size_t i{}; i < line && i < m_lineSpans.size(); ++i)
+        count += m_lineSpans[i].size();
+    if (line < m_lineSpans.size())
+    {
+        for (const Span& span : m_lineSpans[line])
+        {
+            if (span.col < col)
+                ++count;
+        }
+    }
+    return count;
+}
+
+bool Searcher::findNext(const Document& doc, size_t line, int col, MatchPos* output, bool* outIsWrapped)
+{
+    if (!isActive())
+        return false;
+
+    _syncLineCount(doc);
+    const size_t lineCount = m_lineSpans.size();
+    if (lineCount == 0)
+        return false;
+    line = std::min(line, lineCount-1);
+
+    // The last step is the starting line again, for the matches before the column
+    for (size_t step{}; step <= lineCount; ++step)
+    {
+        const size_t lineI = (line+step)%lineCount;
+        if (!m_isLineSearched[lineI])
+            _searchLine(lineI, doc.getLine(lineI));
+
+        for (const Span& span : m_lineSpans[lineI])
+        {
+            if (step == 0 && span.col <= col)
+                continue;
+            *output = {lineI, span};
+            *outIsWrapped = line+step >= lineCount;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Searcher::findPrev(const Document& doc, size_t line, int col, MatchPos* output, bool* outIsWrapped)
+{
+    if (!isActive())
+        return false;
+
+    _syncLineCount(doc);
+    const size_t lineCount = m_lineSpans.size();
+    if (lineCount == 0)
+        return false;
+    line = std::min(line, lineCount-1);
+
+    for (size_t step{}; step <= lineCount; ++step)
+    {
+        const size_t lineI = (line+lineCount-step%lineCount)%lineCount;
+        if (!m_isLineSearched[lineI])
+            _searchLine(lineI, doc.getLine(lineI));
+
+        const spanList_t& spans = m_lineSpans[lineI];
+        for (auto it = spans.rbegin(); it != spans.rend(); ++it)
+        {
+            if (step == 0 && it->col >= col)
+                continue;
+            *output = {lineI, *it};
+            *outIsWrapped = step > line;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Search
@@ -0,0 +1,262 @@
+#pragma once
+
+#include "types.h"
+#include <vector>
+#include <memory>
+#include <array>
+#include <map>
+#include <unordered_map>
+
+class Document;
+
+/*
+ * Searching in the buffers.
+ *
+ * The matches are stored per line, so an edit only needs the edited lines to be searched again,
+ * and the renderer can walk the matches of a line along with its characters.
+ */
+namespace Search
+{
+
+struct Flags
+{
+    bool isIgnoreCase{};
+    bool isRegex{};
+};
+
+/*
+ * Remove the flag prefixes from the input of the find dialog:
+ *   \c - Ignore case
+ *   \v - Regular expression
+ * E.g. "\c\vfoo|bar"
+ */
+String parseFlags(const String& input, Flags* outFlags);
+
+struct Span
+{
+    int col{};
+    int len{};
+};
+// Sorted by column, the spans don't overlap
+using spanList_t = std::vector<Span>;
+
+/*
+ * A regular expression matched with lazily built DFAs.
+ *
+ * Supports: literals, `.`, `[...]`, `[^...]`, `\d`, `\w`, `\s` (and their negations),
+ * `^`, `$`, `(...)`, `|`, `*`, `+` and `?`.
+ * The matches are leftmost-longest, every line is matched separately.
+ *
+ * The positions where a match can start are found in a single backward pass with
+ * the DFA of the reversed pattern, then the longest match is taken from each start.
+ * The forward DFA is deterministic, so the scans from different starts that reach
+ * a column in the same state share the rest of the work (e.g. `a|a.*b` on a long
+ * line of `a`s), which keeps the matching of a line close to linear.
+ */
+class Regex final
+{
+private:
+    struct CharClass
+    {
+        std::vector<std::pair<Char, Char>> ranges;
+        bool isNegated{};
+    };
+
+    // Instructions of the NFA, the next instruction is the following one unless stated otherwise
+    struct Inst
+    {
+        enum class Type
+        {
+            Class, // Consume a character of `m_classes[arg1]`
+            Split, // Continue at `arg1` and `arg2`
+            Jump,  // Continue at `arg1`
+            Begin, // Assert the beginning of the input
+            End,   // Assert the end of the input
+            Match,
+        } type;
+        int arg1{};
+        int arg2{};
+    };
+
+    struct Node;
+    class Parser;
+
+    static constexpr int DEAD_STATE = -1;
+    static constexpr int UNKNOWN_STATE = -2;
+
+    // A program and its DFA, the states are built when they are first reached
+    class Dfa final
+    {
+    private:
+        struct State
+        {
+            // The `Class`, `End` and `Match` instructions the NFA can be at
+            std::vector<int> insts;
+            bool isMatch{};
+            // Whether it matches if the input ends here
+            bool isMatchAtEnd{};
+            // Transitions on ASCII characters, the others are in `otherNext`
+            std::array<int, 128> asciiNext;
+            std::unordered_map<Char, int> otherNext;
+        };
+
+        const Regex* m_regex{};
+        std::vector<Inst> m_program;
+        std::vector<std::unique_ptr<State>> m_states;
+        std::map<std::vector<int>, int> m_stateIndices;
+        int m_startState{};
+        int m_startStateAtBegin{};
+
+        void _addClosure(int pc, bool isAtBegin, std::vector<int>* output, std::vector<bool>* visited) const;
+        int _getState(std::vector<int>&& insts);
+        void _reset();
+
+    public:
+        void init(const Regex* regex, std::vector<Inst>&& program);
+        // Drop the cached states if there are too many
+        void shrinkIfNeeded();
+
+        inline int getStartState(bool isAtBegin) const { return isAtBegin ? m_startStateAtBegin : m_startState; }
+        int step(int state, Char c);
+        inline bool isMatch(int state, bool isAtEnd) const
+        {
+            return isAtEnd ? m_states[state]->isMatchAtEnd : m_states[state]->isMatch;
+        }
+    };
+
+    std::vector<CharClass> m_classes;
+    bool m_isIgnoreCase{};
+    // Matches the pattern from a position
+    Dfa m_forwardDfa;
+    // Matches the reversed pattern anywhere, run from the end of the line
+    Dfa m_reverseDfa;
+    // ----- Reused between the lines -----
+    // Whether a match can start at the column
+    std::vector<bool> m_canStart;
+    // The state a forward scan was in at the column, and the end of the longest match
+    // from there (or SIZE_MAX)
+    std::vector<int> m_memoStates;
+    std::vector<size_t> m_memoEnds;
+    // The states of the current forward scan
+    std::vector<int> m_scanStates;
+
+    void _emit(const Node& node, bool isReversed, std::vector<Inst>* program) const;
+    bool _classContains(const CharClass& cls, Char c) const;
+
+public:
+    /*
+     * Compile a pattern.
+     * Throws `std::runtime_error` if it is invalid.
+     */
+    Regex(const String& pattern, bool isIgnoreCase);
+    // The DFAs point to it
+    Regex(const Regex&) = delete;
+    Regex& operator=(const Regex&) = delete;
+
+    // Append the matches in `str` to `output`
+    void findAll(const Char* str, size_t len, spanList_t* output);
+};
+
+/*
+ * A compiled search pattern.
+ */
+class Matcher final
+{
+private:
+    String m_needle;
+    bool m_isIgnoreCase{};
+    std::unique_ptr<Regex> m_regex;
+    // Boyer-Moore-Horspool shifts, by the low byte of the character
+    std::array<size_t, 256> m_bmhShifts{};
+    // The lowercase line when ignoring case
+    String m_foldedLine;
+
+    size_t _findNeedle(const Char* str, size_t len) const;
+
+public:
+    /*
+     * Throws `std::runtime_error` if the regex is invalid.
+     */
+    Matcher(const String& pattern, const Flags& flags);
+
+    // Append the matches in `line` (without the line break) to `output`
+    void findAll(const Char* line, size_t len, spanList_t* output);
+};
+
+struct MatchPos
+{
+    size_t line{};
+    Span span;
+};
+
+/*
+ * Keeps the matches of a pattern for every line of a document.
+ *
+ * The owner reports the line changes, and the changed lines are searched again
+ * when they are needed: the visible ones when rendering and the rest in small steps.
+ */
+class Searcher final
+{
+private:
+    String m_pattern;
+    std::unique_ptr<Matcher> m_matcher;
+
+    std::vector<spanList_t> m_lineSpans;
+    std::vector<bool> m_isLineSearched;
+    // Number of lines that need to be searched
+    size_t m_dirtyCount{};
+    // No line before this needs to be searched
+    size_t m_firstDirtyLine{};
+    size_t m_matchCount{};
+
+    void _syncLineCount(const Document& doc);
+    void _searchLine(size_t lineI, const String& line);
+    void _markDirty(size_t lineI);
+
+public:
+    /*
+     * Set the pattern, an empty one clears the search.
+     * Call `resetLines()` afterwards.
+     * Throws `std::runtime_error` if the regex is invalid, the old pattern is kept then.
+     */
+    void setPattern(const String& pattern, const Flags& flags);
+    void clear();
+    inline bool isActive() const { return m_matcher != nullptr; }
+    inline const String& getPattern() const { return m_pattern; }
+
+    // ----- Keep in sync with the document -----
+    // Forget the matches, every line has to be searched
+    void resetLines(size_t lineCount);
+    void invalidateLines(size_t firstLine, size_t lastLine);
+    // `count` lines were inserted after `line`
+    void onLinesInserted(size_t line, size_t count);
+    // `count` lines were removed after `line`
+    void onLinesRemoved(size_t line, size_t count);
+
+    // ----- Searching -----
+    // Search the changed lines in this range
+    void updateLines(const Document& doc, size_t firstLine, size_t lastLine);
+    /*
+     * Search the changed lines until done or `budgetMs` is spent.
+     * Returns true when every line is searched.
+     */
+    bool updateFor(const Document& doc, double budgetMs);
+    inline bool isComplete() const { return m_dirtyCount == 0; }
+
+    // Returns nullptr if there is no match in the line
+    const spanList_t* getLineSpans(size_t line) const;
+    // Only counts the searched lines
+    inline size_t getMatchCount() const { return m_matchCount; }
+    // The number of matches before the position in the searched lines
+    size_t countMatchesBefore(size_t line, int col) const;
+
+    /*
+     * Find the first match after (or before) the position, wrapping around the end.
+     * The lines on the way are searched if needed.
+     * Returns false if there is no match at all.
+     */
+    bool findNext(const Document& doc, size_t line, int col, MatchPos* output, bool* outIsWrapped);
+    bool findPrev(const Document& doc, size_t line, int col, MatchPos* output, bool* outIsWrapped);
+};
+
+} // namespace Search
@@ -64,9 +64,8 @@ static Split* loadTabRecursively(const cJSON* node)
                 return nullptr;
             }
             const std::string path = fileVal->valuestring;
-            // Note: Don't mess up recent file list with session-loaded files
-            Buffer* buff = App::openFileInNewBuffer(path, false);
 
+            int cursorLine{};
             if (const cJSON* cursorLineVal = cJSON_GetObjectItemCaseSensitive(child, "cursorLine"))
             {
                 if (!cJSON_IsNumber(cursorLineVal) || cursorLineVal->valueint < 0)
@@ -74,13 +73,9 @@ static Split* loadTabRecursively(const cJSON* node)
                     Logger::err << "Invalid value for 'cursorLine', expected a number" << Logger::End;
                     return nullptr;
                 }
-                // Not very efficient but oh, well, at least it does all the checks
-                for (int i{}; i < cursorLineVal->valueint; ++i)
-                {
-                    buff->moveCursor(Buffer::CursorMovCmd::Down);
-                    buff->updateCursor();
-                }
+                cursorLine = cursorLineVal->valueint;
             }
+            int cursorCol{};
             if (const cJSON* cursorColVal = cJSON_GetObjectItemCaseSensitive(child, "cursorCol"))
             {
                 if (!cJSON_IsNumber(cursorColVal) || cursorColVal->valueint < 0)
@@ -88,13 +83,12 @@ static Split* loadTabRecursively(const cJSON* node)
                     Logger::err << "Invalid value for 'cursorCol', expected a positive number" << Logger::End;
                     return nullptr;
                 }
-                // Not very efficient but oh, well, at least it does all the checks
-                for (int i{}; i < cursorColVal->valueint; ++i)
-                {
-                    buff->moveCursor(Buffer::CursorMovCmd::Right);
-                    buff->updateCursor();
-                }
+                cursorCol = cursorColVal->valueint;
             }
+
+            // The buffer is only a placeholder until it's shown, the cursor is placed when it's loaded
+            // Note: Don't mess up recent file list with session-loaded files
+            Buffer* buff = App::openFileDeferred(path, false, cursorLine, cursorCol);
             output->addChild(buff);
         }
         else
@@ -13,7 +13,7 @@ public:
     Shader(const std::string& vertShaderPath, const std::string& fragShaderPath);
 
     inline uint getId() const { return m_programId; }
-    inline void use() { glUseProgram(m_programId); }
+    inline void use() { GlStats::useProgram(m_programId); }
 
     ~Shader();
 };
@@ -0,0 +1,55 @@
+#include "StartupTimeline.h"
+#include "ThreadPool.h"
+#include "Logger.h"
+#include "globals.h"
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+void StartupTimeline::_record(const std::string& name, clock::time_point start)
+{
+    const auto now = clock::now();
+    Phase phase{
+        name,
+        std::this_thread::get_id() == m_mainThreadId,
+        std::chrono::duration<double, std::milli>(start-m_startTime).count(),
+        std::chrono::duration<double, std::milli>(now-start).count()};
+
+    std::lock_guard<std::mutex> guard{m_mutex};
+    m_phases.push_back(std::move(phase));
+}
+
+void StartupTimeline::_submit(std::function<void()> job)
+{
+    if (g_threadPool)
+        g_threadPool->submit(std::move(job));
+    else
+        job();
+}
+
+double StartupTimeline::getElapsedMs() const
+{
+    return std::chrono::duration<double, std::milli>(clock::now()-m_startTime).count();
+}
+
+void StartupTimeline::logReport()
+{
+    std::vector<Phase> phases;
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        phases = m_phases;
+    }
+    std::stable_sort(phases.begin(), phases.end(),
+            [](const Phase& a, const Phase& b){ return a.startMs < b.startMs; });
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    ss << "Startup timeline (" << getElapsedMs() << "ms):";
+    ss << "\n    " << std::setw(8) << "start" << std::setw(10) << "duration" << "  thread  phase";
+    for (const auto& phase : phases)
+    {
+        ss << "\n    " << std::setw(8) << phase.startMs << std::setw(10) << phase.durationMs
+           << (phase.isOnMainThread ? "  main    " : "  worker  ") << phase.name;
+    }
+    Logger::log << ss.str() << Logger::End;
+}
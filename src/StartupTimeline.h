@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <type_traits>
+
+/*
+ * Runs the steps of the startup and records when and where each of them ran.
+ *
+ * The steps that don't need the GL context run on the thread pool with `runAsync()`,
+ * the main thread only waits for their results when it needs them.
+ */
+class StartupTimeline final
+{
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Phase
+    {
+        std::string name;
+        bool isOnMainThread{};
+        double startMs{};
+        double durationMs{};
+    };
+
+    clock::time_point m_startTime = clock::now();
+    std::thread::id m_mainThreadId = std::this_thread::get_id();
+    std::vector<Phase> m_phases;
+    std::mutex m_mutex;
+
+    void _record(const std::string& name, clock::time_point start);
+    // Run on the thread pool, or right away if there is no pool
+    static void _submit(std::function<void()> job);
+
+    class _Recorder final
+    {
+    private:
+        StartupTimeline* m_timeline;
+        std::string m_name;
+        clock::time_point m_start = clock::now();
+
+    public:
+        _Recorder(StartupTimeline* timeline, const std::string& name)
+            : m_timeline{timeline}, m_name{name} {}
+        ~_Recorder() { m_timeline->_record(m_name, m_start); }
+    };
+
+public:
+    StartupTimeline() {}
+    StartupTimeline(const StartupTimeline&) = delete;
+    StartupTimeline& operator=(const StartupTimeline&) = delete;
+
+    /*
+     * Run `fn` on the calling thread and record it.
+     */
+    template <typename Fn>
+    auto run(const std::string& name, Fn&& fn)
+    {
+        _Recorder recorder{this, name};
+        return fn();
+    }
+
+    /*
+     * Run `fn` on the thread pool and record it.
+     * The future returns the result of `fn` or rethrows its exception.
+     */
+    template <typename Fn>
+    auto runAsync(const std::string& name, Fn fn)
+    {
+        using result_t = std::invoke_result_t<Fn>;
+        auto task = std::make_shared<std::packaged_task<result_t()>>(
+                [this, name, fn=std::move(fn)]() mutable { return run(name, fn); });
+        auto future = task->get_future();
+        _submit([task](){ (*task)(); });
+        return future;
+    }
+
+    /*
+     * Wait for a task started by `runAsync()` and return its result.
+     * The time the main thread was blocked is recorded as a phase.
+     */
+    template <typename T>
+    T wait(const std::string& name, std::future<T>& future)
+    {
+        _Recorder recorder{this, "Wait for: "+name};
+        return future.get();
+    }
+
+    // Milliseconds since the start
+    double getElapsedMs() const;
+
+    /*
+     * Log the phases sorted by their start time.
+     */
+    void logReport();
+};
@@ -1,5 +1,6 @@
 #include "StatusMsg.h"
 #include "globals.h"
+#include "EventLoop.h"
 
 RGBColor StatusMsg::getTypeColor()
 {
@@ -18,6 +19,8 @@ void StatusMsg::tick(float frameTime)
     m_secsUntilClear -= frameTime;
     if (oldVal > 0 && m_secsUntilClear <= 0)
         g_isRedrawNeeded = true;
+    else if (m_secsUntilClear > 0)
+        EventLoop::wakeUpIn(m_secsUntilClear*1000);
 }
 
 void StatusMsg::set(const std::string& val, Type type)
@@ -0,0 +1,232 @@
+#include "Syntax.h"
+#include "common/string.h"
+#include <unordered_set>
+#include <algorithm>
+
+namespace Syntax
+{
+
+template <typename T>
+static std::unordered_set<String> listToSet(const T& list, bool onlyWords)
+{
+    std::unordered_set<String> set;
+    for (const auto& item : list)
+    {
+        if (!onlyWords || isIdentifierChar(item[0]))
+            set.insert(item);
+    }
+    return set;
+}
+
+static String collectOperatorChars()
+{
+    String chars;
+    for (const auto& item : operatorList)
+    {
+        if (item.size() == 1 && !isIdentifierChar(item[0]))
+            chars += item[0];
+    }
+    return chars;
+}
+
+static constexpr Char specialChars[] = {';', '{', '}', '(', ')'};
+
+static const String commentNotes[] = {U"TODO:", U"FIXME:", U"XXX:"};
+static constexpr SyntaxMarks commentNoteMarks[] = {MARK_TODO, MARK_FIXME, MARK_XXX};
+
+LineState highlightLine(
+        const String& line, LineState startState, std::u8string* outMarks, const isPathFn_t& isPath)
+{
+    static const auto keywords = listToSet(keywordList, false);
+    static const auto types = listToSet(typeList, false);
+    static const auto operatorWords = listToSet(operatorList, true);
+    static const String operatorChars = collectOperatorChars();
+
+    std::u8string& marks = *outMarks;
+    marks.assign(line.size(), MARK_NONE);
+
+    // Don't touch the line break
+    const size_t contentLen = line.ends_with('\n') ? line.size()-1 : line.size();
+
+    auto markRange{[&](size_t from, size_t to, SyntaxMarks mark){
+        std::fill(marks.begin()+from, marks.begin()+std::min(to, contentLen), mark);
+    }};
+
+    auto markComment{[&](size_t from, size_t to){
+        to = std::min(to, contentLen);
+        markRange(from, to, MARK_COMMENT);
+        for (size_t noteI{}; noteI < std::size(commentNotes); ++noteI)
+        {
+            const String& note = commentNotes[noteI];
+            size_t found = from;
+            while ((found = line.find(note, found)) != String::npos && found+note.size() <= to)
+            {
+                if (found == 0 || !isIdentifierChar(line[found-1]))
+                    markRange(found, found+note.size(), commentNoteMarks[noteI]);
+                found += note.size();
+            }
+        }
+    }};
+
+    // Returns the position after the closing quote, or the end of the line if it's not closed
+    auto skipQuoted{[&](size_t from, Char quote, bool* outIsClosed){
+        for (size_t i{from}; i < contentLen; ++i)
+        {
+            if (line[i] == '\\')
+            {
+                ++i; // Skip the escaped character
+            }
+            else if (line[i] == quote)
+            {
+                *outIsClosed = true;
+                return i+1;
+            }
+        }
+        *outIsClosed = false;
+        return contentLen;
+    }};
+    auto endsWithContinuation{[&](){
+        return contentLen > 0 && line[contentLen-1] == '\\';
+    }};
+
+    size_t i{};
+    switch (startState)
+    {
+    case LineState::Normal:
+        break;
+
+    case LineState::BlockComment:
+    {
+        const size_t end = line.find(blockCommentEnd);
+        if (end == String::npos)
+        {
+            markComment(0, contentLen);
+            return LineState::BlockComment;
+        }
+        i = end+blockCommentEnd.size();
+        markComment(0, i);
+        break;
+    }
+
+    case LineState::String:
+    {
+        bool isClosed;
+        i = skipQuoted(0, '"', &isClosed);
+        markRange(0, i, MARK_STRING);
+        if (!isClosed && endsWithContinuation())
+            return LineState::String;
+        break;
+    }
+    }
+
+    const size_t firstNonSpace = std::find_if(line.begin(), line.end(),
+            [](Char c){ return !u_isspace(c); })-line.begin();
+
+    while (i < contentLen)
+    {
+        const Char c = line[i];
+
+        if (line.compare(i, lineCommentPrefix.size(), lineCommentPrefix) == 0)
+        {
+            markComment(i, contentLen);
+            break;
+        }
+
+        if (line.compare(i, blockCommentBegin.size(), blockCommentBegin) == 0)
+        {
+            const size_t end = line.find(blockCommentEnd, i+blockCommentBegin.size());
+            if (end == String::npos)
+            {
+                markComment(i, contentLen);
+                return LineState::BlockComment;
+            }
+            markComment(i, end+blockCommentEnd.size());
+            i = end+blockCommentEnd.size();
+            continue;
+        }
+
+        if (c == '"')
+        {
+            bool isClosed;
+            const size_t end = skipQuoted(i+1, '"', &isClosed);
+            markRange(i, end, MARK_STRING);
+            if (!isClosed && endsWithContinuation())
+                return LineState::String;
+            i = end;
+            continue;
+        }
+
+        if (c == '\'')
+        {
+            bool isClosed;
+            const size_t end = skipQuoted(i+1, '\'', &isClosed);
+            markRange(i, end, MARK_CHARLIT);
+            i = end;
+            continue;
+        }
+
+        if (i == firstNonSpace && line.compare(i, preprocessorPrefix.size(), preprocessorPrefix) == 0)
+        {
+            const size_t end = std::min(line.find_first_of(' ', i), contentLen);
+            markRange(i, end, MARK_PREPRO);
+            i = end;
+            continue;
+        }
+
+        if (u_isdigit(c) || (c == '.' && i+1 < contentLen && u_isdigit(line[i+1])))
+        {
+            size_t end = i+1;
+            // Also accept suffixes, hex digits, exponents and digit separators
+            while (end < contentLen && (isIdentifierChar(line[end]) || line[end] == '.' || line[end] == '\''))
+                ++end;
+            markRange(i, end, MARK_NUMBER);
+            i = end;
+            continue;
+        }
+
+        if (isIdentifierChar(c))
+        {
+            size_t end = i+1;
+            while (end < contentLen && isIdentifierChar(line[end]))
+                ++end;
+            const String word = line.substr(i, end-i);
+            if (keywords.contains(word))
+                markRange(i, end, MARK_KEYWORD);
+            else if (types.contains(word))
+                markRange(i, end, MARK_TYPE);
+            else if (operatorWords.contains(word))
+                markRange(i, end, MARK_OPERATOR);
+            i = end;
+            continue;
+        }
+
+        if (operatorChars.find(c) != String::npos)
+            marks[i] = MARK_OPERATOR;
+        else if (std::find(std::begin(specialChars), std::end(specialChars), c) != std::end(specialChars))
+            marks[i] = MARK_SPECCHAR;
+        ++i;
+    }
+
+    // Paths and URLs are marked everywhere, they are separated by whitespace or quotes
+    for (size_t wordBeg{}; wordBeg < contentLen;)
+    {
+        while (wordBeg < contentLen && (u_isspace(line[wordBeg]) || line[wordBeg] == '"'))
+            ++wordBeg;
+        size_t wordEnd = wordBeg;
+        bool hasSlash = false;
+        while (wordEnd < contentLen && !u_isspace(line[wordEnd]) && line[wordEnd] != '"')
+        {
+            hasSlash |= (line[wordEnd] == '/');
+            ++wordEnd;
+        }
+
+        // Only check the words that can be paths, checking the file system is slow
+        if (hasSlash && isPath(line.substr(wordBeg, wordEnd-wordBeg)))
+            markRange(wordBeg, wordEnd, MARK_FILEPATH);
+        wordBeg = wordEnd;
+    }
+
+    return LineState::Normal;
+}
+
+}
@@ -4,6 +4,7 @@
 #include "TextRenderer.h"
 #include <array>
 #include <string>
+#include <functional>
 
 namespace Syntax
 {
@@ -91,4 +92,34 @@ inline String blockCommentEnd{U"*/"};
 
 inline String preprocessorPrefix{U"#"};
 
+/*
+ * The highlighter state at a line boundary.
+ * The state at the end of a line is the start state of the next one.
+ */
+enum class LineState : uint8_t
+{
+    Normal,
+    BlockComment,
+    // A string literal continued with a backslash at the end of the line
+    String,
+};
+
+// Tells if a word is an existing path or a URL
+using isPathFn_t = std::function<bool(const String&)>;
+
+/*
+ * Tokenize a line in a single pass.
+ *
+ * Args:
+ *  + line: The line to highlight (including the line break).
+ *  + startState: The state at the end of the previous line.
+ *  + outMarks: Filled with a `SyntaxMarks` value for each character of the line.
+ *  + isPath: Used to check the words that look like paths or URLs.
+ *
+ * Returns:
+ *  + the state at the end of the line.
+ */
+LineState highlightLine(
+        const String& line, LineState startState, std::u8string* outMarks, const isPathFn_t& isPath);
+
 }
@@ -1,12 +1,142 @@
 #include "TextRenderer.h"
+#include "UiRenderer.h"
 #include "App.h"
 #include "Logger.h"
 #include "config.h"
 #include "glstuff.h"
 #include "globals.h"
+#include "Profiler.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
+#include <cstddef>
+
+void GlyphAtlas::_addPage()
+{
+    Page page;
+    page.height = PAGE_INIT_HEIGHT_PX;
+    page.pixels.resize(PAGE_WIDTH_PX*page.height);
+
+    glGenTextures(1, &page.textureId);
+    GlStats::bindTexture(GL_TEXTURE_2D, page.textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GlStats::texImage2D(GL_TEXTURE_2D,
+            0, GL_RED,
+            PAGE_WIDTH_PX, page.height,
+            0, GL_RED, GL_UNSIGNED_BYTE, page.pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    assert(page.textureId);
+
+    Logger::dbg << "Created glyph atlas page " << m_pages.size() << Logger::End;
+    m_pages.push_back(std::move(page));
+}
+
+void GlyphAtlas::_growPage(Page& page, int newHeight)
+{
+    assert(newHeight > page.height && newHeight <= PAGE_MAX_HEIGHT_PX);
+
+    // The rows are stored continuously, so the old data stays where it was
+    page.pixels.resize(PAGE_WIDTH_PX*newHeight);
+    page.height = newHeight;
+
+    GlStats::bindTexture(GL_TEXTURE_2D, page.textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GlStats::texImage2D(GL_TEXTURE_2D,
+            0, GL_RED,
+            PAGE_WIDTH_PX, page.height,
+            0, GL_RED, GL_UNSIGNED_BYTE, page.pixels.data());
+}
+
+bool GlyphAtlas::_tryPackIntoPage(Page& page, int width, int height, glm::ivec2* outPos)
+{
+    const int paddedW = width+GLYPH_PADDING_PX;
+    const int paddedH = height+GLYPH_PADDING_PX;
+
+    // Find the shelf that wastes the least vertical space
+    Shelf* bestShelf{};
+    for (auto& shelf : page.shelves)
+    {
+        if (shelf.height >= paddedH && shelf.usedWidth+paddedW <= PAGE_WIDTH_PX
+         && (!bestShelf || shelf.height < bestShelf->height))
+        {
+            bestShelf = &shelf;
+        }
+    }
+
+    if (!bestShelf)
+    {
+        // Start a new shelf below the last one
+        const int shelfY = page.shelves.empty() ? 0 : page.shelves.back().y+page.shelves.back().height;
+        if (shelfY+paddedH > PAGE_MAX_HEIGHT_PX)
+            return false;
+
+        if (shelfY+paddedH > page.height)
+        {
+            int newHeight = page.height;
+            while (shelfY+paddedH > newHeight)
+                newHeight *= 2;
+            _growPage(page, std::min(newHeight, PAGE_MAX_HEIGHT_PX));
+        }
+
+        page.shelves.push_back(Shelf{shelfY, paddedH, 0});
+        bestShelf = &page.shelves.back();
+    }
+
+    *outPos = {bestShelf->usedWidth, bestShelf->y};
+    bestShelf->usedWidth += paddedW;
+    return true;
+}
+
+std::pair<uint, glm::ivec2> GlyphAtlas::add(const uint8_t* bitmap, int width, int height, int pitch)
+{
+    assert(width <= PAGE_WIDTH_PX-GLYPH_PADDING_PX && height <= PAGE_MAX_HEIGHT_PX-GLYPH_PADDING_PX);
+
+    // Nothing to store (e.g. space), the glyph won't be drawn
+    if (width == 0 || height == 0)
+        return {0, {0, 0}};
+
+    if (m_pages.empty())
+        _addPage();
+
+    // Only the last page can have free space
+    glm::ivec2 pos{};
+    if (!_tryPackIntoPage(m_pages.back(), width, height, &pos))
+    {
+        _addPage();
+        [[maybe_unused]] const bool isPacked = _tryPackIntoPage(m_pages.back(), width, height, &pos);
+        assert(isPacked);
+    }
+
+    Page& page = m_pages.back();
+    for (int row{}; row < height; ++row)
+    {
+        std::memcpy(page.pixels.data()+(pos.y+row)*PAGE_WIDTH_PX+pos.x,
+                bitmap+row*pitch, width);
+    }
+
+    GlStats::bindTexture(GL_TEXTURE_2D, page.textureId);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, PAGE_WIDTH_PX);
+    GlStats::texSubImage2D(GL_TEXTURE_2D,
+            0, pos.x, pos.y, width, height,
+            GL_RED, GL_UNSIGNED_BYTE, page.pixels.data()+pos.y*PAGE_WIDTH_PX+pos.x);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    return {m_pages.size()-1, pos};
+}
+
+void GlyphAtlas::clear()
+{
+    for (auto& page : m_pages)
+    {
+        glDeleteTextures(1, &page.textureId);
+    }
+    m_pages.clear();
+}
 
 void Face::_load(
         FT_Library library,
@@ -44,10 +174,12 @@ void Face::_load(
 
 void Face::load(
         FT_Library library,
+        GlyphAtlas* atlas,
         const std::string& path,
         int size,
         bool isRegularFont)
 {
+    m_atlas = atlas;
     _load(library, path, size);
     if (isRegularFont)
     {
@@ -58,7 +190,7 @@ void Face::load(
 
 void Face::_cacheGlyph(uint glyph)
 {
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    assert(m_atlas);
     // Note: FT_Load_Glyph needs the gylph index, not the character code
     // Use FT_Get_Char_Index to get the glyph index for the char code
     if (FT_Error error = FT_Load_Glyph(m_face, glyph, FT_LOAD_RENDER))
@@ -67,21 +199,13 @@ void Face::_cacheGlyph(uint glyph)
             << Logger::End;
     }
 
-    uint texId;
-    glGenTextures(1, &texId);
-    glBindTexture(GL_TEXTURE_2D, texId);
-    glTexImage2D(GL_TEXTURE_2D,
-            0, GL_RED,
-            m_face->glyph->bitmap.width, m_face->glyph->bitmap.rows,
-            0, GL_RED, GL_UNSIGNED_BYTE, m_face->glyph->bitmap.buffer);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    const FT_Bitmap& bitmap = m_face->glyph->bitmap;
+    const auto [page, atlasPos] = m_atlas->add(
+            bitmap.buffer, bitmap.width, bitmap.rows, bitmap.pitch);
 
-    assert(texId);
     m_glyphs.insert({glyph, Face::Glyph{
-            texId,
+            page,
+            atlasPos,
             {m_face->glyph->bitmap.width, m_face->glyph->bitmap.rows}, // Size
             {m_face->glyph->bitmap_left, m_face->glyph->bitmap_top}, // Bearing
             (uint)m_face->glyph->advance.x // Advance
@@ -95,11 +219,8 @@ void Face::cleanUp()
 
     Logger::dbg << "Freeing glyphs.." << Logger::End;
 
+    // Note: The bitmaps are owned by the atlas
     const size_t count = m_glyphs.size();
-    for (auto& glyph : m_glyphs)
-    {
-        glDeleteTextures(1, &glyph.second.textureId);
-    }
     m_glyphs.clear();
     FT_Done_Face(m_face);
 
@@ -152,17 +273,24 @@ TextRenderer::TextRenderer(
     setFontSize(DEF_FONT_SIZE_PX);
 
     glGenVertexArrays(1, &m_fontVao);
-    glBindVertexArray(m_fontVao);
+    GlStats::bindVertexArray(m_fontVao);
 
     glGenBuffers(1, &m_fontVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m_fontVbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, 0, GL_DYNAMIC_DRAW);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_fontVbo);
+    m_fontVboCapacity = sizeof(GlyphVertex)*6*1024;
+    GlStats::bufferData(GL_ARRAY_BUFFER, m_fontVboCapacity, 0, GL_STREAM_DRAW);
 
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    // Position and texture coordinate
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GlyphVertex), 0);
     glEnableVertexAttribArray(0);
+    // Color
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GlyphVertex), (void*)offsetof(GlyphVertex, r));
+    glEnableVertexAttribArray(1);
+
+    GlStats::bindVertexArray(0);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_projMatUniformLoc = glGetUniformLocation(m_glyphShader.getId(), "projectionMat");
 
     setDrawingColor({0.0f, 0.0f, 0.0f});
 
@@ -171,73 +299,100 @@ TextRenderer::TextRenderer(
 
 void TextRenderer::setFontSize(int size)
 {
-    m_regularFace->load(m_library, m_regularFontPath, size, true);
-    m_boldFace->load(m_library, m_boldFontPath, size, false);
-    m_italicFace->load(m_library, m_italicFontPath, size, false);
-    m_boldItalicFace->load(m_library, m_boldItalicFontPath, size, false);
-    m_fallbackFace->load(m_library, m_fbFontPath, size, false);
+    // The old glyphs are useless now
+    flush();
+    m_atlas.clear();
+
+    m_regularFace->load(m_library, &m_atlas, m_regularFontPath, size, true);
+    m_boldFace->load(m_library, &m_atlas, m_boldFontPath, size, false);
+    m_italicFace->load(m_library, &m_atlas, m_italicFontPath, size, false);
+    m_boldItalicFace->load(m_library, &m_atlas, m_boldItalicFontPath, size, false);
+    m_fallbackFace->load(m_library, &m_atlas, m_fbFontPath, size, false);
 }
 
 void TextRenderer::prepareForDrawing()
 {
     m_glyphShader.use();
 
-    const auto matrix = glm::ortho(0.0f, (float)g_windowWidth, (float)g_windowHeight, 0.0f);
-    glUniformMatrix4fv(
-            glGetUniformLocation(m_glyphShader.getId(), "projectionMat"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(matrix));
+    // The uniform is stored in the program, so only update it when the window has been resized
+    if (m_projMatWinSize.x != g_windowWidth || m_projMatWinSize.y != g_windowHeight)
+    {
+        const auto matrix = glm::ortho(0.0f, (float)g_windowWidth, (float)g_windowHeight, 0.0f);
+        glUniformMatrix4fv(m_projMatUniformLoc, 1, GL_FALSE, glm::value_ptr(matrix));
+        m_projMatWinSize = {g_windowWidth, g_windowHeight};
+    }
 
-    glBindVertexArray(m_fontVao);
+    GlStats::bindVertexArray(m_fontVao);
 }
 
 void TextRenderer::setDrawingColor(const RGBColor& color)
 {
     // TODO: Support alpha
 
-    // Don't set the color if it is already set
-    if (color.r == m_currentTextColor.r
-     && color.g == m_currentTextColor.g
-     && color.b == m_currentTextColor.b)
-    {
-        return;
-    }
+    // The color is stored per vertex, so this is cheap
     m_currentTextColor = color;
-
-    glUniform3f(glGetUniformLocation(m_glyphShader.getId(), "textColor"), UNPACK_RGB_COLOR(color));
 }
 
-static inline Face::GlyphDimensions renderGlyph(
-        const Face::Glyph& glyph,
-        int textX, int textY, float scale,
-        uint fontVbo)
+void TextRenderer::_queueGlyph(const Face::Glyph& glyph, float textX, float textY)
 {
-    const float charX = textX + glyph.bearing.x * scale;
-    const float charY = textY - (glyph.bearing.y) + g_fontSizePx;
-    const float charW = glyph.size.x * scale;
-    const float charH = glyph.size.y * scale;
+    // Whitespace has no bitmap
+    if (glyph.size.x == 0 || glyph.size.y == 0)
+        return;
 
-    const float vertexData[6][4] = {
-        {charX,         charY + charH, 0.0f, 0.0f},
-        {charX,         charY,         0.0f, 1.0f},
-        {charX + charW, charY,         1.0f, 1.0f},
+    // We can only draw from one atlas page at a time
+    if (!m_batch.empty() && glyph.page != m_batchPage)
+        flush();
+    m_batchPage = glyph.page;
 
-        {charX,         charY + charH, 0.0f, 0.0f},
-        {charX + charW, charY,         1.0f, 1.0f},
-        {charX + charW, charY + charH, 1.0f, 0.0f},
+    const float charX = textX + glyph.bearing.x;
+    const float charY = textY - (glyph.bearing.y) + g_fontSizePx;
+    const float charW = glyph.size.x;
+    const float charH = glyph.size.y;
+
+    // Texture coordinates are in pixels, the shader normalizes them
+    const float u1 = glyph.atlasPos.x;
+    const float v1 = glyph.atlasPos.y;
+    const float u2 = u1 + glyph.size.x;
+    const float v2 = v1 + glyph.size.y;
+
+    const float r = m_currentTextColor.r;
+    const float g = m_currentTextColor.g;
+    const float b = m_currentTextColor.b;
+    const GlyphVertex vertexData[6] = {
+        {charX,         charY + charH, u1, v2, r, g, b},
+        {charX,         charY,         u1, v1, r, g, b},
+        {charX + charW, charY,         u2, v1, r, g, b},
+
+        {charX,         charY + charH, u1, v2, r, g, b},
+        {charX + charW, charY,         u2, v1, r, g, b},
+        {charX + charW, charY + charH, u2, v2, r, g, b},
     };
+    m_batch.insert(m_batch.end(), std::begin(vertexData), std::end(vertexData));
+}
 
-    glBindTexture(GL_TEXTURE_2D, glyph.textureId);
+void TextRenderer::flush()
+{
+    // The backgrounds have to be drawn before the text
+    g_uiRenderer->flush(UiRenderer::Layer::BelowText);
+
+    if (m_batch.empty())
+        return;
 
+    prepareForDrawing();
+    GlStats::bindTexture(GL_TEXTURE_2D, m_atlas.getPageTexture(m_batchPage));
 
-    glBindBuffer(GL_ARRAY_BUFFER, fontVbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertexData), vertexData);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    const size_t dataSize = m_batch.size()*sizeof(GlyphVertex);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_fontVbo);
+    if (dataSize > m_fontVboCapacity)
+        m_fontVboCapacity = std::max(dataSize, m_fontVboCapacity*2);
+    // Orphan the old storage, so we don't have to wait for the previous draw to finish
+    GlStats::bufferData(GL_ARRAY_BUFFER, m_fontVboCapacity, 0, GL_STREAM_DRAW);
+    GlStats::bufferSubData(GL_ARRAY_BUFFER, 0, dataSize, m_batch.data());
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    GlStats::drawArrays(GL_TRIANGLES, 0, m_batch.size());
 
-    return {glyph.advance};
+    m_batch.clear();
 }
 
 
@@ -261,9 +416,9 @@ Face::GlyphDimensions TextRenderer::renderChar(
     )
 {
     auto face = getFaceFromStyle(style);
-    return renderGlyph(
-            *getGlyph(face, c),
-            position.x, position.y, 1.0f, m_fontVbo);
+    const Face::Glyph* glyph = getGlyph(face, c);
+    _queueGlyph(*glyph, position.x, position.y);
+    return {glyph->advance};
 }
 
 #define ANSI_ESC_CHAR_0                 '\033'
@@ -316,6 +471,8 @@ std::pair<glm::ivec2, glm::ivec2> TextRenderer::renderString(
         bool onlyMeasure/*=false*/
     )
 {
+    PROFILE_FUNC();
+
     static constexpr float scale = 1.0f;
     FontStyle currStyle = initStyle;
     Face* face;
@@ -460,16 +617,19 @@ std::pair<glm::ivec2, glm::ivec2> TextRenderer::renderString(
         }
         if (textY > g_windowHeight)
         {
+            flush();
             area.second.y = std::ceil(textY+g_fontSizePx*scale);
             return area;
         }
 
+        const Face::Glyph* glyph = getGlyph(face, c);
         if (!onlyMeasure)
-            renderGlyph(*getGlyph(face, c), textX, textY, scale, m_fontVbo);
-        textX += (getGlyph(face, c)->advance/64.0f) * scale;
+            _queueGlyph(*glyph, textX, textY);
+        textX += (glyph->advance/64.0f) * scale;
         area.second.x = std::max(area.second.x, (int)std::ceil(textX));
     }
 
+    flush();
     area.second.y = std::ceil(textY+g_fontSizePx*scale);
     return area;
 }
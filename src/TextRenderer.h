@@ -6,6 +6,7 @@
 #include <memory>
 #include <string>
 #include <map>
+#include <vector>
 #include <glm/glm.hpp>
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -29,12 +30,78 @@ inline std::string fontStyleToStr(FontStyle style)
     return ""; // Never reached
 }
 
+/*
+ * Packs the glyph bitmaps of all faces into a few large textures,
+ * so a whole screen of text can be drawn with a handful of draw calls.
+ *
+ * Glyphs are placed on shelves (rows). A page starts small and its height is doubled
+ * when it runs out of space. When a page reaches the maximum size, a new page is started.
+ * Glyph positions are stored in pixels, so growing a page doesn't invalidate them.
+ */
+class GlyphAtlas
+{
+public:
+    static constexpr int PAGE_WIDTH_PX          = 1024;
+    static constexpr int PAGE_INIT_HEIGHT_PX    = 128;
+    static constexpr int PAGE_MAX_HEIGHT_PX     = 1024;
+    // Empty space between glyphs, so linear filtering doesn't pick up the neighbours
+    static constexpr int GLYPH_PADDING_PX       = 1;
+
+private:
+    struct Shelf
+    {
+        int y{};
+        int height{};
+        int usedWidth{};
+    };
+
+    struct Page
+    {
+        uint textureId{};
+        int height{};
+        // CPU-side copy of the texture, used to reupload the data when the page grows
+        std::vector<uint8_t> pixels;
+        std::vector<Shelf> shelves;
+    };
+
+    std::vector<Page> m_pages;
+
+    void _addPage();
+    void _growPage(Page& page, int newHeight);
+    bool _tryPackIntoPage(Page& page, int width, int height, glm::ivec2* outPos);
+
+public:
+    GlyphAtlas() {}
+
+    /*
+     * Copy a glyph bitmap to the atlas.
+     *
+     * Returns:
+     *  + the index of the page and the top-left position of the bitmap in pixels.
+     */
+    std::pair<uint, glm::ivec2> add(const uint8_t* bitmap, int width, int height, int pitch);
+
+    inline uint getPageTexture(uint page) const { return m_pages[page].textureId; }
+    inline size_t getPageCount() const { return m_pages.size(); }
+
+    // Delete all the pages
+    void clear();
+
+    ~GlyphAtlas()
+    {
+        clear();
+    }
+};
+
 class Face
 {
 public:
     struct Glyph
     {
-        uint textureId{};
+        // Atlas page index
+        uint page{};
+        // Position in the atlas page, in pixels
+        glm::ivec2 atlasPos;
         glm::ivec2 size;
         glm::ivec2 bearing;
         uint advance{};
@@ -47,6 +114,7 @@ public:
 
 private:
     FT_Face m_face{};
+    GlyphAtlas* m_atlas{};
     std::map<uint, Glyph> m_glyphs;
 
     void _load(FT_Library library, const std::string& path, int size);
@@ -55,7 +123,7 @@ private:
 public:
     Face() {}
 
-    void load(FT_Library library, const std::string& path, int size, bool isRegularFont);
+    void load(FT_Library library, GlyphAtlas* atlas, const std::string& path, int size, bool isRegularFont);
 
     void cleanUp();
 
@@ -79,6 +147,8 @@ private:
     std::string m_fbFontPath;
 
     FT_Library m_library{};
+    // Note: The atlas has to outlive the faces
+    GlyphAtlas m_atlas;
     std::unique_ptr<Face> m_regularFace = std::make_unique<Face>();
     std::unique_ptr<Face> m_boldFace = std::make_unique<Face>();
     std::unique_ptr<Face> m_italicFace = std::make_unique<Face>();
@@ -86,12 +156,26 @@ private:
     std::unique_ptr<Face> m_fallbackFace = std::make_unique<Face>();
     uint m_fontVao;
     uint m_fontVbo;
+    size_t m_fontVboCapacity{};
 
     Shader m_glyphShader;
+    int m_projMatUniformLoc{-1};
+    glm::ivec2 m_projMatWinSize{};
 
     RGBColor m_currentTextColor{1, 1, 1};
 
+    struct GlyphVertex
+    {
+        float x, y;
+        float u, v;
+        float r, g, b;
+    };
+    // Glyphs waiting to be drawn, all of them are on the `m_batchPage` atlas page
+    std::vector<GlyphVertex> m_batch;
+    uint m_batchPage{};
+
     Face::Glyph* getGlyph(Face* face, FT_ULong charcode);
+    void _queueGlyph(const Face::Glyph& glyph, float textX, float textY);
 
     // ---------------------------------------------
     friend class Buffer;
@@ -120,6 +204,16 @@ public:
 
     void setFontSize(int size);
 
+    /*
+     * Draw the queued glyphs.
+     *
+     * Characters are not drawn immediately, but collected and drawn in one go.
+     * Call this before drawing something with another renderer that may overlap the text.
+     * `UiRenderer` does this automatically.
+     * The rectangles queued below the text are drawn first.
+     */
+    void flush();
+
     /*
      * Render a string to the window.
      *
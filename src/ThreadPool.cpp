@@ -0,0 +1,54 @@
+#include "ThreadPool.h"
+#include "Logger.h"
+#include "Profiler.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount/*=0*/)
+{
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (size_t i{}; i < threadCount; ++i)
+        m_workers.emplace_back(&ThreadPool::_workerLoop, this, i);
+    Logger::dbg << "Started a thread pool with " << threadCount << " workers" << Logger::End;
+}
+
+void ThreadPool::_workerLoop(size_t workerI)
+{
+    Profiler::setThreadName("Worker "+std::to_string(workerI));
+
+    while (true)
+    {
+        job_t job;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_cond.wait(lock, [this](){ return m_shouldStop || !m_jobs.empty(); });
+            if (m_shouldStop)
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job();
+    }
+}
+
+void ThreadPool::submit(job_t job)
+{
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        m_jobs.push_back(std::move(job));
+    }
+    m_cond.notify_one();
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        m_shouldStop = true;
+        m_jobs.clear();
+    }
+    m_cond.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+ * A fixed number of worker threads that run the submitted jobs in FIFO order.
+ * The workers sleep on a condition variable while there is nothing to do.
+ */
+class ThreadPool final
+{
+public:
+    using job_t = std::function<void()>;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::deque<job_t> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_shouldStop{};
+
+    void _workerLoop(size_t workerI);
+
+public:
+    /*
+     * @param threadCount The number of workers, 0 means the number of hardware threads.
+     */
+    explicit ThreadPool(size_t threadCount=0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /*
+     * Queue a job. Can be called from any thread.
+     */
+    void submit(job_t job);
+
+    inline size_t getThreadCount() const { return m_workers.size(); }
+
+    /*
+     * Waits for the running jobs to finish, the queued ones are dropped.
+     */
+    ~ThreadPool();
+};
@@ -1,3 +0,0 @@
-#include "Timer.h"
-
-Timer timer;
@@ -1,4 +1,5 @@
 #include "UiRenderer.h"
+#include "TextRenderer.h"
 #include "App.h"
 #include "Logger.h"
 #include "config.h"
@@ -7,6 +8,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstddef>
+#include <algorithm>
 
 UiRenderer::UiRenderer()
     :
@@ -16,24 +19,29 @@ UiRenderer::UiRenderer()
     // --- UI stuff setup ---
 
     glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
+    GlStats::bindVertexArray(m_vao);
 
     glGenBuffers(1, &m_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*2, 0, GL_DYNAMIC_DRAW);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    m_vboCapacity = sizeof(QuadVertex)*6*256;
+    GlStats::bufferData(GL_ARRAY_BUFFER, m_vboCapacity, 0, GL_STREAM_DRAW);
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    // Position
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(QuadVertex), 0);
     glEnableVertexAttribArray(0);
+    // Color
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(QuadVertex), (void*)offsetof(QuadVertex, r));
+    glEnableVertexAttribArray(1);
 
 
     // --- Image stuff setup ---
 
     glGenVertexArrays(1, &m_imgVao);
-    glBindVertexArray(m_imgVao);
+    GlStats::bindVertexArray(m_imgVao);
 
     glGenBuffers(1, &m_imgVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, m_imgVbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, 0, GL_DYNAMIC_DRAW);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_imgVbo);
+    GlStats::bufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, 0, GL_DYNAMIC_DRAW);
 
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float)*4, 0);
     glEnableVertexAttribArray(0);
@@ -41,35 +49,97 @@ UiRenderer::UiRenderer()
     glEnableVertexAttribArray(1);
 
 
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GlStats::bindVertexArray(0);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m_projMatUniformLoc = glGetUniformLocation(m_shader.getId(), "projectionMat");
+    m_imgProjMatUniformLoc = glGetUniformLocation(m_imgShader.getId(), "projectionMat");
 
     Logger::dbg << "UI renderer setup done" << Logger::End;
 }
 
-static void configShaderBeforeDrawing(Shader& shader, int windowWidth, int windowHeight, const RGBAColor& color)
+// The uniform is stored in the program, so only update it when the window has been resized
+static void updateProjMatIfNeeded(int uniformLoc, glm::ivec2* cachedWinSize)
 {
-    shader.use();
-    glUniform4f(glGetUniformLocation(shader.getId(), "fillColor"), UNPACK_RGBA_COLOR(color));
-    const auto matrix = glm::ortho(0.0f, (float)windowWidth, (float)windowHeight, 0.0f);
-    glUniformMatrix4fv(
-            glGetUniformLocation(shader.getId(), "projectionMat"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(matrix));
+    assert(g_windowWidth > 0 && g_windowHeight > 0);
+
+    if (cachedWinSize->x != g_windowWidth || cachedWinSize->y != g_windowHeight)
+    {
+        const auto matrix = glm::ortho(0.0f, (float)g_windowWidth, (float)g_windowHeight, 0.0f);
+        glUniformMatrix4fv(uniformLoc, 1, GL_FALSE, glm::value_ptr(matrix));
+        *cachedWinSize = {g_windowWidth, g_windowHeight};
+    }
 }
 
-static void drawVertices(uint vao, uint vbo, const float** vertexData, int vertexCount)
+void UiRenderer::_drawQuads(const std::vector<Quad>& quads)
 {
-    glBindVertexArray(vao);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vertexCount*sizeof(float)*2, vertexData);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (quads.empty())
+        return;
+
+    m_vertices.clear();
+    m_vertices.reserve(quads.size()*6);
+    for (const Quad& quad : quads)
+    {
+        auto addVertex{[&](int x, int y){
+            m_vertices.push_back({(float)x, (float)y, UNPACK_RGBA_COLOR(quad.color)});
+        }};
+        addVertex(quad.pos1.x, quad.pos2.y);
+        addVertex(quad.pos1.x, quad.pos1.y);
+        addVertex(quad.pos2.x, quad.pos1.y);
+
+        addVertex(quad.pos1.x, quad.pos2.y);
+        addVertex(quad.pos2.x, quad.pos1.y);
+        addVertex(quad.pos2.x, quad.pos2.y);
+    }
+
+    m_shader.use();
+    updateProjMatIfNeeded(m_projMatUniformLoc, &m_projMatWinSize);
+
+    GlStats::bindVertexArray(m_vao);
+
+    const size_t dataSize = m_vertices.size()*sizeof(QuadVertex);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    if (dataSize > m_vboCapacity)
+        m_vboCapacity = std::max(dataSize, m_vboCapacity*2);
+    // Orphan the old storage, so we don't have to wait for the previous draw to finish
+    GlStats::bufferData(GL_ARRAY_BUFFER, m_vboCapacity, 0, GL_STREAM_DRAW);
+    GlStats::bufferSubData(GL_ARRAY_BUFFER, 0, dataSize, m_vertices.data());
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, 0);
+
+    GlStats::drawArrays(GL_TRIANGLES, 0, m_vertices.size());
+
+    GlStats::bindVertexArray(0);
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+void UiRenderer::_addQuad(std::vector<Quad>& quads, const glm::ivec2& position1, const glm::ivec2& position2,
+        const RGBAColor& color)
+{
+    if (!quads.empty())
+    {
+        // Merge the runs of same colored cells in a line (e.g. selection, indent rainbow)
+        Quad& last = quads.back();
+        if (last.pos2.x == position1.x && last.pos1.y == position1.y && last.pos2.y == position2.y
+         && last.color.r == color.r && last.color.g == color.g && last.color.b == color.b && last.color.a == color.a)
+        {
+            last.pos2.x = position2.x;
+            return;
+        }
+    }
+    quads.push_back({position1, position2, color});
+}
 
-    glBindVertexArray(0);
+void UiRenderer::_addOutline(std::vector<Quad>& quads, const glm::ivec2& position1, const glm::ivec2& position2,
+        const RGBAColor& color, uint borderThickness)
+{
+    const int thickness = borderThickness;
+    // Top
+    _addQuad(quads, position1, {position2.x, position1.y+thickness}, color);
+    // Right side
+    _addQuad(quads, {position2.x-thickness, position1.y}, position2, color);
+    // Bottom
+    _addQuad(quads, {position1.x, position2.y-thickness}, position2, color);
+    // Left side
+    _addQuad(quads, position1, {position1.x+thickness, position2.y}, color);
 }
 
 void UiRenderer::renderFilledRectangle(
@@ -78,20 +148,12 @@ void UiRenderer::renderFilledRectangle(
         const RGBAColor& fillColor
     )
 {
-    assert(g_windowWidth > 0 && g_windowHeight > 0);
-
-    configShaderBeforeDrawing(m_shader, g_windowWidth, g_windowHeight, fillColor);
-
-    const float vertexData[6][2] = {
-        {(float)position1.x, (float)position2.y},
-        {(float)position1.x, (float)position1.y},
-        {(float)position2.x, (float)position1.y},
+    // Draw the queued text first, so it doesn't end up above the rectangle
+    g_textRenderer->flush();
 
-        {(float)position1.x, (float)position2.y},
-        {(float)position2.x, (float)position1.y},
-        {(float)position2.x, (float)position2.y},
-    };
-    drawVertices(m_vao, m_vbo, (const float**)vertexData, 6);
+    std::vector<Quad> quads;
+    _addQuad(quads, position1, position2, fillColor);
+    _drawQuads(quads);
 }
 
 void UiRenderer::renderRectangleOutline(
@@ -101,68 +163,50 @@ void UiRenderer::renderRectangleOutline(
         uint borderThickness
     )
 {
-    assert(g_windowWidth > 0 && g_windowHeight > 0);
-
-    configShaderBeforeDrawing(m_shader, g_windowWidth, g_windowHeight, fillColor);
+    // Draw the queued text first, so it doesn't end up above the rectangle
+    g_textRenderer->flush();
 
-    // Top
-    const float rect1VertexData[6][2] = {
-        {(float)position2.x,                 (float)position1.y},
-        {(float)position1.x,                 (float)position1.y},
-        {(float)position1.x,                 (float)position1.y+borderThickness},
-        {(float)position2.x,                 (float)position1.y},
-        {(float)position2.x,                 (float)position1.y+borderThickness},
-        {(float)position1.x,                 (float)position1.y+borderThickness},
-    };
-    drawVertices(m_vao, m_vbo, (const float**)rect1VertexData, 6);
+    std::vector<Quad> quads;
+    _addOutline(quads, position1, position2, fillColor, borderThickness);
+    _drawQuads(quads);
+}
 
-    // Right side
-    const float rect2VertexData[6][2] = {
-        {(float)position2.x,                 (float)position1.y},
-        {(float)position2.x,                 (float)position2.y},
-        {(float)position2.x-borderThickness, (float)position2.y},
-        {(float)position2.x-borderThickness, (float)position2.y},
-        {(float)position2.x-borderThickness, (float)position1.y},
-        {(float)position2.x,                 (float)position1.y},
-    };
-    drawVertices(m_vao, m_vbo, (const float**)rect2VertexData, 6);
+void UiRenderer::queueFilledRectangle(
+        const glm::ivec2& position1,
+        const glm::ivec2& position2,
+        const RGBAColor& fillColor,
+        Layer layer/*=Layer::BelowText*/
+    )
+{
+    _addQuad(m_layers[(int)layer], position1, position2, fillColor);
+}
 
-    // Bottom
-    const float rect3VertexData[6][2] = {
-        {(float)position1.x,                 (float)position2.y},
-        {(float)position2.x,                 (float)position2.y},
-        {(float)position2.x,                 (float)position2.y-borderThickness},
-        {(float)position1.x,                 (float)position2.y},
-        {(float)position1.x,                 (float)position2.y-borderThickness},
-        {(float)position2.x,                 (float)position2.y-borderThickness},
-    };
-    drawVertices(m_vao, m_vbo, (const float**)rect3VertexData, 6);
+void UiRenderer::queueRectangleOutline(
+        const glm::ivec2& position1,
+        const glm::ivec2& position2,
+        const RGBAColor& color,
+        uint borderThickness,
+        Layer layer/*=Layer::BelowText*/
+    )
+{
+    _addOutline(m_layers[(int)layer], position1, position2, color, borderThickness);
+}
 
-    // Left side
-    const float rect4VertexData[6][2] = {
-        {(float)position1.x,                 (float)position2.y},
-        {(float)position1.x,                 (float)position1.y},
-        {(float)position1.x+borderThickness, (float)position1.y},
-        {(float)position1.x+borderThickness, (float)position1.y},
-        {(float)position1.x+borderThickness, (float)position2.y},
-        {(float)position1.x,                 (float)position2.y},
-    };
-    drawVertices(m_vao, m_vbo, (const float**)rect4VertexData, 6);
+void UiRenderer::flush(Layer layer)
+{
+    auto& quads = m_layers[(int)layer];
+    _drawQuads(quads);
+    quads.clear();
 }
 
 void UiRenderer::renderImage(const Image* image, const glm::ivec2& pos, const glm::ivec2& size)
 {
-    assert(g_windowWidth > 0 && g_windowHeight > 0);
+    g_textRenderer->flush();
 
     m_imgShader.use();
-    const auto matrix = glm::ortho(0.0f, (float)g_windowWidth, (float)g_windowHeight, 0.0f);
-    glUniformMatrix4fv(
-            glGetUniformLocation(m_imgShader.getId(), "projectionMat"),
-            1,
-            GL_FALSE,
-            glm::value_ptr(matrix));
+    updateProjMatIfNeeded(m_imgProjMatUniformLoc, &m_imgProjMatWinSize);
 
-    glBindTexture(GL_TEXTURE_2D, image->getSamplerId());
+    GlStats::bindTexture(GL_TEXTURE_2D, image->getSamplerId());
 
     const float x1 = pos.x;
     const float y1 = pos.y;
@@ -177,15 +221,15 @@ void UiRenderer::renderImage(const Image* image, const glm::ivec2& pos, const gl
         {x2, y2, 1.0f, 0.0f},
     };
 
-    glBindVertexArray(m_imgVao);
+    GlStats::bindVertexArray(m_imgVao);
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_imgVbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 6*sizeof(float)*4, vertexData);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, m_imgVbo);
+    GlStats::bufferSubData(GL_ARRAY_BUFFER, 0, 6*sizeof(float)*4, vertexData);
+    GlStats::bindBuffer(GL_ARRAY_BUFFER, 0);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    GlStats::drawArrays(GL_TRIANGLES, 0, 6);
 
-    glBindVertexArray(0);
+    GlStats::bindVertexArray(0);
 }
 
 UiRenderer::~UiRenderer()
@@ -4,21 +4,62 @@
 #include "Shader.h"
 #include "Image.h"
 #include <memory>
+#include <vector>
 #include <glm/glm.hpp>
 
 class Image;
 
 class UiRenderer
 {
+public:
+    /*
+     * The queued rectangles are drawn in layers, one draw call per layer.
+     * The rectangles below the text are drawn before the queued text is drawn,
+     * the ones above it have to be flushed after the text.
+     */
+    enum class Layer
+    {
+        BelowText,
+        AboveText,
+        _Count,
+    };
+
 private:
     uint m_vao;
     uint m_vbo;
+    size_t m_vboCapacity{};
 
     uint m_imgVao;
     uint m_imgVbo;
 
     Shader m_shader;
+    int m_projMatUniformLoc{-1};
+    glm::ivec2 m_projMatWinSize{};
     Shader m_imgShader;
+    int m_imgProjMatUniformLoc{-1};
+    glm::ivec2 m_imgProjMatWinSize{};
+
+    struct Quad
+    {
+        glm::ivec2 pos1;
+        glm::ivec2 pos2;
+        RGBAColor color;
+    };
+    std::vector<Quad> m_layers[(int)Layer::_Count];
+
+    struct QuadVertex
+    {
+        float x, y;
+        float r, g, b, a;
+    };
+    // Reused between the draws
+    std::vector<QuadVertex> m_vertices;
+
+    void _drawQuads(const std::vector<Quad>& quads);
+    static void _addQuad(std::vector<Quad>& quads, const glm::ivec2& position1, const glm::ivec2& position2,
+            const RGBAColor& color);
+    static void _addOutline(std::vector<Quad>& quads, const glm::ivec2& position1, const glm::ivec2& position2,
+            const RGBAColor& color, uint borderThickness);
 
     friend class Image;
     // Used by Image::render()
@@ -27,6 +68,9 @@ private:
 public:
     UiRenderer();
 
+    /*
+     * Draw a rectangle now.
+     */
     void renderFilledRectangle(
         const glm::ivec2& position1,
         const glm::ivec2& position2,
@@ -40,6 +84,32 @@ public:
         uint borderThickness
         );
 
+    /*
+     * Queue a rectangle to be drawn when its layer is flushed.
+     * If it continues the previous rectangle of the layer in the same line with the same color,
+     * it is merged into that.
+     */
+    void queueFilledRectangle(
+        const glm::ivec2& position1,
+        const glm::ivec2& position2,
+        const RGBAColor& fillColor,
+        Layer layer=Layer::BelowText
+        );
+
+    void queueRectangleOutline(
+        const glm::ivec2& position1,
+        const glm::ivec2& position2,
+        const RGBAColor& color,
+        uint borderThickness,
+        Layer layer=Layer::BelowText
+        );
+
+    /*
+     * Draw the queued rectangles of a layer.
+     * `TextRenderer::flush()` flushes the `BelowText` layer.
+     */
+    void flush(Layer layer);
+
     ~UiRenderer();
 };
 
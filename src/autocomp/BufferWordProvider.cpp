@@ -1,18 +1,212 @@
 #include "BufferWordProvider.h"
 #include "Popup.h"
 #include "../Logger.h"
+#include "../Buffer.h"
+#include "../ThreadPool.h"
+#include "../Profiler.h"
+#include "../globals.h"
+#include "../common/string.h"
+#include "../config.h"
+#include <algorithm>
 
 namespace Autocomp
 {
 
+std::unordered_map<String, int> BufferWordProvider::countWords(const String& text)
+{
+    std::unordered_map<String, int> counts;
+    size_t i{};
+    while (i < text.size())
+    {
+        if (!isIdentifierChar(text[i]))
+        {
+            ++i;
+            continue;
+        }
+
+        const size_t start = i;
+        while (i < text.size() && isIdentifierChar(text[i]))
+            ++i;
+        // Skip numbers
+        if (i-start >= BUFFWORD_MIN_LEN && !u_isdigit(text[start]))
+            ++counts[text.substr(start, i-start)];
+    }
+    return counts;
+}
+
+BufferWordProvider::wordId_t BufferWordProvider::_intern(const String& word)
+{
+    auto it = m_wordIds.find(word);
+    if (it != m_wordIds.end())
+        return it->second;
+
+    wordId_t id;
+    if (m_freeWordIds.empty())
+    {
+        id = m_wordTexts.size();
+        m_wordTexts.push_back(word);
+        m_wordTotals.push_back(0);
+        m_wordRefCounts.push_back(0);
+    }
+    else
+    {
+        id = m_freeWordIds.back();
+        m_freeWordIds.pop_back();
+        m_wordTexts[id] = word;
+        assert(m_wordTotals[id] == 0 && m_wordRefCounts[id] == 0);
+    }
+    m_wordIds.emplace(word, id);
+    return id;
+}
+
+void BufferWordProvider::_unref(wordId_t id)
+{
+    assert(m_wordRefCounts[id] > 0);
+    if (--m_wordRefCounts[id] != 0)
+        return;
+
+    // The counts of the buffers cancelled out
+    assert(m_wordTotals[id] == 0);
+    m_wordIds.erase(m_wordTexts[id]);
+    m_wordTexts[id].clear();
+    m_wordTexts[id].shrink_to_fit();
+    m_freeWordIds.push_back(id);
+}
+
+void BufferWordProvider::_addCount(BufferWords& buffer, const String& word, int delta)
+{
+    const wordId_t id = _intern(word);
+    auto [it, isNew] = buffer.counts.emplace(id, 0);
+    if (isNew)
+        ++m_wordRefCounts[id];
+    it->second += delta;
+    m_wordTotals[id] += delta;
+    if (it->second == 0)
+    {
+        buffer.counts.erase(it);
+        _unref(id);
+    }
+}
+
+void BufferWordProvider::_dropBuffer(std::map<bufid_t, BufferWords>::iterator it)
+{
+    for (const auto& [id, count] : it->second.counts)
+    {
+        m_wordTotals[id] -= count;
+        _unref(id);
+    }
+    m_buffers.erase(it);
+}
+
+void BufferWordProvider::indexBuffer(bufid_t bufid, String content)
+{
+    uint64_t serial;
+    {
+        std::lock_guard<std::mutex> guard{m_mutex};
+        // Drop the old index, the edits counted so far are included in the new content
+        auto it = m_buffers.find(bufid);
+        if (it != m_buffers.end())
+            _dropBuffer(it);
+        serial = ++m_lastJobSerial;
+        m_buffers[bufid].jobSerial = serial;
+    }
+
+    auto job = [this, bufid, serial, content=std::move(content)](){
+        PROFILE_ZONE("Index buffer words");
+
+        const auto counts = countWords(content);
+
+        std::lock_guard<std::mutex> guard{m_mutex};
+        auto it = m_buffers.find(bufid);
+        // The buffer was closed or reindexed in the meantime
+        if (it == m_buffers.end() || it->second.jobSerial != serial)
+            return;
+        for (const auto& [word, count] : counts)
+            _addCount(it->second, word, count);
+        Logger::dbg << "BufferWordProvider: Indexed buffer " << bufid << " ("
+            << counts.size() << " unique words)" << Logger::End;
+    };
+
+    if (g_threadPool)
+        g_threadPool->submit(std::move(job));
+    else
+        job();
+}
+
+void BufferWordProvider::update(bufid_t bufid, const String& oldText, const String& newText)
+{
+    const auto oldCounts = countWords(oldText);
+    const auto newCounts = countWords(newText);
+
+    std::lock_guard<std::mutex> guard{m_mutex};
+    auto& buffer = m_buffers[bufid];
+    for (const auto& [word, count] : oldCounts)
+        _addCount(buffer, word, -count);
+    for (const auto& [word, count] : newCounts)
+        _addCount(buffer, word, count);
+}
+
+void BufferWordProvider::removeBuffer(bufid_t bufid)
+{
+    std::lock_guard<std::mutex> guard{m_mutex};
+    auto it = m_buffers.find(bufid);
+    if (it == m_buffers.end())
+        return;
+    _dropBuffer(it);
+}
+
+std::vector<String> BufferWordProvider::query(const String& prefix, bufid_t currBufid, size_t maxCount) const
+{
+    std::lock_guard<std::mutex> guard{m_mutex};
+
+    const auto currBuf = m_buffers.find(currBufid);
+    struct Match
+    {
+        int score;
+        wordId_t id;
+    };
+    std::vector<Match> matches;
+    // Only visit the words that start with the prefix
+    for (auto it = m_wordIds.lower_bound(prefix);
+         it != m_wordIds.end() && it->first.starts_with(prefix); ++it)
+    {
+        const wordId_t id = it->second;
+        // Negative while the initial index of a buffer is being built
+        if (it->first.size() == prefix.size() || m_wordTotals[id] <= 0)
+            continue;
+
+        int score = m_wordTotals[id];
+        if (currBuf != m_buffers.end())
+        {
+            const auto countIt = currBuf->second.counts.find(id);
+            if (countIt != currBuf->second.counts.end())
+                score += countIt->second*(BUFFWORD_CURR_BUF_WEIGHT-1);
+        }
+        matches.push_back({score, id});
+    }
+
+    const size_t count = std::min(matches.size(), maxCount);
+    std::partial_sort(matches.begin(), matches.begin()+count, matches.end(),
+            [](const Match& a, const Match& b){ return a.score > b.score; });
+
+    std::vector<String> output;
+    output.reserve(count);
+    for (size_t i{}; i < count; ++i)
+        output.push_back(m_wordTexts[matches[i].id]);
+    return output;
+}
+
 void BufferWordProvider::get(bufid_t bufid, Popup* popupP)
 {
-    Logger::dbg << "BufferWordProvider: feeding words into Popup (count: " << m_words.size() << ")" << Logger::End;
+    if (!g_activeBuff)
+        return;
 
-    if (m_words.find(bufid) == m_words.end())
+    const String prefix = g_activeBuff->getWordToComplete();
+    if (prefix.empty())
         return;
 
-    auto words = m_words.find(bufid)->second;
+    const auto words = query(prefix, bufid, BUFFWORD_MAX_RESULTS);
+    Logger::dbg << "BufferWordProvider: feeding words into Popup (count: " << words.size() << ")" << Logger::End;
     for (const auto& word : words)
     {
         Popup::Item item;
@@ -22,18 +216,15 @@ void BufferWordProvider::get(bufid_t bufid, Popup* popupP)
     }
 }
 
-void BufferWordProvider::add(bufid_t bufid, const String& word)
-{
-    if (m_words.find(bufid) == m_words.end())
-        m_words.insert({bufid, {word}});
-    else
-        m_words.at(bufid).push_back(word);
-}
-
 void BufferWordProvider::clear()
 {
-    m_words.clear();
+    std::lock_guard<std::mutex> guard{m_mutex};
+    m_buffers.clear();
+    m_wordIds.clear();
+    m_wordTexts.clear();
+    m_wordTotals.clear();
+    m_wordRefCounts.clear();
+    m_freeWordIds.clear();
 }
 
 } // namespace Autocomp
-
@@ -5,18 +5,80 @@
 #include "../types.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
 
 namespace Autocomp
 {
 
+/*
+ * Offers the words of the open buffers.
+ *
+ * The words are interned, every buffer only stores how many times each word occurs in it.
+ * A word is released when no buffer contains it anymore.
+ * The index of a buffer is built in the background when it is opened
+ * and updated from the edited lines.
+ */
 class BufferWordProvider final : public IProvider
 {
 private:
-    std::map<bufid_t, std::vector<String>> m_words;
+    using wordId_t = uint32_t;
+
+    // Interned words, sorted so the words with a prefix are next to each other
+    std::map<String, wordId_t> m_wordIds;
+    // Indexed by the word ID, the released IDs are reused
+    std::vector<String> m_wordTexts;
+    // The number of occurrences in all the buffers
+    std::vector<int> m_wordTotals;
+    // The number of buffers that have a non-zero count of the word
+    std::vector<uint32_t> m_wordRefCounts;
+    std::vector<wordId_t> m_freeWordIds;
+
+    struct BufferWords
+    {
+        // Can be negative while the initial index is being built,
+        // the edits made in the meantime are applied to it
+        std::unordered_map<wordId_t, int> counts;
+        // Identifies the last indexing job, the results of the older ones are dropped
+        uint64_t jobSerial{};
+    };
+    std::map<bufid_t, BufferWords> m_buffers;
+    uint64_t m_lastJobSerial{};
+
+    // Protects everything, the background jobs merge their results
+    mutable std::mutex m_mutex;
+
+    wordId_t _intern(const String& word);
+    // Release the word if no buffer refers to it anymore
+    void _unref(wordId_t id);
+    void _addCount(BufferWords& buffer, const String& word, int delta);
+    // Remove the counts of a buffer from the totals
+    void _dropBuffer(std::map<bufid_t, BufferWords>::iterator it);
 
 public:
+    // Count the words of a text
+    static std::unordered_map<String, int> countWords(const String& text);
+
+    /*
+     * Build the index of a buffer in the background.
+     * Replaces the current index of the buffer.
+     */
+    void indexBuffer(bufid_t bufid, String content);
+    /*
+     * Update the index of a buffer after an edit.
+     * `oldText` and `newText` are the whole lines touched by the edit, before and after it.
+     */
+    void update(bufid_t bufid, const String& oldText, const String& newText);
+    void removeBuffer(bufid_t bufid);
+
+    /*
+     * Returns the words that start with `prefix` (but are longer than it) from all the buffers.
+     * The most frequent ones are first, the words of `currBufid` count more.
+     */
+    std::vector<String> query(const String& prefix, bufid_t currBufid, size_t maxCount) const;
+
     virtual void get(bufid_t bufid, Popup* popupP) override;
-    virtual void add(bufid_t bufid, const String& word);
     virtual void clear();
 };
 
@@ -1,27 +1,87 @@
 #include "DictionaryProvider.h"
 #include "Popup.h"
 #include "../App.h"
+#include "../Buffer.h"
+#include "../globals.h"
 #include "../common/file.h"
+#include "../common/string.h"
+#include <filesystem>
+#include <fstream>
+#include <cstring>
 
 namespace Autocomp
 {
 
+std::unique_ptr<WordIndex> DictionaryProvider::loadOrBuildIndex(
+        const std::string& listPath, const std::string& indexPath)
+{
+    std::error_code err;
+    const auto listModTime = std::filesystem::last_write_time(listPath);
+    const auto indexModTime = std::filesystem::last_write_time(indexPath, err);
+    if (!err && indexModTime >= listModTime)
+    {
+        try
+        {
+            auto index = std::make_unique<WordIndex>(std::make_shared<const MappedFile>(indexPath));
+            Logger::dbg << "Loaded dictionary index: " << quoteStr(indexPath) << Logger::End;
+            return index;
+        }
+        catch (std::exception& e)
+        {
+            Logger::warn << "Failed to load dictionary index: " << quoteStr(indexPath)
+                << ": " << e.what() << ", rebuilding it" << Logger::End;
+        }
+    }
+
+    Logger::log << "Building dictionary index: " << quoteStr(indexPath) << Logger::End;
+    std::ifstream file{listPath, std::ios::in | std::ios::binary};
+    if (file.fail())
+    {
+        throw std::runtime_error{std::strerror(errno)};
+    }
+    std::vector<std::string> words;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (countUtf8Chars(line.data(), line.size()) > 2)
+            words.push_back(std::move(line));
+    }
+    std::string data = WordIndex::build(std::move(words));
+
+    // Write to a temporary file, so a half-written index is never loaded
+    const std::string tempPath = indexPath+".tmp";
+    {
+        std::ofstream out{tempPath, std::ios::out | std::ios::binary | std::ios::trunc};
+        out.write(data.data(), data.size());
+        out.close();
+        if (out.fail())
+        {
+            Logger::warn << "Failed to write dictionary index: " << quoteStr(indexPath)
+                << ", keeping it in memory" << Logger::End;
+            std::filesystem::remove(tempPath, err);
+            return std::make_unique<WordIndex>(std::move(data));
+        }
+    }
+    std::filesystem::rename(tempPath, indexPath, err);
+    if (err)
+    {
+        Logger::warn << "Failed to write dictionary index: " << quoteStr(indexPath)
+            << ": " << err.message() << ", keeping it in memory" << Logger::End;
+        std::filesystem::remove(tempPath, err);
+    }
+    return std::make_unique<WordIndex>(std::move(data));
+}
+
 DictionaryProvider::DictionaryProvider()
 {
     Logger::log << "Loading dictionary: " << quoteStr(DICTIONARY_FILE_PATH) << Logger::End;
 
     try
     {
-        const String content = loadUnicodeFile(App::getResPath(DICTIONARY_FILE_PATH));
-        LineIterator it = content;
-        String line;
-        while (it.next(line))
-        {
-            if (line.length() > 2)
-            {
-                m_words.push_back(line);
-            }
-        }
+        m_index = loadOrBuildIndex(
+                App::getResPath(DICTIONARY_FILE_PATH), App::getStatePath(DICTIONARY_INDEX_PATH));
     }
     catch (std::exception& e)
     {
@@ -31,20 +91,24 @@ DictionaryProvider::DictionaryProvider()
     }
 
     Logger::log << "Loaded dictionary " << quoteStr(DICTIONARY_FILE_PATH) << " with "
-        << m_words.size() << " words (filtered)" << Logger::End;
-    if (m_words.size() > 50'000)
-    {
-        Logger::warn << "Dictionary has a lot of words, autocompletion may be slow" << Logger::End;
-    }
+        << m_index->getWordCount() << " words (filtered)" << Logger::End;
 }
 
 void DictionaryProvider::get(bufid_t, Popup* popupP)
 {
-    Logger::dbg << "DictionaryProvider: feeding words into Popup (count: " << m_words.size() << ")" << Logger::End;
-    for (const auto& word : m_words)
+    if (!g_activeBuff)
+        return;
+
+    const std::string prefix = utf32To8(g_activeBuff->getWordToComplete());
+    if (prefix.empty())
+        return;
+
+    const auto words = m_index->findWithPrefix(prefix, DICTIONARY_MAX_RESULTS);
+    Logger::dbg << "DictionaryProvider: feeding words into Popup (count: " << words.size() << ")" << Logger::End;
+    for (const auto& word : words)
     {
         Popup::Item item;
-        item.label = utf32To8(word);
+        item.label = word;
         item.kind.emplace(lsCompletionItemKind::Text);
         popupP->addItem(std::move(item));
     }
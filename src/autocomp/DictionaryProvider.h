@@ -1,8 +1,9 @@
 #pragma once
 
 #include "IProvider.h"
+#include "WordIndex.h"
 #include "../types.h"
-#include <vector>
+#include <memory>
 
 namespace Autocomp
 {
@@ -10,9 +11,13 @@ namespace Autocomp
 class DictionaryProvider final : public IProvider
 {
 private:
-    // This is the list of words in the dictionary
+    // This is the index of the words in the dictionary
     // It is used by all the buffers
-    std::vector<String> m_words;
+    std::unique_ptr<WordIndex> m_index;
+
+    // Load the index file or build it from the word list if it is missing or outdated
+    static std::unique_ptr<WordIndex> loadOrBuildIndex(
+            const std::string& listPath, const std::string& indexPath);
 
 public:
     DictionaryProvider();
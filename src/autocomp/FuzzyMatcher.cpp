@@ -0,0 +1,108 @@
+#include "FuzzyMatcher.h"
+#include "../common/string.h"
+#include <algorithm>
+#include <unicode/uchar.h>
+
+#define SCORE_MATCH             16
+#define BONUS_CONSECUTIVE       24
+#define BONUS_WORD_START        32
+#define BONUS_PREFIX            64
+#define MAX_GAP_PENALTY         8
+
+namespace Autocomp
+{
+
+namespace Fuzzy
+{
+
+MatchKey makeKey(const String& text)
+{
+    MatchKey key;
+    key.lower = strToLower(text);
+    key.charMask = calcCharMask(key.lower);
+
+    const size_t len = std::min<size_t>(text.size(), 64);
+    for (size_t i{}; i < len; ++i)
+    {
+        // The first character, the one after an underscore or another non-identifier character,
+        // or the upper case character of a camelCase hump
+        const bool isWordStart = i == 0
+            || !isIdentifierChar(text[i-1]) || text[i-1] == '_'
+            || (u_isupper(text[i]) && u_islower(text[i-1]));
+        if (isWordStart && isIdentifierChar(text[i]))
+            key.wordStarts |= uint64_t(1) << i;
+    }
+    return key;
+}
+
+static inline int getCharMaskBit(Char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return c-'a';           // 0..25
+    if (c >= '0' && c <= '9')
+        return 26+(c-'0');      // 26..35
+    if (c == '_')
+        return 36;
+    if (c < 128)
+        return 37+(c%26);       // 37..62, shared by the other ASCII characters
+    return 63;
+}
+
+uint64_t calcCharMask(const String& lowerStr)
+{
+    uint64_t mask{};
+    // Lower case letters, digits and the underscore get their own bits,
+    // the other ASCII characters share some, the rest share one
+    for (Char c : lowerStr)
+        mask |= uint64_t(1) << getCharMaskBit(c);
+    return mask;
+}
+
+int calcScore(const MatchKey& key, const String& patternLower, uint64_t patternMask)
+{
+    if (patternLower.empty())
+        return 0;
+    // Cheap early rejection, most candidates fail here
+    if ((patternMask & ~key.charMask) || patternLower.size() > key.lower.size())
+        return -1;
+
+    const Char* const text = key.lower.data();
+    const size_t textLen = key.lower.size();
+
+    int score{};
+    size_t textI{};
+    size_t prevMatchI = SIZE_MAX;
+    for (const Char patChar : patternLower)
+    {
+        // Find the next occurrence
+        while (textI < textLen && text[textI] != patChar)
+            ++textI;
+        if (textI == textLen)
+            return -1;
+
+        score += SCORE_MATCH;
+        if (prevMatchI != SIZE_MAX)
+        {
+            if (textI == prevMatchI+1)
+                score += BONUS_CONSECUTIVE;
+            else
+                score -= std::min<int>(textI-prevMatchI-1, MAX_GAP_PENALTY);
+        }
+        if (textI < 64 && (key.wordStarts & (uint64_t(1) << textI)))
+            score += BONUS_WORD_START;
+
+        prevMatchI = textI;
+        ++textI;
+    }
+
+    if (std::equal(patternLower.begin(), patternLower.end(), text))
+        score += BONUS_PREFIX;
+    // Prefer the shorter candidates
+    score -= (textLen-patternLower.size())/4;
+
+    return std::max(score, 0);
+}
+
+} // namespace Fuzzy
+
+} // namespace Autocomp
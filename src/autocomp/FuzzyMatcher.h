@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../types.h"
+#include <cstdint>
+
+namespace Autocomp
+{
+
+namespace Fuzzy
+{
+
+/*
+ * The data of a completion candidate needed for matching.
+ * Built once per candidate, so matching does not allocate or convert.
+ */
+struct MatchKey
+{
+    String lower;
+    // Characters that appear in the text, see `calcCharMask()`
+    uint64_t charMask{};
+    // Bit `i` is set if a word starts at index `i` (only the first 64 characters)
+    uint64_t wordStarts{};
+};
+
+MatchKey makeKey(const String& text);
+
+/*
+ * A 64-bit set of the characters in a lowercase string.
+ * If a bit is set in the pattern's mask but not in the candidate's,
+ * the candidate can't match.
+ */
+uint64_t calcCharMask(const String& lowerStr);
+
+/*
+ * Match the pattern as a subsequence of the candidate.
+ *
+ * @param patternLower The lowercase pattern.
+ * @param patternMask `calcCharMask(patternLower)`
+ * @returns The score (higher is better) or -1 if the candidate does not match.
+ */
+int calcScore(const MatchKey& key, const String& patternLower, uint64_t patternMask);
+
+} // namespace Fuzzy
+
+} // namespace Autocomp
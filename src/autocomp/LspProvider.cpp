@@ -6,6 +6,7 @@
 #include "../globals.h"
 #include "../doxygen.h"
 #include "../markdown.h"
+#include "../EventLoop.h"
 #ifdef __clang__
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Weverything"
@@ -44,6 +45,7 @@
 #include <filesystem>
 #include <type_traits>
 #include <mutex>
+#include <algorithm>
 
 #define LSP_TIMEOUT_MILLI 10000
 
@@ -80,11 +82,104 @@ namespace Autocomp
 bool didServerCrash = false;
 
 // static
-LspProvider::diagListMap_t LspProvider::s_diags{};
+std::unordered_map<std::string, LspProvider::fileDiagsPtr_t> LspProvider::s_diags{};
+// static
+std::mutex LspProvider::s_diagsMutex;
+
+LspProvider::FileDiags::FileDiags(diagList_t&& diags)
+    : m_diags{std::move(diags)}
+{
+    for (const lsDiagnostic& diag : m_diags)
+    {
+        // Note: We default to Information, maybe this needs to be changed later
+        const auto sev = diag.severity.get_value_or(lsDiagnosticSeverity::Information);
+        if (sev == lsDiagnosticSeverity::Error)
+            ++m_errorCount;
+        else if (sev == lsDiagnosticSeverity::Warning)
+            ++m_warningCount;
+
+        const int startLine = diag.range.start.line;
+        const int endLine = std::max(diag.range.end.line, diag.range.start.line);
+        for (int lineI{startLine}; lineI <= endLine; ++lineI)
+        {
+            Span span;
+            span.startCol = (lineI == startLine ? diag.range.start.character : 0);
+            span.endCol = (lineI == diag.range.end.line ? diag.range.end.character : INT_MAX);
+            span.diag = &diag;
+            span.isStart = (lineI == startLine);
+            m_lineSpans[lineI].push_back(span);
+        }
+    }
+
+    for (auto& [lineI, spans] : m_lineSpans)
+    {
+        // Stable, so the diagnostics that came first stay first
+        std::stable_sort(spans.begin(), spans.end(), [](const Span& a, const Span& b){
+                return a.startCol < b.startCol;
+        });
+    }
+}
+
+const LspProvider::FileDiags::spanList_t* LspProvider::FileDiags::getLineSpans(int line) const
+{
+    const auto it = m_lineSpans.find(line);
+    return it == m_lineSpans.end() ? nullptr : &it->second;
+}
+
+const lsDiagnostic* LspProvider::FileDiags::findAt(int line, int col) const
+{
+    const spanList_t* spans = getLineSpans(line);
+    if (!spans)
+        return nullptr;
+
+    // Pick the one that came first from the server, like a linear search would
+    const lsDiagnostic* found{};
+    for (const Span& span : *spans)
+    {
+        if (span.startCol > col)
+            break;
+        if (col < span.endCol && (!found || span.diag < found))
+            found = span.diag;
+    }
+    return found;
+}
+
+const lsDiagnostic* LspProvider::FileDiags::findStartingIn(int line) const
+{
+    const spanList_t* spans = getLineSpans(line);
+    if (!spans)
+        return nullptr;
+
+    const lsDiagnostic* found{};
+    for (const Span& span : *spans)
+    {
+        if (span.isStart && (!found || span.diag < found))
+            found = span.diag;
+    }
+    return found;
+}
+
+// static
+LspProvider::fileDiagsPtr_t LspProvider::getDiagsForFile(const std::string& path)
+{
+    std::lock_guard<std::mutex> guard{s_diagsMutex};
+    const auto it = s_diags.find(path);
+    return it == s_diags.end() ? nullptr : it->second;
+}
+
+// static
+void LspProvider::setDiagsForFile(const std::string& path, diagList_t&& diags)
+{
+    // Build the index before locking, the reader must not wait for it
+    auto fileDiags = std::make_shared<const FileDiags>(std::move(diags));
+
+    std::lock_guard<std::mutex> guard{s_diagsMutex};
+    s_diags.insert_or_assign(path, std::move(fileDiags));
+}
 
 static bool publishDiagnosticsCallback(std::unique_ptr<LspMessage> msg)
 {
-    Logger::dbg << "LSP: Received a textDocument/publishDiagnostics notification: "
+    LOG_DBG("LSP") << "Received a textDocument/publishDiagnostics notification: "
         << msg->ToJson() << Logger::End;
 
     auto notif = dynamic_cast<Notify_TextDocumentPublishDiagnostics::notify*>(msg.get());
@@ -93,11 +188,11 @@ static bool publishDiagnosticsCallback(std::unique_ptr<LspMessage> msg)
     Logger::dbg << "Path: " << notif->params.uri.GetAbsolutePath().path << Logger::End;
     Logger::dbg << "Diagn. count: " << notif->params.diagnostics.size() << Logger::End;
 
-    auto insertedIt = LspProvider::s_diags.insert_or_assign(
-            notif->params.uri.GetAbsolutePath().path, LspProvider::diagList_t{}).first;
-    insertedIt->second = std::move(notif->params.diagnostics);
+    LspProvider::setDiagsForFile(
+            notif->params.uri.GetAbsolutePath().path, std::move(notif->params.diagnostics));
 
     g_isRedrawNeeded = true;
+    EventLoop::wakeUpNow(); // We are on the LSP thread
 
     return true; // TODO: What's this?
 }
@@ -164,7 +259,7 @@ static void applyWorkspaceEdit(const lsWorkspaceEdit& edit)
 
 static bool workspaceApplyEditCallback(std::unique_ptr<LspMessage> msg)
 {
-    Logger::dbg << "LSP: Received a workspace/applyEdit request: "
+    LOG_DBG("LSP") << "Received a workspace/applyEdit request: "
         << msg->ToJson() << Logger::End;
 
     auto req = dynamic_cast<WorkspaceApply::request*>(msg.get());
@@ -181,7 +276,7 @@ static bool workspaceApplyEditCallback(std::unique_ptr<LspMessage> msg)
 
 static bool workspaceConfigurationCallback(std::unique_ptr<LspMessage> msg)
 {
-    Logger::dbg << "LSP: Received a workspace/configuration request: "
+    LOG_DBG("LSP") << "Received a workspace/configuration request: "
         << msg->ToJson() << Logger::End;
 
     const auto ptr = dynamic_cast<const WorkspaceConfiguration::request*>(msg.get());
@@ -210,7 +305,7 @@ bool LspProvider::progressCallback(std::unique_ptr<LspMessage> msg)
 {
     std::lock_guard<std::mutex> lock{progCallbackMutex};
 
-    Logger::dbg << "LSP: Received a $/progress notification: "
+    LOG_DBG("LSP") << "Received a $/progress notification: "
         << msg->ToJson() << Logger::End;
 
     auto notif = dynamic_cast<Notify_Progress::notify*>(msg.get());
@@ -307,6 +402,7 @@ bool LspProvider::progressCallback(std::unique_ptr<LspMessage> msg)
         g_progressPopup->hideAndClear();
     }
     g_isRedrawNeeded = true;
+    EventLoop::wakeUpNow(); // We are on the LSP thread
 
     return true; // TODO: What's this?
 }
@@ -318,13 +414,13 @@ void LspProvider::_replyToWorkDoneProgressCreate(const window_workDoneProgressCr
     window_workDoneProgressCreate::response resp;
     resp.id = req->id;
 
-    Logger::dbg << "LSP: Sending reply to window/workDoneProgress/create: " << resp.ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Sending reply to window/workDoneProgress/create: " << resp.ToJson() << Logger::End;
     m_client->getEndpoint()->sendResponse(resp);
 }
 
 static bool workDoneProgressCreateCallback(std::unique_ptr<LspMessage> msg)
 {
-    Logger::dbg << "LSP: Received a window/workDoneProgress/create request: "
+    LOG_DBG("LSP") << "Received a window/workDoneProgress/create request: "
         << msg->ToJson() << Logger::End;
 
     auto msg_ = dynamic_cast<const window_workDoneProgressCreate::request*>(msg.get());
@@ -361,7 +457,7 @@ static bool windowLogMessageCallback(std::unique_ptr<LspMessage> msg)
 
 static bool clangdFileStatusCallback(std::unique_ptr<LspMessage> msg)
 {
-    Logger::dbg << "LSP: Received a textDocument/clangd.fileStatus notification: " << msg->ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Received a textDocument/clangd.fileStatus notification: " << msg->ToJson() << Logger::End;
 
     // See:
     //  - https://clangd.llvm.org/extensions#file-status
@@ -379,7 +475,10 @@ void LspProvider::_processClangdFileStatus(const Notify_ClangdFileStatus::notify
 {
     m_fileStatuses.insert_or_assign(msg->params.uri.GetAbsolutePath(), msg->params.state);
     if (g_activeBuff && g_activeBuff->getFilePath() == msg->params.uri.GetAbsolutePath().path)
+    {
         g_isRedrawNeeded = true;
+        EventLoop::wakeUpNow();
+    }
 }
 
 std::optional<std::string> LspProvider::getStatusForFile(const std::string& path)
@@ -390,31 +489,12 @@ std::optional<std::string> LspProvider::getStatusForFile(const std::string& path
     return it->second;
 }
 
-LspProvider::LspProvider()
+std::unique_ptr<LspClient> LspProvider::startServer()
 {
-    BusynessHandler bh{this};
-
-    {
-        Logger::log << "Loading LSP status icons" << Logger::End;
-        static constexpr const char* statusIconPaths[] = {
-            "../img/lsp_status/lsp_ok.png",           // Ok
-            "../img/lsp_status/lsp_waiting.png",      // Waiting
-            "../img/lsp_status/lsp_crashed.png",      // Crashed
-        };
-        static_assert(sizeof(statusIconPaths)/sizeof(statusIconPaths[0]) == (size_t)LspServerStatus::_Count);
-        for (size_t i{}; i < (size_t)LspServerStatus::_Count; ++i)
-        {
-            m_statusIcons[i] = std::make_unique<Image>(App::getResPath(statusIconPaths[i]));
-        }
-    }
-
     Logger::log << "Starting LSP server" << Logger::End;
 
-    //const std::string root = "/home/mike/programming/cpp/opengl_text_editor/build";
-    const std::string root = g_exeDirPath;
     //static const std::string exe = "/home/mike/.local/share/nvim/plugged/lua-language-server/bin/lua-language-server";
     //static const std::string exe = "ccls";
-    static const std::string exe = "/usr/bin/clangd";
     //static const std::string exe = "/home/mike/.local/bin/pyright-langserver";
     //static const std::string exe = "gopls";
     //static const std::string exe = "/usr/local/bin/vscode-html-language-server";
@@ -426,15 +506,46 @@ LspProvider::LspProvider()
 
     try
     {
-        m_client = std::make_unique<LspClient>(m_serverPath, args);
+        return std::make_unique<LspClient>(LSP_SERVER_PATH, args);
     }
     catch (const std::exception& e)
+    {
+        didServerCrash = true;
+        g_isRedrawNeeded = true;
+        return nullptr;
+    }
+}
+
+LspProvider::LspProvider(std::unique_ptr<LspClient> client)
+    : m_client{std::move(client)}, m_serverPath{LSP_SERVER_PATH}
+{
+    {
+        Logger::log << "Loading LSP status icons" << Logger::End;
+        static constexpr const char* statusIconPaths[] = {
+            "../img/lsp_status/lsp_ok.png",           // Ok
+            "../img/lsp_status/lsp_waiting.png",      // Waiting
+            "../img/lsp_status/lsp_crashed.png",      // Crashed
+        };
+        static_assert(sizeof(statusIconPaths)/sizeof(statusIconPaths[0]) == (size_t)LspServerStatus::_Count);
+        for (size_t i{}; i < (size_t)LspServerStatus::_Count; ++i)
+        {
+            m_statusIcons[i] = std::make_unique<Image>(App::getResPath(statusIconPaths[i]));
+        }
+    }
+
+    // Failed to start
+    if (!m_client)
     {
         didServerCrash = true;
         g_isRedrawNeeded = true;
         return;
     }
 
+    BusynessHandler bh{this};
+
+    //const std::string root = "/home/mike/programming/cpp/opengl_text_editor/build";
+    const std::string root = g_exeDirPath;
+
     // Register handlers
     {
         m_client->getClientEndpoint()->registerNotifyHandler(
@@ -605,7 +716,7 @@ LspProvider::LspProvider()
     Notify_InitializedNotification::notify initednotif;
     if (didServerCrash) // Maybe it crashed in the meantime
         return;
-    Logger::dbg << "LSP: Sending initialized notification: " << initednotif.ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Sending initialized notification: " << initednotif.ToJson() << Logger::End;
     m_client->getEndpoint()->sendNotification(initednotif);
 
     if (cap.completionProvider && cap.completionProvider->triggerCharacters)
@@ -627,6 +738,94 @@ LspProvider::LspProvider()
     m_servCaps = std::move(cap);
 }
 
+void LspProvider::_addInFlightRequest(const std::string& method, InFlightRequest req, bool supersede)
+{
+    auto& reqs = m_inFlightReqs[method];
+    while (!reqs.empty() && (supersede || reqs.size() >= LSP_MAX_IN_FLIGHT_REQS))
+    {
+        _cancelRequest(reqs.front());
+        reqs.pop_front();
+    }
+    reqs.push_back(std::move(req));
+
+    m_status = LspServerStatus::Waiting;
+    g_isRedrawNeeded = true; // Update status icon
+}
+
+void LspProvider::_cancelRequest(const InFlightRequest& req)
+{
+    if (didServerCrash)
+        return;
+
+    LOG_DBG("LSP") << "Cancelling request #" << req.serial << Logger::End;
+    m_client->getEndpoint()->cancelRequest(req.id);
+}
+
+void LspProvider::_queueResponse(const std::string& method, uint64_t serial, std::function<void()> handler)
+{
+    {
+        std::lock_guard<std::mutex> guard{m_respQueueMutex};
+        m_respQueue.push_back({method, serial, std::move(handler)});
+    }
+    EventLoop::wakeUpNow();
+}
+
+void LspProvider::processResponses()
+{
+    std::vector<QueuedResponse> queue;
+    {
+        std::lock_guard<std::mutex> guard{m_respQueueMutex};
+        queue.swap(m_respQueue);
+    }
+    if (queue.empty())
+        return;
+
+    for (auto& resp : queue)
+    {
+        auto& reqs = m_inFlightReqs[resp.method];
+        auto reqIt = std::find_if(reqs.begin(), reqs.end(),
+                [&](const InFlightRequest& req){ return req.serial == resp.serial; });
+        // The request was cancelled, the response is outdated
+        if (reqIt == reqs.end())
+        {
+            LOG_DBG("LSP") << "Dropping response of cancelled request #" << resp.serial << Logger::End;
+            continue;
+        }
+        reqs.erase(reqIt);
+
+        // Note: The handler may send new requests
+        if (resp.handler)
+            resp.handler();
+    }
+
+    if (std::all_of(m_inFlightReqs.begin(), m_inFlightReqs.end(),
+                [](const auto& pair){ return pair.second.empty(); }))
+    {
+        m_status = LspServerStatus::Ok;
+    }
+    g_isRedrawNeeded = true;
+}
+
+void LspProvider::cancelRequestsOf(const void* owner)
+{
+    for (auto& pair : m_inFlightReqs)
+    {
+        auto& reqs = pair.second;
+        for (auto it = reqs.begin(); it != reqs.end();)
+        {
+            if (it->owner == owner)
+            {
+                _cancelRequest(*it);
+                it = reqs.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
 void LspProvider::get(Popup* popupP, lsCompletionTriggerKind trigger)
 {
     //Logger::dbg << "LspProvider: " << "TODO" << Logger::End;
@@ -643,28 +842,27 @@ void LspProvider::get(Popup* popupP, lsCompletionTriggerKind trigger)
     req.params.uri.emplace();
     req.params.uri->SetPath(g_activeBuff->getFilePath());
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp) return;
-
-    for (const auto& item : resp->response.result.items)
-    {
-        popupP->addItem({std::move(item)});
-    }
-
-    //g_activeBuff->getFilePath();
+    // The previous completion requests are outdated
+    sendRequestAsync(req, popupP, true, [popupP](td_completion::response& resp){
+        for (auto& item : resp.result.items)
+        {
+            popupP->addItem({std::move(item)});
+        }
+        // If incomplete, the items can't be filtered further without asking the server again
+        popupP->setIncomplete(resp.result.isIncomplete);
+    });
 }
 
-std::optional<lsCompletionItem> LspProvider::compItemResolve(const lsCompletionItem& item)
+void LspProvider::compItemResolve(const lsCompletionItem& item, const void* owner, compItemCallback_t callback)
 {
-    if (didServerCrash) return {};
-    BusynessHandler bh{this};
+    if (!m_servCaps.completionProvider || !m_servCaps.completionProvider->resolveProvider.get_value_or(false))
+        return;
 
     completionItem_resolve::request req;
     req.params = item;
-    auto resp = sendRequest<500>(req);
-    if (resp)
-        return resp->response.result;
-    return {};
+    sendRequestAsync(req, owner, false, [callback](completionItem_resolve::response& resp){
+        callback(resp.result);
+    });
 }
 
 void LspProvider::_busyBegin()
@@ -703,7 +901,7 @@ void LspProvider::_replyToWsApplyEdit(const std::string& msgIfErr)
         resp.result.failureReason.emplace(msgIfErr);
     }
 
-    Logger::dbg << "LSP: Sending reply to workspace/applyEdit: " << resp.ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Sending reply to workspace/applyEdit: " << resp.ToJson() << Logger::End;
     m_client->getEndpoint()->sendResponse(resp);
 }
 
@@ -741,7 +939,7 @@ void LspProvider::_replyToWsConfig(const WorkspaceConfiguration::request* msg)
         Logger::dbg << "There is no configuration for the server: " << servName << Logger::End;
     }
 
-    Logger::dbg << "LSP: Sending reply to workspace/configuration: " << resp.ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Sending reply to workspace/configuration: " << resp.ToJson() << Logger::End;
     m_client->getEndpoint()->sendResponse(resp);
 }
 
@@ -751,6 +949,9 @@ void LspProvider::onFileOpen(const std::string& path, Langs::LangId language, co
     //       or maybe not if it is surely handled outside
     assert(std::filesystem::path{path}.is_absolute());
 
+    // The whole content is sent, the queued changes are obsolete
+    m_pendingChanges.erase(path);
+
     if (m_servCaps.textDocumentSync
      && m_servCaps.textDocumentSync->second
      && m_servCaps.textDocumentSync->second->openClose.get_value_or(false))
@@ -759,22 +960,18 @@ void LspProvider::onFileOpen(const std::string& path, Langs::LangId language, co
         notif.params.textDocument.uri.SetPath(path);
         notif.params.textDocument.languageId = Langs::langIdToLspId(language);
         notif.params.textDocument.text = fileContent;
-        Logger::dbg << "LSP: Sending textDocument/didOpen notification: " << notif.ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Sending textDocument/didOpen notification: " << notif.ToJson() << Logger::End;
         m_client->getEndpoint()->send(notif);
     }
     else
     {
-        Logger::dbg << "LSP: textDocument/didOpen is not supported" << Logger::End;
+        LOG_DBG("LSP") << "textDocument/didOpen is not supported" << Logger::End;
     }
 }
 
-void LspProvider::onFileChange(const std::string& path, int version, const std::string& newContent)
+lsTextDocumentSyncKind LspProvider::_getDocSyncKind() const
 {
-#ifndef TESTING
-    if (didServerCrash) return;
-
     using tDocSyncKind = lsTextDocumentSyncKind;
-    //Logger::log << m_servCaps.textDocumentSync->first.get_value_or(tDocSyncKind::None) << Logger::End;
 
     // Get the values if available, otherwise default to None
     const tDocSyncKind kindVal1
@@ -785,35 +982,162 @@ void LspProvider::onFileChange(const std::string& path, int version, const std::
         = m_servCaps.textDocumentSync && m_servCaps.textDocumentSync->second
         ? m_servCaps.textDocumentSync->second->change.get_value_or(tDocSyncKind::None)
         : tDocSyncKind::None;
-    const tDocSyncKind kindVal = (kindVal1 != tDocSyncKind::None ? kindVal1 : kindVal2);
+    return (kindVal1 != tDocSyncKind::None ? kindVal1 : kindVal2);
+}
 
-    if (kindVal != tDocSyncKind::Full)
+// The columns are in UTF-16 code units, like in the changes
+static lsPosition calcEndPos(const lsPosition& start, const String& text)
+{
+    lsPosition end = start;
+    for (Char c : text)
     {
-        const bool isIncSyncSupported = (kindVal == tDocSyncKind::Incremental);
-        Logger::dbg << "LSP: Incremental textDocument/didChange supported? " << (isIncSyncSupported ? "YES" : "NO") << Logger::End;
+        if (c == '\n')
+        {
+            ++end.line;
+            end.character = 0;
+        }
+        else
+        {
+            end.character += countUtf16Units(&c, 1);
+        }
+    }
+    return end;
+}
 
-        Notify_TextDocumentDidChange::notify notif;
-        notif.params.uri.emplace();
-        notif.params.uri->SetPath(path); // Only for old protocol support
-        notif.params.textDocument.uri.SetPath(path);
-        notif.params.textDocument.version = version;
-        notif.params.contentChanges.emplace_back();
-        notif.params.contentChanges[0].text = newContent;
-        // TODO: Send only difference if supported (isIncSyncSupported)
-        //notif.params.contentChanges[0].range; // If this is given, .text is the diff
-        Logger::dbg << "LSP: Sending textDocument/didChange notification: " << notif.ToJson() << Logger::End;
-        m_client->getEndpoint()->send(notif);
+bool LspProvider::_mergeChanges(PendingChange& prev, const PendingChange& next)
+{
+    // Typing: the next insertion continues the previous one
+    if (next.removed.empty() && calcEndPos(prev.start, prev.inserted) == next.start)
+    {
+        prev.inserted += next.inserted;
+        return true;
     }
-    else
+
+    if (next.inserted.empty())
     {
-        Logger::dbg << "LSP: textDocument/didChange is not supported" << Logger::End;
+        // Forward delete at the same position
+        if (prev.inserted.empty() && next.start == prev.start)
+        {
+            prev.removed += next.removed;
+            return true;
+        }
+
+        // Backspace: the deleted range ends where the previous deletion started
+        if (prev.inserted.empty() && calcEndPos(next.start, next.removed) == prev.start)
+        {
+            prev.start = next.start;
+            prev.removed = next.removed+prev.removed;
+            return true;
+        }
+
+        // Deleting the end of the text that was inserted by the previous change
+        if (next.removed.size() <= prev.inserted.size()
+         && calcEndPos(next.start, next.removed) == calcEndPos(prev.start, prev.inserted)
+         && prev.inserted.ends_with(next.removed))
+        {
+            prev.inserted.resize(prev.inserted.size()-next.removed.size());
+            return true;
+        }
     }
+
+    return false;
+}
+
+void LspProvider::onFileChange(const std::string& path, int version,
+        const lsPosition& start, const String& removed, const String& inserted,
+        const contentGetter_t& getContent)
+{
+#ifndef TESTING
+    if (didServerCrash) return;
+
+    if (removed.empty() && inserted.empty())
+        return;
+
+    auto& pending = m_pendingChanges[path];
+    pending.version = version;
+    pending.getContent = getContent;
+
+    // If there are too many changes, the whole content is sent anyway
+    if (pending.changes.size() > LSP_MAX_PENDING_CHANGES)
+        return;
+
+    PendingChange change{start, removed, inserted};
+    if (pending.changes.empty() || !_mergeChanges(pending.changes.back(), change))
+        pending.changes.push_back(std::move(change));
+#else
+    (void)path;
+    (void)version;
+    (void)start;
+    (void)removed;
+    (void)inserted;
+    (void)getContent;
 #endif
 }
 
+void LspProvider::_sendFileChanges(const std::string& path, const PendingFileChanges& pending)
+{
+    if (didServerCrash) return;
+
+    const lsTextDocumentSyncKind kindVal = _getDocSyncKind();
+    if (kindVal == lsTextDocumentSyncKind::None)
+    {
+        LOG_DBG("LSP") << "textDocument/didChange is not supported" << Logger::End;
+        return;
+    }
+
+    Notify_TextDocumentDidChange::notify notif;
+    notif.params.uri.emplace();
+    notif.params.uri->SetPath(path); // Only for old protocol support
+    notif.params.textDocument.uri.SetPath(path);
+    notif.params.textDocument.version = pending.version;
+    if (kindVal == lsTextDocumentSyncKind::Incremental
+     && pending.changes.size() <= LSP_MAX_PENDING_CHANGES)
+    {
+        for (const auto& change : pending.changes)
+        {
+            auto& event = notif.params.contentChanges.emplace_back();
+            event.range.emplace(lsRange{change.start, calcEndPos(change.start, change.removed)});
+            event.text = utf32To8(change.inserted);
+        }
+    }
+    else
+    {
+        notif.params.contentChanges.emplace_back();
+        notif.params.contentChanges[0].text = pending.getContent();
+    }
+    LOG_DBG("LSP") << "Sending textDocument/didChange notification for "
+        << path << " (version " << pending.version << ", "
+        << (kindVal == lsTextDocumentSyncKind::Incremental ? "incremental" : "full")
+        << ", " << notif.params.contentChanges.size() << " change(s))" << Logger::End;
+    m_client->getEndpoint()->send(notif);
+}
+
+void LspProvider::flushFileChanges()
+{
+    if (m_pendingChanges.empty())
+        return;
+
+    auto pendingChanges = std::move(m_pendingChanges);
+    m_pendingChanges.clear();
+    for (const auto& [path, pending] : pendingChanges)
+        _sendFileChanges(path, pending);
+}
+
+void LspProvider::flushFileChanges(const std::string& path)
+{
+    auto it = m_pendingChanges.find(path);
+    if (it == m_pendingChanges.end())
+        return;
+
+    const PendingFileChanges pending = std::move(it->second);
+    m_pendingChanges.erase(it);
+    _sendFileChanges(path, pending);
+}
+
 void LspProvider::onFileClose(const std::string& path)
 {
     if (didServerCrash) return;
+    flushFileChanges(path);
 
     // TODO: Make the path absolute
     //       or maybe not if it is surely handled outside
@@ -825,12 +1149,12 @@ void LspProvider::onFileClose(const std::string& path)
     {
         Notify_TextDocumentDidClose::notify notif;
         notif.params.textDocument.uri.SetPath(path);
-        Logger::dbg << "LSP: Sending textDocument/didClose notification: " << notif.ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Sending textDocument/didClose notification: " << notif.ToJson() << Logger::End;
         m_client->getEndpoint()->send(notif);
     }
     else
     {
-        Logger::dbg << "LSP: textDocument/didClose is not supported" << Logger::End;
+        LOG_DBG("LSP") << "textDocument/didClose is not supported" << Logger::End;
     }
 }
 
@@ -838,6 +1162,7 @@ void LspProvider::beforeFileSave(const std::string& path, LspProvider::saveReaso
 {
     if (didServerCrash) return;
     BusynessHandler bh{this};
+    flushFileChanges(path);
 
     if (m_servCaps.textDocumentSync
      && m_servCaps.textDocumentSync->second
@@ -846,12 +1171,12 @@ void LspProvider::beforeFileSave(const std::string& path, LspProvider::saveReaso
         td_willSave::notify notif;
         notif.params.textDocument.uri.SetPath(path);
         notif.params.reason.emplace(reason);
-        Logger::dbg << "LSP: Sending textDocument/willSave notification: " << notif.ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Sending textDocument/willSave notification: " << notif.ToJson() << Logger::End;
         m_client->getEndpoint()->send(notif);
     }
     else
     {
-        Logger::dbg << "LSP: textDocument/willSave is not supported" << Logger::End;
+        LOG_DBG("LSP") << "textDocument/willSave is not supported" << Logger::End;
     }
 }
 
@@ -868,6 +1193,7 @@ void LspProvider::onFileSave(const std::string& path, const std::string& content
 {
     if (didServerCrash) return;
     BusynessHandler bh{this};
+    flushFileChanges(path);
 
     if (m_servCaps.textDocumentSync
      && m_servCaps.textDocumentSync->second
@@ -878,118 +1204,118 @@ void LspProvider::onFileSave(const std::string& path, const std::string& content
         if (!contentIfNeeded.empty())
             notif.params.text.emplace(contentIfNeeded);
 
-        Logger::dbg << "LSP: Sending textDocument/didSave notification: " << notif.ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Sending textDocument/didSave notification: " << notif.ToJson() << Logger::End;
         m_client->getEndpoint()->send(notif);
     }
     else
     {
-        Logger::dbg << "LSP: textDocument/didSave is not supported" << Logger::End;
+        LOG_DBG("LSP") << "textDocument/didSave is not supported" << Logger::End;
     }
 }
 
-LspProvider::HoverInfo LspProvider::getHover(const std::string& path, uint line, uint col)
+static LspProvider::HoverInfo makeHoverInfo(const td_hover::response& resp)
 {
-    BusynessHandler bh(this);
-
-    if (m_servCaps.hoverProvider.get_value_or(false))
+    LspProvider::HoverInfo info;
+    if (resp.result.contents.second)
     {
-        td_hover::request req;
-        req.params.position.line = line;
-        req.params.position.character = col;
-        req.params.textDocument.uri.SetPath(path);
-
-        auto resp = sendRequest<500>(req);
-        if (!resp) return {};
-
-        HoverInfo info;
-        if (resp->response.result.contents.second)
+        const auto& markupContent = resp.result.contents.second.get();
+        if (markupContent.kind == "markdown") // Kind can be plaintext or markdown
         {
-            const auto& markupContent = resp->response.result.contents.second.get();
-            if (markupContent.kind == "markdown") // Kind can be plaintext or markdown
-            {
-                // Note: Can contain code blocks (MarkupContent is preferred over MarkedString
-                //       because they can contain markdown with code inside, but MarkedString
-                //       can only contain code without markdown)
-                info.text = Markdown::markdownToAnsiEscaped(Doxygen::doxygenToAnsiEscaped(markupContent.value));
-            }
-            else
-            {
-                if (markupContent.kind != "plaintext")
-                    Logger::warn << "Unknown MarkupContent kind: " << markupContent.kind << Logger::End;
-                info.text = utf8To32(Doxygen::doxygenToAnsiEscaped(markupContent.value));
-            }
+            // Note: Can contain code blocks (MarkupContent is preferred over MarkedString
+            //       because they can contain markdown with code inside, but MarkedString
+            //       can only contain code without markdown)
+            info.text = Markdown::markdownToAnsiEscaped(Doxygen::doxygenToAnsiEscaped(markupContent.value));
         }
-        else if (resp->response.result.contents.first)
+        else
         {
-            const auto& markedStrings = resp->response.result.contents.first.get();
-            info.text = U"";
-            for (const auto& mstr : markedStrings)
+            if (markupContent.kind != "plaintext")
+                Logger::warn << "Unknown MarkupContent kind: " << markupContent.kind << Logger::End;
+            info.text = utf8To32(Doxygen::doxygenToAnsiEscaped(markupContent.value));
+        }
+    }
+    else if (resp.result.contents.first)
+    {
+        const auto& markedStrings = resp.result.contents.first.get();
+        info.text = U"";
+        for (const auto& mstr : markedStrings)
+        {
+            // If the values are plain text objects
+            if (mstr.first.has_value())
             {
-                // If the values are plain text objects
-                if (mstr.first.has_value())
-                {
-                    info.text += utf8To32(mstr.first.get()) + U'\n';
-                }
-                // If the values are MarkedStrings
-                else if (mstr.second.has_value())
+                info.text += utf8To32(mstr.first.get()) + U'\n';
+            }
+            // If the values are MarkedStrings
+            else if (mstr.second.has_value())
+            {
+                if (mstr.second->language.get_value_or("").empty())
                 {
-                    if (mstr.second->language.get_value_or("").empty())
-                    {
-                        info.text += utf8To32(mstr.second->value) + U'\n';
-                    }
-                    else
-                    {
-                        // TODO: Highlight based on the specified language
-                        info.text += utf8To32(mstr.second->value) + U'\n';
-                        Logger::warn << "Unimplemented syntax highligthing for MarkedString language: "
-                            << mstr.second->language.get() << Logger::End;
-                    }
+                    info.text += utf8To32(mstr.second->value) + U'\n';
                 }
                 else
                 {
-                    assert(false);
+                    // TODO: Highlight based on the specified language
+                    info.text += utf8To32(mstr.second->value) + U'\n';
+                    Logger::warn << "Unimplemented syntax highligthing for MarkedString language: "
+                        << mstr.second->language.get() << Logger::End;
                 }
             }
+            else
+            {
+                assert(false);
+            }
         }
-        info.text = strTrimTrailingLineBreak(info.text);
+    }
+    info.text = strTrimTrailingLineBreak(info.text);
 
-        if (resp->response.result.range)
-        {
-            info.gotRange  = true;
-            info.startLine = resp->response.result.range->start.line;
-            info.startCol  = resp->response.result.range->start.character;
-            info.endLine   = resp->response.result.range->end.line;
-            info.endCol    = resp->response.result.range->end.character;
-        }
+    if (resp.result.range)
+    {
+        info.gotRange  = true;
+        info.startLine = resp.result.range->start.line;
+        info.startCol  = resp.result.range->start.character;
+        info.endLine   = resp.result.range->end.line;
+        info.endCol    = resp.result.range->end.character;
+    }
+
+    return info;
+}
+
+void LspProvider::getHover(const std::string& path, uint line, uint col, const void* owner, hoverCallback_t callback)
+{
+    if (m_servCaps.hoverProvider.get_value_or(false))
+    {
+        td_hover::request req;
+        req.params.position.line = line;
+        req.params.position.character = col;
+        req.params.textDocument.uri.SetPath(path);
 
-        return info;
+        // Only the last hovered position is interesting
+        sendRequestAsync(req, owner, true, [callback](td_hover::response& resp){
+            callback(makeHoverInfo(resp));
+        });
     }
     else
     {
-        Logger::dbg << "LSP: textDocument/hover is not supported" << Logger::End;
-        return {};
+        LOG_DBG("LSP") << "textDocument/hover is not supported" << Logger::End;
     }
 }
 
-lsSignatureHelp LspProvider::getSignatureHelp(const std::string& path, uint line, uint col)
+void LspProvider::getSignatureHelp(const std::string& path, uint line, uint col,
+        const void* owner, signHelpCallback_t callback)
 {
-    BusynessHandler bh{this};
-
     td_signatureHelp::request req;
     req.params.position.line = line;
     req.params.position.character = col;
     req.params.textDocument.uri.SetPath(path);
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp) return {};
-    return std::move(resp->response.result);
+    sendRequestAsync(req, owner, true, [callback](td_signatureHelp::response& resp){
+        callback(resp.result);
+    });
 }
 
 template <typename ReqType>
-LspProvider::Location LspProvider::_getDefOrDeclOrImp(const std::string& path, uint line, uint col)
+void LspProvider::_getDefOrDeclOrImp(const std::string& path, uint line, uint col,
+        const void* owner, locationCallback_t callback)
 {
-    BusynessHandler bn{this};
-
     constexpr bool needsDef  = std::is_same<ReqType, td_definition::request>();
     constexpr bool needsDecl = std::is_same<ReqType, td_declaration::request>();
     constexpr bool needsImp  = std::is_same<ReqType, td_implementation::request>();
@@ -1020,59 +1346,60 @@ LspProvider::Location LspProvider::_getDefOrDeclOrImp(const std::string& path, u
         req.params.uri.emplace();
         req.params.uri->SetPath(path);
 
-        const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-        if (!resp) return {};
-
-        Location loc;
-        if (resp->response.result.first && !resp->response.result.first->empty())
-        {
-            // TODO: Don't use only the first one
-            loc.path = resp->response.result.first.get()[0].uri.GetAbsolutePath().path;
-            loc.line = resp->response.result.first.get()[0].range.start.line;
-            loc.col = resp->response.result.first.get()[0].range.start.character;
-        }
-        else if (resp->response.result.second && !resp->response.result.second->empty())
-        {
-            // TODO: Don't use only the first one
-            loc.path = resp->response.result.second.get()[0].targetUri.GetAbsolutePath().path;
-            loc.line = resp->response.result.second.get()[0].targetSelectionRange.start.line;
-            loc.col = resp->response.result.second.get()[0].targetSelectionRange.start.character;
-        }
+        // Only the last jump is interesting
+        sendRequestAsync(req, owner, true, [callback](typename ReqType::Response& resp){
+            Location loc;
+            if (resp.result.first && !resp.result.first->empty())
+            {
+                // TODO: Don't use only the first one
+                loc.path = resp.result.first.get()[0].uri.GetAbsolutePath().path;
+                loc.line = resp.result.first.get()[0].range.start.line;
+                loc.col = resp.result.first.get()[0].range.start.character;
+            }
+            else if (resp.result.second && !resp.result.second->empty())
+            {
+                // TODO: Don't use only the first one
+                loc.path = resp.result.second.get()[0].targetUri.GetAbsolutePath().path;
+                loc.line = resp.result.second.get()[0].targetSelectionRange.start.line;
+                loc.col = resp.result.second.get()[0].targetSelectionRange.start.character;
+            }
 
-        return loc;
+            if (!loc.path.empty())
+                callback(loc);
+        });
     }
     else
     {
         if constexpr (needsDef)
-            Logger::dbg << "LSP: textDocument/definition is not supported" << Logger::End;
+            LOG_DBG("LSP") << "textDocument/definition is not supported" << Logger::End;
         else if constexpr (needsDecl)
-            Logger::dbg << "LSP: textDocument/declaration is not supported" << Logger::End;
+            LOG_DBG("LSP") << "textDocument/declaration is not supported" << Logger::End;
         else if constexpr (needsImp)
-            Logger::dbg << "LSP: textDocument/implementation is not supported" << Logger::End;
-
-        return {};
+            LOG_DBG("LSP") << "textDocument/implementation is not supported" << Logger::End;
     }
 }
 
-LspProvider::Location LspProvider::getDefinition(const std::string& path, uint line, uint col)
+void LspProvider::getDefinition(const std::string& path, uint line, uint col,
+        const void* owner, locationCallback_t callback)
 {
-    return _getDefOrDeclOrImp<td_definition::request>(path, line, col);
+    _getDefOrDeclOrImp<td_definition::request>(path, line, col, owner, std::move(callback));
 }
 
-LspProvider::Location LspProvider::getDeclaration(const std::string& path, uint line, uint col)
+void LspProvider::getDeclaration(const std::string& path, uint line, uint col,
+        const void* owner, locationCallback_t callback)
 {
-    return _getDefOrDeclOrImp<td_declaration::request>(path, line, col);
+    _getDefOrDeclOrImp<td_declaration::request>(path, line, col, owner, std::move(callback));
 }
 
-LspProvider::Location LspProvider::getImplementation(const std::string& path, uint line, uint col)
+void LspProvider::getImplementation(const std::string& path, uint line, uint col,
+        const void* owner, locationCallback_t callback)
 {
-    return _getDefOrDeclOrImp<td_implementation::request>(path, line, col);
+    _getDefOrDeclOrImp<td_implementation::request>(path, line, col, owner, std::move(callback));
 }
 
-LspProvider::codeActionResult_t LspProvider::getCodeActionForLine(const std::string& path, uint line)
+void LspProvider::getCodeActionForLine(const std::string& path, uint line,
+        const void* owner, codeActionCallback_t callback)
 {
-    BusynessHandler bh{this};
-
     td_codeAction::request req;
     req.params.textDocument.uri.SetPath(path);
     req.params.range.start.line = line;
@@ -1080,10 +1407,10 @@ LspProvider::codeActionResult_t LspProvider::getCodeActionForLine(const std::str
     req.params.range.end.line = line+1;
     req.params.range.end.character = 0;
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp) return {};
-
-    return resp->response.result;
+    // The actions of the previous line are outdated
+    sendRequestAsync(req, owner, true, [callback](td_codeAction::response& resp){
+        callback(std::move(resp.result));
+    });
 }
 
 void LspProvider::executeCommand(const std::string& cmd, const boost::optional<std::vector<lsp::Any>>& args)
@@ -1095,17 +1422,21 @@ void LspProvider::executeCommand(const std::string& cmd, const boost::optional<s
     req.params.arguments = args;
 
 #if 0
-    Logger::dbg << "LSP: Sending workspace/executeCommand request: " << req.ToJson() << Logger::End;
+    LOG_DBG("LSP") << "Sending workspace/executeCommand request: " << req.ToJson() << Logger::End;
     m_client->getEndpoint()->send(req);
 #else
     sendRequest<LSP_TIMEOUT_MILLI>(req);
 #endif
 }
 
-LspProvider::CanRenameSymbolResult LspProvider::canRenameSymbolAt(const std::string& filePath, const lsPosition& pos)
+void LspProvider::canRenameSymbolAt(const std::string& filePath, const lsPosition& pos,
+        const void* owner, canRenameCallback_t callback)
 {
-    if (didServerCrash) return {.isError=true};
-    BusynessHandler bh{this};
+    if (didServerCrash)
+    {
+        callback({.isError=true, .errorOrSymName="The server crashed"});
+        return;
+    }
 
     td_prepareRename::request req;
     req.params.textDocument.uri.SetPath(filePath);
@@ -1113,60 +1444,47 @@ LspProvider::CanRenameSymbolResult LspProvider::canRenameSymbolAt(const std::str
     req.params.uri->SetPath(filePath);
     req.params.position = pos;
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp)
-    {
-        // FIXME: `resp` is NULL here
-        //if (resp->is_error)
-        //    return {.isError=true, .errorOrSymName=resp->error.error.message};
-        //return {.isError=true, .errorOrSymName="Timed out"};
-        return {.isError=true, .errorOrSymName="Error"};
-    }
-
-    std::string symName;
-    lsRange range;
-    if (resp->response.result.first)
-    {
-        range = resp->response.result.first.get();
-    }
-    else if (resp->response.result.second)
-    {
-        const auto result = resp->response.result.second.get();
-        assert(!result.placeholder.empty());
-        symName = result.placeholder;
-    }
-    else
-    {
-        assert(false);
-    }
+    sendRequestAsync(req, owner, true,
+        [callback](td_prepareRename::response& resp){
+            std::string symName;
+            lsRange range;
+            if (resp.result.first)
+            {
+                range = resp.result.first.get();
+            }
+            else if (resp.result.second)
+            {
+                const auto result = resp.result.second.get();
+                assert(!result.placeholder.empty());
+                symName = result.placeholder;
+            }
+            else
+            {
+                assert(false);
+            }
 
-    return {.isError=false, .errorOrSymName=symName, .rangeIfNoName=range};
+            callback({.isError=false, .errorOrSymName=symName, .rangeIfNoName=range});
+        },
+        [callback](const std::string& error){
+            callback({.isError=true, .errorOrSymName=error});
+        });
 }
 
 void LspProvider::renameSymbol(const std::string& filePath, const lsPosition& pos, const std::string& newName)
 {
-    BusynessHandler bh{this};
-
     td_rename::request req;
     req.params.textDocument.uri.SetPath(filePath);
     req.params.position = pos;
     req.params.newName = newName;
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp)
-    {
-        // FIXME: Resp is NULL here
-        //g_statMsg.set(
-        //        "Failed to rename symbol: "+(resp->is_error ? respGetErrMsg(resp) : "Request timed out"),
-        //        StatusMsg::Type::Error);
-        g_statMsg.set(
-                "Failed to rename symbol",
-                StatusMsg::Type::Error);
-        return;
-    }
-
-    const auto& edit = resp->response.result;
-    applyWorkspaceEdit(edit);
+    // Not owned by the buffer, the edit can touch any file
+    sendRequestAsync(req, nullptr, false,
+        [](td_rename::response& resp){
+            applyWorkspaceEdit(resp.result);
+        },
+        [](const std::string& error){
+            g_statMsg.set("Failed to rename symbol: "+error, StatusMsg::Type::Error);
+        });
 }
 
 LspProvider::docSymbolResult_t LspProvider::getDocSymbols(const std::string& filePath)
@@ -1195,10 +1513,8 @@ LspProvider::wpSymbolResult_t LspProvider::getWpSymbols(const std::string& query
     return resp->response.result;
 }
 
-std::vector<lsTextEdit> LspProvider::getFormattingEdits(const std::string& filePath)
+void LspProvider::getFormattingEdits(const std::string& filePath, const void* owner, editsCallback_t callback)
 {
-    BusynessHandler bh{this};
-
     td_formatting::request req;
     req.params.textDocument.uri.SetPath(filePath);
     req.params.options.tabSize = 4;
@@ -1207,10 +1523,9 @@ std::vector<lsTextEdit> LspProvider::getFormattingEdits(const std::string& fileP
     req.params.options.insertFinalNewline.emplace(true);
     req.params.options.trimFinalNewlines.emplace(true);
 
-    const auto resp = sendRequest<LSP_TIMEOUT_MILLI>(req);
-    if (!resp) return {};
-
-    return resp->response.result;
+    sendRequestAsync(req, owner, true, [callback](td_formatting::response& resp){
+        callback(resp.result);
+    });
 }
 
 std::vector<lsTextEdit> LspProvider::getOnTypeFormattingEdits(
@@ -1256,7 +1571,7 @@ LspProvider::~LspProvider()
     // Send exit notification
     {
         Notify_Exit::notify exitNotif;
-        Logger::dbg << "LSP: Sending exit notification: " << exitNotif.ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Sending exit notification: " << exitNotif.ToJson() << Logger::End;
         m_client->getEndpoint()->send(exitNotif);
     }
 }
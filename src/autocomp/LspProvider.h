@@ -14,6 +14,11 @@
 #include <chrono>
 #include <unordered_map>
 #include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <climits>
 using namespace std::chrono_literals;
 #ifdef __clang__
 #pragma clang diagnostic push
@@ -42,7 +47,7 @@ using namespace std::chrono_literals;
 #pragma clang diagnostic pop
 #endif // __clang__
 
-extern bool g_isRedrawNeeded;
+extern std::atomic<bool> g_isRedrawNeeded;
 
 namespace Autocomp
 {
@@ -267,6 +272,68 @@ private:
     // Used for `textDocument/clangd.fileStatus`
     std::map<std::string, std::string> m_fileStatuses;
 
+    /*
+     * An edit that was not sent to the server yet.
+     * `removed` was replaced with `inserted` at `start` (column in UTF-16 code units).
+     */
+    struct PendingChange
+    {
+        lsPosition start;
+        String removed;
+        String inserted;
+    };
+
+    struct PendingFileChanges
+    {
+        int version{};
+        std::vector<PendingChange> changes;
+        // Used when the server does not support incremental sync
+        // or when there are too many changes to send them one by one
+        std::function<std::string()> getContent;
+    };
+    // Key: file path
+    std::map<std::string, PendingFileChanges> m_pendingChanges;
+
+    /*
+     * An asynchronous request that was not answered yet.
+     */
+    struct InFlightRequest
+    {
+        lsRequestId id;
+        // Unique, identifies the response in the queue
+        uint64_t serial{};
+        // The object that sent the request, see `cancelRequestsOf()`
+        const void* owner{};
+    };
+    // Key: method
+    std::map<std::string, std::deque<InFlightRequest>> m_inFlightReqs;
+    uint64_t m_lastReqSerial{};
+
+    /*
+     * Responses waiting to be processed by the main thread.
+     * The responses arrive on the LSP thread, `processResponses()` handles them.
+     */
+    struct QueuedResponse
+    {
+        std::string method;
+        uint64_t serial{};
+        // Empty if the server responded with an error
+        std::function<void()> handler;
+    };
+    std::vector<QueuedResponse> m_respQueue;
+    std::mutex m_respQueueMutex;
+
+    // Also cancels the requests that exceed the limit or are superseded by this one
+    void _addInFlightRequest(const std::string& method, InFlightRequest req, bool supersede);
+    void _cancelRequest(const InFlightRequest& req);
+    // Called on the LSP thread
+    void _queueResponse(const std::string& method, uint64_t serial, std::function<void()> handler);
+
+    lsTextDocumentSyncKind _getDocSyncKind() const;
+    // Try to merge `next` into `prev`, returns false if not possible
+    static bool _mergeChanges(PendingChange& prev, const PendingChange& next);
+    void _sendFileChanges(const std::string& path, const PendingFileChanges& pending);
+
     // Use `BusynessHandler`
     void _busyBegin();
     // Use `BusynessHandler`
@@ -276,7 +343,7 @@ private:
         requires (timeout > 0 && std::is_base_of<RequestInMessage, T>::value)
     std::unique_ptr<lsp::ResponseOrError<typename T::Response>> sendRequest(T& req)
     {
-        Logger::dbg << "LSP: Sending " << req.method << " request: "
+        LOG_DBG("LSP") << "Sending " << req.method << " request: "
             << req.ToJson() << Logger::End;
 
         //assert(req.id.has_value());
@@ -288,6 +355,9 @@ private:
             return {};
         }
 
+        // The server must see the same content as we do
+        flushFileChanges();
+
         auto resp = m_client->getEndpoint()->waitResponse(req, timeout);
 
         if (!resp)
@@ -301,23 +371,155 @@ private:
                 << respGetErrMsg(resp) << Logger::End;
             return {};
         }
-        Logger::dbg << "LSP: Response: " << resp->ToJson() << Logger::End;
+        LOG_DBG("LSP") << "Response: " << resp->ToJson() << Logger::End;
 
         return resp;
     }
 
+    /*
+     * Send a request without waiting for the response.
+     * `onResponse` is called by `processResponses()` on the main thread,
+     * it is not called if the request failed or was cancelled.
+     * `onError`, if set, is called the same way with the error message if the server responded with an error.
+     *
+     * @param owner Used to cancel the requests of an object when it is destroyed.
+     * @param supersede If true, the in-flight requests of the same method are cancelled.
+     */
+    template <typename T>
+        requires (std::is_base_of<RequestInMessage, T>::value)
+    void sendRequestAsync(T& req, const void* owner, bool supersede,
+            std::function<void(typename T::Response&)> onResponse,
+            std::function<void(const std::string&)> onError=nullptr)
+    {
+        LOG_DBG("LSP") << "Sending " << req.method << " request (async): "
+            << req.ToJson() << Logger::End;
+
+        assert(!req.method.empty());
+
+        if (didServerCrash)
+        {
+            Logger::dbg << "Can't send request, server crashed" << Logger::End;
+            return;
+        }
+
+        // The server must see the same content as we do
+        flushFileChanges();
+
+        const std::string method = req.method;
+        const uint64_t serial = ++m_lastReqSerial;
+        m_client->getEndpoint()->send(req,
+                [this, method, serial, onResponse](typename T::Response& resp){
+                    auto respP = std::make_shared<typename T::Response>(std::move(resp));
+                    _queueResponse(method, serial, [onResponse, respP](){ onResponse(*respP); });
+                },
+                [this, method, serial, onError](const Rsp_Error& err){
+                    Logger::err << "LSP server responded with error: "
+                        << err.error.ToString() << Logger::End;
+                    std::function<void()> handler;
+                    if (onError)
+                        handler = [onError, msg=err.error.message](){ onError(msg); };
+                    _queueResponse(method, serial, std::move(handler));
+                });
+        // Note: The response is only processed on the main thread, so it is fine to add it after sending.
+        //       `send()` assigned the ID.
+        _addInFlightRequest(method, {req.id, serial, owner}, supersede);
+    }
+
 public:
-    LspProvider();
+    /*
+     * Start the server process. Can be called from any thread, so the server can
+     * start up while the editor is being initialized. Returns null if it failed to start.
+     */
+    static std::unique_ptr<LspClient> startServer();
+    /*
+     * Take over the server started by `startServer()` and initialize it.
+     * If `client` is null, the server is treated as crashed.
+     */
+    explicit LspProvider(std::unique_ptr<LspClient> client);
 
     using diagList_t = std::vector<lsDiagnostic>;
-    using diagListMap_t = std::unordered_map<std::string, diagList_t>;
-    static diagListMap_t s_diags;
 
+    /*
+     * The diagnostics of a file, bucketed by line.
+     * Immutable once published, so it can be read without locking.
+     */
+    class FileDiags final
+    {
+    public:
+        // The part of a diagnostic that is in one line
+        struct Span
+        {
+            int startCol{};
+            int endCol{}; // Exclusive, INT_MAX if the diagnostic continues in the next line
+            const lsDiagnostic* diag{};
+            bool isStart{}; // Whether the diagnostic starts in this line
+        };
+        using spanList_t = std::vector<Span>;
+
+    private:
+        diagList_t m_diags;
+        // Line index -> spans sorted by start column
+        std::unordered_map<int, spanList_t> m_lineSpans;
+        int m_errorCount{};
+        int m_warningCount{};
+
+    public:
+        FileDiags(diagList_t&& diags);
+        FileDiags(const FileDiags&) = delete;
+        FileDiags& operator=(const FileDiags&) = delete;
+
+        inline const diagList_t& getAll() const { return m_diags; }
+        inline int getErrorCount() const { return m_errorCount; }
+        inline int getWarningCount() const { return m_warningCount; }
+
+        // Returns nullptr if there is no diagnostic in the line
+        const spanList_t* getLineSpans(int line) const;
+        // Returns the first diagnostic that contains the position or nullptr
+        const lsDiagnostic* findAt(int line, int col) const;
+        // Returns the first diagnostic that starts in the line or nullptr
+        const lsDiagnostic* findStartingIn(int line) const;
+    };
+    using fileDiagsPtr_t = std::shared_ptr<const FileDiags>;
+
+private:
+    /*
+     * Path -> diagnostics.
+     * Written by the LSP thread and read by the main thread. The snapshots are
+     * swapped under the lock, the readers keep a reference to the one they got.
+     */
+    static std::unordered_map<std::string, fileDiagsPtr_t> s_diags;
+    static std::mutex s_diagsMutex;
+
+public:
+    // Returns nullptr if there are no diagnostics for the file
+    static fileDiagsPtr_t getDiagsForFile(const std::string& path);
+    static void setDiagsForFile(const std::string& path, diagList_t&& diags);
+
+    // Run the handlers of the responses that arrived. Called once per frame.
+    void processResponses();
+    // Cancel the in-flight requests sent by `owner`
+    void cancelRequestsOf(const void* owner);
+
+    // Adds the items to the popup when the response arrives
     void get(Popup* popupP, lsCompletionTriggerKind trigger);
-    std::optional<lsCompletionItem> compItemResolve(const lsCompletionItem& item);
+    using compItemCallback_t = std::function<void(const lsCompletionItem&)>;
+    // `callback` is called with the resolved item when the response arrives
+    void compItemResolve(const lsCompletionItem& item, const void* owner, compItemCallback_t callback);
 
     void onFileOpen(const std::string& path, Langs::LangId language, const std::string& fileContent);
-    void onFileChange(const std::string& path, int version, const std::string& newContent);
+    using contentGetter_t = std::function<std::string()>;
+    /*
+     * Queue an edit: `removed` was replaced with `inserted` at `start`.
+     * The column of `start` is in UTF-16 code units, as the protocol requires.
+     * The queued edits are merged if possible and sent by `flushFileChanges()`.
+     * `getContent` is called to get the whole file when the changes can't be sent incrementally.
+     */
+    void onFileChange(const std::string& path, int version,
+            const lsPosition& start, const String& removed, const String& inserted,
+            const contentGetter_t& getContent);
+    // Send the queued `textDocument/didChange` notifications. Called once per frame.
+    void flushFileChanges();
+    void flushFileChanges(const std::string& path);
     void onFileClose(const std::string& path);
     using saveReason_t = WillSaveTextDocumentParams::TextDocumentSaveReason;
     void beforeFileSave(const std::string& path, saveReason_t reason);
@@ -334,9 +536,14 @@ public:
         int endCol    = -1;
     };
 
-    HoverInfo getHover(const std::string& path, uint line, uint col);
+    using hoverCallback_t = std::function<void(const HoverInfo&)>;
+    // `callback` is called when the response arrives
+    void getHover(const std::string& path, uint line, uint col, const void* owner, hoverCallback_t callback);
 
-    lsSignatureHelp getSignatureHelp(const std::string& path, uint line, uint col);
+    using signHelpCallback_t = std::function<void(const lsSignatureHelp&)>;
+    // `callback` is called when the response arrives
+    void getSignatureHelp(const std::string& path, uint line, uint col,
+            const void* owner, signHelpCallback_t callback);
 
     struct Location
     {
@@ -345,17 +552,23 @@ public:
         int col  = -1;
     };
 
+    // Called with the location when the response arrives, not called if there is none
+    using locationCallback_t = std::function<void(const Location&)>;
+
 private:
     template <typename ReqType>
-    Location _getDefOrDeclOrImp(const std::string& path, uint line, uint col);
+    void _getDefOrDeclOrImp(const std::string& path, uint line, uint col,
+            const void* owner, locationCallback_t callback);
 
 public:
-    Location getDefinition(const std::string& path, uint line, uint col);
-    Location getDeclaration(const std::string& path, uint line, uint col);
-    Location getImplementation(const std::string& path, uint line, uint col);
+    void getDefinition(const std::string& path, uint line, uint col, const void* owner, locationCallback_t callback);
+    void getDeclaration(const std::string& path, uint line, uint col, const void* owner, locationCallback_t callback);
+    void getImplementation(const std::string& path, uint line, uint col, const void* owner, locationCallback_t callback);
 
     using codeActionResult_t = decltype(td_codeAction::response::result);
-    codeActionResult_t getCodeActionForLine(const std::string& path, uint line);
+    using codeActionCallback_t = std::function<void(codeActionResult_t&&)>;
+    // `callback` is called when the response arrives
+    void getCodeActionForLine(const std::string& path, uint line, const void* owner, codeActionCallback_t callback);
     void executeCommand(const std::string& cmd, const boost::optional<std::vector<lsp::Any>>& args);
     // Used by the workspace/applyEdit callback
     void _replyToWsApplyEdit(const std::string& msgIfErr);
@@ -381,7 +594,11 @@ public:
         // this contains the range of the name.
         lsRange rangeIfNoName;
     };
-    CanRenameSymbolResult canRenameSymbolAt(const std::string& filePath, const lsPosition& pos);
+    using canRenameCallback_t = std::function<void(const CanRenameSymbolResult&)>;
+    // `callback` is called when the response arrives, also if the server responded with an error
+    void canRenameSymbolAt(const std::string& filePath, const lsPosition& pos,
+            const void* owner, canRenameCallback_t callback);
+    // The edits are applied when the response arrives
     void renameSymbol(const std::string& filePath, const lsPosition& pos, const std::string& newName);
 
     using docSymbolResult_t = std::vector<lsDocumentSymbol>;
@@ -390,7 +607,9 @@ public:
     using wpSymbolResult_t = std::vector<lsSymbolInformation>;
     wpSymbolResult_t getWpSymbols(const std::string& query="");
 
-    std::vector<lsTextEdit> getFormattingEdits(const std::string& filePath);
+    using editsCallback_t = std::function<void(const std::vector<lsTextEdit>&)>;
+    // `callback` is called when the response arrives
+    void getFormattingEdits(const std::string& filePath, const void* owner, editsCallback_t callback);
     std::vector<lsTextEdit> getOnTypeFormattingEdits(
             const std::string& filePath, const lsPosition& pos, Char typedChar);
 
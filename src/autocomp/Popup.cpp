@@ -2,7 +2,7 @@
 #include "../globals.h"
 #include "../UiRenderer.h"
 #include "../TextRenderer.h"
-#include "../Timer.h"
+#include "../Profiler.h"
 #include "../Logger.h"
 #include "../common/string.h"
 #include "../markdown.h"
@@ -31,14 +31,16 @@ void Popup::sortItemsIfNeeded()
     if (!m_isSortingNeeded)
         return;
 
-    std::sort(m_items.begin(), m_items.end(),
-            [](const std::unique_ptr<Item>& a, const std::unique_ptr<Item>& b) {
+    // Note: The ranking uses this order to break ties
+    std::stable_sort(m_items.begin(), m_items.end(),
+            [](const Entry& a, const Entry& b) {
                 // Sort by `sortText` if exists, otherwise use `label`
-                const auto& textA = a->sortText.get_value_or(a->label);
-                const auto& textB = b->sortText.get_value_or(b->label);
+                const auto& textA = a.item->sortText.get_value_or(a.item->label);
+                const auto& textB = b.item->sortText.get_value_or(b.item->label);
                 return textA < textB;
             }
     );
+    m_areCandidatesValid = false;
 
     // Remove duplicates
     //m_items.erase(std::unique(m_items.begin(), m_items.end(),
@@ -57,16 +59,54 @@ void Popup::filterItemsIfNeeded()
         return;
 
 #if AUTOCOMP_FILTER_ITEMS
-    for (size_t i{}; i < m_items.size(); ++i)
+    PROFILE_FUNC();
+
+    // If the filter only grew, the items that did not match before can't match now
+    if (!m_areCandidatesValid || !m_filter.starts_with(m_candidateFilter))
     {
-        if (m_filter.empty() || utf8To32(m_items[i]->filterText.value_or(m_items[i]->label)).starts_with(m_filter))
-        {
-            m_filteredItems.push_back(m_items[i].get());
-        }
+        m_candidateIs.resize(m_items.size());
+        for (size_t i{}; i < m_items.size(); ++i)
+            m_candidateIs[i] = i;
+    }
+
+    const String patternLower = strToLower(m_filter);
+    const uint64_t patternMask = Fuzzy::calcCharMask(patternLower);
+    struct Scored
+    {
+        int score;
+        uint32_t itemI;
+    };
+    std::vector<Scored> scored;
+    scored.reserve(m_candidateIs.size());
+    for (const uint32_t itemI : m_candidateIs)
+    {
+        const int score = Fuzzy::calcScore(m_items[itemI].key, patternLower, patternMask);
+        if (score >= 0)
+            scored.push_back({score, itemI});
     }
+
+    m_candidateIs.clear();
+    for (const auto& entry : scored)
+        m_candidateIs.push_back(entry.itemI);
+    m_candidateFilter = m_filter;
+    m_areCandidatesValid = true;
+
+    // Only the best ones are shown, don't sort the rest
+    const size_t shownCount = std::min<size_t>(scored.size(), AUTOCOMP_MAX_SHOWN_ITEMS);
+    std::partial_sort(scored.begin(), scored.begin()+shownCount, scored.end(),
+            [](const Scored& a, const Scored& b){
+                return a.score != b.score ? a.score > b.score : a.itemI < b.itemI;
+            });
+
+    m_filteredItems.clear();
+    for (size_t i{}; i < shownCount; ++i)
+        m_filteredItems.push_back(m_items[scored[i].itemI].item.get());
+
+    LOG_DBG("Autocomp") << scored.size() << " items matched "
+        << quoteStr(m_filter) << Logger::End;
 #else
     m_filteredItems.clear();
-    std::transform(m_items.cbegin(), m_items.cend(), std::back_inserter(m_filteredItems), [](const auto& v){ return v.get(); });
+    std::transform(m_items.cbegin(), m_items.cend(), std::back_inserter(m_filteredItems), [](const auto& v){ return v.item.get(); });
 #endif
 
     m_isFilteringNeeded = false;
@@ -162,7 +202,7 @@ void Popup::render()
     if (!m_isEnabled)
         return;
 
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     sortItemsIfNeeded();
     filterItemsIfNeeded();
@@ -226,8 +266,6 @@ void Popup::render()
     }
 
     m_docWin.render();
-
-    TIMER_END_FUNC();
 }
 
 void Popup::updateDocWin()
@@ -283,6 +321,28 @@ void Popup::updateDocWin()
 
 void Popup::show(std::optional<Bindings::BindingKey> triggerKey)
 {
+#if AUTOCOMP_FILTER_ITEMS
+    // When typing the rest of a word, we only need to narrow down the items we already have
+    if (m_isEnabled && !m_isIncomplete && !m_items.empty() && !m_filter.empty()
+     && triggerKey.has_value() && !triggerKey->isFuncKey() && isIdentifierChar(triggerKey->getAsChar()))
+    {
+        const String word = g_activeBuff->getWordToComplete();
+        if (word.size() > m_filter.size() && word.starts_with(m_filter))
+        {
+            m_filter = word;
+            m_isFilteringNeeded = true;
+            m_selectedItemI = 0;
+            m_scrollByItems = 0;
+            filterItemsIfNeeded();
+            if (m_filteredItems.empty())
+                m_docWin.hideAndClear();
+            else
+                updateDocWin();
+            return;
+        }
+    }
+#endif
+
     clear();
     m_isEnabled = false;
 
@@ -317,13 +377,21 @@ void Popup::show(std::optional<Bindings::BindingKey> triggerKey)
 
     m_isEnabled = true;
     m_filter = g_activeBuff->getWordToComplete();
-    Autocomp::lspProvider->get(this, triggerKind);
+    // We are the popup of the active buffer
+    g_activeBuff->regenAutocompList(triggerKind);
     filterItemsIfNeeded();
     sortItemsIfNeeded();
 
     Logger::dbg << "FILTER: " << m_filter << Logger::End;
 }
 
+Popup::~Popup()
+{
+    // The responses would add items to us
+    if (Autocomp::lspProvider)
+        Autocomp::lspProvider->cancelRequestsOf(this);
+}
+
 void Popup::clear()
 {
     m_items.clear();
@@ -333,6 +401,8 @@ void Popup::clear()
     m_scrollByItems = 0;
     m_isSortingNeeded = true;
     m_isFilteringNeeded = true;
+    m_isIncomplete = false;
+    m_areCandidatesValid = false;
 }
 
 }
@@ -4,6 +4,8 @@
 #include "../globals.h"
 #include "../FloatingWin.h"
 #include "../Bindings.h"
+#include "../common/string.h"
+#include "FuzzyMatcher.h"
 #include <vector>
 #include <memory>
 #include <algorithm>
@@ -11,8 +13,10 @@
 
 // Sort on client side?
 #define AUTOCOMP_SORT_ITEMS 0
-// Filter on client side?
-#define AUTOCOMP_FILTER_ITEMS 0
+// Filter and rank on client side?
+#define AUTOCOMP_FILTER_ITEMS 1
+// Max. number of best matching items to show
+#define AUTOCOMP_MAX_SHOWN_ITEMS 256
 
 namespace Autocomp
 {
@@ -29,13 +33,25 @@ private:
     glm::ivec2 m_size{};
     int m_scrollByItems{};
 
-    std::vector<std::unique_ptr<Item>> m_items;
+    struct Entry
+    {
+        std::unique_ptr<Item> item;
+        Fuzzy::MatchKey key;
+    };
+    std::vector<Entry> m_items;
     bool m_isSortingNeeded{};
     int m_selectedItemI{};
+    // If true, the server did not send every item, so we can't filter them on our own
+    bool m_isIncomplete{};
 
     String m_filter;
     std::vector<Item*> m_filteredItems;
     bool m_isFilteringNeeded{};
+    // The indices of the items that matched `m_candidateFilter`.
+    // When the filter grows, only these need to be checked.
+    std::vector<uint32_t> m_candidateIs;
+    String m_candidateFilter;
+    bool m_areCandidatesValid{};
 
     FloatingWindow m_docWin;
 
@@ -44,16 +60,25 @@ private:
     void filterItemsIfNeeded();
     void updateDocWin();
 
+    // To allow filtering in benchmarks
+    friend class BenchmarkRunner;
+
 public:
     void render();
 
     inline void hide()
     {
+        // The items are not needed anymore
+        if (Autocomp::lspProvider)
+            Autocomp::lspProvider->cancelRequestsOf(this);
+
         m_isEnabled = false;
         m_selectedItemI = 0; // Reset selected item
         m_filter.clear();
         m_filteredItems.clear();
         m_items.clear();
+        m_isIncomplete = false;
+        m_areCandidatesValid = false;
         m_isFilteringNeeded = true;
     }
 
@@ -64,11 +89,16 @@ public:
 
     inline void addItem(Item item)
     {
-        m_items.push_back(std::make_unique<Item>(item));
+        // Convert the filter text only once
+        Fuzzy::MatchKey key = Fuzzy::makeKey(utf8To32(item.filterText.value_or(item.label)));
+        m_items.push_back({std::make_unique<Item>(std::move(item)), std::move(key)});
         m_isSortingNeeded = true;
         m_isFilteringNeeded = true;
+        m_areCandidatesValid = false;
     }
 
+    inline void setIncomplete(bool isIncomplete) { m_isIncomplete = isIncomplete; }
+
     inline void selectNextItem()
     {
         sortItemsIfNeeded();
@@ -136,6 +166,8 @@ public:
     }
 
     void clear();
+
+    ~Popup();
 };
 
 }
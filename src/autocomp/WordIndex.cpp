@@ -0,0 +1,245 @@
+#include "WordIndex.h"
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#define WORD_INDEX_MAGIC        "HXWIDX01"
+#define WORD_INDEX_MAGIC_LEN    8
+// Number of words in a block, the first one is stored whole
+#define WORD_INDEX_BLOCK_SIZE   16
+
+/*
+ * Layout:
+ *      char     magic[8]
+ *      uint32_t wordCount
+ *      uint32_t blockCount
+ *      uint32_t blockOffsets[blockCount] -- Relative to the first block
+ *      Blocks:
+ *          varint len, char word[len]
+ *          (varint sharedLen, varint suffixLen, char suffix[suffixLen]) * (WORD_INDEX_BLOCK_SIZE-1)
+ */
+
+namespace Autocomp
+{
+
+static void writeVarint(std::string& out, uint32_t val)
+{
+    while (val >= 0x80)
+    {
+        out += char((val & 0x7f) | 0x80);
+        val >>= 7;
+    }
+    out += char(val);
+}
+
+static uint32_t readVarint(const char*& ptr)
+{
+    uint32_t val{};
+    int shift{};
+    while (true)
+    {
+        const uint8_t byte = *ptr++;
+        val |= uint32_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return val;
+        shift += 7;
+    }
+}
+
+// Like `readVarint()`, but returns false instead of reading past `end` or overflowing
+static bool readVarintChecked(const char*& ptr, const char* end, uint32_t* outVal)
+{
+    uint32_t val{};
+    for (int shift{}; shift < 32; shift += 7)
+    {
+        if (ptr >= end)
+            return false;
+        const uint8_t byte = *ptr++;
+        val |= uint32_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *outVal = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void writeU32(std::string& out, uint32_t val)
+{
+    out.append((const char*)&val, sizeof(val));
+}
+
+static uint32_t readU32(const char* ptr)
+{
+    uint32_t val;
+    std::memcpy(&val, ptr, sizeof(val));
+    return val;
+}
+
+std::string WordIndex::build(std::vector<std::string> words)
+{
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    const uint32_t blockCount = (words.size()+WORD_INDEX_BLOCK_SIZE-1)/WORD_INDEX_BLOCK_SIZE;
+    std::string blocks;
+    std::vector<uint32_t> blockOffsets;
+    blockOffsets.reserve(blockCount);
+    for (size_t i{}; i < words.size(); ++i)
+    {
+        const std::string& word = words[i];
+        if (i % WORD_INDEX_BLOCK_SIZE == 0)
+        {
+            blockOffsets.push_back(blocks.size());
+            writeVarint(blocks, word.size());
+            blocks += word;
+        }
+        else
+        {
+            const std::string& prev = words[i-1];
+            const size_t shared = std::mismatch(
+                    prev.begin(), prev.begin()+std::min(prev.size(), word.size()), word.begin()).first-prev.begin();
+            writeVarint(blocks, shared);
+            writeVarint(blocks, word.size()-shared);
+            blocks.append(word, shared);
+        }
+    }
+
+    std::string out = WORD_INDEX_MAGIC;
+    writeU32(out, words.size());
+    writeU32(out, blockCount);
+    for (uint32_t offs : blockOffsets)
+        writeU32(out, offs);
+    out += blocks;
+    return out;
+}
+
+WordIndex::WordIndex(std::shared_ptr<const MappedFile> file)
+    : m_file{std::move(file)}, m_data{m_file->data()}, m_size{m_file->size()}
+{
+    _parseHeader();
+}
+
+WordIndex::WordIndex(std::string data)
+    : m_ownData{std::move(data)}, m_data{m_ownData.data()}, m_size{m_ownData.size()}
+{
+    _parseHeader();
+}
+
+void WordIndex::_parseHeader()
+{
+    const size_t headerSize = WORD_INDEX_MAGIC_LEN+2*sizeof(uint32_t);
+    if (m_size < headerSize || std::memcmp(m_data, WORD_INDEX_MAGIC, WORD_INDEX_MAGIC_LEN) != 0)
+        throw std::runtime_error{"Invalid word index header"};
+
+    m_wordCount = readU32(m_data+WORD_INDEX_MAGIC_LEN);
+    m_blockCount = readU32(m_data+WORD_INDEX_MAGIC_LEN+sizeof(uint32_t));
+    if (m_blockCount != (uint64_t(m_wordCount)+WORD_INDEX_BLOCK_SIZE-1)/WORD_INDEX_BLOCK_SIZE
+     || m_size < headerSize+uint64_t(m_blockCount)*sizeof(uint32_t))
+        throw std::runtime_error{"Invalid word index header"};
+
+    m_blockOffsets = m_data+headerSize;
+    m_blocks = m_blockOffsets+m_blockCount*sizeof(uint32_t);
+    _validateBlocks();
+}
+
+void WordIndex::_validateBlocks() const
+{
+    // The lookups don't check the bounds, so walk the whole index once to make sure that
+    // a truncated or corrupt file can't make them read outside of it
+    const char* const end = m_data+m_size;
+    const size_t blocksSize = end-m_blocks;
+    uint32_t prevLen{};
+    for (uint32_t blockI{}; blockI < m_blockCount; ++blockI)
+    {
+        const uint32_t offs = readU32(m_blockOffsets+blockI*sizeof(uint32_t));
+        const size_t blockEnd = (blockI+1 < m_blockCount
+                ? readU32(m_blockOffsets+(blockI+1)*sizeof(uint32_t)) : blocksSize);
+        if ((blockI == 0 && offs != 0) || blockEnd > blocksSize || offs >= blockEnd)
+            throw std::runtime_error{"Invalid word index block offset"};
+
+        const char* ptr = m_blocks+offs;
+        const char* const blockEndP = m_blocks+blockEnd;
+        const uint32_t wordsInBlock = std::min<uint32_t>(
+                WORD_INDEX_BLOCK_SIZE, m_wordCount-blockI*WORD_INDEX_BLOCK_SIZE);
+        for (uint32_t i{}; i < wordsInBlock; ++i)
+        {
+            uint32_t shared{};
+            uint32_t len{};
+            if ((i != 0 && (!readVarintChecked(ptr, blockEndP, &shared) || shared > prevLen))
+             || !readVarintChecked(ptr, blockEndP, &len)
+             || len > size_t(blockEndP-ptr))
+                throw std::runtime_error{"Invalid word index block"};
+            ptr += len;
+            prevLen = shared+len;
+        }
+        if (ptr != blockEndP)
+            throw std::runtime_error{"Invalid word index block size"};
+    }
+}
+
+std::string_view WordIndex::_getBlockFirstWord(uint32_t blockI) const
+{
+    const char* ptr = m_blocks+readU32(m_blockOffsets+blockI*sizeof(uint32_t));
+    const uint32_t len = readVarint(ptr);
+    return {ptr, len};
+}
+
+std::vector<std::string> WordIndex::findWithPrefix(const std::string& prefix, size_t maxCount) const
+{
+    std::vector<std::string> output;
+    if (m_wordCount == 0 || maxCount == 0)
+        return output;
+
+    // Find the first block that starts with a word not less than the prefix,
+    // the matches start either in it or at the end of the previous block
+    uint32_t lo{};
+    uint32_t hi = m_blockCount;
+    while (lo < hi)
+    {
+        const uint32_t mid = lo+(hi-lo)/2;
+        if (_getBlockFirstWord(mid) < prefix)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    uint32_t blockI = (lo > 0 ? lo-1 : 0);
+
+    std::string word;
+    for (uint32_t wordI = blockI*WORD_INDEX_BLOCK_SIZE; wordI < m_wordCount;)
+    {
+        const char* ptr = m_blocks+readU32(m_blockOffsets+blockI*sizeof(uint32_t));
+        const uint32_t firstLen = readVarint(ptr);
+        word.assign(ptr, firstLen);
+        ptr += firstLen;
+
+        for (uint32_t i{}; i < WORD_INDEX_BLOCK_SIZE && wordI < m_wordCount; ++i, ++wordI)
+        {
+            if (i != 0)
+            {
+                const uint32_t shared = readVarint(ptr);
+                const uint32_t suffixLen = readVarint(ptr);
+                word.resize(shared);
+                word.append(ptr, suffixLen);
+                ptr += suffixLen;
+            }
+
+            if (word.starts_with(prefix))
+            {
+                output.push_back(word);
+                if (output.size() == maxCount)
+                    return output;
+            }
+            else if (word > prefix)
+            {
+                // The words are sorted, no more matches
+                return output;
+            }
+        }
+        ++blockI;
+    }
+    return output;
+}
+
+} // namespace Autocomp
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../common/file.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace Autocomp
+{
+
+/*
+ * An immutable, sorted list of UTF-8 words in a binary format that can be memory mapped.
+ *
+ * The words are grouped into blocks. The first word of a block is stored whole,
+ * the others as the length of the prefix they share with the previous word and the rest
+ * (front coding). Lookups binary search the blocks by their first word and only decode
+ * the words from there.
+ */
+class WordIndex final
+{
+private:
+    std::shared_ptr<const MappedFile> m_file;
+    // Used when the index is not loaded from a file
+    std::string m_ownData;
+
+    const char* m_data{};
+    size_t m_size{};
+    uint32_t m_wordCount{};
+    uint32_t m_blockCount{};
+    const char* m_blockOffsets{};
+    const char* m_blocks{};
+
+    void _parseHeader();
+    // Throws `std::runtime_error` if a block is out of bounds or malformed
+    void _validateBlocks() const;
+    std::string_view _getBlockFirstWord(uint32_t blockI) const;
+
+public:
+    /*
+     * Build the binary representation of a word list.
+     * The words don't need to be sorted or unique.
+     */
+    static std::string build(std::vector<std::string> words);
+
+    /*
+     * Throws `std::runtime_error` if the data is not a valid index.
+     */
+    WordIndex(std::shared_ptr<const MappedFile> file);
+    WordIndex(std::string data);
+    WordIndex(const WordIndex&) = delete;
+    WordIndex& operator=(const WordIndex&) = delete;
+
+    inline size_t getWordCount() const { return m_wordCount; }
+
+    // Returns the first `maxCount` words that start with `prefix`, in sorted order
+    std::vector<std::string> findWithPrefix(const std::string& prefix, size_t maxCount) const;
+};
+
+} // namespace Autocomp
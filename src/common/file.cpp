@@ -6,6 +6,10 @@
 #include <cstring>
 #include <fstream>
 #include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 String loadUnicodeFile(const std::string& filePath)
 {
@@ -69,6 +73,190 @@ std::string loadAsciiFile(const std::string& filePath)
     return std::string(input.data(), input.size());
 }
 
+MappedFile::MappedFile(const std::string& filePath)
+    : m_filePath{filePath}
+{
+    const int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::runtime_error{std::strerror(errno)};
+    }
+
+    struct stat st{};
+    if (fstat(fd, &st) == -1)
+    {
+        const int err = errno;
+        close(fd);
+        throw std::runtime_error{std::strerror(err)};
+    }
+    m_size = st.st_size;
+    m_device = st.st_dev;
+    m_inode = st.st_ino;
+    m_modTime = st.st_mtim;
+
+    if (m_size)
+    {
+        void* addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error{std::strerror(err)};
+        }
+        // Note: The default read-ahead suits the indexing of the lines,
+        //       call `adviseRandomAccess()` after it
+        m_data = (const char*)addr;
+    }
+    // The mapping stays valid after closing the file
+    close(fd);
+
+    Logger::dbg << "Mapped file \"" << filePath << "\" (" << m_size << " bytes)" << Logger::End;
+}
+
+void MappedFile::adviseRandomAccess() const
+{
+    // The lines are decoded when they are scrolled to or searched
+    if (m_data)
+        madvise((void*)m_data, m_size, MADV_RANDOM);
+}
+
+bool MappedFile::isChangedInPlace() const
+{
+    struct stat st{};
+    if (stat(m_filePath.c_str(), &st) == -1)
+        return false; // Removed, we still have it
+
+    if (st.st_dev != m_device || st.st_ino != m_inode)
+        return false; // Replaced, we still have the old one
+    return (size_t)st.st_size != m_size
+        || st.st_mtim.tv_sec != m_modTime.tv_sec || st.st_mtim.tv_nsec != m_modTime.tv_nsec;
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data)
+        munmap((void*)m_data, m_size);
+}
+
+static mode_t getUmask()
+{
+    // There is no way to read it without setting it
+    const mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}
+
+AtomicFileWriter::AtomicFileWriter(const std::string& filePath)
+    : m_filePath{filePath}
+{
+    const size_t slashPos = filePath.find_last_of('/');
+    const std::string dir = (slashPos == std::string::npos ? "" : filePath.substr(0, slashPos+1));
+    const std::string name = (slashPos == std::string::npos ? filePath : filePath.substr(slashPos+1));
+    // Hidden, so it doesn't show up in the file lists while it's being written
+    m_tempPath = dir+'.'+name+".tmp-XXXXXX";
+
+    m_fd = mkstemp(m_tempPath.data());
+    if (m_fd == -1 && (errno == EACCES || errno == EPERM))
+    {
+        // The directory is not writable, but the file may be
+        Logger::warn << "Failed to create a temporary file for \"" << filePath
+            << "\" (" << std::strerror(errno) << "), writing in place" << Logger::End;
+        m_tempPath.clear();
+        m_isInPlace = true;
+        m_fd = open(filePath.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (m_fd == -1)
+        {
+            throw std::runtime_error{std::strerror(errno)};
+        }
+        return;
+    }
+    if (m_fd == -1)
+    {
+        throw std::runtime_error{std::strerror(errno)};
+    }
+
+    // `mkstemp()` creates the file with 0600
+    struct stat st{};
+    const mode_t mode = (stat(filePath.c_str(), &st) == 0 ? st.st_mode & 07777 : 0666 & ~getUmask());
+    if (fchmod(m_fd, mode) == -1)
+    {
+        Logger::warn << "Failed to set the permissions of " << m_tempPath
+            << ": " << std::strerror(errno) << Logger::End;
+    }
+}
+
+void AtomicFileWriter::write(const char* data, size_t size)
+{
+    while (size)
+    {
+        const ssize_t written = ::write(m_fd, data, size);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error{std::strerror(errno)};
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void AtomicFileWriter::commit(bool sync)
+{
+    if (sync && fsync(m_fd) == -1)
+    {
+        throw std::runtime_error{std::strerror(errno)};
+    }
+    const int fd = m_fd;
+    m_fd = -1;
+    if (close(fd) == -1)
+    {
+        const int err = errno;
+        if (!m_isInPlace)
+            unlink(m_tempPath.c_str());
+        throw std::runtime_error{std::strerror(err)};
+    }
+    if (m_isInPlace)
+        return;
+
+    if (rename(m_tempPath.c_str(), m_filePath.c_str()) == -1)
+    {
+        const int err = errno;
+        unlink(m_tempPath.c_str());
+        throw std::runtime_error{std::strerror(err)};
+    }
+    m_tempPath.clear();
+
+    if (sync)
+    {
+        // Make the rename durable
+        const size_t slashPos = m_filePath.find_last_of('/');
+        const std::string dir = (slashPos == std::string::npos ? "." : m_filePath.substr(0, slashPos+1));
+        const int dirFd = open(dir.c_str(), O_RDONLY|O_DIRECTORY);
+        if (dirFd != -1)
+        {
+            fsync(dirFd);
+            close(dirFd);
+        }
+    }
+}
+
+bool AtomicFileWriter::canReplace(const std::string& filePath)
+{
+    const size_t slashPos = filePath.find_last_of('/');
+    const std::string dir = (slashPos == std::string::npos ? "." : filePath.substr(0, slashPos+1));
+    return access(dir.c_str(), W_OK) == 0;
+}
+
+AtomicFileWriter::~AtomicFileWriter()
+{
+    if (m_fd != -1)
+        close(m_fd);
+    // Not committed
+    if (!m_tempPath.empty())
+        unlink(m_tempPath.c_str());
+}
+
 bool isReadOnlyFile(const std::string& filePath)
 {
     std::fstream file;
@@ -3,6 +3,8 @@
 #include "../types.h"
 #include <stdexcept>
 #include <string>
+#include <ctime>
+#include <sys/types.h>
 
 class InvalidUnicodeError : public std::runtime_error
 {
@@ -27,6 +29,84 @@ String loadUnicodeFile(const std::string& filePath);
  */
 std::string loadAsciiFile(const std::string& filePath);
 
+/*
+ * A read-only, private memory mapping of a whole file.
+ *
+ * The mapping keeps the file alive if it is replaced (renamed over or deleted), but not if
+ * another program writes into it: the pages that were not read yet show the new data,
+ * and the ones past the new end raise SIGBUS when the file is truncated.
+ * `isChangedInPlace()` tells if that happened, the mapping should be dropped then.
+ *
+ * Throws `std::runtime_error` when the file can't be opened or mapped.
+ */
+class MappedFile final
+{
+private:
+    std::string m_filePath;
+    const char* m_data{};
+    size_t m_size{};
+    dev_t m_device{};
+    ino_t m_inode{};
+    timespec m_modTime{};
+
+public:
+    MappedFile(const std::string& filePath);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Null if the file is empty
+    inline const char* data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+
+    // Tell the kernel that the file will be accessed randomly from now, so it doesn't read ahead
+    void adviseRandomAccess() const;
+    /*
+     * Returns true if the mapped file was written to since it was mapped.
+     * Replacing the file with another one doesn't count.
+     */
+    bool isChangedInPlace() const;
+
+    ~MappedFile();
+};
+
+/*
+ * Writes a file atomically: the data goes to a temporary file in the same directory,
+ * which replaces the file in `commit()`. The temporary file is removed if `commit()`
+ * is not called. The permissions of the existing file are kept.
+ * If the temporary file can't be created (e.g. a writable file in a read-only directory),
+ * the file is truncated and written in place instead, which is not atomic.
+ *
+ * Throws `std::runtime_error` when any of the operations fail.
+ */
+class AtomicFileWriter final
+{
+private:
+    std::string m_filePath;
+    // Empty when writing in place
+    std::string m_tempPath;
+    int m_fd{-1};
+    bool m_isInPlace{};
+
+public:
+    AtomicFileWriter(const std::string& filePath);
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    void write(const char* data, size_t size);
+    inline void write(const std::string& data) { write(data.data(), data.size()); }
+    /*
+     * Replace the file with the written data.
+     * If `sync` is true, wait until the data and the rename reach the disk.
+     */
+    void commit(bool sync);
+    inline bool isInPlace() const { return m_isInPlace; }
+
+    // Whether a temporary file can be created next to the file, so it can be replaced atomically
+    static bool canReplace(const std::string& filePath);
+
+    ~AtomicFileWriter();
+};
+
 /*
  * Tries to open the file as writable. If fails, returns true.
  */
@@ -49,6 +49,82 @@ std::string utf32To8(const String& input)
     return output;
 }
 
+size_t countUtf8Chars(const char* data, size_t size)
+{
+    // Every byte that is not a continuation byte starts a character
+    size_t count{};
+    for (size_t i{}; i < size; ++i)
+        count += ((uint8_t)data[i] & 0xc0) != 0x80;
+    return count;
+}
+
+size_t countUtf16Units(const Char* data, size_t size)
+{
+    // The characters outside the BMP are encoded as surrogate pairs
+    size_t count = size;
+    for (size_t i{}; i < size; ++i)
+        count += data[i] > 0xffff;
+    return count;
+}
+
+void decodeUtf8Line(const char* data, size_t size, String* output)
+{
+    output->clear();
+    output->reserve(size+1);
+
+    size_t i{};
+    while (i < size)
+    {
+        const uint8_t lead = data[i];
+        if (lead < 0x80)
+        {
+            *output += (Char)lead;
+            ++i;
+            continue;
+        }
+        // Stray continuation byte, not counted by `countUtf8Chars()`
+        if ((lead & 0xc0) == 0x80)
+        {
+            ++i;
+            continue;
+        }
+
+        size_t contCount;
+        Char cp;
+        if ((lead & 0xe0) == 0xc0)      { contCount = 1; cp = lead & 0x1f; }
+        else if ((lead & 0xf0) == 0xe0) { contCount = 2; cp = lead & 0x0f; }
+        else if ((lead & 0xf8) == 0xf0) { contCount = 3; cp = lead & 0x07; }
+        else                            { contCount = 0; cp = 0; }
+
+        bool isValid = contCount && i+contCount < size;
+        for (size_t j{1}; isValid && j <= contCount; ++j)
+        {
+            const uint8_t byte = data[i+j];
+            if ((byte & 0xc0) != 0x80)
+                isValid = false;
+            else
+                cp = (cp << 6) | (byte & 0x3f);
+        }
+
+        if (isValid && (cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff)))
+            isValid = false;
+
+        if (isValid)
+        {
+            *output += cp;
+            i += contCount+1;
+        }
+        else
+        {
+            // Skip the lead byte only, the continuation bytes are skipped by the next iterations
+            *output += (Char)0xfffd;
+            ++i;
+        }
+    }
+
+    *output += '\n';
+}
+
 size_t countLineListLen(const std::vector<String>& lines)
 {
     size_t len{};
@@ -19,6 +19,21 @@ String icuStrToUtf32(const icu::UnicodeString& input);
 String utf8To32(const std::string& input);
 std::string utf32To8(const String& input);
 
+/*
+ * Returns the number of characters `decodeUtf8Line()` would produce from `data`.
+ */
+size_t countUtf8Chars(const char* data, size_t size);
+/*
+ * Returns the number of UTF-16 code units needed to encode `data`.
+ * The LSP counts the columns in these.
+ */
+size_t countUtf16Units(const Char* data, size_t size);
+/*
+ * Decode a line of UTF-8 and append a line break. Invalid sequences are replaced with U+FFFD.
+ * This doesn't depend on ICU, so it is fast enough to decode lines on demand.
+ */
+void decodeUtf8Line(const char* data, size_t size, String* output);
+
 template <typename T>
 static constexpr bool _isStringType = false;
 template <typename T>
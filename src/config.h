@@ -6,7 +6,34 @@
 
 #else
 
-#define DEBUG_ENABLE_FUNC_TIMER         0
+//-------------------- Logger --------------------
+
+// The log levels below this are compiled out (0: debug, 1: info, 2: warning, 3: error)
+#ifdef NDEBUG
+#   define LOGGER_MIN_LEVEL             1
+#else
+#   define LOGGER_MIN_LEVEL             0
+#endif
+// Max. number of records waiting to be written, must be a power of 2
+#define LOGGER_QUEUE_SIZE               4096
+// The records are also written to this file, relative to the state directory
+// ($XDG_STATE_HOME/HaxEdit or ~/.local/state/HaxEdit). Empty to only log to the console.
+#define LOGGER_FILE_PATH                "HaxEdit.log"
+// The log file is rotated when it's larger than this
+#define LOGGER_FILE_MAX_SIZE            (4*1024*1024)
+// Number of rotated log files to keep
+#define LOGGER_FILE_KEEP_COUNT          3
+
+//-------------------- Profiler --------------------
+
+// Record the profiler zones, shown in debug draw mode (F3) and exported by `:profile`
+#define PROFILER_ENABLE                 1
+// Max. number of recorded zones per thread, the oldest ones are overwritten
+#define PROFILER_RING_SIZE              16384
+// Number of frames shown in the overlay graphs
+#define PROFILER_HISTORY_LEN            120
+// Max. number of zones listed in the overlay
+#define PROFILER_OVERLAY_MAX_ZONES      10
 
 //-------------------- Window size --------------------
 
@@ -53,6 +80,9 @@
 #define ICON_FILE_PATH                  "../img/logo.png"
 //#define DICTIONARY_FILE_PATH            "/usr/share/dict/words"
 #define DICTIONARY_FILE_PATH            "../external/dictionary.txt"
+// Generated from the dictionary when it is missing or older than the dictionary,
+// relative to the state directory (the install directory may be read-only)
+#define DICTIONARY_INDEX_PATH           "dictionary.idx"
 #define THEME_PATH                      "../external/themes/nightlion_aptan.epf"
 
 //-------------------- Welcome screen --------------------
@@ -94,14 +124,28 @@
 // Milliseconds to wait before toggling cursor visibility
 // Set to -1 to disable blinking
 #define CURSOR_BLINK_MS                 500
-#define AUTO_RELOAD_CHECK_FREQ_MS       5000
-#define GIT_BRANCH_CHECK_FREQ_MS        10000
+// Update the git signs when no edit was made for this long
+#define GIT_DIFF_DEBOUNCE_MS            300
+// The files are saved in chunks of this many bytes
+#define SAVE_CHUNK_SIZE                 (1024*1024)
+// Wait until the saved file reaches the disk
+#define SAVE_FSYNC                      true
 
 #define AUTO_RELOAD_MODE_DONT 0
 #define AUTO_RELOAD_MODE_AUTO 1
 #define AUTO_RELOAD_MODE_ASK  2
 #define AUTO_RELOAD_MODE                AUTO_RELOAD_MODE_ASK
 
+// The restored buffers are opened when they are first shown, or in the background when idle
+#define LAZY_BUFFER_PRELOAD             true
+// The time between preloading two buffers, the input is handled in between
+#define LAZY_BUFFER_PRELOAD_INTERVAL_MS 200
+// At most this many buffers are kept loaded. The clean buffers that were shown least recently
+// are unloaded above it.
+#define LAZY_BUFFER_MAX_LOADED          20
+// Only unload the buffers that were not shown for this long
+#define LAZY_BUFFER_UNLOAD_AFTER_S      300
+
 #define IMG_BUF_ZOOM_STEP               0.05f
 #define HIDE_MOUSE_WHILE_TYPING         true
 
@@ -112,6 +156,19 @@
 
 #define FORMAT_ON_TYPING                false
 
+// The lines that are not visible are highlighted in the background,
+// this many lines at once
+#define HL_BG_CHUNK_LINES               4096
+
+//-------------------- Search --------------------
+
+// Needles at least this long are searched with Boyer-Moore-Horspool
+#define SEARCH_BMH_MIN_LEN              16
+// Time spent searching the lines that are not visible per main loop iteration
+#define SEARCH_TICK_BUDGET_MS           8
+// The regex DFA cache is dropped when it grows above this many states
+#define SEARCH_REGEX_MAX_DFA_STATES     2048
+
 //-------------------- Dialogs --------------------
 
 #define FILE_DIALOG_ICON_SIZE_PX        32
@@ -125,8 +182,32 @@
 #define DATE_TIME_STR_LEN               19
 
 #define MAX_FILE_SIZE                   1024*1024*1024
+// Files at least this large are memory mapped and only the accessed lines are decoded
+#define LARGE_FILE_MODE_MIN_SIZE        16*1024*1024
 
 // Max. number of paths to store in the last files list
 #define RECENT_LIST_MAX_SIZE            20
 
+// The LSP server to start
+#define LSP_SERVER_PATH                 "/usr/bin/clangd"
+
+// Max. number of queued edits to send in a `textDocument/didChange`,
+// the whole file is sent if there are more
+#define LSP_MAX_PENDING_CHANGES         64
+
+// Max. number of dictionary words to offer for completion
+#define DICTIONARY_MAX_RESULTS          100
+
+// Min. length of the buffer words that are offered for completion
+#define BUFFWORD_MIN_LEN                3
+// Max. number of buffer words to offer for completion
+#define BUFFWORD_MAX_RESULTS            100
+// How many times more an occurrence in the current buffer is worth
+// when ranking the buffer words
+#define BUFFWORD_CURR_BUF_WEIGHT        4
+
+// Max. number of unanswered asynchronous requests of a method,
+// the oldest one is cancelled when sending more
+#define LSP_MAX_IN_FLIGHT_REQS          4
+
 #endif // __has_include("dev_config.h")
@@ -41,7 +41,7 @@ void AskerDialog::render()
     if (m_isClosed)
         return;
 
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     recalculateDimensions();
 
@@ -60,8 +60,6 @@ void AskerDialog::render()
     g_textRenderer->renderString(
             m_buffer,
             {m_entryRect.xPos, m_entryRect.yPos-2});
-
-    TIMER_END_FUNC();
 }
 
 void AskerDialog::handleKey(const Bindings::BindingKey& key)
@@ -1,5 +1,5 @@
 #include "Dialog.h"
-#include "../Timer.h"
+#include "../Profiler.h"
 #include "../TextRenderer.h"
 #include "../UiRenderer.h"
 
@@ -3,7 +3,7 @@
 #include "../FileTypeHandler.h"
 #include "../TextRenderer.h"
 #include "../Logger.h"
-#include "../Timer.h"
+#include "../Profiler.h"
 #include "../config.h"
 #include "../types.h"
 #include "../config.h"
@@ -75,7 +75,7 @@ void FileDialog::render()
     if (m_isClosed)
         return;
 
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     recalculateDimensions();
 
@@ -92,7 +92,6 @@ void FileDialog::render()
 
     if (m_fileList.empty())
     {
-        TIMER_END_FUNC();
         return;
     }
 
@@ -135,13 +134,11 @@ void FileDialog::render()
                 file->name, file->isDirectory)->render(
                     {rect.xPos, rect.yPos}, {FILE_DIALOG_ICON_SIZE_PX, FILE_DIALOG_ICON_SIZE_PX});
     }
-
-    TIMER_END_FUNC();
 }
 
 void FileDialog::genFileList()
 {
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
     Logger::dbg << "Listing directory: " << quoteStr(m_dirPath) << Logger::End;
     m_dirPath = std_fs::canonical(m_dirPath);
     Logger::dbg << "..., as canonical: " << quoteStr(m_dirPath) << Logger::End;
@@ -211,7 +208,36 @@ void FileDialog::genFileList()
         }
     );
 
-    TIMER_END_FUNC();
+    if (g_fileWatcher && m_watchedDirPath != m_dirPath)
+    {
+        g_fileWatcher->unwatch(m_dirWatchId);
+        m_dirWatchId = g_fileWatcher->watch(m_dirPath, [this](){ _onDirChanged(); });
+        m_watchedDirPath = m_dirPath;
+    }
+}
+
+void FileDialog::_onDirChanged()
+{
+    Logger::dbg << "Directory changed, listing again: " << quoteStr(m_dirPath) << Logger::End;
+
+    // Keep the selected file selected
+    const std::string selectedName = m_fileList.empty() ? "" : m_fileList[m_selectedFileI]->name;
+    genFileList();
+    auto it = std::find_if(m_fileList.begin(), m_fileList.end(),
+            [&](const std::unique_ptr<FileEntry>& x){ return x->name == selectedName; });
+    if (it != m_fileList.end())
+        m_selectedFileI = it-m_fileList.begin();
+    else
+        m_selectedFileI = std::min(m_selectedFileI, std::max((int)m_fileList.size()-1, 0));
+
+    recalculateDimensions();
+    g_isRedrawNeeded = true;
+}
+
+FileDialog::~FileDialog()
+{
+    if (g_fileWatcher)
+        g_fileWatcher->unwatch(m_dirWatchId);
 }
 
 void FileDialog::handleKey(const Bindings::BindingKey& key)
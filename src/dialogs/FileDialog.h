@@ -7,6 +7,7 @@
 #include <time.h>
 #include "Dialog.h"
 #include "../globals.h"
+#include "../FileWatcher.h"
 
 class FileDialog final : public Dialog
 {
@@ -27,6 +28,9 @@ private:
     static std::string s_lastDir;
 
     std::string m_dirPath;
+    // The directory is watched, so the list stays up to date
+    std::string m_watchedDirPath;
+    FileWatcher::watchId_t m_dirWatchId{};
     Type m_type{};
     int m_selectedFileI{};
     int m_scrollPx{};
@@ -45,6 +49,8 @@ private:
     virtual void recalculateDimensions() override;
 
     void genFileList();
+    // Called when something in the directory has changed
+    void _onDirChanged();
 
     inline void selectNextFile()
     {
@@ -78,6 +84,8 @@ public:
     virtual void render() override;
     virtual void handleKey(const Bindings::BindingKey& key) override;
 
+    virtual ~FileDialog();
+
     inline std::string getSelectedFilePath()
     {
         if (m_fileList.empty())
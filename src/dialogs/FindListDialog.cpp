@@ -3,6 +3,7 @@
 #include "../TextRenderer.h"
 #include "../UiRenderer.h"
 #include "../common/string.h"
+#include "../EventLoop.h"
 
 FindListDialog::FindListDialog(
             callback_t enterCb,
@@ -123,6 +124,10 @@ void FindListDialog::tick(int elapsedMs)
             m_selectedEntryI = std::min(m_selectedEntryI, m_entries.size()-1);
         g_isRedrawNeeded = true;
     }
+    else if (m_timeUntilFetch > 0)
+    {
+        EventLoop::wakeUpIn(m_timeUntilFetch);
+    }
 }
 
 void FindListDialog::handleKey(const Bindings::BindingKey& key)
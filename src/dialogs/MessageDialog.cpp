@@ -2,7 +2,7 @@
 #include "../UiRenderer.h"
 #include "../TextRenderer.h"
 #include "../Logger.h"
-#include "../Timer.h"
+#include "../Profiler.h"
 #include "../config.h"
 #include "../common/string.h"
 #include "../globals.h"
@@ -75,7 +75,7 @@ void MessageDialog::render()
     if (m_isClosed)
         return;
 
-    TIMER_BEGIN_FUNC();
+    PROFILE_FUNC();
 
     recalculateDimensions();
 
@@ -122,8 +122,6 @@ void MessageDialog::render()
         g_textRenderer->renderString(
                 getBtnText(m_btnInfo[i]), {m_btnTxtDims[i].xPos, m_btnTxtDims[i].yPos});
     }
-
-    TIMER_END_FUNC();
 }
 
 void MessageDialog::handleKey(const Bindings::BindingKey& key)
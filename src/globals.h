@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <memory>
+#include <atomic>
 #include "glstuff.h"
 #include "config.h"
 #include "modes.h"
@@ -21,6 +22,8 @@ struct Theme;
 class RecentFileList;
 class FloatingWindow;
 class ProgressFloatingWin;
+class ThreadPool;
+class FileWatcher;
 
 #ifdef _DEF_GLOBALS_
 
@@ -38,7 +41,8 @@ bool g_isMouseBtnRPressed = false;
 bool g_isMouseBtnMPressed = false;
 int g_mouseHoldTime = 0;
 
-bool g_isRedrawNeeded = false;
+// Also set by the background jobs
+std::atomic<bool> g_isRedrawNeeded = false;
 bool g_isTitleUpdateNeeded = true;
 bool g_isDebugDrawMode = false;
 
@@ -63,6 +67,9 @@ std::unique_ptr<FloatingWindow> g_hoverPopup;
 std::unique_ptr<ProgressFloatingWin> g_progressPopup;
 std::unique_ptr<FloatingWindow> g_lspInfoPopup;
 
+std::unique_ptr<ThreadPool> g_threadPool;
+std::unique_ptr<FileWatcher> g_fileWatcher;
+
 // Loaded by App::loadCursors()
 namespace Cursors
 {
@@ -96,7 +103,7 @@ extern bool g_isMouseBtnRPressed;
 extern bool g_isMouseBtnMPressed;
 extern int g_mouseHoldTime;
 
-extern bool g_isRedrawNeeded;
+extern std::atomic<bool> g_isRedrawNeeded;
 extern bool g_isTitleUpdateNeeded;
 extern bool g_isDebugDrawMode;
 
@@ -117,6 +124,9 @@ extern std::unique_ptr<FloatingWindow> g_hoverPopup;
 extern std::unique_ptr<ProgressFloatingWin> g_progressPopup;
 extern std::unique_ptr<FloatingWindow> g_lspInfoPopup;
 
+extern std::unique_ptr<ThreadPool> g_threadPool;
+extern std::unique_ptr<FileWatcher> g_fileWatcher;
+
 namespace Cursors
 {
 extern GLFWcursor* busy;
@@ -4,6 +4,7 @@
 #include <GL/gl.h>
 #include <GLFW/glfw3.h>
 #include <string>
+#include <cstdint>
 
 namespace GlfwHelpers
 {
@@ -36,3 +37,101 @@ inline std::string keyOrBtnActionToStr(int act)
 }
 
 }
+
+/*
+ * Thin wrappers of the GL calls used by the rendering code that count the calls,
+ * so the render benchmark can report them. Only call them from the main thread.
+ */
+namespace GlStats
+{
+
+struct Counters
+{
+    uint32_t drawCalls{};
+    uint64_t vertexCount{};
+    uint32_t textureBinds{};
+    uint32_t textureUploads{};
+    uint32_t bufferUploads{};
+    uint64_t uploadedBytes{};
+    uint32_t programBinds{};
+    uint32_t vaoBinds{};
+    uint32_t bufferBinds{};
+    // Every call made through these wrappers, the other GL calls are not counted
+    uint32_t wrappedCalls{};
+};
+
+inline Counters counters;
+
+inline void reset() { counters = {}; }
+
+inline void drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    ++counters.drawCalls;
+    counters.vertexCount += count;
+    ++counters.wrappedCalls;
+    glDrawArrays(mode, first, count);
+}
+
+inline void bindTexture(GLenum target, GLuint texture)
+{
+    ++counters.textureBinds;
+    ++counters.wrappedCalls;
+    glBindTexture(target, texture);
+}
+
+inline void texImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+        GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    ++counters.textureUploads;
+    ++counters.wrappedCalls;
+    glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+}
+
+inline void texSubImage2D(GLenum target, GLint level, GLint xOffset, GLint yOffset, GLsizei width, GLsizei height,
+        GLenum format, GLenum type, const void* pixels)
+{
+    ++counters.textureUploads;
+    ++counters.wrappedCalls;
+    glTexSubImage2D(target, level, xOffset, yOffset, width, height, format, type, pixels);
+}
+
+inline void bindVertexArray(GLuint array)
+{
+    ++counters.vaoBinds;
+    ++counters.wrappedCalls;
+    glBindVertexArray(array);
+}
+
+inline void bindBuffer(GLenum target, GLuint buffer)
+{
+    ++counters.bufferBinds;
+    ++counters.wrappedCalls;
+    glBindBuffer(target, buffer);
+}
+
+inline void bufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    ++counters.bufferUploads;
+    // Orphaning the buffer (null data) doesn't upload anything
+    if (data)
+        counters.uploadedBytes += size;
+    ++counters.wrappedCalls;
+    glBufferData(target, size, data, usage);
+}
+
+inline void bufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+    ++counters.bufferUploads;
+    counters.uploadedBytes += size;
+    ++counters.wrappedCalls;
+    glBufferSubData(target, offset, size, data);
+}
+
+inline void useProgram(GLuint program)
+{
+    ++counters.programBinds;
+    ++counters.wrappedCalls;
+    glUseProgram(program);
+}
+
+}
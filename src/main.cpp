@@ -4,6 +4,12 @@
 #include "App.h"
 #include "Bindings.h"
 #include "SessionHandler.h"
+#include "EventLoop.h"
+#include "ThreadPool.h"
+#include "FileWatcher.h"
+#include "StartupTimeline.h"
+#include "Profiler.h"
+#include "RenderBenchmark.h"
 #include <filesystem>
 #include "dialogs/FindDialog.h"
 #include "dialogs/FindListDialog.h"
@@ -11,13 +17,26 @@
 
 int main(int argc, char** argv)
 {
+#ifdef NDEBUG
+    Logger::setLoggerVerbosity(Logger::LoggerVerbosity::Verbose);
+#else
     Logger::setLoggerVerbosity(Logger::LoggerVerbosity::Debug);
+#endif
+    Profiler::setThreadName("Main");
 
     g_exePath = App::getExePath();
-    Logger::log << "Exe path: " << g_exePath << Logger::End;
     g_exeDirPath = std::filesystem::path{g_exePath}.parent_path();
+    // Not in the working directory, HaxEdit can be started from anywhere
+    if (!std::string{LOGGER_FILE_PATH}.empty())
+        Logger::setLogFile(App::getStatePath(LOGGER_FILE_PATH));
+    Logger::log << "Exe path: " << g_exePath << Logger::End;
     Logger::log << "Exe dir: " << g_exeDirPath << Logger::End;
 
+    if (argc > 1 && std::string{argv[1]} == "--bench-render")
+    {
+        return RenderBenchmark::run(argc-2, argv+2);
+    }
+
     Logger::dbg << "Initializing GLFW" << Logger::End;
     if (!glfwInit())
     {
@@ -25,51 +44,82 @@ int main(int argc, char** argv)
     }
 
     double appStartTime = glfwGetTime();
+    StartupTimeline startup;
 
-    Logger::dbg << "Creating GLFW window" << Logger::End;
-    g_window = App::createWindow();
-    Logger::dbg << "Created GLFW window" << Logger::End;
+    // Start the work that doesn't need the window, so it runs while we set up OpenGL
+    g_threadPool = std::make_unique<ThreadPool>();
+    auto fontPathsTask = startup.runAsync("Resolve font paths", App::resolveFontPaths);
+    auto themeTask = startup.runAsync("Load theme", App::loadTheme);
+    auto fileTypeHandlerTask = startup.runAsync("Load file type icons", App::createFileTypeHandler);
+    auto lspServerTask = startup.runAsync("Start LSP server", Autocomp::LspProvider::startServer);
+    // These are handed over when they are ready, we don't wait for them
+    (void)startup.runAsync("Load dictionary", App::loadDictionary);
+    App::setFortune(startup.runAsync("Run fortune", [](){
+        std::string fortune = OS::runExternalCommand(FORTUNE_CMD);
+        // Show it on the startup screen
+        EventLoop::runOnMainThread([](){ g_isRedrawNeeded = true; });
+        return fortune;
+    }));
 
-    Logger::dbg << "Initializing GLEW" << Logger::End;
-    App::initGlew();
-    Logger::dbg << "Initialized GLEW" << Logger::End;
+    startup.run("Create window", [](){
+        Logger::dbg << "Creating GLFW window" << Logger::End;
+        g_window = App::createWindow();
+        Logger::dbg << "Created GLFW window" << Logger::End;
 
-    Logger::dbg << "Configurign OpenGL context" << Logger::End;
-    App::setupGlFeatures();
-    Logger::dbg << "OpenGL context configured" << Logger::End;
+        Logger::dbg << "Initializing GLEW" << Logger::End;
+        App::initGlew();
+        Logger::dbg << "Initialized GLEW" << Logger::End;
 
-    App::setupKeyBindings();
+        Logger::dbg << "Configurign OpenGL context" << Logger::End;
+        App::setupGlFeatures();
+        Logger::dbg << "OpenGL context configured" << Logger::End;
+    });
 
-    App::initGit();
-    App::loadCursors();
-    App::loadSignImages();
+    startup.run("Set up key bindings", App::setupKeyBindings);
+    startup.run("Initialize git", App::initGit);
+    startup.run("Load cursors and signs", [](){
+        App::loadCursors();
+        App::loadSignImages();
+    });
 
     glClear(GL_COLOR_BUFFER_BIT);
     glClearColor(UNPACK_RGB_COLOR(DEF_BG), 1.0f);
     glfwSwapBuffers(g_window);
 
-    g_textRenderer.reset(App::createTextRenderer());
-    g_uiRenderer.reset(App::createUiRenderer());
+    const App::FontPaths fontPaths = startup.wait("Resolve font paths", fontPathsTask);
+    startup.run("Create renderers", [&](){
+        g_textRenderer.reset(App::createTextRenderer(fontPaths));
+        g_uiRenderer.reset(App::createUiRenderer());
+    });
     g_hoverPopup.reset(new FloatingWindow);
     g_progressPopup.reset(new ProgressFloatingWin);
     g_lspInfoPopup.reset(new FloatingWindow);
-    g_fileTypeHandler.reset(App::createFileTypeHandler());
     g_recentFilePaths = std::make_unique<RecentFileList>();
-    App::createAutocompleteProviders();
-    App::loadTheme();
+    g_fileWatcher = std::make_unique<FileWatcher>();
+    g_theme.reset(startup.wait("Load theme", themeTask));
+    g_fileTypeHandler.reset(startup.wait("Load file type icons", fileTypeHandlerTask));
     glfwPollEvents();
 
-    glClear(GL_COLOR_BUFFER_BIT);
-    glClearColor(UNPACK_RGB_COLOR(DEF_BG), 1.0f);
-    App::renderStartupScreen();
-    glfwSwapBuffers(g_window);
+    startup.run("First frame", [](){
+        glClear(GL_COLOR_BUFFER_BIT);
+        glClearColor(UNPACK_RGB_COLOR(DEF_BG), 1.0f);
+        App::renderStartupScreen();
+        glfwSwapBuffers(g_window);
+    });
+
+    // The server has been starting up in the meantime
+    auto lspClient = startup.wait("Start LSP server", lspServerTask);
+    startup.run("Initialize LSP server", [&](){
+        App::createAutocompleteProviders(std::move(lspClient));
+    });
 
     for (int i{1}; i < argc; ++i)
     {
         const std::string path = argv[i];
         if (std::filesystem::is_directory(path))
             continue;
-        g_tabs.push_back(std::make_unique<Split>(App::openFileInNewBuffer(path)));
+        // Opened when shown
+        g_tabs.push_back(std::make_unique<Split>(App::openFileDeferred(path)));
     }
     if (!g_tabs.empty())
     {
@@ -93,11 +143,13 @@ int main(int argc, char** argv)
         }
     };
 
+    startup.logReport();
     g_statMsg.set("Welcome to HaxorEdit!\t"
             "(Launched in "+std::to_string(glfwGetTime()-appStartTime)+"s"
             ", loaded "+std::to_string(g_tabs.size())+" files)", StatusMsg::Type::Info);
 
     int msUntilCursorBlinking = CURSOR_BLINK_MS;
+    Profiler::beginFrame();
     while (!glfwWindowShouldClose(g_window))
     {
         const double startTime = glfwGetTime();
@@ -113,6 +165,8 @@ int main(int argc, char** argv)
 
         if (g_isRedrawNeeded || g_dialogFlashTime > 0)
         {
+            PROFILE_ZONE("Render");
+
             glClearColor(UNPACK_RGB_COLOR(g_theme->bgColor), 1.0f);
             glClear(GL_COLOR_BUFFER_BIT);
 
@@ -129,7 +183,13 @@ int main(int argc, char** argv)
             App::renderPopups();
             App::renderDialogs();
             App::renderPrompt();
+            if (g_isDebugDrawMode)
+                App::renderProfilerOverlay();
 
+            {
+                PROFILE_ZONE("Swap buffers");
+                glfwSwapBuffers(g_window);
+            }
             g_isRedrawNeeded = false;
         }
 
@@ -139,23 +199,47 @@ int main(int argc, char** argv)
             g_isTitleUpdateNeeded = false;
         }
 
-        glfwPollEvents();
-        Bindings::runBindingForFrame();
-
-        glfwSwapBuffers(g_window);
+        // Sleep until an input event or until a component needs to do something,
+        // the time spent waiting is not part of the frame
+        Profiler::endFrame();
+        EventLoop::waitEvents();
+        Profiler::beginFrame();
+        {
+            PROFILE_ZONE("Handle input");
+            Bindings::runBindingForFrame();
+        }
+        {
+            PROFILE_ZONE("LSP");
+            // Send the edits made in this frame in one notification
+            Autocomp::lspProvider->flushFileChanges();
+            Autocomp::lspProvider->processResponses();
+        }
+        {
+            PROFILE_ZONE("Run queued");
+            // Finish the work that the background jobs handed back (saving, etc.)
+            EventLoop::runQueued();
+        }
+        // Reload the changed files, update the git status, etc.
+        g_fileWatcher->processEvents();
 
         const double frameTimeSec = glfwGetTime()-startTime;
 
         msUntilCursorBlinking -= frameTimeSec*1000;
+        if (CURSOR_BLINK_MS >= 0 && g_activeBuff)
+            EventLoop::wakeUpIn(msUntilCursorBlinking);
         g_statMsg.tick(frameTimeSec);
         if (g_dialogFlashTime > 0)
+        {
             g_dialogFlashTime -= frameTimeSec*1000;
+            // Animated, draw every frame
+            EventLoop::wakeUpIn(0);
+        }
         Prompt::get()->update(frameTimeSec*1000);
         if (g_activeBuff)
         {
             g_activeBuff->tickCursorHold(frameTimeSec*1000);
-            g_activeBuff->tickAutoReload(frameTimeSec*1000);
-            g_activeBuff->tickGitBranchUpdate(frameTimeSec*1000);
+            g_activeBuff->tickGitDiffUpdate(frameTimeSec*1000);
+            g_activeBuff->tickSearch();
         }
         if (!g_dialogs.empty())
         {
@@ -166,11 +250,15 @@ int main(int argc, char** argv)
         }
         App::tickMouseHold(frameTimeSec*1000);
         App::tickPopups();
+        App::tickLazyBuffers(frameTimeSec*1000);
     }
 
     Logger::log << "Shutting down!" << Logger::End;
     sessHndlr.writeToFile();
     g_tabs.clear();
+    // Stop the workers before the window is gone, they can post events
+    g_threadPool.reset();
+    g_fileWatcher.reset();
     // Last thing to do, we keep alive the window while cleaning up buffers
     glfwDestroyWindow(g_window);
     glfwTerminate();
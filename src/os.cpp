@@ -3,6 +3,7 @@
 #include "Logger.h"
 #ifdef OS_LINUX
 #include <stdio.h>
+#include <fontconfig/fontconfig.h>
 #endif
 
 namespace OS
@@ -26,7 +27,37 @@ std::string runExternalCommand(const std::string& command)
 std::string getFontFilePath(const std::string& fontName, FontStyle style)
 {
 #ifdef OS_LINUX
-    return runExternalCommand("fc-match --format=%{file} \""+fontName+":style="+fontStyleToStr(style)+'"');
+    // Do what `fc-match` does, without starting a process
+    if (!FcInit())
+    {
+        Logger::err << "Failed to initialize Fontconfig" << Logger::End;
+        return "";
+    }
+
+    const std::string query = fontName+":style="+fontStyleToStr(style);
+    FcPattern* pattern = FcNameParse((const FcChar8*)query.c_str());
+    if (!pattern)
+    {
+        Logger::err << "Invalid font pattern: " << quoteStr(query) << Logger::End;
+        return "";
+    }
+    FcConfigSubstitute(nullptr, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    std::string path;
+    FcResult result;
+    if (FcPattern* match = FcFontMatch(nullptr, pattern, &result))
+    {
+        FcChar8* file{};
+        if (FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch)
+            path = (const char*)file;
+        FcPatternDestroy(match);
+    }
+    FcPatternDestroy(pattern);
+
+    if (path.empty())
+        Logger::err << "No font found for " << quoteStr(query) << Logger::End;
+    return path;
 #else
 #error "TODO: Unimplemented"
 #endif
@@ -0,0 +1,336 @@
+#define _DEF_GLOBALS_
+#include "globals.h"
+#undef _DEF_GLOBALS_
+#include "App.h"
+#include "Document.h"
+#include "autocomp/Popup.h"
+#include "common/string.h"
+#include "../external/cJSON/cJSON.h"
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <random>
+#include <fstream>
+#include <cstring>
+
+/*
+ * Micro-benchmarks of the editing core.
+ *
+ * Every benchmark is repeated and the statistics of the repetitions are written as JSON.
+ * `scripts/compare_benchmarks.py` compares two outputs.
+ *
+ * Usage: benchmarks [--reps N] [--filter SUBSTR] [--out FILE]
+ */
+
+static size_t repCount = 15;
+static std::string nameFilter;
+// Results are written here, so the compiler can't optimize the work away
+static volatile size_t sink;
+
+// Generate C-like source code, the same for every run
+static String genSource(size_t lineCount)
+{
+    std::mt19937 rng{1234};
+    static const char* const words[] = {
+        "int", "return", "value", "buffer", "size_t", "const", "auto", "for", "if", "while",
+        "std::string", "count", "index", "result", "nullptr", "true", "false", "// comment",
+    };
+    std::string output;
+    for (size_t i{}; i < lineCount; ++i)
+    {
+        const size_t indent = rng()%4;
+        output.append(indent*4, ' ');
+        const size_t wordCount = 2+rng()%8;
+        for (size_t j{}; j < wordCount; ++j)
+        {
+            output += words[rng()%std::size(words)];
+            output += (j+1 == wordCount ? ';' : ' ');
+        }
+        if (i%50 == 0)
+            output += " \"string literal with ünïcödé\"";
+        output += '\n';
+    }
+    return utf8To32(output);
+}
+
+class BenchmarkRunner
+{
+private:
+    struct Result
+    {
+        std::string name;
+        std::vector<double> samplesNs;
+    };
+    std::vector<Result> m_results;
+
+    /*
+     * Run `fn` `repCount` times (plus a warmup run), `setup` is run before every repetition
+     * and is not measured.
+     */
+    void _bench(const std::string& name, const std::function<void()>& setup, const std::function<void()>& fn)
+    {
+        if (!nameFilter.empty() && name.find(nameFilter) == std::string::npos)
+            return;
+
+        Result result{name, {}};
+        for (size_t i{}; i < repCount+1; ++i)
+        {
+            setup();
+            const auto start = std::chrono::steady_clock::now();
+            fn();
+            const auto end = std::chrono::steady_clock::now();
+            // The first one is a warmup
+            if (i != 0)
+                result.samplesNs.push_back(std::chrono::duration<double, std::nano>(end-start).count());
+        }
+
+        std::vector<double> sorted = result.samplesNs;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << name << ": median " << sorted[sorted.size()/2]/1e6 << " ms, min " << sorted.front()/1e6 << " ms\n";
+        m_results.push_back(std::move(result));
+    }
+
+    static void _setBufferContent(Buffer* buffer, const String& content)
+    {
+        buffer->m_document->setContent(content);
+        buffer->m_document->clearHistory();
+        buffer->m_lineInfoList.assign(buffer->m_document->getLineCount(), {});
+        buffer->_invalidateHighlighting(0, buffer->m_lineInfoList.size()-1);
+        buffer->m_searcher.resetLines(buffer->m_document->getLineCount());
+        buffer->m_cursorLine = 0;
+        buffer->m_cursorCol = 0;
+        buffer->m_cursorCharPos = 0;
+    }
+
+public:
+    void benchDocument(size_t lineCount)
+    {
+        const std::string suffix = "/"+std::to_string(lineCount);
+        const String content = genSource(lineCount);
+        Document doc;
+
+        _bench("Document::insert char"+suffix,
+                [&](){ doc.setContent(content); doc.clearHistory(); },
+                [&](){
+                    for (int i{}; i < 1000; ++i)
+                        doc.insert({int(lineCount/2+i%100), 2}, U"x");
+                });
+
+        _bench("Document::insert lines"+suffix,
+                [&](){ doc.setContent(content); doc.clearHistory(); },
+                [&](){
+                    for (int i{}; i < 100; ++i)
+                        doc.insert({int(lineCount/2), 0}, U"first line\nsecond line\nthird line\n");
+                });
+
+        _bench("Document::delete_ lines"+suffix,
+                [&](){ doc.setContent(content); doc.clearHistory(); },
+                [&](){
+                    for (int i{}; i < 100; ++i)
+                        doc.delete_({{int(lineCount/4), 0}, {int(lineCount/4+2), 0}});
+                });
+
+        _bench("Document::get"+suffix,
+                [&](){ doc.setContent(content); },
+                [&](){
+                    for (int i{}; i < 100; ++i)
+                        sink = doc.get({{int(i*lineCount/100), 0}, {int(std::min(i*lineCount/100+50, lineCount-1)), 0}}).size();
+                });
+
+        _bench("Document::getLine all"+suffix,
+                [&](){ doc.setContent(content); },
+                [&](){
+                    size_t sum{};
+                    for (size_t i{}; i < doc.getLineCount(); ++i)
+                        sum += doc.getLine(i).size();
+                    sink = sum;
+                });
+    }
+
+    void benchBuffer(size_t lineCount)
+    {
+        const std::string suffix = "/"+std::to_string(lineCount);
+        const String content = genSource(lineCount);
+        Buffer buffer;
+
+        _bench("Buffer::_updateHighlighting"+suffix,
+                [&](){ _setBufferContent(&buffer, content); },
+                [&](){ buffer._updateHighlighting(lineCount); });
+
+        buffer.m_searcher.setPattern(U"buffer", {});
+        _bench("Buffer::findUpdate"+suffix,
+                [&](){ _setBufferContent(&buffer, content); },
+                [&](){ buffer.findUpdate(); });
+        buffer.m_searcher.setPattern(U"[a-z]+_[a-z]+\\(", {.isRegex=true});
+        _bench("Buffer::findUpdate regex"+suffix,
+                [&](){ _setBufferContent(&buffer, content); },
+                [&](){ buffer.findUpdate(); });
+        buffer.m_searcher.clear();
+
+        // Undo and redo an entry with many changes
+        _bench("Buffer::undo+redo 1000 changes"+suffix,
+                [&](){
+                    _setBufferContent(&buffer, content);
+                    buffer.beginHistoryEntry();
+                    for (int i{}; i < 1000; ++i)
+                        buffer.applyInsertion({int(i%lineCount), 0}, U"    ");
+                    buffer.endHistoryEntry();
+                },
+                [&](){ buffer.undo(); buffer.redo(); });
+
+        // Undo and redo one large insertion
+        const String inserted = genSource(lineCount/2);
+        _bench("Buffer::undo+redo large insertion"+suffix,
+                [&](){
+                    _setBufferContent(&buffer, content);
+                    buffer.beginHistoryEntry();
+                    buffer.applyInsertion({int(lineCount/2), 0}, inserted);
+                    buffer.endHistoryEntry();
+                },
+                [&](){ buffer.undo(); buffer.redo(); });
+    }
+
+    void benchStrings(size_t lineCount)
+    {
+        const std::string suffix = "/"+std::to_string(lineCount);
+        const String content32 = genSource(lineCount);
+        const std::string content8 = utf32To8(content32);
+
+        _bench("utf8To32"+suffix, [](){}, [&](){ sink = utf8To32(content8).size(); });
+        _bench("utf32To8"+suffix, [](){}, [&](){ sink = utf32To8(content32).size(); });
+        _bench("splitStrToLines"+suffix, [](){}, [&](){ sink = splitStrToLines(content32, true).size(); });
+    }
+
+    void benchPopup(size_t itemCount)
+    {
+        const std::string suffix = "/"+std::to_string(itemCount);
+        std::mt19937 rng{4321};
+        auto genIdent{[&](){
+            static const char* const parts[] = {
+                "get", "set", "buffer", "line", "count", "update", "render", "file", "path", "cursor", "text", "item"};
+            std::string ident;
+            const size_t partCount = 1+rng()%4;
+            for (size_t i{}; i < partCount; ++i)
+            {
+                std::string part = parts[rng()%std::size(parts)];
+                if (i != 0)
+                    part[0] = std::toupper(part[0]);
+                ident += part;
+            }
+            return ident+std::to_string(rng()%100);
+        }};
+
+        Autocomp::Popup popup;
+        for (size_t i{}; i < itemCount; ++i)
+        {
+            Autocomp::Popup::Item item;
+            item.label = genIdent();
+            popup.addItem(std::move(item));
+        }
+
+        _bench("Popup::filterItemsIfNeeded"+suffix,
+                [&](){
+                    popup.m_filter = U"gCnt";
+                    popup.m_areCandidatesValid = false;
+                    popup.m_isFilteringNeeded = true;
+                },
+                [&](){ popup.filterItemsIfNeeded(); });
+
+        // Typing a word, the candidates of the previous filter are reused
+        _bench("Popup::filterItemsIfNeeded typing"+suffix,
+                [&](){ popup.m_areCandidatesValid = false; },
+                [&](){
+                    for (const String& filter : {U"g", U"ge", U"get", U"getL", U"getLi", U"getLin"})
+                    {
+                        popup.m_filter = filter;
+                        popup.m_isFilteringNeeded = true;
+                        popup.filterItemsIfNeeded();
+                    }
+                });
+    }
+
+    bool writeJson(const std::string& path) const
+    {
+        cJSON* json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(json, "schemaVersion", 1);
+        cJSON_AddNumberToObject(json, "timestamp", std::time(nullptr));
+#ifdef NDEBUG
+        cJSON_AddStringToObject(json, "buildType", "release");
+#else
+        cJSON_AddStringToObject(json, "buildType", "debug");
+#endif
+        cJSON_AddStringToObject(json, "unit", "ns");
+        cJSON* benchmarks = cJSON_AddArrayToObject(json, "benchmarks");
+        for (const auto& result : m_results)
+        {
+            std::vector<double> sorted = result.samplesNs;
+            std::sort(sorted.begin(), sorted.end());
+            const double mean = std::accumulate(sorted.begin(), sorted.end(), 0.0)/sorted.size();
+            double variance{};
+            for (double sample : sorted)
+                variance += (sample-mean)*(sample-mean);
+            variance /= std::max<size_t>(sorted.size()-1, 1);
+
+            cJSON* bench = cJSON_CreateObject();
+            cJSON_AddStringToObject(bench, "name", result.name.c_str());
+            cJSON_AddNumberToObject(bench, "repetitions", sorted.size());
+            cJSON_AddNumberToObject(bench, "min", sorted.front());
+            cJSON_AddNumberToObject(bench, "median", sorted[sorted.size()/2]);
+            cJSON_AddNumberToObject(bench, "mean", mean);
+            cJSON_AddNumberToObject(bench, "stddev", std::sqrt(variance));
+            cJSON_AddNumberToObject(bench, "max", sorted.back());
+            cJSON* samples = cJSON_AddArrayToObject(bench, "samples");
+            for (double sample : result.samplesNs)
+                cJSON_AddItemToArray(samples, cJSON_CreateNumber(sample));
+            cJSON_AddItemToArray(benchmarks, bench);
+        }
+
+        char* printed = cJSON_Print(json);
+        std::ofstream file{path};
+        file << printed << '\n';
+        cJSON_free(printed);
+        cJSON_Delete(json);
+        return file.good();
+    }
+};
+
+int main(int argc, char** argv)
+{
+    std::string outPath = "benchmark_results.json";
+    for (int i=1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--reps") == 0 && i+1 < argc)
+            repCount = std::max(std::atoi(argv[++i]), 1);
+        else if (std::strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+            nameFilter = argv[++i];
+        else if (std::strcmp(argv[i], "--out") == 0 && i+1 < argc)
+            outPath = argv[++i];
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--reps N] [--filter SUBSTR] [--out FILE]\n";
+            return 1;
+        }
+    }
+
+    // Keep the logging out of the measurements
+    Logger::setLoggerVerbosity(Logger::LoggerVerbosity::Quiet);
+
+    BenchmarkRunner runner;
+    for (size_t lineCount : {1000, 10000, 100000})
+    {
+        runner.benchDocument(lineCount);
+        runner.benchBuffer(lineCount);
+        runner.benchStrings(lineCount);
+    }
+    runner.benchPopup(10000);
+
+    if (!runner.writeJson(outPath))
+    {
+        std::cerr << "Failed to write results: " << outPath << '\n';
+        return 1;
+    }
+    std::cout << "Wrote results to " << outPath << '\n';
+    return 0;
+}
@@ -3,6 +3,8 @@
 #undef _DEF_GLOBALS_
 #include "App.h"
 #include "common/file.h"
+#include "Search.h"
+#include "Document.h"
 
 std::string testName = "applyEdit";
 
@@ -25,6 +27,46 @@ static void checkTest(const std::string& result)
     ++testId;
 }
 
+static void checkEqual(const std::string& name, const std::string& result, const std::string& expected)
+{
+    if (expected == result)
+    {
+        Logger::log << "Test '" << name << "' passed" << Logger::End;
+    }
+    else
+    {
+        Logger::err << "Test '" << name << "' FAILED" << Logger::End;
+        Logger::err << "Expected: \"" << expected << "\", got: \"" << result << '"' << Logger::End;
+        std::exit(1);
+    }
+}
+
+static std::string spansToStr(const Search::spanList_t& spans)
+{
+    std::string output;
+    for (const Search::Span& span : spans)
+        output += '('+std::to_string(span.col)+','+std::to_string(span.len)+')';
+    return output;
+}
+
+// The matches of a find dialog input in a line
+static std::string findInLine(const String& input, const String& line)
+{
+    Search::Flags flags;
+    const String pattern = Search::parseFlags(input, &flags);
+    try
+    {
+        Search::Matcher matcher{pattern, flags};
+        Search::spanList_t spans;
+        matcher.findAll(line.data(), line.size(), &spans);
+        return spansToStr(spans);
+    }
+    catch (const std::runtime_error&)
+    {
+        return "error";
+    }
+}
+
 class TestRunner
 {
 public:
@@ -33,10 +75,10 @@ public:
         Logger::log << "---------- Running tests ----------" << Logger::End;
 
         auto getApplyEditResult = [&](const lsPosition& start, const lsPosition& end, const std::string newText){
-            static auto input = splitStrToLines(loadUnicodeFile("../samples/"+testName+"_input.txt"), true);
-            buffer->m_content = input;
+            static const auto input = loadUnicodeFile("../samples/"+testName+"_input.txt");
+            buffer->m_document->setContent(input);
             buffer->applyEdit(lsTextEdit{{start, end}, newText, {}});
-            return strToAscii(lineVecConcat(buffer->m_content));
+            return strToAscii(buffer->m_document->getConcated());
         };
 
         // Noop
@@ -130,6 +172,99 @@ public:
 
         Logger::log << "---------- Finished running tests ----------" << Logger::End;
     }
+
+    void runSearchTests()
+    {
+        Logger::log << "---------- Running search tests ----------" << Logger::End;
+
+        //-------------------- Matcher --------------------
+
+        checkEqual("plain", findInLine(U"ab", U"xxabyyab"), "(2,2)(6,2)");
+        checkEqual("plain, no overlap", findInLine(U"aa", U"aaaaa"), "(0,2)(2,2)");
+        checkEqual("plain, no match", findInLine(U"abc", U"ab"), "");
+        // Longer than `SEARCH_BMH_MIN_LEN`
+        checkEqual("plain, long needle", findInLine(U"abcdefghijklmnopq", U"xxabcdefghijklmnopqyyabcdefghijklmnopq"),
+                "(2,17)(21,17)");
+        checkEqual("ignore case", findInLine(U"\\cFOO", U"foo Foo fOo"), "(0,3)(4,3)(8,3)");
+        checkEqual("ignore case, non-ASCII", findInLine(U"\\cÉ", U"éÉe"), "(0,1)(1,1)");
+
+        //-------------------- Regex --------------------
+
+        checkEqual("regex, repeat", findInLine(U"\\vfo+", U"f fo foo"), "(2,2)(5,3)");
+        checkEqual("regex, begin", findInLine(U"\\v^a", U"aaa"), "(0,1)");
+        checkEqual("regex, end", findInLine(U"\\va$", U"aaa"), "(2,1)");
+        checkEqual("regex, empty matches", findInLine(U"\\va?", U"bab"), "(1,1)");
+        checkEqual("regex, alternation", findInLine(U"\\vab|cd", U"abcd"), "(0,2)(2,2)");
+        checkEqual("regex, longest", findInLine(U"\\v(a|ab)(c|bcd)", U"abcd"), "(0,4)");
+        checkEqual("regex, leftmost", findInLine(U"\\vabcd|c", U"abcd"), "(0,4)");
+        checkEqual("regex, class", findInLine(U"\\v[a-c]+", U"xabcabd"), "(1,5)");
+        checkEqual("regex, negated class", findInLine(U"\\v[^a-c]+", U"xabcabd"), "(0,1)(6,1)");
+        checkEqual("regex, escapes", findInLine(U"\\v\\d+\\s\\w", U"a12 b345"), "(1,4)");
+        checkEqual("regex, group", findInLine(U"\\v(ab)*c", U"ababc c"), "(0,5)(6,1)");
+        checkEqual("regex, ignore case", findInLine(U"\\c\\v[A-C]x?", U"axbBX"), "(0,2)(2,1)(3,2)");
+        checkEqual("regex, non-ASCII", findInLine(U"\\vé+", U"aééb"), "(1,2)");
+        checkEqual("regex, unclosed group", findInLine(U"\\v(a", U""), "error");
+        checkEqual("regex, unmatched )", findInLine(U"\\va)", U""), "error");
+        checkEqual("regex, nothing to repeat", findInLine(U"\\v*a", U""), "error");
+        checkEqual("regex, unclosed class", findInLine(U"\\v[a", U""), "error");
+        checkEqual("regex, invalid range", findInLine(U"\\v[z-a]", U""), "error");
+        {
+            // Must not be quadratic
+            const String line(100000, 'a');
+            checkEqual("regex, long line", findInLine(U"\\va|a.*b", line).substr(0, 10), "(0,1)(1,1)");
+            checkEqual("regex, long line, no match", findInLine(U"\\v.*x", line), "");
+        }
+
+        //-------------------- Searcher --------------------
+
+        {
+            Document doc;
+            doc.setContent(U"foo bar foo\nbar\nfoo\n");
+            Search::Searcher searcher;
+            searcher.setPattern(U"foo", {});
+            searcher.resetLines(doc.getLineCount());
+            checkEqual("searcher, visible lines", std::to_string(searcher.getMatchCount()), "0");
+            searcher.updateLines(doc, 0, 0);
+            checkEqual("searcher, visible lines", spansToStr(*searcher.getLineSpans(0)), "(0,3)(8,3)");
+            checkEqual("searcher, incomplete", std::to_string(searcher.isComplete()), "0");
+            searcher.updateFor(doc, 1000);
+            checkEqual("searcher, count", std::to_string(searcher.getMatchCount()), "3");
+            checkEqual("searcher, count before", std::to_string(searcher.countMatchesBefore(2, 0)), "2");
+
+            Search::MatchPos pos;
+            bool isWrapped{};
+            searcher.findNext(doc, 0, 0, &pos, &isWrapped);
+            checkEqual("searcher, next", std::to_string(pos.line)+':'+std::to_string(pos.span.col)+':'+std::to_string(isWrapped), "0:8:0");
+            searcher.findNext(doc, 2, 0, &pos, &isWrapped);
+            checkEqual("searcher, next wrapped", std::to_string(pos.line)+':'+std::to_string(pos.span.col)+':'+std::to_string(isWrapped), "0:0:1");
+            searcher.findPrev(doc, 0, 0, &pos, &isWrapped);
+            checkEqual("searcher, prev wrapped", std::to_string(pos.line)+':'+std::to_string(pos.span.col)+':'+std::to_string(isWrapped), "2:0:1");
+
+            // Insert "foo\n" after the first line
+            doc.insert({1, 0}, U"foo\n");
+            searcher.onLinesInserted(0, 1);
+            searcher.invalidateLines(0, 1);
+            checkEqual("searcher, after insertion", std::to_string(searcher.isComplete()), "0");
+            searcher.updateFor(doc, 1000);
+            checkEqual("searcher, after insertion", std::to_string(searcher.getMatchCount()), "4");
+
+            // Remove the second and the third line
+            doc.delete_({{1, 0}, {3, 0}});
+            searcher.onLinesRemoved(0, 2);
+            searcher.invalidateLines(0, 0);
+            searcher.updateFor(doc, 1000);
+            checkEqual("searcher, after deletion", std::to_string(searcher.getMatchCount()), "3");
+            checkEqual("searcher, after deletion", spansToStr(*searcher.getLineSpans(1)), "(0,3)");
+
+            searcher.setPattern(U"\\d+", {.isRegex=true});
+            searcher.resetLines(doc.getLineCount());
+            searcher.updateFor(doc, 1000);
+            checkEqual("searcher, no match", std::to_string(searcher.getMatchCount()), "0");
+            checkEqual("searcher, no match", std::to_string(searcher.findNext(doc, 0, 0, &pos, &isWrapped)), "0");
+        }
+
+        Logger::log << "---------- Finished running search tests ----------" << Logger::End;
+    }
 };
 
 int main()
@@ -139,6 +274,7 @@ int main()
     TestRunner runner;
     Buffer buffer;
     runner.runTests(&buffer);
+    runner.runSearchTests();
 
     return 0;
 }